@@ -0,0 +1,653 @@
+// bench_ffi.c - Per-call cost of the ditto.h API, the native side of the FFI
+// benchmark
+//
+// Usage: ditto_bench_ffi [--iterations N] [--runs N] [--keys N] [--out FILE]
+//
+// Times each call in a loop from C, which is the cost of the work itself
+// with no FFI crossing. app/flutter/benchmark/ffi_bench.dart runs the same
+// cases through dart:ffi and is meant to print the same JSON, so on one
+// machine the difference between the two is what crossing and marshalling
+// cost (the Dart side has not been run yet; see BUILD.md):
+//   call      each per-operation function, one call at a time
+//   batch     ditto_multi_get and ditto_write_batch against as many single calls
+//   callback  put-to-callback latency, inline and from the dispatcher thread
+// Every case runs --runs times after a warm-up and reports its median run.
+// One-off calls (open, close, configuration, export and import) are not
+// timed. Times are in nanoseconds.
+#include "ditto.h"
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KEY_CAP 32
+#define MAX_BATCH 256
+#define MAX_VALUE (64u << 10)
+#define MAX_LOAD_BYTES (64u << 20)  // values loaded at once, caps the live keys
+#define SCAN_KEYS 100               // keys under each scanned prefix
+#define BUF_BYTES (MAX_VALUE + (64u << 10))
+
+#if defined(__APPLE__)
+#define BENCH_OS "macos"
+#elif defined(_WIN32)
+#define BENCH_OS "windows"
+#elif defined(__linux__)
+#define BENCH_OS "linux"
+#else
+#define BENCH_OS "unknown"
+#endif
+
+// Named as Dart's Abi does, so both harnesses report the same string
+#if defined(__x86_64__) || defined(_M_X64)
+#define BENCH_ARCH "x64"
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define BENCH_ARCH "arm64"
+#elif defined(__i386__) || defined(_M_IX86)
+#define BENCH_ARCH "ia32"
+#elif defined(__arm__) || defined(_M_ARM)
+#define BENCH_ARCH "arm"
+#else
+#define BENCH_ARCH "unknown"
+#endif
+
+typedef struct {
+    size_t iterations;
+    int runs;
+    size_t keys;
+} config_t;
+
+// A store loaded with `live` of the `keys` keys, all holding `value_size`
+// bytes, plus everything the cases pass in so no case allocates or formats
+// while timed.
+typedef struct {
+    ditto_db_t* db;
+    ditto_db_t* async_db;       // async notifications on, one subscription
+    size_t keys;
+    size_t live;                // keys loaded, fewer for large values
+    size_t value_size;          // of the loaded values, 0 = nothing loaded
+    char (*names)[KEY_CAP];     // "bench:%08zu"
+    size_t* name_lens;
+    ditto_key_t** interned;
+    char (*prefixes)[KEY_CAP];  // each matching SCAN_KEYS keys
+    size_t n_prefixes;
+    const char* batch_keys[MAX_BATCH];
+    const uint8_t* batch_values[MAX_BATCH];
+    size_t batch_lens[MAX_BATCH];
+    size_t offsets[MAX_BATCH];
+    size_t lens[MAX_BATCH];
+    int32_t status[MAX_BATCH];
+    uint8_t* value;
+    uint8_t* buf;
+    uint64_t* samples;          // per-call latencies of sampled cases
+} bench_t;
+
+typedef struct bench_case bench_case_t;
+struct bench_case {
+    const char* group;
+    const char* name;
+    size_t value_size;          // of the loaded values, 0 = any
+    size_t batch;               // keys per call
+    size_t scale;               // runs iterations / scale calls
+    int consumes;               // deletes the keys it visits: reloads each run
+    int sampled;                // fills samples; reports their mean
+    void (*run)(bench_t* b, const bench_case_t* c, size_t n);
+};
+
+// ============================================================================
+// Timing
+// ============================================================================
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts the samples and returns their value at `pct`
+static uint64_t samples_percentile(uint64_t* samples, size_t n, double pct) {
+    qsort(samples, n, sizeof(uint64_t), compare_u64);
+    size_t rank = (size_t)(pct / 100.0 * (double)(n - 1) + 0.5);
+    return samples[rank];
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+// Keys are visited round-robin; a division per call would be timed too
+#define NEXT_KEY(b, k) ((k) + 1 == (b)->live ? 0 : (k) + 1)
+
+static void run_version(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)b;
+    (void)c;
+    for (size_t i = 0; i < n; i++) {
+        ditto_version();
+    }
+}
+
+static void run_put(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_put(b->db, b->names[k], b->value, b->value_size);
+    }
+}
+
+static void run_put_n(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_put_n(b->db, b->names[k], b->name_lens[k], b->value, b->value_size);
+    }
+}
+
+static void run_put_k(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_put_k(b->db, b->interned[k], b->value, b->value_size);
+    }
+}
+
+static void run_put_ttl(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_put_ttl(b->db, b->names[k], b->value, b->value_size, 3600000);
+    }
+}
+
+static void run_get(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        size_t len = BUF_BYTES;
+        ditto_get(b->db, b->names[k], b->buf, &len);
+    }
+}
+
+static void run_get_n(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        size_t len = BUF_BYTES;
+        ditto_get_n(b->db, b->names[k], b->name_lens[k], b->buf, &len);
+    }
+}
+
+static void run_get_k(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        size_t len = BUF_BYTES;
+        ditto_get_k(b->db, b->interned[k], b->buf, &len);
+    }
+}
+
+static void run_get_view(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        const uint8_t* ptr;
+        size_t len;
+        ditto_view_t* view;
+        if (ditto_get_view(b->db, b->names[k], &ptr, &len, &view) == 0) {
+            ditto_view_release(view);
+        }
+    }
+}
+
+// 64 bytes from the middle of a 1 KiB value
+static void run_get_range(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        size_t len = 64;
+        ditto_get_range(b->db, b->names[k], 512, b->buf, &len, NULL);
+    }
+}
+
+static void run_put_range(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_put_range(b->db, b->names[k], 512, b->value, 64);
+    }
+}
+
+static void run_delete(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0; i < n; i++) {
+        ditto_delete(b->db, b->names[i]);
+    }
+}
+
+static void run_delete_n(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0; i < n; i++) {
+        ditto_delete_n(b->db, b->names[i], b->name_lens[i]);
+    }
+}
+
+static void run_delete_k(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0; i < n; i++) {
+        ditto_delete_k(b->db, b->interned[i]);
+    }
+}
+
+static void run_intern(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_key_t* key;
+        if (ditto_key_intern(b->db, b->names[k], b->name_lens[k], &key) == 0) {
+            ditto_key_release(key);
+        }
+    }
+}
+
+static void run_txn(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_txn_t* txn;
+        if (ditto_txn_begin(b->db, &txn) != 0) continue;
+        size_t len = BUF_BYTES;
+        ditto_txn_get(txn, b->names[k], b->buf, &len);
+        ditto_txn_put(txn, b->names[k], b->value, b->value_size);
+        ditto_txn_commit(txn);
+    }
+}
+
+static void run_snapshot(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        ditto_snapshot_t* snap;
+        if (ditto_snapshot_open(b->db, &snap) != 0) continue;
+        size_t len = BUF_BYTES;
+        ditto_snapshot_get(snap, b->names[k], b->buf, &len);
+        ditto_snapshot_close(snap);
+    }
+}
+
+static void run_scan(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, p = 0; i < n; i++, p = p + 1 == b->n_prefixes ? 0 : p + 1) {
+        ditto_cursor_t* cursor;
+        if (ditto_scan_prefix(b->db, b->prefixes[p], &cursor) != 0) continue;
+        size_t count;
+        do {
+            size_t len = BUF_BYTES;
+            if (ditto_cursor_next(cursor, b->buf, &len, &count) != 0) break;
+        } while (count > 0);
+        ditto_cursor_close(cursor);
+    }
+}
+
+static void on_change_noop(void* user_data, const char* key) {
+    (void)user_data;
+    (void)key;
+}
+
+static void run_subscribe(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        int32_t id;
+        if (ditto_subscribe_key(b->db, b->names[k], on_change_noop, NULL, &id) == 0) {
+            ditto_unsubscribe(b->db, id);
+        }
+    }
+}
+
+static void run_stats(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0; i < n; i++) {
+        ditto_stats_t stats;
+        ditto_get_stats(b->db, &stats, sizeof(stats));
+    }
+}
+
+// `batch` single gets per iteration, to set against one ditto_multi_get()
+static void run_get_batch(bench_t* b, const bench_case_t* c, size_t n) {
+    for (size_t i = 0, k = 0; i < n; i++) {
+        for (size_t j = 0; j < c->batch; j++, k = NEXT_KEY(b, k)) {
+            size_t len = BUF_BYTES;
+            ditto_get(b->db, b->names[k], b->buf, &len);
+        }
+    }
+}
+
+static void run_multi_get(bench_t* b, const bench_case_t* c, size_t n) {
+    for (size_t i = 0, k = 0; i < n; i++) {
+        for (size_t j = 0; j < c->batch; j++, k = NEXT_KEY(b, k)) {
+            b->batch_keys[j] = b->names[k];
+        }
+        size_t arena_len = BUF_BYTES;
+        ditto_multi_get(b->db, b->batch_keys, c->batch, b->buf, &arena_len,
+                        b->offsets, b->lens, b->status);
+    }
+}
+
+static void run_put_batch(bench_t* b, const bench_case_t* c, size_t n) {
+    for (size_t i = 0, k = 0; i < n; i++) {
+        for (size_t j = 0; j < c->batch; j++, k = NEXT_KEY(b, k)) {
+            ditto_put(b->db, b->names[k], b->value, b->value_size);
+        }
+    }
+}
+
+static void run_write_batch(bench_t* b, const bench_case_t* c, size_t n) {
+    for (size_t i = 0, k = 0; i < n; i++) {
+        for (size_t j = 0; j < c->batch; j++, k = NEXT_KEY(b, k)) {
+            b->batch_keys[j] = b->names[k];
+            b->batch_values[j] = b->value;
+            b->batch_lens[j] = b->value_size;
+        }
+        ditto_write_batch(b->db, c->batch, b->batch_keys, b->batch_values,
+                          b->batch_lens, NULL, NULL);
+    }
+}
+
+static _Atomic uint64_t notified;       // callbacks run
+static _Atomic uint64_t notified_ns;    // when the last one started
+
+static void on_notify(void* user_data, const char* key) {
+    (void)user_data;
+    (void)key;
+    atomic_store_explicit(&notified_ns, now_ns(), memory_order_relaxed);
+    atomic_fetch_add_explicit(&notified, 1, memory_order_release);
+}
+
+// From calling ditto_put() to the subscription callback starting
+static void run_notify_inline(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    int32_t id;
+    if (ditto_subscribe(b->db, on_notify, NULL, &id) != 0) return;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        uint64_t start = now_ns();
+        ditto_put(b->db, b->names[k], b->value, b->value_size);
+        b->samples[i] = atomic_load_explicit(&notified_ns, memory_order_relaxed) - start;
+    }
+    ditto_unsubscribe(b->db, id);
+}
+
+static void run_notify_async(bench_t* b, const bench_case_t* c, size_t n) {
+    (void)c;
+    for (size_t i = 0, k = 0; i < n; i++, k = NEXT_KEY(b, k)) {
+        uint64_t seen = atomic_load_explicit(&notified, memory_order_acquire);
+        uint64_t start = now_ns();
+        ditto_put(b->async_db, b->names[k], b->value, b->value_size);
+        while (atomic_load_explicit(&notified, memory_order_acquire) == seen) {
+            sched_yield();
+        }
+        b->samples[i] = atomic_load_explicit(&notified_ns, memory_order_relaxed) - start;
+    }
+}
+
+// Grouped by loaded value size, so the store is reloaded as few times as
+// possible
+static const bench_case_t cases[] = {
+    {"call", "ditto_version", 0, 1, 1, 0, 0, run_version},
+    {"call", "ditto_key_intern+release", 0, 1, 1, 0, 0, run_intern},
+    {"call", "ditto_subscribe_key+unsubscribe", 0, 1, 1, 0, 0, run_subscribe},
+    {"call", "ditto_put", 16, 1, 1, 0, 0, run_put},
+    {"call", "ditto_put_n", 16, 1, 1, 0, 0, run_put_n},
+    {"call", "ditto_put_k", 16, 1, 1, 0, 0, run_put_k},
+    {"call", "ditto_put_ttl", 16, 1, 1, 0, 0, run_put_ttl},
+    {"call", "ditto_get", 16, 1, 1, 0, 0, run_get},
+    {"call", "ditto_get_n", 16, 1, 1, 0, 0, run_get_n},
+    {"call", "ditto_get_k", 16, 1, 1, 0, 0, run_get_k},
+    {"call", "ditto_get_view+release", 16, 1, 1, 0, 0, run_get_view},
+    {"call", "ditto_txn_begin+get+put+commit", 16, 1, 1, 0, 0, run_txn},
+    {"call", "ditto_snapshot_open+get+close", 16, 1, 1, 0, 0, run_snapshot},
+    {"call", "ditto_scan_prefix+cursor_next+close", 16, SCAN_KEYS, 100, 0, 0, run_scan},
+    {"call", "ditto_get_stats", 16, 1, 1000, 0, 0, run_stats},
+    {"call", "ditto_delete", 16, 1, 1, 1, 0, run_delete},
+    {"call", "ditto_delete_n", 16, 1, 1, 1, 0, run_delete_n},
+    {"call", "ditto_delete_k", 16, 1, 1, 1, 0, run_delete_k},
+    {"batch", "ditto_get", 16, 1, 1, 0, 0, run_get_batch},
+    {"batch", "ditto_multi_get", 16, 1, 1, 0, 0, run_multi_get},
+    {"batch", "ditto_get", 16, 16, 16, 0, 0, run_get_batch},
+    {"batch", "ditto_multi_get", 16, 16, 16, 0, 0, run_multi_get},
+    {"batch", "ditto_get", 16, 256, 256, 0, 0, run_get_batch},
+    {"batch", "ditto_multi_get", 16, 256, 256, 0, 0, run_multi_get},
+    {"batch", "ditto_put", 16, 1, 1, 0, 0, run_put_batch},
+    {"batch", "ditto_write_batch", 16, 1, 1, 0, 0, run_write_batch},
+    {"batch", "ditto_put", 16, 16, 16, 0, 0, run_put_batch},
+    {"batch", "ditto_write_batch", 16, 16, 16, 0, 0, run_write_batch},
+    {"batch", "ditto_put", 16, 256, 256, 0, 0, run_put_batch},
+    {"batch", "ditto_write_batch", 16, 256, 256, 0, 0, run_write_batch},
+    {"callback", "notify_inline", 16, 1, 1, 0, 1, run_notify_inline},
+    {"callback", "notify_async", 16, 1, 10, 0, 1, run_notify_async},
+    {"call", "ditto_put", 1024, 1, 1, 0, 0, run_put},
+    {"call", "ditto_get", 1024, 1, 1, 0, 0, run_get},
+    {"call", "ditto_get_range", 1024, 1, 1, 0, 0, run_get_range},
+    {"call", "ditto_put_range", 1024, 1, 1, 0, 0, run_put_range},
+    {"call", "ditto_put", 65536, 1, 10, 0, 0, run_put},
+    {"call", "ditto_get", 65536, 1, 10, 0, 0, run_get},
+};
+
+// ============================================================================
+// Harness
+// ============================================================================
+
+static FILE* out;
+static int first_result = 1;
+
+// Puts every live key with a value of `value_size` bytes
+static int bench_load(bench_t* b, size_t value_size) {
+    b->live = b->keys;
+    if (b->live > MAX_LOAD_BYTES / value_size) b->live = MAX_LOAD_BYTES / value_size;
+    for (size_t k = 0; k < b->live; k++) {
+        if (ditto_put(b->db, b->names[k], b->value, value_size) != 0) {
+            fprintf(stderr, "load failed\n");
+            return -1;
+        }
+    }
+    b->value_size = value_size;
+    return 0;
+}
+
+static int bench_case(bench_t* b, const config_t* cfg, const bench_case_t* c) {
+    size_t n = cfg->iterations / c->scale;
+    if (c->consumes && n > b->live) n = b->live;
+    if (n == 0) n = 1;
+
+    double* per_call = (double*)calloc((size_t)cfg->runs, sizeof(double));
+    double* means = (double*)calloc((size_t)cfg->runs, sizeof(double));
+    uint64_t* p50 = (uint64_t*)calloc((size_t)cfg->runs, sizeof(uint64_t));
+    uint64_t* p99 = (uint64_t*)calloc((size_t)cfg->runs, sizeof(uint64_t));
+    if (!per_call || !means || !p50 || !p99) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    // Run -1 is the warm-up
+    for (int r = -1; r < cfg->runs; r++) {
+        if ((c->value_size && c->value_size != b->value_size) || c->consumes) {
+            if (bench_load(b, c->value_size ? c->value_size : b->value_size) != 0) {
+                return -1;
+            }
+            if (c->consumes && n > b->live) n = b->live;
+        }
+        uint64_t start = now_ns();
+        c->run(b, c, n);
+        uint64_t elapsed = now_ns() - start;
+        if (r < 0) continue;
+
+        per_call[r] = (double)elapsed / (double)n;
+        if (c->sampled) {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < n; i++) sum += b->samples[i];
+            per_call[r] = (double)sum / (double)n;
+            p99[r] = samples_percentile(b->samples, n, 99);
+            p50[r] = samples_percentile(b->samples, n, 50);
+        }
+        means[r] = per_call[r];
+    }
+
+    // The median run, and the percentiles of that run
+    qsort(means, (size_t)cfg->runs, sizeof(double), compare_double);
+    double median = means[cfg->runs / 2];
+    int pick = 0;
+    while (per_call[pick] != median) pick++;
+
+    fprintf(out, "%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"variant\": \"native\", "
+            "\"value_size\": %zu, \"batch\": %zu, \"calls\": %zu, "
+            "\"ns_per_call\": %.1f, \"ns_per_key\": %.1f",
+            first_result ? "" : ",", c->group, c->name, c->value_size, c->batch, n,
+            median, median / (double)c->batch);
+    if (c->sampled) {
+        fprintf(out, ", \"p50_ns\": %llu, \"p99_ns\": %llu",
+                (unsigned long long)p50[pick], (unsigned long long)p99[pick]);
+    }
+    fprintf(out, "}");
+    first_result = 0;
+
+    free(per_call);
+    free(means);
+    free(p50);
+    free(p99);
+    return 0;
+}
+
+static int bench_init(bench_t* b, const config_t* cfg) {
+    memset(b, 0, sizeof(*b));
+    b->keys = cfg->keys;
+    b->live = cfg->keys;
+    b->names = calloc(cfg->keys, KEY_CAP);
+    b->name_lens = (size_t*)calloc(cfg->keys, sizeof(size_t));
+    b->interned = (ditto_key_t**)calloc(cfg->keys, sizeof(ditto_key_t*));
+    b->n_prefixes = cfg->keys / SCAN_KEYS;
+    b->prefixes = calloc(b->n_prefixes, KEY_CAP);
+    b->value = (uint8_t*)malloc(MAX_VALUE);
+    b->buf = (uint8_t*)malloc(BUF_BYTES);
+    b->samples = (uint64_t*)calloc(cfg->iterations, sizeof(uint64_t));
+    if (!b->names || !b->name_lens || !b->interned || !b->prefixes || !b->value ||
+        !b->buf || !b->samples) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    memset(b->value, 'v', MAX_VALUE);
+
+    int32_t id;
+    if (ditto_open(DITTO_MEMORY_PATH, &b->db) != 0 ||
+        ditto_open(DITTO_MEMORY_PATH, &b->async_db) != 0 ||
+        ditto_enable_async_notifications(b->async_db, 1024) != 0 ||
+        ditto_subscribe(b->async_db, on_notify, NULL, &id) != 0) {
+        fprintf(stderr, "cannot open the stores\n");
+        return -1;
+    }
+    for (size_t k = 0; k < cfg->keys; k++) {
+        snprintf(b->names[k], KEY_CAP, "bench:%08zu", k);
+        b->name_lens[k] = strlen(b->names[k]);
+        if (ditto_key_intern(b->db, b->names[k], b->name_lens[k], &b->interned[k]) != 0) {
+            fprintf(stderr, "ditto_key_intern failed\n");
+            return -1;
+        }
+    }
+    // Keys sharing their first 12 characters, SCAN_KEYS of them
+    for (size_t p = 0; p < b->n_prefixes; p++) {
+        snprintf(b->prefixes[p], KEY_CAP, "bench:%06zu", p);
+    }
+    return 0;
+}
+
+static void bench_release(bench_t* b) {
+    for (size_t k = 0; b->interned && k < b->keys; k++) {
+        ditto_key_release(b->interned[k]);
+    }
+    ditto_close(b->db);
+    ditto_close(b->async_db);
+    free(b->names);
+    free(b->name_lens);
+    free(b->interned);
+    free(b->prefixes);
+    free(b->value);
+    free(b->buf);
+    free(b->samples);
+}
+
+static void runtime_name(char* buf, size_t cap) {
+#if defined(__clang__)
+    snprintf(buf, cap, "clang %d.%d.%d", __clang_major__, __clang_minor__,
+             __clang_patchlevel__);
+#elif defined(__GNUC__)
+    snprintf(buf, cap, "gcc %d.%d.%d", __GNUC__, __GNUC_MINOR__, __GNUC_PATCHLEVEL__);
+#elif defined(_MSC_VER)
+    snprintf(buf, cap, "msvc %d", _MSC_VER);
+#else
+    snprintf(buf, cap, "unknown");
+#endif
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [--iterations N] [--runs N] [--keys N] [--out FILE]\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    config_t cfg = {200000, 5, 10000};
+    const char* out_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--iterations") == 0) {
+            cfg.iterations = (size_t)strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--runs") == 0) {
+            cfg.runs = atoi(val);
+        } else if (strcmp(arg, "--keys") == 0) {
+            cfg.keys = (size_t)strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--out") == 0) {
+            out_path = val;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.iterations == 0 || cfg.runs < 1 || cfg.keys < MAX_BATCH ||
+        cfg.keys < SCAN_KEYS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "cannot open %s\n", out_path);
+        return 1;
+    }
+
+    bench_t b;
+    int rc = bench_init(&b, &cfg);
+
+    char runtime[64];
+    runtime_name(runtime, sizeof(runtime));
+    fprintf(out, "{\n  \"harness\": \"c\",\n  \"library_version\": \"%s\",\n",
+            ditto_version());
+    fprintf(out, "  \"platform\": {\"os\": \"%s\", \"arch\": \"%s\", \"runtime\": \"%s\"},\n",
+            BENCH_OS, BENCH_ARCH, runtime);
+    fprintf(out, "  \"config\": {\"iterations\": %zu, \"runs\": %d, \"keys\": %zu},\n",
+            cfg.iterations, cfg.runs, cfg.keys);
+    fprintf(out, "  \"results\": [");
+    for (size_t i = 0; rc == 0 && i < sizeof(cases) / sizeof(cases[0]); i++) {
+        rc = bench_case(&b, &cfg, &cases[i]);
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    bench_release(&b);
+    if (out != stdout) fclose(out);
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+// bench_scaling.c - get/put throughput of one ditto_db_t from 1 to N threads
+//
+// Usage: ditto_bench_scaling [max_threads] [keys] [seconds_per_run] [read_pct]
+#include "ditto.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define VALUE_SIZE 100
+
+typedef struct {
+    ditto_db_t* db;
+    size_t keys;
+    int read_pct;
+    double seconds;
+    uint64_t seed;
+    uint64_t gets;
+    uint64_t puts;
+} worker_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t* state) {
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+static void format_key(char* buf, size_t cap, uint64_t i) {
+    snprintf(buf, cap, "collection:document:%llu", (unsigned long long)i);
+}
+
+static void* worker_main(void* arg) {
+    worker_t* w = (worker_t*)arg;
+    uint8_t value[VALUE_SIZE] = {0};
+    uint8_t out[VALUE_SIZE];
+    char key[64];
+
+    double deadline = now_seconds() + w->seconds;
+    while (now_seconds() < deadline) {
+        // Check the clock once per batch so timing does not dominate
+        for (int i = 0; i < 256; i++) {
+            uint64_t r = next_random(&w->seed);
+            format_key(key, sizeof(key), r % w->keys);
+            if ((int)((r >> 32) % 100) < w->read_pct) {
+                size_t len = sizeof(out);
+                ditto_get(w->db, key, out, &len);
+                w->gets++;
+            } else {
+                value[0] = (uint8_t)r;
+                ditto_put(w->db, key, value, sizeof(value));
+                w->puts++;
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)(cpus > 0 ? cpus : 4);
+    size_t keys = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 100000;
+    double seconds = argc > 3 ? atof(argv[3]) : 1.0;
+    int read_pct = argc > 4 ? atoi(argv[4]) : 90;
+    if (max_threads < 1 || keys == 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [max_threads] [keys] [seconds] [read_pct]\n", argv[0]);
+        return 1;
+    }
+
+    ditto_db_t* db = NULL;
+    if (ditto_open(":memory:", &db) != 0) {
+        fprintf(stderr, "ditto_open failed\n");
+        return 1;
+    }
+
+    // Preload so reads hit
+    uint8_t value[VALUE_SIZE] = {0};
+    char key[64];
+    for (size_t i = 0; i < keys; i++) {
+        format_key(key, sizeof(key), i);
+        ditto_put(db, key, value, sizeof(value));
+    }
+
+    printf("keys=%zu value=%dB read=%d%% seconds/run=%.2f\n",
+           keys, VALUE_SIZE, read_pct, seconds);
+    printf("%8s %14s %14s %14s %9s\n",
+           "threads", "get ops/s", "put ops/s", "total ops/s", "speedup");
+
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        worker_t* workers = (worker_t*)calloc((size_t)threads, sizeof(worker_t));
+        pthread_t* tids = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+        if (!workers || !tids) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        for (int t = 0; t < threads; t++) {
+            workers[t] = (worker_t){db, keys, read_pct, seconds,
+                                    0x9E3779B97F4A7C15ULL * (uint64_t)(t + 1), 0, 0};
+            pthread_create(&tids[t], NULL, worker_main, &workers[t]);
+        }
+
+        uint64_t gets = 0;
+        uint64_t puts = 0;
+        for (int t = 0; t < threads; t++) {
+            pthread_join(tids[t], NULL);
+            gets += workers[t].gets;
+            puts += workers[t].puts;
+        }
+
+        double total = (double)(gets + puts) / seconds;
+        if (threads == 1) base = total;
+        printf("%8d %14.0f %14.0f %14.0f %8.2fx\n", threads,
+               (double)gets / seconds, (double)puts / seconds, total,
+               base > 0 ? total / base : 0.0);
+
+        free(workers);
+        free(tids);
+
+        // Always include max_threads itself, even when it is not a power of two
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+
+    ditto_close(db);
+    return 0;
+}
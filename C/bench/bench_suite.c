@@ -0,0 +1,520 @@
+// bench_suite.c - Latency, mixed-workload and fan-out benchmarks as JSON
+//
+// Usage: ditto_bench [--keys N] [--threads N] [--seconds S] [--value-size B]
+//                    [--max-value B] [--path DIR] [--out FILE]
+//
+// Runs three groups and prints one JSON document (to stdout, or --out):
+//   latency  single-threaded put/get/delete for value sizes 16 B .. max-value
+//   ycsb     YCSB-A/B/C-like mixes on --threads threads, zipfian keys
+//   fanout   put cost with 0..256 subscriptions, matching and not
+// Latencies are per operation in nanoseconds.
+#include "ditto.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KEY_CAP 64
+#define MAX_LATENCY_BYTES (256u << 20)  // data written per latency run
+
+typedef struct {
+    size_t keys;
+    int threads;
+    double seconds;
+    size_t value_size;
+    size_t max_value;
+    const char* path;
+} config_t;
+
+// ============================================================================
+// Timing and Histograms
+// ============================================================================
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Log-linear histogram: exact below 64 ns, then 32 buckets per power of
+// two, so any percentile is within about 3% of the true value.
+#define HIST_SUB_BITS 5
+#define HIST_LINEAR 64
+#define HIST_BUCKETS (HIST_LINEAR + (64 - 6) * (1 << HIST_SUB_BITS))
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} histogram_t;
+
+static size_t hist_bucket(uint64_t v) {
+    if (v < HIST_LINEAR) return (size_t)v;
+    int msb = 63 - __builtin_clzll(v);
+    size_t sub = (size_t)(v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return HIST_LINEAR + (size_t)(msb - 6) * (1 << HIST_SUB_BITS) + sub;
+}
+
+// Lowest value that lands in bucket b
+static uint64_t hist_bucket_value(size_t b) {
+    if (b < HIST_LINEAR) return b;
+    size_t msb = (b - HIST_LINEAR) / (1 << HIST_SUB_BITS) + 6;
+    uint64_t sub = (b - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+    return (1ull << msb) | (sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_record(histogram_t* h, uint64_t v) {
+    h->counts[hist_bucket(v)]++;
+    h->total++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
+}
+
+static void hist_merge(histogram_t* into, const histogram_t* from) {
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        into->counts[b] += from->counts[b];
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+    if (from->max > into->max) into->max = from->max;
+}
+
+static uint64_t hist_percentile(const histogram_t* h, double pct) {
+    if (h->total == 0) return 0;
+    uint64_t rank = (uint64_t)ceil(pct / 100.0 * (double)h->total);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) return hist_bucket_value(b);
+    }
+    return h->max;
+}
+
+// ============================================================================
+// Key Generation
+// ============================================================================
+
+static uint64_t next_random(uint64_t* state) {
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+static double next_unit(uint64_t* state) {
+    return (double)(next_random(state) >> 11) / 9007199254740992.0;
+}
+
+static void format_key(char* buf, uint64_t i) {
+    snprintf(buf, KEY_CAP, "collection:document:%llu", (unsigned long long)i);
+}
+
+// YCSB's zipfian generator (Gray et al.), theta 0.99. Ranks are scrambled
+// so the hot keys are spread over the key space rather than clustered.
+typedef struct {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} zipf_t;
+
+static void zipf_init(zipf_t* z, uint64_t n) {
+    z->n = n;
+    z->theta = 0.99;
+    double zeta2 = 1.0 + pow(0.5, z->theta);
+    z->zetan = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        z->zetan += 1.0 / pow((double)i, z->theta);
+    }
+    z->alpha = 1.0 / (1.0 - z->theta);
+    z->eta = (1.0 - pow(2.0 / (double)n, 1.0 - z->theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_next(const zipf_t* z, uint64_t* state) {
+    double u = next_unit(state);
+    double uz = u * z->zetan;
+    uint64_t rank;
+    if (uz < 1.0) {
+        rank = 0;
+    } else if (uz < 1.0 + pow(0.5, z->theta)) {
+        rank = 1;
+    } else {
+        rank = (uint64_t)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    }
+    if (rank >= z->n) rank = z->n - 1;
+
+    // FNV-1a over the rank
+    uint64_t h = 14695981039346656037ull;
+    for (int i = 0; i < 8; i++) {
+        h = (h ^ ((rank >> (8 * i)) & 0xff)) * 1099511628211ull;
+    }
+    return h % z->n;
+}
+
+// ============================================================================
+// JSON Output
+// ============================================================================
+
+static FILE* out;
+static int first_result = 1;
+
+static void json_latency(const char* name, const histogram_t* h) {
+    fprintf(out,
+            "\"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, "
+            "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+            name, (unsigned long long)h->total,
+            h->total ? (double)h->sum / (double)h->total : 0.0,
+            (unsigned long long)hist_percentile(h, 50),
+            (unsigned long long)hist_percentile(h, 99),
+            (unsigned long long)hist_percentile(h, 99.9),
+            (unsigned long long)h->max);
+}
+
+// Starts a result object; the caller prints its latency fields and closes it
+// with result_end().
+static void result_begin(const char* group, const char* name, size_t value_size,
+                         int threads, uint64_t ops, double seconds) {
+    fprintf(out, "%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"value_size\": %zu, "
+            "\"threads\": %d, \"ops\": %llu, \"seconds\": %.3f, "
+            "\"ops_per_sec\": %.0f, \"latency_ns\": {",
+            first_result ? "" : ",", group, name, value_size, threads,
+            (unsigned long long)ops, seconds, seconds > 0 ? (double)ops / seconds : 0.0);
+    first_result = 0;
+}
+
+static void result_end(void) {
+    fprintf(out, "}}");
+}
+
+static int open_db(const config_t* cfg, ditto_db_t** out_db) {
+    if (ditto_open(cfg->path, out_db) != 0) {
+        fprintf(stderr, "ditto_open(%s) failed\n", cfg->path);
+        return -1;
+    }
+    return 0;
+}
+
+// ============================================================================
+// Latency by Value Size
+// ============================================================================
+
+static int bench_latency(const config_t* cfg, size_t value_size) {
+    size_t n = cfg->keys;
+    if (n > MAX_LATENCY_BYTES / value_size) n = MAX_LATENCY_BYTES / value_size;
+    if (n == 0) n = 1;
+
+    ditto_db_t* db;
+    if (open_db(cfg, &db) != 0) return -1;
+    uint8_t* value = (uint8_t*)malloc(value_size);
+    uint8_t* buf = (uint8_t*)malloc(value_size);
+    histogram_t* hist = (histogram_t*)calloc(3, sizeof(histogram_t));
+    if (!value || !buf || !hist) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    memset(value, 'v', value_size);
+
+    char key[KEY_CAP];
+    uint64_t started = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        format_key(key, i);
+        uint64_t t0 = now_ns();
+        ditto_put(db, key, value, value_size);
+        hist_record(&hist[0], now_ns() - t0);
+    }
+    double put_secs = (double)(now_ns() - started) / 1e9;
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    started = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        format_key(key, next_random(&seed) % n);
+        size_t len = value_size;
+        uint64_t t0 = now_ns();
+        ditto_get(db, key, buf, &len);
+        hist_record(&hist[1], now_ns() - t0);
+    }
+    double get_secs = (double)(now_ns() - started) / 1e9;
+
+    started = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        format_key(key, i);
+        uint64_t t0 = now_ns();
+        ditto_delete(db, key);
+        hist_record(&hist[2], now_ns() - t0);
+    }
+    double delete_secs = (double)(now_ns() - started) / 1e9;
+    ditto_close(db);
+
+    const char* names[3] = {"put", "get", "delete"};
+    double secs[3] = {put_secs, get_secs, delete_secs};
+    for (int i = 0; i < 3; i++) {
+        result_begin("latency", names[i], value_size, 1, n, secs[i]);
+        json_latency(names[i], &hist[i]);
+        result_end();
+    }
+
+    free(value);
+    free(buf);
+    free(hist);
+    return 0;
+}
+
+// ============================================================================
+// YCSB-like Mixed Workloads
+// ============================================================================
+
+typedef struct {
+    ditto_db_t* db;
+    const zipf_t* zipf;
+    size_t value_size;
+    int read_pct;
+    uint64_t deadline;
+    uint64_t seed;
+    uint64_t ops;
+    histogram_t reads;
+    histogram_t updates;
+} ycsb_worker_t;
+
+static void* ycsb_main(void* arg) {
+    ycsb_worker_t* w = (ycsb_worker_t*)arg;
+    uint8_t* value = (uint8_t*)calloc(1, w->value_size);
+    uint8_t* buf = (uint8_t*)malloc(w->value_size);
+    char key[KEY_CAP];
+    if (!value || !buf) return NULL;
+
+    while (now_ns() < w->deadline) {
+        for (int i = 0; i < 64; i++) {
+            format_key(key, zipf_next(w->zipf, &w->seed));
+            int is_read = (int)(next_random(&w->seed) % 100) < w->read_pct;
+            uint64_t t0 = now_ns();
+            if (is_read) {
+                size_t len = w->value_size;
+                ditto_get(w->db, key, buf, &len);
+                hist_record(&w->reads, now_ns() - t0);
+            } else {
+                value[0]++;
+                ditto_put(w->db, key, value, w->value_size);
+                hist_record(&w->updates, now_ns() - t0);
+            }
+            w->ops++;
+        }
+    }
+
+    free(value);
+    free(buf);
+    return NULL;
+}
+
+static int bench_ycsb(const config_t* cfg, ditto_db_t* db, const zipf_t* zipf,
+                      const char* name, int read_pct) {
+    ycsb_worker_t* workers = (ycsb_worker_t*)calloc((size_t)cfg->threads,
+                                                    sizeof(ycsb_worker_t));
+    pthread_t* tids = (pthread_t*)calloc((size_t)cfg->threads, sizeof(pthread_t));
+    if (!workers || !tids) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    uint64_t started = now_ns();
+    uint64_t deadline = started + (uint64_t)(cfg->seconds * 1e9);
+    for (int t = 0; t < cfg->threads; t++) {
+        workers[t].db = db;
+        workers[t].zipf = zipf;
+        workers[t].value_size = cfg->value_size;
+        workers[t].read_pct = read_pct;
+        workers[t].deadline = deadline;
+        workers[t].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(t + 1);
+        pthread_create(&tids[t], NULL, ycsb_main, &workers[t]);
+    }
+
+    histogram_t* merged = (histogram_t*)calloc(2, sizeof(histogram_t));
+    if (!merged) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    uint64_t ops = 0;
+    for (int t = 0; t < cfg->threads; t++) {
+        pthread_join(tids[t], NULL);
+        hist_merge(&merged[0], &workers[t].reads);
+        hist_merge(&merged[1], &workers[t].updates);
+        ops += workers[t].ops;
+    }
+    double secs = (double)(now_ns() - started) / 1e9;
+
+    result_begin("ycsb", name, cfg->value_size, cfg->threads, ops, secs);
+    json_latency("read", &merged[0]);
+    fprintf(out, ", ");
+    json_latency("update", &merged[1]);
+    result_end();
+
+    free(merged);
+    free(workers);
+    free(tids);
+    return 0;
+}
+
+static int bench_ycsb_all(const config_t* cfg) {
+    ditto_db_t* db;
+    if (open_db(cfg, &db) != 0) return -1;
+
+    // Load phase
+    uint8_t* value = (uint8_t*)calloc(1, cfg->value_size);
+    if (!value) return -1;
+    char key[KEY_CAP];
+    for (size_t i = 0; i < cfg->keys; i++) {
+        format_key(key, i);
+        ditto_put(db, key, value, cfg->value_size);
+    }
+    free(value);
+
+    zipf_t zipf;
+    zipf_init(&zipf, cfg->keys);
+    int rc = bench_ycsb(cfg, db, &zipf, "A (50% read, 50% update)", 50);
+    if (rc == 0) rc = bench_ycsb(cfg, db, &zipf, "B (95% read, 5% update)", 95);
+    if (rc == 0) rc = bench_ycsb(cfg, db, &zipf, "C (100% read)", 100);
+    ditto_close(db);
+    return rc;
+}
+
+// ============================================================================
+// Subscription Fan-out
+// ============================================================================
+
+static _Atomic uint64_t callbacks_run;
+
+static void on_change(void* user_data, const char* key) {
+    (void)user_data;
+    (void)key;
+    atomic_fetch_add_explicit(&callbacks_run, 1, memory_order_relaxed);
+}
+
+// Put latency with `subs` subscriptions registered. Matching subscriptions
+// watch every key and each runs per put; non-matching ones watch keys that
+// are never written, which measures the cost of filtering them out.
+static int bench_fanout(const config_t* cfg, int subs, int matching) {
+    ditto_db_t* db;
+    if (open_db(cfg, &db) != 0) return -1;
+
+    char key[KEY_CAP];
+    for (int i = 0; i < subs; i++) {
+        int32_t id;
+        if (matching) {
+            ditto_subscribe(db, on_change, NULL, &id);
+        } else {
+            snprintf(key, sizeof(key), "unwatched:%d", i);
+            ditto_subscribe_key(db, key, on_change, NULL, &id);
+        }
+    }
+
+    size_t n = cfg->keys < 200000 ? cfg->keys : 200000;
+    uint8_t value[16] = {0};
+    histogram_t* hist = (histogram_t*)calloc(1, sizeof(histogram_t));
+    if (!hist) return -1;
+    atomic_store(&callbacks_run, 0);
+    uint64_t started = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        format_key(key, i);
+        uint64_t t0 = now_ns();
+        ditto_put(db, key, value, sizeof(value));
+        hist_record(hist, now_ns() - t0);
+    }
+    double secs = (double)(now_ns() - started) / 1e9;
+    ditto_close(db);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%d %s subscriptions", subs,
+             matching ? "matching" : "non-matching");
+    result_begin("fanout", name, sizeof(value), 1, n, secs);
+    json_latency("put", hist);
+    fprintf(out, ", \"callbacks\": %llu",
+            (unsigned long long)atomic_load(&callbacks_run));
+    result_end();
+    free(hist);
+    return 0;
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [--keys N] [--threads N] [--seconds S] [--value-size B]\n"
+            "       %*s [--max-value B] [--path DIR] [--out FILE]\n",
+            argv0, (int)strlen(argv0), "");
+}
+
+int main(int argc, char** argv) {
+    config_t cfg = {100000, 4, 1.0, 100, 1u << 20, ":memory:"};
+    const char* out_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--keys") == 0) {
+            cfg.keys = (size_t)strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--threads") == 0) {
+            cfg.threads = atoi(val);
+        } else if (strcmp(arg, "--seconds") == 0) {
+            cfg.seconds = atof(val);
+        } else if (strcmp(arg, "--value-size") == 0) {
+            cfg.value_size = (size_t)strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--max-value") == 0) {
+            cfg.max_value = (size_t)strtoull(val, NULL, 10);
+        } else if (strcmp(arg, "--path") == 0) {
+            cfg.path = val;
+        } else if (strcmp(arg, "--out") == 0) {
+            out_path = val;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.keys == 0 || cfg.threads < 1 || cfg.seconds <= 0 ||
+        cfg.value_size == 0 || cfg.max_value < 16) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "cannot open %s\n", out_path);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"library_version\": \"%s\",\n", ditto_version());
+    fprintf(out, "  \"config\": {\"keys\": %zu, \"threads\": %d, \"seconds\": %.2f, "
+            "\"value_size\": %zu, \"max_value\": %zu, \"path\": \"%s\"},\n",
+            cfg.keys, cfg.threads, cfg.seconds, cfg.value_size, cfg.max_value,
+            cfg.path);
+    fprintf(out, "  \"results\": [");
+
+    int rc = 0;
+    for (size_t size = 16; rc == 0 && size <= cfg.max_value; size *= 4) {
+        rc = bench_latency(&cfg, size);
+    }
+    if (rc == 0) rc = bench_ycsb_all(&cfg);
+    static const int fanout_subs[] = {0, 1, 16, 256};
+    for (size_t i = 0; rc == 0 && i < sizeof(fanout_subs) / sizeof(fanout_subs[0]); i++) {
+        rc = bench_fanout(&cfg, fanout_subs[i], 1);
+        if (rc == 0 && fanout_subs[i] > 0) rc = bench_fanout(&cfg, fanout_subs[i], 0);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) fclose(out);
+    return rc == 0 ? 0 : 1;
+}
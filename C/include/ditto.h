@@ -18,7 +18,18 @@ extern "C" {
 #endif
 
 typedef struct ditto_db ditto_db_t;          // opaque handle
+typedef struct ditto_view ditto_view_t;      // opaque borrowed value
 
+// Pass as ditto_open()'s path for a purely in-memory store.
+#define DITTO_MEMORY_PATH ":memory:"
+
+// Opens the store in directory `path`, creating it if needed. Changes are
+// appended to a write-ahead log there and replayed on the next open; a
+// record torn by a crash is discarded. The log is periodically compacted in
+// the background into a snapshot file that is memory-mapped on open, so
+// startup only replays changes made since. A store can be open in only one
+// process at a time. Pass DITTO_MEMORY_PATH to keep nothing on disk.
+// Windows builds have no file backend yet and return -1 for any other path.
 // Returns 0 on success, non-zero on error.
 // On success, *out_db is a valid handle. Call ditto_close() when done.
 DITTO_API int32_t ditto_open(const char* path, ditto_db_t** out_db);
@@ -26,12 +37,26 @@ DITTO_API int32_t ditto_open(const char* path, ditto_db_t** out_db);
 // Always safe to call; frees resources and invalidates pointer.
 DITTO_API void ditto_close(ditto_db_t* db);
 
-// Put a value. Returns 0 on success.
+// Put a value. Returns 0 on success. For an on-disk store, -1 can also mean
+// the change was applied in memory but could not be written to the log; the
+// log then rejects further writes.
 DITTO_API int32_t ditto_put(ditto_db_t* db,
                             const char* key,
                             const uint8_t* data,
                             size_t len);
 
+// Put a value that expires ttl_ms milliseconds from now (ttl_ms > 0). A
+// background thread deletes expired keys within about 10 ms of their
+// deadline; everything that expires together reaches subscribers as one
+// batch of changes. A later put or delete of the key clears its TTL. The
+// deadline is wall-clock time and survives reopening an on-disk store.
+// Returns as ditto_put(), or -1 if ttl_ms is 0.
+DITTO_API int32_t ditto_put_ttl(ditto_db_t* db,
+                                const char* key,
+                                const uint8_t* data,
+                                size_t len,
+                                uint32_t ttl_ms);
+
 // Get a value into caller-provided buffer. If out_len is smaller than value,
 // function sets *out_len to required size and returns 1 (buffer too small).
 // Returns 0 on success, 2 if key not found, other non-zero on error.
@@ -40,9 +65,244 @@ DITTO_API int32_t ditto_get(ditto_db_t* db,
                             uint8_t* out_buf,
                             size_t* inout_len);
 
+// Borrow the current value without copying it. On success *out_ptr and
+// *out_len describe the stored bytes and *out_view pins them: they stay
+// valid and unchanged, even if the key is overwritten or deleted, until
+// ditto_view_release(*out_view). The bytes must not be modified.
+// Returns 0 on success, 2 if key not found, other non-zero on error.
+DITTO_API int32_t ditto_get_view(ditto_db_t* db,
+                                 const char* key,
+                                 const uint8_t** out_ptr,
+                                 size_t* out_len,
+                                 ditto_view_t** out_view);
+
+// Release a view obtained from ditto_get_view(). Safe to call with NULL and
+// from any thread. Views must be released before ditto_close().
+DITTO_API void ditto_view_release(ditto_view_t* view);
+
 // Delete a key. Returns 0 on success, 2 if key not found.
 DITTO_API int32_t ditto_delete(ditto_db_t* db, const char* key);
 
+// Length-prefixed variants of the calls above for callers that already know
+// the key's length (e.g. FFI callers holding a byte buffer); the key need not
+// be NUL-terminated. Keys may not contain a NUL byte: such calls return -1.
+DITTO_API int32_t ditto_put_n(ditto_db_t* db,
+                              const char* key,
+                              size_t key_len,
+                              const uint8_t* data,
+                              size_t len);
+
+DITTO_API int32_t ditto_get_n(ditto_db_t* db,
+                              const char* key,
+                              size_t key_len,
+                              uint8_t* out_buf,
+                              size_t* inout_len);
+
+DITTO_API int32_t ditto_get_view_n(ditto_db_t* db,
+                                   const char* key,
+                                   size_t key_len,
+                                   const uint8_t** out_ptr,
+                                   size_t* out_len,
+                                   ditto_view_t** out_view);
+
+DITTO_API int32_t ditto_delete_n(ditto_db_t* db, const char* key, size_t key_len);
+
+// Partial reads and writes for large values. Writes change the stored
+// bytes in place when no view or read snapshot still needs the old ones,
+// so their cost follows the bytes written rather than the size of the
+// value; a value grown by appends gets room to grow into. Each
+// write notifies subscribers once, and a key's TTL is kept.
+//
+// Copy up to *inout_len bytes of the value from `offset` into out_buf and
+// set *inout_len to the bytes copied, fewer near the end of the value.
+// *out_value_len (may be NULL) is set to the value's full length. Returns
+// 0 on success, 2 if key not found, -1 if offset is past the end.
+DITTO_API int32_t ditto_get_range(ditto_db_t* db,
+                                  const char* key,
+                                  size_t offset,
+                                  uint8_t* out_buf,
+                                  size_t* inout_len,
+                                  size_t* out_value_len);
+
+// Write len bytes at `offset`, at most the value's current length,
+// extending the value if they run past its end. Returns 0 on success, 2 if
+// key not found, -1 if offset is past the end or on error.
+DITTO_API int32_t ditto_put_range(ditto_db_t* db,
+                                  const char* key,
+                                  size_t offset,
+                                  const uint8_t* data,
+                                  size_t len);
+
+// Append len bytes to the value, creating the key if it does not exist.
+// Returns as ditto_put().
+DITTO_API int32_t ditto_append(ditto_db_t* db,
+                               const char* key,
+                               const uint8_t* data,
+                               size_t len);
+
+// Interned keys. A handle holds a copy of the key with its hash precomputed
+// and remembers where the key was last found, so hot keys skip hashing and
+// probing. A handle belongs to the db it was interned for (other dbs reject
+// it with -1) and must be released before ditto_close(). The _k calls behave
+// like their C-string counterparts; lookups update the handle's hint, so a
+// handle used by several threads at once is safe but may miss the hint.
+typedef struct ditto_key ditto_key_t;        // opaque interned key
+
+// Returns 0 on success, -1 if the key contains a NUL byte or on error.
+DITTO_API int32_t ditto_key_intern(ditto_db_t* db,
+                                   const char* key,
+                                   size_t key_len,
+                                   ditto_key_t** out_key);
+
+// Frees a handle. Safe to call with NULL.
+DITTO_API void ditto_key_release(ditto_key_t* key);
+
+DITTO_API int32_t ditto_put_k(ditto_db_t* db,
+                              const ditto_key_t* key,
+                              const uint8_t* data,
+                              size_t len);
+
+DITTO_API int32_t ditto_get_k(ditto_db_t* db,
+                              ditto_key_t* key,
+                              uint8_t* out_buf,
+                              size_t* inout_len);
+
+DITTO_API int32_t ditto_get_view_k(ditto_db_t* db,
+                                   ditto_key_t* key,
+                                   const uint8_t** out_ptr,
+                                   size_t* out_len,
+                                   ditto_view_t** out_view);
+
+DITTO_API int32_t ditto_delete_k(ditto_db_t* db, const ditto_key_t* key);
+
+// Operation codes for ditto_write_batch().
+#define DITTO_OP_PUT    0
+#define DITTO_OP_DELETE 1
+
+// Apply count puts/deletes in one call. Operation i writes values[i]
+// (lens[i] bytes) to keys[i], or deletes keys[i] when ops[i] is
+// DITTO_OP_DELETE; ops may be NULL for an all-put batch, and values/lens
+// may be NULL for an all-delete batch. Operations are grouped by shard and
+// each shard is locked once; operations on the same key apply in array
+// order. Subscribers get a single notification covering every key changed.
+// The batch is not atomic: concurrent readers may observe it partially
+// applied. If out_status is non-NULL, out_status[i] receives the result of
+// operation i as ditto_put()/ditto_delete() would return it.
+// Returns 0 if every operation succeeded or deleted a missing key, -1 if
+// any operation failed (the others are still applied).
+DITTO_API int32_t ditto_write_batch(ditto_db_t* db,
+                                    size_t count,
+                                    const char* const* keys,
+                                    const uint8_t* const* values,
+                                    const size_t* lens,
+                                    const uint8_t* ops,
+                                    int32_t* out_status);
+
+// Look up count keys in one call, packing the values found back to back
+// into `arena` (*inout_arena_len bytes). Keys are grouped by shard and each
+// shard is visited once, without taking its lock. For key i, out_status[i]
+// is 0 with the value at arena + out_offsets[i] (out_lens[i] bytes), 2 if
+// the key is not found, 1 if it is found but did not fit (out_lens[i]
+// still gives its size), or -1 if keys[i] is NULL. Each value is as
+// ditto_get() would return it; the set is not a snapshot across shards
+// (see ditto_snapshot_open()).
+// *inout_arena_len is set to the bytes all found values need, so a call
+// that returns 1 can be retried with an arena of that size; pass a NULL
+// arena to only measure. Returns 0 if every value fit, 1 if the arena was
+// too small, -1 on invalid arguments or if any key was NULL.
+DITTO_API int32_t ditto_multi_get(ditto_db_t* db,
+                                  const char* const* keys,
+                                  size_t count,
+                                  uint8_t* arena,
+                                  size_t* inout_arena_len,
+                                  size_t* out_offsets,
+                                  size_t* out_lens,
+                                  int32_t* out_status);
+
+// Transactions. Reads go to the store (or to the transaction's own writes)
+// and remember the version of each key read; writes are buffered until
+// commit. Commit checks that no key read has changed since, then applies
+// every write at once: no reader, read snapshot or crash recovery sees part
+// of a transaction. Subscribers get a single notification covering every
+// key changed. One transaction must not be used by several threads at once.
+typedef struct ditto_txn ditto_txn_t;        // opaque transaction
+
+DITTO_API int32_t ditto_txn_begin(ditto_db_t* db, ditto_txn_t** out_txn);
+
+// Like ditto_get(), and records the key as read.
+DITTO_API int32_t ditto_txn_get(ditto_txn_t* txn,
+                                const char* key,
+                                uint8_t* out_buf,
+                                size_t* inout_len);
+
+DITTO_API int32_t ditto_txn_put(ditto_txn_t* txn,
+                                const char* key,
+                                const uint8_t* data,
+                                size_t len);
+
+DITTO_API int32_t ditto_txn_delete(ditto_txn_t* txn, const char* key);
+
+// Ends the transaction, which is freed whatever the outcome. Returns 0 on
+// success, 3 if another write changed a key the transaction read (nothing
+// was applied; run the transaction again), other non-zero on error.
+DITTO_API int32_t ditto_txn_commit(ditto_txn_t* txn);
+
+// Discards the transaction's writes and frees it. Safe to call with NULL.
+DITTO_API void ditto_txn_abort(ditto_txn_t* txn);
+
+// Ordered scans. Keys are visited in bytewise order, a batch of records per
+// ditto_cursor_next() call. Each batch is read consistently, but the scan as
+// a whole is not a snapshot: keys changed while it runs may or may not be
+// seen, and no key is returned twice. Close cursors before ditto_close().
+typedef struct ditto_cursor ditto_cursor_t;  // opaque scan position
+
+// Scan every key starting with `prefix`. Returns 0 on success.
+DITTO_API int32_t ditto_scan_prefix(ditto_db_t* db,
+                                    const char* prefix,
+                                    ditto_cursor_t** out_cursor);
+
+// Scan keys in [start, end). A NULL start begins at the first key and a NULL
+// end runs through the last. Returns 0 on success.
+DITTO_API int32_t ditto_scan_range(ditto_db_t* db,
+                                   const char* start,
+                                   const char* end,
+                                   ditto_cursor_t** out_cursor);
+
+// Fill out_buf with as many of the next records as fit, each laid out as
+// [uint32 key_len][uint32 value_len][key bytes][value bytes] in native byte
+// order, unpadded and without NUL terminators. On return *inout_len is the
+// number of bytes used and *out_count the number of records; a count of 0
+// means the scan is finished. If not even the next record fits, sets
+// *inout_len to its size and returns 1 (buffer too small).
+// Returns 0 on success, other non-zero on error.
+DITTO_API int32_t ditto_cursor_next(ditto_cursor_t* cursor,
+                                    uint8_t* out_buf,
+                                    size_t* inout_len,
+                                    size_t* out_count);
+
+// Free a cursor. Safe to call with NULL.
+DITTO_API void ditto_cursor_close(ditto_cursor_t* cursor);
+
+// Read snapshots. A snapshot sees the store as it was when opened: every
+// change that completed before ditto_snapshot_open() and none that started
+// after, across all keys, while writers carry on without waiting for it.
+// Old values are kept only as long as some open snapshot can still read
+// them. Snapshots may be read from any thread and must be closed before
+// ditto_close().
+typedef struct ditto_snapshot ditto_snapshot_t;  // opaque read view
+
+DITTO_API int32_t ditto_snapshot_open(ditto_db_t* db, ditto_snapshot_t** out_snap);
+
+// Like ditto_get(), as of the snapshot. Returns 0 on success, 1 if the
+// buffer is too small, 2 if the key did not exist, other non-zero on error.
+DITTO_API int32_t ditto_snapshot_get(ditto_snapshot_t* snap,
+                                     const char* key,
+                                     uint8_t* out_buf,
+                                     size_t* inout_len);
+
+// Safe to call with NULL.
+DITTO_API void ditto_snapshot_close(ditto_snapshot_t* snap);
+
 // Callback signature for change notifications.
 // user_data is an opaque pointer provided at subscription time.
 typedef void (*ditto_on_change_cb)(void* user_data, const char* key);
@@ -54,14 +314,497 @@ DITTO_API int32_t ditto_subscribe(ditto_db_t* db,
                                   void* user_data,
                                   int32_t* out_sub_id);
 
+// Callback signature for batched change notifications. keys holds n distinct
+// keys, valid only for the duration of the call.
+typedef void (*ditto_on_changes_cb)(void* user_data, const char** keys, size_t n);
+
+// Subscribe to changes for all keys, delivered in batches. Returns a
+// subscription id (>=1) via out_sub_id. Returns 0 on success.
+// Without async notifications every batch holds a single key.
+DITTO_API int32_t ditto_subscribe_batch(ditto_db_t* db,
+                                        ditto_on_changes_cb cb,
+                                        void* user_data,
+                                        int32_t* out_sub_id);
+
+// Subscribe to changes of one key only. Writes to other keys never reach
+// the callback. Returns a subscription id (>=1) via out_sub_id.
+// Returns 0 on success.
+DITTO_API int32_t ditto_subscribe_key(ditto_db_t* db,
+                                      const char* key,
+                                      ditto_on_change_cb cb,
+                                      void* user_data,
+                                      int32_t* out_sub_id);
+
+// Subscribe to changes of keys starting with `prefix`. Returns a
+// subscription id (>=1) via out_sub_id. Returns 0 on success.
+DITTO_API int32_t ditto_subscribe_prefix(ditto_db_t* db,
+                                         const char* prefix,
+                                         ditto_on_change_cb cb,
+                                         void* user_data,
+                                         int32_t* out_sub_id);
+
+// Batched form of ditto_subscribe_prefix(): each call receives only the
+// changed keys that start with `prefix`.
+DITTO_API int32_t ditto_subscribe_prefix_batch(ditto_db_t* db,
+                                               const char* prefix,
+                                               ditto_on_changes_cb cb,
+                                               void* user_data,
+                                               int32_t* out_sub_id);
+
+// Subscribe to keys evicted to stay within the memory budget (see
+// ditto_set_memory_budget()). Only evictions reach the callback; other
+// subscriptions matching an evicted key see it as an ordinary change, since
+// it now reads as not found. Returns a subscription id (>=1) via out_sub_id.
+// Returns 0 on success.
+DITTO_API int32_t ditto_subscribe_evictions(ditto_db_t* db,
+                                            ditto_on_change_cb cb,
+                                            void* user_data,
+                                            int32_t* out_sub_id);
+
 // Unsubscribe by id. Returns 0 on success.
 DITTO_API int32_t ditto_unsubscribe(ditto_db_t* db, int32_t sub_id);
 
+// Opt in to asynchronous notifications: writes queue the changed key in a
+// bounded queue of queue_capacity entries (rounded up to a power of two) and
+// return, while a dedicated dispatcher thread invokes the callbacks. Changes
+// that pile up while a callback runs are coalesced into one batch, so a key
+// written repeatedly may be reported once. If the queue is full, writers
+// wait for the dispatcher to catch up; changes a callback makes are
+// delivered on the dispatcher thread straight away instead, ahead of the
+// queue. Stays enabled until ditto_close(), which delivers everything still
+// queued. Returns 0 on success (including when already enabled).
+DITTO_API int32_t ditto_enable_async_notifications(ditto_db_t* db,
+                                                   size_t queue_capacity);
+
+// Change ring: an alternative to callbacks for consumers that would rather
+// poll. Every change is appended as a record to a ring in one block of
+// native memory, which consumers read in place or copy out with
+// ditto_change_ring_read(); the only callback is a doorbell, rung at most
+// once per ditto_change_ring_arm(). Records carry no values: read the key
+// to learn its new state. Each consumer keeps its own cursor (the seq of
+// the last record it consumed), so any number can read the same ring; a
+// slow consumer is lapped rather than slowing writers down.
+typedef struct ditto_change_ring ditto_change_ring_t;   // opaque ring
+
+// Called on the writing thread with no store locks held, but with the
+// ring's publish lock: it must be quick and must not write to the store.
+typedef void (*ditto_doorbell_cb)(void* user_data);
+
+#define DITTO_CHANGE_RING_VERSION 1
+
+// Record kinds
+#define DITTO_CHANGE_WRITTEN 0  // put or deleted
+#define DITTO_CHANGE_EVICTED 1  // evicted for the memory budget
+#define DITTO_CHANGE_LOST    2  // key longer than the key area; not included
+
+// Layout of the ring's memory. Fields are written with atomic stores; a
+// reader going in place loads `head` with acquire semantics, then for
+// record n (1 <= n <= head) at records_offset + (n & (record_capacity - 1))
+// * sizeof(ditto_change_record_t): checks seq == n, reads the record and
+// its key at keys_offset + (key_pos & (key_capacity - 1)), and after an
+// acquire fence checks that seq is still n and key_head - key_pos <=
+// key_capacity. If not, the record was overwritten: the reader was lapped.
+typedef struct {
+    uint32_t version;           // DITTO_CHANGE_RING_VERSION
+    uint32_t record_capacity;   // records, a power of two
+    uint32_t key_capacity;      // key bytes, a power of two
+    uint32_t records_offset;    // from the start of the block
+    uint32_t keys_offset;
+    uint32_t doorbell_armed;    // set by ditto_change_ring_arm()
+    uint64_t head;              // seq of the newest record, 0 = none yet
+    uint64_t key_head;          // key bytes claimed so far, gaps included
+} ditto_change_ring_header_t;
+
+typedef struct {
+    uint64_t seq;               // from 1; 0 while being rewritten
+    uint32_t kind;              // DITTO_CHANGE_*
+    uint32_t key_len;           // key bytes, no NUL
+    uint64_t key_pos;           // a key never wraps around the key area
+} ditto_change_record_t;
+
+// Start publishing changes to a new ring of record_capacity records and
+// key_capacity key bytes (each rounded up to a power of two). A store has
+// at most one ring; it must be closed before ditto_close(). The doorbell
+// starts armed. Returns 0 on success, -1 on error or if a ring is open.
+DITTO_API int32_t ditto_change_ring_open(ditto_db_t* db,
+                                         uint32_t record_capacity,
+                                         uint32_t key_capacity,
+                                         ditto_doorbell_cb doorbell,
+                                         void* user_data,
+                                         ditto_change_ring_t** out_ring);
+
+// The ring's memory, laid out as described above. Valid until
+// ditto_change_ring_close().
+DITTO_API int32_t ditto_change_ring_memory(ditto_change_ring_t* ring,
+                                           const uint8_t** out_base,
+                                           size_t* out_size);
+
+// Copy records after *inout_cursor into out_buf, each as a u32 kind, a u32
+// key length and the key bytes, and advance the cursor past them. Start
+// from 0 for every record still in the ring, or from the header's head for
+// new ones only. *inout_len is set to the bytes written and *out_count to
+// the records; *out_lost counts records overwritten before they were read
+// (may be NULL). Returns 0 on success, 1 if not even one record fits
+// (*inout_len is then the size needed), -1 on error.
+DITTO_API int32_t ditto_change_ring_read(ditto_change_ring_t* ring,
+                                         uint64_t* inout_cursor,
+                                         uint8_t* out_buf,
+                                         size_t* inout_len,
+                                         size_t* out_count,
+                                         uint64_t* out_lost);
+
+// Ask for the doorbell to be rung by the next change. Returns 0 when armed,
+// or 1 if records after `cursor` were already published: read them first.
+DITTO_API int32_t ditto_change_ring_arm(ditto_change_ring_t* ring,
+                                        uint64_t cursor);
+
+// Stop publishing and free the ring. Safe to call with NULL.
+DITTO_API void ditto_change_ring_close(ditto_change_ring_t* ring);
+
+// Change journal: every put and delete is numbered in the order it was
+// applied, and the most recent ones (change_journal_capacity in
+// ditto_options_t) are kept so a consumer that fell behind or
+// re-subscribed can catch up on what changed instead of rereading
+// everything. Seqs restart with each ditto_open(), which gets a new
+// incarnation id so a seq is never mistaken for one from an earlier open.
+//
+// Copy the changes numbered after since_seq into out_buf, oldest first,
+// each as a u64 seq, a u32 op (DITTO_OP_PUT or DITTO_OP_DELETE; keys that
+// expire or are evicted are deletes), a u32 key length and the key bytes.
+// *inout_len is set to the bytes written and *out_count to the changes.
+// *out_seq is set to the seq to pass next time: the last change copied, or
+// the newest seq once caught up. *inout_incarnation is set to the id of
+// this open; pass it back with *out_seq. Start from 0 for both. Returns 0 on
+// success, 1 if not even one change fits (*inout_len is then the size
+// needed), 2 if changes after since_seq are no longer kept or since_seq
+// came from another incarnation (read every key, then continue from
+// *out_seq), -1 on error.
+DITTO_API int32_t ditto_changes_since(ditto_db_t* db,
+                                      uint64_t* inout_incarnation,
+                                      uint64_t since_seq,
+                                      uint8_t* out_buf,
+                                      size_t* inout_len,
+                                      size_t* out_count,
+                                      uint64_t* out_seq);
+
+// Replication stream: ditto_export_*() writes the store, or what changed in
+// it since a seq, as self-contained chunks that ditto_import_stream()
+// applies to another store through ditto_write_batch(). A chunk is a
+// 24-byte header (magic "DDX1", version 1, codec, record count, payload
+// size before and after compression, CRC32C of the payload) and records of
+// a u32 key length, a u32 value length (0xFFFFFFFF for a delete, which has
+// no value bytes), the key and the value, all little-endian. Values are
+// the ones current when their chunk is written; an export is not a
+// snapshot, but one since the seq it began at sends later changes again.
+typedef struct ditto_export ditto_export_t;  // opaque export position
+
+// Start an export of every key (since_seq 0) or of the keys changed after
+// since_seq, with chunks compressed by `compression` (DITTO_COMPRESS_*)
+// where that makes them smaller. *out_seq is set to the seq to export
+// since next time and *inout_incarnation to the id it belongs to, as for
+// ditto_changes_since(). Returns 0 on success, 2 if changes after since_seq
+// are no longer kept or since_seq came from another incarnation (export
+// everything instead), -1 on error. Close exports before ditto_close().
+DITTO_API int32_t ditto_export_begin(ditto_db_t* db,
+                                     uint64_t* inout_incarnation,
+                                     uint64_t since_seq,
+                                     int32_t compression,
+                                     ditto_export_t** out_export,
+                                     uint64_t* out_seq);
+
+// Write the next chunk, as many records as fit in *inout_len bytes, and set
+// *inout_len to its size; 0 means the export is finished. Returns 0 on
+// success, 1 if not even one record fits (*inout_len is then the size
+// needed), -1 on error.
+DITTO_API int32_t ditto_export_next(ditto_export_t* exp,
+                                    uint8_t* out_buf,
+                                    size_t* inout_len);
+
+// Safe to call with NULL.
+DITTO_API void ditto_export_close(ditto_export_t* exp);
+
+// Apply whole chunks, back to back in `data`, in order. Each chunk is
+// checked before any of it is applied. Returns 0 on success, -1 if a chunk
+// is malformed or failed to apply (the chunks before it stay applied).
+DITTO_API int32_t ditto_import_stream(ditto_db_t* db,
+                                      const uint8_t* data,
+                                      size_t len);
+
+// Durability modes for ditto_set_durability(). In every mode a write has
+// reached the OS before its call returns, so it survives the process
+// crashing; the modes differ in when it is forced to stable storage.
+#define DITTO_DURABILITY_OS       0  // left to the OS (default)
+#define DITTO_DURABILITY_SYNC     1  // fsync before each write returns
+#define DITTO_DURABILITY_PERIODIC 2  // fsync every interval_ms in the background
+
+// Select how on-disk writes are made durable. Concurrent writers share log
+// writes and fsyncs (group commit), so SYNC mode costs one fsync per group
+// of writers rather than per write. interval_ms is only used by PERIODIC.
+// ditto_close() always syncs. No-op for in-memory stores.
+// Returns 0 on success, -1 on an invalid mode.
+DITTO_API int32_t ditto_set_durability(ditto_db_t* db,
+                                       int32_t mode,
+                                       uint32_t interval_ms);
+
+// Eviction policies for ditto_set_memory_budget().
+#define DITTO_EVICT_NONE  0  // grow without bound (default)
+#define DITTO_EVICT_CLOCK 1  // evict keys not read or written recently
+
+// Cap the key and value bytes held in memory (payload_bytes in
+// ditto_stats_t) at roughly max_bytes, for stores used as a cache. A write
+// that goes over the budget evicts other keys, chosen by `policy`, before
+// it returns; evicted keys are deleted as if by ditto_delete() and reported
+// to ditto_subscribe_evictions(). Each shard enforces an equal share, so
+// evictions can start a little before the total reaches the budget.
+// Values in the memory-mapped snapshot are not counted. A smaller budget
+// takes effect immediately. Returns 0 on success, -1 on an invalid policy.
+DITTO_API int32_t ditto_set_memory_budget(ditto_db_t* db,
+                                          uint64_t max_bytes,
+                                          int32_t policy);
+
+// Codecs for ditto_set_compression().
+#define DITTO_COMPRESS_NONE 0  // store values as given (default)
+#define DITTO_COMPRESS_LZ4  1  // LZ4 block format
+
+// Compress values of at least min_size bytes held in memory, for stores of
+// large compressible values such as JSON documents. Values that shrink by
+// less than an eighth are kept as is. Reads are unchanged: ditto_get()
+// expands straight into the caller's buffer, and ditto_get_view() lends an
+// expanded copy. Applies to values written from now on; the log and the
+// snapshot file keep values uncompressed. Compressed values count at their
+// compressed size in payload_bytes and the memory budget.
+// Returns 0 on success, -1 on an invalid codec.
+DITTO_API int32_t ditto_set_compression(ditto_db_t* db,
+                                        int32_t codec,
+                                        size_t min_size);
+
+// Settings for ditto_open_ex(). Call ditto_options_init() first and change
+// only the fields you need: struct_size records which version of the
+// struct the caller was built against, so fields added later keep their
+// defaults for older callers.
+typedef struct {
+    uint32_t struct_size;           // sizeof(ditto_options_t)
+    uint32_t shard_count;           // power of two up to 32 (default 16)
+    uint64_t initial_capacity;      // keys to size the tables for up front
+    uint32_t async_queue_capacity;  // > 0: ditto_enable_async_notifications()
+    int32_t durability;             // DITTO_DURABILITY_*, see ditto_set_durability()
+    uint32_t durability_interval_ms;
+    int32_t eviction_policy;        // DITTO_EVICT_*, see ditto_set_memory_budget()
+    uint64_t memory_budget;         // bytes, 0 = unbounded
+    int32_t compression;            // DITTO_COMPRESS_*, see ditto_set_compression()
+    uint64_t compression_min_size;
+    uint32_t change_journal_capacity;   // changes kept for ditto_changes_since()
+
+    // Background maintenance, see ditto_compact_now(). The worker runs every
+    // interval and rests between steps to use at most cpu_percent of one
+    // core; rounds are skipped while writers wait longer than pause_wait_us
+    // on average for a shard lock (never with -DDITTO_STATS=OFF).
+    uint32_t maintenance_interval_ms;   // 0 = no worker (default 1000)
+    uint32_t maintenance_cpu_percent;   // 1-100 (default 10)
+    uint32_t maintenance_pause_wait_us; // 0 = never skip (default 1000)
+    uint64_t maintenance_io_bytes_per_sec;  // snapshot writes, 0 = unlimited
+    uint64_t compact_log_bytes;         // compact past this much log (default
+                                        // 64 MiB), 0 = only ditto_compact_now()
+} ditto_options_t;
+
+// Fill *opts with the settings ditto_open() uses.
+DITTO_API void ditto_options_init(ditto_options_t* opts);
+
+// ditto_open() with settings applied before the store is used. Shard count
+// and initial capacity can only be chosen here; a capacity sized for the
+// expected key count avoids resizing the tables while they are first
+// loaded, replay included. opts may be NULL for the defaults. Returns 0 on
+// success, -1 on an invalid setting or any ditto_open() error.
+DITTO_API int32_t ditto_open_ex(const char* path,
+                                const ditto_options_t* opts,
+                                ditto_db_t** out_db);
+
+// Run a full maintenance pass now, e.g. while the app is idle: compacts an
+// on-disk store's log into a new snapshot, finishes resizes and shrinks
+// tables left sparse by deletes, and repacks slab memory, returning the
+// chunks it empties to the system; open collections of db get the same.
+// This is the background worker's work, done to completion and without its
+// CPU/IO budget; writers to a shard wait while it is worked on. Blocks
+// still lent out by views stay where they are. Returns 0 on success, -1 if
+// a compaction failed (that store is unchanged and the rest of the pass
+// still runs).
+DITTO_API int32_t ditto_compact_now(ditto_db_t* db);
+
+// Collections: named key spaces inside one store, for data with different
+// access patterns (small hot settings next to a large cold cache) that key
+// prefixes would put in the same shards. Each collection has its own
+// shards and sizing, memory budget and eviction, subscribers and async
+// dispatcher, change journal and log, so writes, rehashing and eviction in
+// one never contend with or evict from another. The handle's own keys are
+// a separate space of their own.
+typedef struct ditto_coll ditto_coll_t;     // opaque, owned by its store
+
+// Open the collection `name` of db, creating it if needed, and set
+// *out_coll; db must not be a collection's handle. Names are 1-64
+// characters of letters, digits, '_', '-' and '.', not starting with '.'.
+// An on-disk store keeps each collection in its own subdirectory, opened
+// only when the collection is; an in-memory store's collections are in
+// memory too. Collections stay open until ditto_close() of db, and opening
+// one again returns the same handle.
+// Returns 0 on success, -1 on an invalid name or any ditto_open() error.
+DITTO_API int32_t ditto_collection_open(ditto_db_t* db,
+                                        const char* name,
+                                        ditto_coll_t** out_coll);
+
+// ditto_collection_open() with settings, as ditto_open_ex(), applied when
+// the collection is first opened; opts may be NULL for the defaults. The
+// maintenance_* fields are ignored: db's maintenance worker and
+// ditto_compact_now() look after its collections.
+DITTO_API int32_t ditto_collection_open_ex(ditto_db_t* db,
+                                           const char* name,
+                                           const ditto_options_t* opts,
+                                           ditto_coll_t** out_coll);
+
+// The collection as a store handle, for every other call: views, batches,
+// transactions, scans, TTLs, budgets, stats and the rest work on it as on
+// any store. Valid until db is closed; ditto_close() on it does nothing.
+DITTO_API ditto_db_t* ditto_collection_db(ditto_coll_t* coll);
+
+// ditto_put(), ditto_get(), ditto_delete(), ditto_subscribe(),
+// ditto_subscribe_key() and ditto_unsubscribe() on a collection. Its
+// subscribers only hear of its own keys.
+DITTO_API int32_t ditto_coll_put(ditto_coll_t* coll,
+                                 const char* key,
+                                 const uint8_t* data,
+                                 size_t len);
+DITTO_API int32_t ditto_coll_get(ditto_coll_t* coll,
+                                 const char* key,
+                                 uint8_t* out_buf,
+                                 size_t* inout_len);
+DITTO_API int32_t ditto_coll_delete(ditto_coll_t* coll, const char* key);
+DITTO_API int32_t ditto_coll_subscribe(ditto_coll_t* coll,
+                                       ditto_on_change_cb cb,
+                                       void* user_data,
+                                       int32_t* out_sub_id);
+DITTO_API int32_t ditto_coll_subscribe_key(ditto_coll_t* coll,
+                                           const char* key,
+                                           ditto_on_change_cb cb,
+                                           void* user_data,
+                                           int32_t* out_sub_id);
+DITTO_API int32_t ditto_coll_unsubscribe(ditto_coll_t* coll, int32_t sub_id);
+
+// Runtime statistics reported by ditto_get_stats(). Counters run from
+// ditto_open() and are never reset; times are in nanoseconds. Libraries built
+// with -DDITTO_STATS=OFF report zero for everything from `gets` on except
+// the table shape, which is measured by the call itself.
+typedef struct {
+    uint64_t payload_bytes;     // key and value bytes held in memory
+    uint64_t allocated_bytes;   // heap bytes reserved to hold them, tables included
+    uint64_t mapped_bytes;      // size of the memory-mapped snapshot, if any
+
+    // Operations, counted when attempted
+    uint64_t gets;              // point reads, including snapshot and transaction reads
+    uint64_t puts;              // including batched and transactional writes
+    uint64_t deletes;
+    uint64_t scans;             // cursors opened
+    uint64_t txn_commits;
+    uint64_t txn_conflicts;     // commits that returned 3
+
+    // Lock contention: acquisitions that had to wait, and the total wait
+    uint64_t shard_lock_contended;
+    uint64_t shard_lock_wait_ns;
+    uint64_t sub_lock_contended;
+    uint64_t sub_lock_wait_ns;
+
+    // Hash table shape: in-memory entries and how far past their home slot
+    // they sit (0 = found on the first probe)
+    uint64_t entries;
+    double avg_probe_distance;
+    uint64_t max_probe_distance;
+
+    // Change notifications. A batch is one delivery of changed keys to the
+    // matching subscriptions; callback time is spent inside those callbacks.
+    uint64_t notify_batches;
+    uint64_t notify_keys;
+    uint64_t callback_ns;
+    uint64_t max_callback_ns;
+
+    // Async notifications only: changes taken off the queue, their summed
+    // and worst wait from the write to their batch starting, and how many
+    // are queued now and at most so far
+    uint64_t dispatched;
+    uint64_t dispatch_latency_ns;
+    uint64_t max_dispatch_latency_ns;
+    uint64_t queue_depth;
+    uint64_t max_queue_depth;
+
+    uint64_t evictions;         // keys evicted for the memory budget
+    uint64_t expirations;       // keys deleted by ditto_put_ttl() expiry
+
+    // Values held compressed, their compressed bytes and their length
+    // uncompressed (table shape, see ditto_set_compression())
+    uint64_t compressed_values;
+    uint64_t compressed_bytes;
+    uint64_t uncompressed_bytes;
+
+    // Maintenance, ditto_compact_now() included: passes over every shard,
+    // background rounds skipped for foreground latency, log compactions and
+    // slab memory returned to the system
+    uint64_t maintenance_passes;
+    uint64_t maintenance_pauses;
+    uint64_t compactions;
+    uint64_t slab_bytes_released;
+} ditto_stats_t;
+
+// Fill *out_stats with current counters and memory usage. Shards are sampled
+// one at a time, so the totals are approximate while writes are in flight;
+// the table shape costs a pass over every slot. Counters are kept per shard
+// and per lock, so collecting them adds no shared writes to the hot path.
+// Pass sizeof(ditto_stats_t) as stats_size; at most that many bytes are
+// written, so callers built against an older header keep working.
+// Returns 0 on success, -1 on invalid arguments.
+DITTO_API int32_t ditto_get_stats(ditto_db_t* db,
+                                  ditto_stats_t* out_stats,
+                                  size_t stats_size);
+
+// Tracing, to see where a call's time goes: each call is recorded as a
+// span with nested spans for its phases (hashing, shard and subscription
+// lock waits, allocation, log appends, eviction, notification, subscriber
+// callbacks and commit), next to spans for the dispatcher, expiry and
+// maintenance threads. Only in builds with -DDITTO_TRACE=ON; otherwise the
+// spans are compiled out and these calls return -1. Tracing is process-wide,
+// covering every open store, and records into a lock-free ring per thread.
+//
+// Starts tracing, keeping the most recent `events_per_thread` spans of each
+// thread (0 for 16384). Restarting discards what was recorded.
+// Returns 0 on success, -1 if built without tracing or on invalid arguments.
+DITTO_API int32_t ditto_trace_start(size_t events_per_thread);
+
+// Stops recording; what was recorded can still be exported.
+// Returns 0, or -1 if built without tracing.
+DITTO_API int32_t ditto_trace_stop(void);
+
+// Copy the spans recorded since ditto_trace_start() into out_buf as Chrome
+// trace event JSON, which Perfetto and chrome://tracing load. Timestamps are
+// microseconds (to the nanosecond) on the monotonic clock Dart's Timeline
+// uses, and thread ids are the OS ones, so the spans line up with a Flutter
+// timeline of the same process. The JSON is not NUL-terminated. If *inout_len
+// is too small, sets *inout_len to the size needed and returns 1; stop
+// tracing first for that size to stay put.
+// Returns 0 on success, -1 if built without tracing or on error.
+DITTO_API int32_t ditto_trace_export(char* out_buf, size_t* inout_len);
+
 // Returns a null-terminated, static string (do not free).
 DITTO_API const char* ditto_version(void);
 
-// Thread-safety: ditto_db_t is safe to use from a single thread at a time.
-// Callbacks may be invoked from a background thread.
+// Thread-safety: ditto_db_t is fully thread-safe. Every function except
+// ditto_close() may be called concurrently from any number of threads on the
+// same handle; ditto_close() must not race with other calls on that handle
+// or on its collections.
+// Keys are spread over independently locked shards: writes only serialize
+// with operations on the same shard, and point reads (the get family and
+// ditto_multi_get()) take no lock. They are lock-free rather than wait-free:
+// a read retries while a resize republishes the shard's table, and yields
+// to a write rewriting the key's value in place.
+// Callbacks run on the writing thread and may be invoked concurrently when
+// several threads write at once; with async notifications enabled they run
+// only on the dispatcher thread, one at a time. Once ditto_unsubscribe()
+// returns, that subscription's callback is not invoked again.
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,7 @@
+// checksum.h - CRC32C used to validate on-disk records
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Extends `crc` (0 for a fresh checksum) with `len` bytes of `data`.
+uint32_t ditto_crc32c(uint32_t crc, const void* data, size_t len);
@@ -1,348 +1,6647 @@
 // ditto.c - Simple KV store implementation for Flutter FFI interview module
 #include "../include/ditto.h"
+#include "bytes.h"
+#include "checksum.h"
+#include "fileio.h"
+#include "hash.h"
+#include "lz.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "wal.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #define VERSION "1.0.0"
-#define MAX_SUBSCRIPTIONS 100
+
+// Runtime statistics (ditto_get_stats). Build with -DDITTO_ENABLE_STATS=0 to
+// compile the counters and lock timing out; the stats then read as zero.
+#ifndef DITTO_ENABLE_STATS
+#define DITTO_ENABLE_STATS 1
+#endif
 
 // ============================================================================
 // Internal Data Structures
 // ============================================================================
 
-// Simple hash table entry
-typedef struct kv_entry {
-    char* key;
-    uint8_t* data;
+// Stored value. Immutable once published and refcounted so ditto_get_view()
+// can lend it out: the entry holds one reference and every outstanding view
+// another, so an overwrite only drops the entry's reference. A writer that
+// holds the only reference may rewrite the value in place after claiming
+// it with VALUE_WRITING, which lock-free readers cannot take a reference
+// past. Values read from a snapshot point into its mapping and pin the
+// snapshot instead of owning the bytes. With compression on, large values
+// are kept as an LZ4 block: `len` stays the value's own length and data
+// starts with the block's u32 size. The header is kept to 24 bytes since
+// every value pays for it.
+struct ditto_view {
+    _Atomic uint32_t refs;
+    uint8_t size_class;         // slab class of this block
+    uint8_t mapped;             // data holds a pointer into owner's mapping
+    uint8_t compressed;         // data holds a block size and an LZ4 block
+    uint8_t block_shift;        // large block rounded up to 2^block_shift bytes, or 0
     size_t len;
-    struct kv_entry* next;
+    void* owner;                // slab_t*, or snapshot_t* when mapped
+    uint8_t data[];
+};
+typedef struct ditto_view kv_value_t;
+
+// Hash table entry; owned by exactly one slot of one slot array and also
+// linked into the shard's skiplist. The key and the skiplist forward
+// pointers are stored inline, so an entry is a single slab block. The table
+// is a delta over the shard's snapshot: an entry with no value marks a key
+// deleted since the snapshot was written.
+typedef struct kv_entry {
+    _Atomic(kv_value_t*) value; // NULL = deleted from the base
+    uint64_t seq;           // db write counter at the last change
+    uint32_t key_len;
+    uint8_t size_class;
+    uint8_t height;         // skiplist levels, forward pointers follow the key
+    _Atomic uint8_t referenced; // CLOCK bit: read or written since the last sweep
+    char key[];             // NUL-terminated
 } kv_entry_t;
 
-// Hash table
-#define HASH_SIZE 256
+// Open-addressing slot. The full hash is kept next to the entry pointer so
+// probes only touch the entry (and compare the key) on a likely match. Both
+// are atomic as lock-free readers probe while a writer fills the slot; the
+// hash is stored first.
+typedef struct {
+    _Atomic uint64_t hash;
+    _Atomic(kv_entry_t*) entry; // NULL = empty, SLOT_TOMBSTONE = deleted
+} kv_slot_t;
+
+static kv_entry_t tombstone_sentinel;
+#define SLOT_TOMBSTONE (&tombstone_sentinel)
+
+// State a key had before a change, kept while a read snapshot may need it.
+// Versions live in a shard-wide list ordered by `end` and in a chained hash
+// map by key, each chain newest first.
+typedef struct kv_version {
+    struct kv_version* chain;   // older version in the same bucket
+    struct kv_version* next;    // next version to expire, by end seq
+    kv_value_t* value;          // the replaced value, NULL = key was absent
+    uint64_t end;               // seq of the change that replaced it
+    uint64_t hash;
+    uint32_t key_len;
+    char key[];
+} kv_version_t;
+
+typedef struct {
+    kv_version_t** buckets;     // power-of-two count, NULL until first use
+    size_t bucket_count;
+    size_t count;
+    kv_version_t* oldest;       // expiry list, oldest `end` first
+    kv_version_t* newest;
+} version_map_t;
+
+// Expiry of a key written with ditto_put_ttl(). Timers are filed by key, so
+// writing the key again can cancel its timer, and in the shard's wheel.
+typedef struct ttl_timer {
+    struct ttl_timer* chain;    // next timer in the same key bucket
+    struct ttl_timer* prev;     // neighbours in the wheel slot
+    struct ttl_timer* next;
+    uint64_t expires_ms;        // wall-clock time, as logged
+    uint64_t hash;
+    uint32_t key_len;
+    uint8_t level;              // wheel slot holding the timer
+    uint8_t slot;
+    char key[];
+} ttl_timer_t;
+
+// Hierarchical timer wheel: level 0 has a slot per tick and each level above
+// a slot per turn of the one below. A level's slot is cascaded into the
+// levels below when they wrap around to it, so arming and cancelling are
+// O(1) and a tick only visits the timers due in it.
+#define TTL_TICK_MS 10
+#define TTL_WHEEL_BITS 6
+#define TTL_WHEEL_SLOTS (1u << TTL_WHEEL_BITS)
+#define TTL_WHEEL_LEVELS 4      // 2^24 ticks, about 46 hours, then re-filed
+typedef struct {
+    ttl_timer_t** buckets;      // by key hash, power-of-two count, NULL until first use
+    size_t bucket_count;
+    _Atomic size_t count;       // changed under the shard's write lock
+    uint64_t current;           // next tick to process
+    ttl_timer_t* slots[TTL_WHEEL_LEVELS][TTL_WHEEL_SLOTS];
+} ttl_wheel_t;
+
+// A shard's recent changes in seq order, for ditto_changes_since(). Records
+// and key bytes are both bounded rings; making room drops the oldest
+// records and raises `floor` to the newest seq no longer held. Changed
+// under the shard's write lock, read under its read lock.
+typedef struct {
+    uint64_t seq;
+    uint64_t key_pos;           // offset into the key area, unmasked
+    uint32_t key_len;
+    uint32_t op;                // DITTO_OP_*
+} journal_record_t;
+
+typedef struct {
+    journal_record_t* records;  // power-of-two count, NULL when disabled
+    char* keys;                 // power-of-two key area
+    size_t record_mask;
+    size_t key_mask;
+    uint64_t head, tail;        // records [head, tail) are held
+    uint64_t key_head, key_tail;
+    uint64_t floor;             // changes up to this seq may be gone
+} change_journal_t;
+
+// Flat, power-of-two sized slot array probed linearly. The allocation
+// starts one slot early: slots[-1].hash holds the capacity, so a reader that
+// only has the published pointer can bound its probe.
+typedef struct {
+    kv_slot_t* slots;
+    size_t capacity;
+    size_t used;            // live entries + tombstones
+} slot_array_t;
+
+// Epoch-based reclamation for the shard's lock-free readers. A reader counts
+// itself into the side of the epoch it entered in; memory a writer unlinks
+// is retired to the current epoch's list and freed two epochs later, once
+// every reader that might still hold it has left. The epoch only advances
+// when no reader remains on the side the next epoch reuses. Lists are
+// changed under the shard's write lock.
+#define RETIRE_ENTRY    0       // kv_entry_t*, freed with its value
+#define RETIRE_VALUE    1       // kv_value_t*, the entry's reference dropped
+#define RETIRE_SLOTS    2       // kv_slot_t* of a replaced slot array
+#define RETIRE_SNAPSHOT 3       // snapshot_t*, the shard's reference dropped
+#define RETIRE_MOVED    4       // kv_entry_t* copied elsewhere, value kept
+typedef struct {
+    void* ptr;
+    int kind;                   // RETIRE_*
+} retired_t;
+
+typedef struct {
+    retired_t* items;
+    size_t count;
+    size_t capacity;
+} retire_list_t;
+
+typedef struct {
+    _Atomic uint64_t epoch;
+    retire_list_t retired[2];   // by epoch parity
+    _Alignas(64) _Atomic size_t readers[2];
+} reclaim_t;
+
+// Acquisitions of one lock that found it held, and the time spent waiting
+typedef struct {
+    _Atomic uint64_t contended;
+    _Atomic uint64_t wait_ns;
+} lock_stats_t;
+
+// Operation counters of one shard. They share the cache line of the shard's
+// lock, which every operation on the shard writes anyway.
+typedef struct {
+    _Atomic uint64_t gets;
+    _Atomic uint64_t puts;
+    _Atomic uint64_t deletes;
+    _Atomic uint64_t evictions;
+    _Atomic uint64_t expirations;
+    lock_stats_t lock;
+} shard_stats_t;
+
+// Hash table for one shard, layered over the snapshot it reads through to.
+// Growing allocates a new `active` array and keeps the old one as
+// `draining`; every write then migrates a few slots until it is empty, so
+// no single operation pays for a full rehash. Writers take the lock; point
+// reads take none and instead probe the arrays published in read_active
+// and read_draining inside a reclaim_t read section. `layout` is a seqlock
+// over the pair: odd while they are being republished, so a reader never
+// trusts a miss from a mix of old and new arrays.
+#define HASH_MIN_CAPACITY 16
+#define HASH_MAX_LOAD_NUM 3     // resize once used > capacity * 3/4
+#define HASH_MAX_LOAD_DEN 4
+#define HASH_MIGRATE_STEP 64    // draining slots visited per write
+#define SKIP_MAX_HEIGHT 12      // skiplist levels, p = 1/4 per level
 typedef struct {
-    kv_entry_t* buckets[HASH_SIZE];
-    pthread_mutex_t lock;
+    slot_array_t active;
+    slot_array_t draining;      // slots == NULL when no resize is running
+    size_t migrate_pos;
+    size_t min_capacity;        // sized at open, never shrunk below
+    size_t count;               // live entries across both arrays
+    _Atomic(kv_slot_t*) read_active;    // copies of the slot pointers above
+    _Atomic(kv_slot_t*) read_draining;
+    _Atomic uint64_t layout;    // odd while either is being republished
+    _Atomic(snapshot_t*) base;  // NULL when there is no snapshot
+    slab_t* slab;               // entries and values; allocs under the write lock
+    size_t payload_bytes;       // key and value bytes held by entries
+    int compacting;             // a compaction has copied this shard's delta
+    uint64_t base_seq;          // collection point of `base`, see table_version()
+    kv_entry_t* skip_head[SKIP_MAX_HEIGHT];  // entries in key order
+    uint32_t skip_rng;          // xorshift state for tower heights
+    version_map_t versions;     // replaced states open snapshots may read
+    size_t clock_hand;          // next slot the eviction sweep visits
+    ttl_wheel_t ttl;            // keys written with a time to live
+    change_journal_t journal;   // recent changes, by seq
+    _Atomic size_t compress_min;    // compress values this long, 0 = off
+    uint8_t* pack_buf;          // compressor output, grown under the write lock
+    size_t pack_cap;
+    reclaim_t reclaim;          // memory lock-free readers may still hold
+    size_t repack_pos;          // next slot hash_table_evacuate() visits
+    size_t evacuating;          // slab chunks the last repack left marked
+    _Alignas(64) pthread_rwlock_t lock;   // readers share, writers exclusive
+    shard_stats_t stats;
 } hash_table_t;
 
-// Subscription entry
+// The key space is split into independently locked shards chosen by hash,
+// so operations on unrelated keys do not contend.
+// ditto_options_t can pick any power of two up to DITTO_MAX_SHARDS.
+#define DITTO_SHARD_COUNT 16    // default
+#define DITTO_MAX_SHARDS 32     // scan shard masks are 32 bits
+
+// Subscription entry; exactly one of the two callbacks is set
+#define SUB_MATCH_ALL    0
+#define SUB_MATCH_KEY    1
+#define SUB_MATCH_PREFIX 2
+#define SUB_MATCH_EVICTED 3     // evictions only, see ditto_subscribe_evictions()
 typedef struct {
     int32_t id;
+    int match;                  // SUB_MATCH_*
+    char* pattern;              // key or prefix, NULL for SUB_MATCH_ALL
+    size_t pattern_len;
     ditto_on_change_cb callback;
+    ditto_on_changes_cb batch_callback;
     void* user_data;
-    int active;
 } subscription_t;
 
+typedef struct {
+    subscription_t** items;
+    size_t count;
+    size_t capacity;
+} sub_list_t;
+
+// Subscriptions sharing one key or prefix, chained in a sub_map_t bucket
+typedef struct sub_group {
+    struct sub_group* next;
+    uint32_t hash;
+    char* pattern;              // borrowed from the first subscription
+    size_t pattern_len;
+    sub_list_t subs;
+} sub_group_t;
+
+typedef struct {
+    sub_group_t** buckets;      // power-of-two count, NULL until first use
+    size_t capacity;
+    size_t count;
+} sub_map_t;
+
+// Every subscription, indexed so a change only visits the ones it matches:
+// exact keys by hash, prefixes by hash per distinct prefix length.
+typedef struct {
+    sub_list_t everything;      // all subscriptions, for lookup by id
+    sub_list_t all_keys;        // SUB_MATCH_ALL
+    sub_map_t keys;             // SUB_MATCH_KEY
+    sub_map_t prefixes;         // SUB_MATCH_PREFIX
+    sub_list_t evicted;         // SUB_MATCH_EVICTED
+    size_t* prefix_lens;        // distinct prefix lengths, ascending
+    size_t* prefix_len_refs;    // subscriptions using each length
+    size_t n_prefix_lens;
+} sub_registry_t;
+
+// Bounded lock-free MPSC ring of changed keys (Vyukov-style: each cell's
+// sequence number says whether it is free for producers or ready for the
+// dispatcher). Keys are heap copies owned by the queue until dispatched.
+#define DISPATCH_BATCH_MAX 1024
+typedef struct {
+    _Atomic size_t seq;
+    char* key;
+    uint64_t enqueued_ns;       // for dispatch latency, 0 without stats
+    int evicted;                // removed by eviction rather than a write
+} change_cell_t;
+
+typedef struct ditto_db ditto_db_t;
+typedef struct {
+    ditto_db_t* db;
+    change_cell_t* cells;
+    size_t mask;
+    _Alignas(64) _Atomic size_t enqueue_pos;
+    _Alignas(64) size_t dequeue_pos;    // dispatcher thread only
+    _Atomic int sleeping;               // dispatcher is (about to be) parked
+    _Atomic int stopping;
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    // Written by the dispatcher thread only, read by ditto_get_stats()
+    _Atomic uint64_t dispatched;        // changes dequeued
+    _Atomic uint64_t latency_ns;        // enqueue-to-delivery, summed
+    _Atomic uint64_t max_latency_ns;
+    _Atomic uint64_t max_depth;
+} dispatcher_t;
+
+// Interned key: its bytes, their hash and the last slot it was found in
+struct ditto_key {
+    ditto_db_t* db;
+    uint64_t hash;
+    size_t len;
+    _Atomic size_t slot_hint;   // active-array index, SIZE_MAX = unknown
+    char key[];                 // NUL-terminated
+};
+
+// Point-in-time read view. Open views are listed in the order they were
+// opened, which is also ascending `seq` order.
+struct ditto_snapshot {
+    ditto_db_t* db;
+    uint64_t seq;               // sees every change numbered <= seq
+    struct ditto_snapshot* prev;
+    struct ditto_snapshot* next;
+};
+
+// A key a transaction read or wrote. Reads remember the version they saw;
+// writes hold a private copy of the new value.
+typedef struct {
+    char* key;                  // NUL-terminated copy
+    size_t key_len;
+    uint64_t hash;
+    uint64_t version;           // reads only, see table_version()
+    uint8_t* value;             // writes only, NULL for a delete
+    size_t value_len;
+} txn_key_t;
+
+typedef struct {
+    txn_key_t* items;
+    size_t count;
+    size_t capacity;
+} txn_set_t;
+
+// Optimistic transaction: buffers writes and validates reads at commit
+struct ditto_txn {
+    ditto_db_t* db;
+    txn_set_t reads;
+    txn_set_t writes;           // one item per key, in first-write order
+};
+
 // Database structure
 struct ditto_db {
-    hash_table_t* table;
-    subscription_t subscriptions[MAX_SUBSCRIPTIONS];
+    hash_table_t* shards;
+    size_t shard_count;
+    sub_registry_t subs;
     int32_t next_sub_id;
-    pthread_mutex_t sub_lock;
+    pthread_rwlock_t sub_lock;  // notifiers share, (un)subscribe exclusive
+    lock_stats_t sub_lock_stats;
+    _Atomic size_t sub_count;   // lets writes skip notifying when zero
+    _Atomic uint64_t notify_batches;    // deliveries, under sub_lock
+    _Atomic uint64_t notify_keys;
+    _Atomic uint64_t callback_ns;       // time spent delivering, summed
+    _Atomic uint64_t max_callback_ns;
+    _Atomic(dispatcher_t*) dispatcher;  // NULL = callbacks run inline
+    pthread_mutex_t ring_lock;  // serializes publishing to the change ring
+    _Atomic(ditto_change_ring_t*) ring; // set and cleared under ring_lock
+    wal_t* wal;                 // NULL for in-memory databases
+    char* path;                 // store directory, NULL for in-memory
+    ditto_db_t* owner;          // store this is a collection of, else NULL
+    pthread_mutex_t coll_lock;  // serializes opening collections
+    _Atomic(ditto_coll_t*) colls;   // newest first, see ditto_collection_open()
+    _Atomic uint64_t write_seq; // bumped under the shard lock by every change
+    uint64_t incarnation;       // random per open; write_seq restarts with it
+    pthread_mutex_t compact_lock;   // one compaction at a time
+    pthread_mutex_t maint_lock;
+    pthread_cond_t maint_wake;
+    pthread_t maint;            // background maintenance, see maint_main()
+    int maint_running;
+    _Atomic int maint_stopping; // set under maint_lock
+    uint32_t maint_interval_ms;
+    uint32_t maint_cpu_percent;
+    uint32_t maint_pause_wait_us;
+    uint64_t maint_io_rate;
+    uint64_t compact_log_bytes;
+    uint64_t hash_seed;         // fixed for the store's lifetime, see hash_key()
+    _Atomic uint64_t shard_budget;  // payload bytes per shard, 0 = unbounded
+    pthread_mutex_t expirer_lock;
+    pthread_cond_t expirer_wake;
+    pthread_t expirer;          // started by the first timer armed
+    int expirer_running;        // guarded by expirer_lock
+    int expirer_stopping;
+    _Atomic int expirer_started;    // set once, read without the lock
+    _Atomic int expirer_idle;   // parked until a timer is armed
+    pthread_mutex_t view_lock;  // guards the list of open read snapshots
+    ditto_snapshot_t* views_head;
+    ditto_snapshot_t* views_tail;
+    _Atomic uint64_t view_oldest;   // seq of the oldest view, UINT64_MAX if none
+    _Atomic uint64_t scans;             // cursors opened
+    _Atomic uint64_t txn_commits;
+    _Atomic uint64_t txn_conflicts;
+    _Atomic uint64_t maint_rounds;
+    _Atomic uint64_t maint_pauses;
+    _Atomic uint64_t compactions;
+    _Atomic uint64_t slab_released;     // chunk bytes returned by repacking
+};
+
+// A named collection: a store of its own, maintained and closed with its
+// owner. Published once opened and never unlinked before the owner closes,
+// so the list is walked without coll_lock.
+struct ditto_coll {
+    ditto_coll_t* next;
+    ditto_db_t* db;
+    char name[];
 };
 
 // ============================================================================
-// Hash Table Implementation
+// Statistics
 // ============================================================================
 
-static uint32_t hash_string(const char* str) {
-    uint32_t hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+// Hot-path counters are relaxed atomics kept where the data they describe
+// already lives (a shard, the subscription lock, the dispatcher) rather than
+// in one place every thread would write; rarer events are counted per store.
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#if DITTO_ENABLE_STATS
+#define STAT_ADD(counter, n) \
+    atomic_fetch_add_explicit(&(counter), (n), memory_order_relaxed)
+#define STAT_NOW() monotonic_ns()
+
+static void stat_max(_Atomic uint64_t* counter, uint64_t value) {
+    uint64_t seen = atomic_load_explicit(counter, memory_order_relaxed);
+    while (seen < value &&
+           !atomic_compare_exchange_weak_explicit(counter, &seen, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+#else
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_NOW() ((uint64_t)0)
+#endif
+
+static uint64_t stat_load(_Atomic uint64_t* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// Lock wrappers that only read the clock when the lock is already held, so
+// uncontended acquisitions cost one extra branch.
+static void rwlock_rdlock_counted(pthread_rwlock_t* lock, lock_stats_t* stats) {
+#if DITTO_ENABLE_STATS
+    if (pthread_rwlock_tryrdlock(lock) == 0) {
+        return;
+    }
+    uint64_t start = monotonic_ns();
+    pthread_rwlock_rdlock(lock);
+    STAT_ADD(stats->contended, 1);
+    STAT_ADD(stats->wait_ns, monotonic_ns() - start);
+#else
+    (void)stats;
+    pthread_rwlock_rdlock(lock);
+#endif
+}
+
+static void rwlock_wrlock_counted(pthread_rwlock_t* lock, lock_stats_t* stats) {
+#if DITTO_ENABLE_STATS
+    if (pthread_rwlock_trywrlock(lock) == 0) {
+        return;
     }
-    return hash % HASH_SIZE;
+    uint64_t start = monotonic_ns();
+    pthread_rwlock_wrlock(lock);
+    STAT_ADD(stats->contended, 1);
+    STAT_ADD(stats->wait_ns, monotonic_ns() - start);
+#else
+    (void)stats;
+    pthread_rwlock_wrlock(lock);
+#endif
 }
 
-static hash_table_t* hash_table_create(void) {
-    hash_table_t* table = (hash_table_t*)calloc(1, sizeof(hash_table_t));
-    if (!table) return NULL;
+static void shard_rdlock(hash_table_t* table) {
+    TRACE_BEGIN(span);
+    rwlock_rdlock_counted(&table->lock, &table->stats.lock);
+    TRACE_END(span, TRACE_LOCK_WAIT);
+}
 
-    pthread_mutex_init(&table->lock, NULL);
-    return table;
+static void shard_wrlock(hash_table_t* table) {
+    TRACE_BEGIN(span);
+    rwlock_wrlock_counted(&table->lock, &table->stats.lock);
+    TRACE_END(span, TRACE_LOCK_WAIT);
 }
 
-static void hash_table_destroy(hash_table_t* table) {
-    if (!table) return;
+static void sub_rdlock(ditto_db_t* db) {
+    TRACE_BEGIN(span);
+    rwlock_rdlock_counted(&db->sub_lock, &db->sub_lock_stats);
+    TRACE_END(span, TRACE_LOCK_WAIT);
+}
 
-    for (int i = 0; i < HASH_SIZE; i++) {
-        kv_entry_t* entry = table->buckets[i];
-        while (entry) {
-            kv_entry_t* next = entry->next;
-            free(entry->key);
-            free(entry->data);
-            free(entry);
-            entry = next;
-        }
+static void sub_wrlock(ditto_db_t* db) {
+    TRACE_BEGIN(span);
+    rwlock_wrlock_counted(&db->sub_lock, &db->sub_lock_stats);
+    TRACE_END(span, TRACE_LOCK_WAIT);
+}
+
+// ============================================================================
+// Hash Table Implementation
+// ============================================================================
+
+// Keys are hashed under a per-store seed so that colliding keys cannot be
+// precomputed (e.g. by a sync peer) to pile into one probe sequence.
+static uint64_t hash_key(const ditto_db_t* db, const char* key, size_t len) {
+    TRACE_BEGIN(span);
+    uint64_t hash = ditto_hash64(key, len, db->hash_seed);
+    TRACE_END(span, TRACE_HASH);
+    return hash;
+}
+
+// Allocates a value from the shard's slab; the caller holds its write lock.
+static kv_value_t* value_create(slab_t* slab, const uint8_t* data, size_t len) {
+    uint8_t size_class;
+    kv_value_t* value = (kv_value_t*)slab_alloc(slab, sizeof(kv_value_t) + len,
+                                                &size_class);
+    if (!value) return NULL;
+    atomic_init(&value->refs, 1);
+    value->size_class = size_class;
+    value->mapped = 0;
+    value->compressed = 0;
+    value->block_shift = 0;
+    value->len = len;
+    value->owner = slab;
+    memcpy(value->data, data, len);
+    return value;
+}
+
+#define VALUE_PACK_HEADER 4     // u32 size of the LZ4 block
+
+// Bytes a slab value's data[] occupies, which is what it costs in memory.
+static size_t value_stored_len(const kv_value_t* value) {
+    if (value->compressed) {
+        return VALUE_PACK_HEADER + get_u32(value->data);
     }
+    return value->len;
+}
 
-    pthread_mutex_destroy(&table->lock);
-    free(table);
+// Whether a value of `len` bytes should be tried compressed in this shard.
+static int value_wants_packing(hash_table_t* table, size_t len) {
+    size_t min = atomic_load_explicit(&table->compress_min, memory_order_relaxed);
+    return min > 0 && len >= min && len <= UINT32_MAX;
 }
 
-static int32_t hash_table_put(hash_table_t* table, const char* key,
-                              const uint8_t* data, size_t len) {
-    pthread_mutex_lock(&table->lock);
+// Allocates a compressed value, or returns NULL if the bytes shrink by less
+// than an eighth (or memory runs out) so the caller stores them as is. The
+// caller holds the shard's write lock, which also guards pack_buf.
+static kv_value_t* value_create_packed(hash_table_t* table, const uint8_t* data,
+                                       size_t len) {
+    size_t cap = len - len / 8;
+    if (table->pack_cap < cap) {
+        uint8_t* buf = (uint8_t*)realloc(table->pack_buf, cap);
+        if (!buf) return NULL;
+        table->pack_buf = buf;
+        table->pack_cap = cap;
+    }
+    size_t packed = ditto_lz_compress(data, len, table->pack_buf, cap);
+    if (packed == 0) return NULL;
 
-    uint32_t idx = hash_string(key);
-    kv_entry_t* entry = table->buckets[idx];
+    uint8_t size_class;
+    kv_value_t* value = (kv_value_t*)slab_alloc(
+        table->slab, sizeof(kv_value_t) + VALUE_PACK_HEADER + packed, &size_class);
+    if (!value) return NULL;
+    atomic_init(&value->refs, 1);
+    value->size_class = size_class;
+    value->mapped = 0;
+    value->compressed = 1;
+    value->block_shift = 0;
+    value->len = len;
+    value->owner = table->slab;
+    put_u32(value->data, (uint32_t)packed);
+    memcpy(value->data + VALUE_PACK_HEADER, table->pack_buf, packed);
+    return value;
+}
 
-    // Check if key exists
-    while (entry) {
-        if (strcmp(entry->key, key) == 0) {
-            // Update existing entry
-            uint8_t* new_data = (uint8_t*)malloc(len);
-            if (!new_data) {
-                pthread_mutex_unlock(&table->lock);
-                return -1;
-            }
-            memcpy(new_data, data, len);
-            free(entry->data);
-            entry->data = new_data;
-            entry->len = len;
-            pthread_mutex_unlock(&table->lock);
-            return 0;
-        }
-        entry = entry->next;
+// Allocates the value for a write into the shard, compressed if enabled and
+// worth it. The caller holds the shard's write lock.
+static kv_value_t* value_create_for(hash_table_t* table, const uint8_t* data,
+                                    size_t len) {
+    TRACE_BEGIN(span);
+    kv_value_t* value = NULL;
+    if (value_wants_packing(table, len)) {
+        value = value_create_packed(table, data, len);
     }
+    if (!value) {
+        value = value_create(table->slab, data, len);
+    }
+    TRACE_END(span, TRACE_ALLOC);
+    return value;
+}
 
-    // Create new entry
-    entry = (kv_entry_t*)calloc(1, sizeof(kv_entry_t));
-    if (!entry) {
-        pthread_mutex_unlock(&table->lock);
-        return -1;
+// Expands a compressed value into `dst`, which has room for value->len bytes.
+static int32_t value_unpack(const kv_value_t* value, uint8_t* dst) {
+    return ditto_lz_decompress(value->data + VALUE_PACK_HEADER,
+                               get_u32(value->data), dst, value->len);
+}
+
+// An uncompressed copy of a compressed value, for callers that need its
+// bytes in place. Safe without the shard lock: large blocks bypass the
+// slab's free lists.
+static kv_value_t* value_create_unpacked(const kv_value_t* packed) {
+    slab_t* slab = (slab_t*)packed->owner;
+    kv_value_t* value = (kv_value_t*)slab_alloc_large(slab,
+                                                      sizeof(kv_value_t) + packed->len);
+    if (!value) return NULL;
+    atomic_init(&value->refs, 1);
+    value->size_class = SLAB_CLASS_NONE;
+    value->mapped = 0;
+    value->compressed = 0;
+    value->block_shift = 0;
+    value->len = packed->len;
+    value->owner = slab;
+    if (value_unpack(packed, value->data) != 0) {
+        slab_free(slab, value, SLAB_CLASS_NONE, sizeof(kv_value_t) + value->len);
+        return NULL;
     }
+    return value;
+}
 
-    entry->key = strdup(key);
-    entry->data = (uint8_t*)malloc(len);
-    if (!entry->key || !entry->data) {
-        free(entry->key);
-        free(entry->data);
-        free(entry);
-        pthread_mutex_unlock(&table->lock);
-        return -1;
+static const uint8_t* value_bytes(const kv_value_t* value) {
+    if (value->mapped) {
+        const uint8_t* bytes;
+        memcpy(&bytes, value->data, sizeof(bytes));
+        return bytes;
     }
+    return value->data;
+}
 
-    memcpy(entry->data, data, len);
-    entry->len = len;
-    entry->next = table->buckets[idx];
-    table->buckets[idx] = entry;
+// Size of a slab value's block as allocated.
+static size_t value_block_size(const kv_value_t* value) {
+    if (value->block_shift) {
+        return (size_t)1 << value->block_shift;
+    }
+    return sizeof(kv_value_t) + value_stored_len(value);
+}
 
-    pthread_mutex_unlock(&table->lock);
-    return 0;
+// Bytes a value's block can hold when rewritten in place, 0 if it cannot
+// be: a large block sized exactly to its bytes must keep that size, as it
+// is freed by it.
+static size_t value_capacity(const kv_value_t* value) {
+    if (value->mapped) {
+        return 0;
+    }
+    if (value->size_class != SLAB_CLASS_NONE) {
+        return slab_class_size(value->size_class) - sizeof(kv_value_t);
+    }
+    return value->block_shift ? value_block_size(value) - sizeof(kv_value_t) : 0;
 }
 
-static int32_t hash_table_get(hash_table_t* table, const char* key,
-                              uint8_t* out_buf, size_t* inout_len) {
-    pthread_mutex_lock(&table->lock);
+#define VALUE_WRITING (1u << 31)   // in refs: being rewritten in place
 
-    uint32_t idx = hash_string(key);
-    kv_entry_t* entry = table->buckets[idx];
+static size_t shard_readers(hash_table_t* table);
 
-    while (entry) {
-        if (strcmp(entry->key, key) == 0) {
-            // Found the key
-            if (out_buf == NULL) {
-                // Query size
-                *inout_len = entry->len;
-                pthread_mutex_unlock(&table->lock);
-                return 1; // Buffer too small
-            }
+// Claims a value for an in-place rewrite if nothing but its entry references
+// it and no lock-free reader is in the shard; until value_unclaim(), readers
+// neither take a reference nor copy it. Readers count themselves in before
+// checking the flag and the claim checks the count after setting it, so one
+// of the two always sees the other. So while any reader is in the shard,
+// whatever key it reads, overwrites and range writes allocate a new block
+// instead of reusing the old one. The caller holds the shard's write lock.
+static int value_claim(hash_table_t* table, kv_value_t* value) {
+    uint32_t refs = 1;
+    if (!atomic_compare_exchange_strong(&value->refs, &refs, 1 | VALUE_WRITING)) {
+        return 0;
+    }
+    if (shard_readers(table) != 0) {
+        atomic_store_explicit(&value->refs, 1, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
 
-            if (*inout_len < entry->len) {
-                // Buffer too small
-                *inout_len = entry->len;
-                pthread_mutex_unlock(&table->lock);
-                return 1;
-            }
+static void value_unclaim(kv_value_t* value) {
+    atomic_store_explicit(&value->refs, 1, memory_order_release);
+}
 
-            // Copy data
-            memcpy(out_buf, entry->data, entry->len);
-            *inout_len = entry->len;
-            pthread_mutex_unlock(&table->lock);
-            return 0;
+// Overwrites a value in place when nothing else references it and the new
+// bytes fit its block. The caller holds the shard's write lock.
+static int value_try_reuse(hash_table_t* table, kv_value_t* value,
+                           const uint8_t* data, size_t len) {
+    size_t capacity = value_capacity(value);
+    if (capacity == 0 || capacity < len || !value_claim(table, value)) {
+        return 0;
+    }
+    memcpy(value->data, data, len);
+    value->compressed = 0;
+    value->len = len;
+    value_unclaim(value);
+    return 1;
+}
+
+// Wraps bytes inside a snapshot's mapping without copying them.
+static kv_value_t* value_create_mapped(snapshot_t* snap, const uint8_t* data,
+                                       size_t len) {
+    kv_value_t* value = (kv_value_t*)malloc(sizeof(kv_value_t) + sizeof(data));
+    if (!value) return NULL;
+    atomic_init(&value->refs, 1);
+    value->size_class = SLAB_CLASS_NONE;
+    value->mapped = 1;
+    value->compressed = 0;
+    value->block_shift = 0;
+    value->len = len;
+    value->owner = snap;
+    memcpy(value->data, &data, sizeof(data));
+    snapshot_retain(snap);
+    return value;
+}
+
+static void value_retain(kv_value_t* value) {
+    atomic_fetch_add_explicit(&value->refs, 1, memory_order_relaxed);
+}
+
+// Takes a reference without the shard lock. Fails while a writer rewrites
+// the value in place, or once its last reference is gone; the caller's read
+// section keeps the block itself from being freed meanwhile.
+static int value_try_retain(kv_value_t* value) {
+    uint32_t refs = atomic_load_explicit(&value->refs, memory_order_relaxed);
+    do {
+        if (refs == 0 || (refs & VALUE_WRITING)) return 0;
+    } while (!atomic_compare_exchange_weak_explicit(&value->refs, &refs, refs + 1,
+                                                    memory_order_acquire,
+                                                    memory_order_relaxed));
+    return 1;
+}
+
+static void value_release(kv_value_t* value) {
+    if (atomic_fetch_sub_explicit(&value->refs, 1, memory_order_acq_rel) == 1) {
+        if (value->mapped) {
+            snapshot_release((snapshot_t*)value->owner);
+            free(value);
+        } else {
+            slab_free((slab_t*)value->owner, value, value->size_class,
+                      value_block_size(value));
         }
-        entry = entry->next;
     }
+}
+
+// An entry block is the header, the key and its NUL, then `height`
+// pointer-aligned forward pointers.
+static size_t entry_tower_offset(size_t key_len) {
+    size_t off = sizeof(kv_entry_t) + key_len + 1;
+    return (off + sizeof(kv_entry_t*) - 1) & ~(sizeof(kv_entry_t*) - 1);
+}
+
+static size_t entry_block_size(size_t key_len, uint8_t height) {
+    return entry_tower_offset(key_len) + height * sizeof(kv_entry_t*);
+}
+
+static kv_entry_t** entry_next(kv_entry_t* entry) {
+    return (kv_entry_t**)((char*)entry + entry_tower_offset(entry->key_len));
+}
+
+// Frees the entry's block only; its value, if any, is referenced elsewhere.
+static void entry_block_free(slab_t* slab, kv_entry_t* entry) {
+    slab_free(slab, entry, entry->size_class,
+              entry_block_size(entry->key_len, entry->height));
+}
+
+static void entry_free(slab_t* slab, kv_entry_t* entry) {
+    if (entry->value) {
+        value_release(entry->value);
+    }
+    entry_block_free(slab, entry);
+}
 
-    pthread_mutex_unlock(&table->lock);
-    return 2; // Key not found
+// Bytes of key and value an entry holds, for the payload statistic.
+// Compressed values count at their compressed size.
+static size_t entry_payload(const kv_entry_t* entry) {
+    return entry->key_len + (entry->value ? value_stored_len(entry->value) : 0);
 }
 
-static int32_t hash_table_delete(hash_table_t* table, const char* key) {
-    pthread_mutex_lock(&table->lock);
+static int slot_array_init(slot_array_t* arr, size_t capacity) {
+    kv_slot_t* block = (kv_slot_t*)calloc(capacity + 1, sizeof(kv_slot_t));
+    if (!block) return -1;
+    atomic_init(&block[0].hash, capacity);
+    arr->slots = block + 1;
+    arr->capacity = capacity;
+    arr->used = 0;
+    return 0;
+}
 
-    uint32_t idx = hash_string(key);
-    kv_entry_t* entry = table->buckets[idx];
-    kv_entry_t* prev = NULL;
+static void slot_block_free(kv_slot_t* slots) {
+    if (slots) {
+        free(slots - 1);
+    }
+}
 
-    while (entry) {
-        if (strcmp(entry->key, key) == 0) {
-            // Found the key
-            if (prev) {
-                prev->next = entry->next;
-            } else {
-                table->buckets[idx] = entry->next;
-            }
+// Returns the slot holding `key`, or NULL if the array does not contain it.
+static kv_slot_t* slot_array_find(const slot_array_t* arr, const char* key,
+                                  size_t key_len, uint64_t hash) {
+    if (!arr->slots) return NULL;
 
-            free(entry->key);
-            free(entry->data);
-            free(entry);
-            pthread_mutex_unlock(&table->lock);
-            return 0;
+    size_t mask = arr->capacity - 1;
+    size_t idx = hash & mask;
+    for (;;) {
+        kv_slot_t* slot = &arr->slots[idx];
+        kv_entry_t* entry = slot->entry;
+        if (entry == NULL) {
+            return NULL;
         }
-        prev = entry;
-        entry = entry->next;
+        if (entry != SLOT_TOMBSTONE && slot->hash == hash &&
+            entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+            return slot;
+        }
+        idx = (idx + 1) & mask;
     }
+}
 
-    pthread_mutex_unlock(&table->lock);
-    return 2; // Key not found
+// Sums how far each live entry sits from its home slot, for ditto_get_stats()
+static void slot_array_probe_stats(const slot_array_t* arr, uint64_t* total,
+                                   uint64_t* max, uint64_t* live) {
+    if (!arr->slots) return;
+
+    size_t mask = arr->capacity - 1;
+    for (size_t i = 0; i < arr->capacity; i++) {
+        const kv_slot_t* slot = &arr->slots[i];
+        if (slot->entry == NULL || slot->entry == SLOT_TOMBSTONE) continue;
+        uint64_t distance = (i - (slot->hash & mask)) & mask;
+        *total += distance;
+        if (distance > *max) *max = distance;
+        (*live)++;
+    }
 }
 
-// ============================================================================
-// Subscription Management
-// ============================================================================
+// Counts the compressed values in the array and their sizes.
+static void slot_array_packed_stats(const slot_array_t* arr, uint64_t* values,
+                                    uint64_t* packed, uint64_t* unpacked) {
+    for (size_t i = 0; arr->slots && i < arr->capacity; i++) {
+        const kv_entry_t* entry = arr->slots[i].entry;
+        if (entry == NULL || entry == SLOT_TOMBSTONE || !entry->value ||
+            !entry->value->compressed) {
+            continue;
+        }
+        (*values)++;
+        *packed += value_stored_len(entry->value);
+        *unpacked += entry->value->len;
+    }
+}
 
-static void notify_subscribers(ditto_db_t* db, const char* key) {
-    pthread_mutex_lock(&db->sub_lock);
+// Places an entry known to be absent from the array. Reuses the first
+// tombstone on the probe path, otherwise claims the terminating empty slot.
+static void slot_array_insert(slot_array_t* arr, kv_entry_t* entry,
+                              uint64_t hash) {
+    size_t mask = arr->capacity - 1;
+    size_t idx = hash & mask;
+    while (arr->slots[idx].entry != NULL &&
+           arr->slots[idx].entry != SLOT_TOMBSTONE) {
+        idx = (idx + 1) & mask;
+    }
+    if (arr->slots[idx].entry == NULL) {
+        arr->used++;
+    }
+    arr->slots[idx].hash = hash;
+    arr->slots[idx].entry = entry;
+}
 
-    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
-        if (db->subscriptions[i].active) {
-            subscription_t* sub = &db->subscriptions[i];
-            // Call the callback (may be from a different thread)
-            if (sub->callback) {
-                sub->callback(sub->user_data, key);
-            }
+static void retire_free(hash_table_t* table, const retired_t* item) {
+    switch (item->kind) {
+    case RETIRE_ENTRY:
+        entry_free(table->slab, (kv_entry_t*)item->ptr);
+        break;
+    case RETIRE_VALUE:
+        value_release((kv_value_t*)item->ptr);
+        break;
+    case RETIRE_SLOTS:
+        slot_block_free((kv_slot_t*)item->ptr);
+        break;
+    case RETIRE_MOVED:
+        entry_block_free(table->slab, (kv_entry_t*)item->ptr);
+        break;
+    default:
+        snapshot_release((snapshot_t*)item->ptr);
+        break;
+    }
+}
+
+static void retire_list_free(hash_table_t* table, retire_list_t* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        retire_free(table, &list->items[i]);
+    }
+    list->count = 0;
+}
+
+// Enters a read section and returns the side to pass to shard_read_exit().
+// The epoch is re-read after counting in, so a reader never counts towards
+// a side the writer has already found empty.
+static size_t shard_read_enter(hash_table_t* table) {
+    reclaim_t* r = &table->reclaim;
+    for (;;) {
+        uint64_t epoch = atomic_load(&r->epoch);
+        size_t side = (size_t)(epoch & 1);
+        atomic_fetch_add(&r->readers[side], 1);
+        if (atomic_load(&r->epoch) == epoch) {
+            return side;
         }
+        atomic_fetch_sub(&r->readers[side], 1);
     }
+}
 
-    pthread_mutex_unlock(&db->sub_lock);
+static void shard_read_exit(hash_table_t* table, size_t side) {
+    atomic_fetch_sub_explicit(&table->reclaim.readers[side], 1,
+                              memory_order_release);
 }
 
-// ============================================================================
-// Public API Implementation
-// ============================================================================
+static size_t shard_readers(hash_table_t* table) {
+    return atomic_load(&table->reclaim.readers[0]) +
+           atomic_load(&table->reclaim.readers[1]);
+}
 
-DITTO_API int32_t ditto_open(const char* path, ditto_db_t** out_db) {
-    if (!path || !out_db) {
-        return -1;
+// Frees what was retired two epochs ago and advances the epoch, if no
+// reader is left on that side; with `wait`, waits for them instead. Called
+// under the shard's write lock, so readers never wait on it.
+static void shard_reclaim(hash_table_t* table, int wait) {
+    reclaim_t* r = &table->reclaim;
+    uint64_t epoch = atomic_load(&r->epoch);
+    size_t side = (size_t)((epoch + 1) & 1);
+    while (atomic_load(&r->readers[side]) != 0) {
+        if (!wait) return;
+        sched_yield();
     }
+    retire_list_free(table, &r->retired[side]);
+    atomic_store(&r->epoch, epoch + 1);
+}
 
-    ditto_db_t* db = (ditto_db_t*)calloc(1, sizeof(ditto_db_t));
-    if (!db) {
-        return -1;
+// Defers freeing memory a writer just unlinked until no read section can
+// still see it. If the list cannot grow, waits out two epochs instead.
+static void shard_retire(hash_table_t* table, int kind, void* ptr) {
+    reclaim_t* r = &table->reclaim;
+    retire_list_t* list = &r->retired[atomic_load(&r->epoch) & 1];
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        retired_t* items = (retired_t*)realloc(list->items,
+                                               capacity * sizeof(retired_t));
+        if (!items) {
+            shard_reclaim(table, 1);
+            shard_reclaim(table, 1);
+            retired_t item = {ptr, kind};
+            retire_free(table, &item);
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
     }
+    list->items[list->count].ptr = ptr;
+    list->items[list->count].kind = kind;
+    list->count++;
+}
 
-    db->table = hash_table_create();
-    if (!db->table) {
-        free(db);
-        return -1;
+// Makes the current slot arrays the ones lock-free readers probe. Readers
+// that overlap either store see `layout` odd or changed and probe again.
+static void hash_table_publish(hash_table_t* table) {
+    atomic_fetch_add(&table->layout, 1);
+    atomic_store(&table->read_draining, table->draining.slots);
+    atomic_store(&table->read_active, table->active.slots);
+    atomic_fetch_add(&table->layout, 1);
+}
+
+// Copies every live entry of `src` into `dst`. The caller retires src's
+// slots once readers can no longer reach them.
+static void slot_array_move_all(slot_array_t* dst, const slot_array_t* src) {
+    for (size_t i = 0; src->slots && i < src->capacity; i++) {
+        kv_slot_t* slot = &src->slots[i];
+        if (slot->entry != NULL && slot->entry != SLOT_TOMBSTONE) {
+            slot_array_insert(dst, slot->entry, slot->hash);
+        }
+    }
+}
+
+// Moves up to `budget` draining slots into the active array. Migrated slots
+// become tombstones so probes for keys not yet moved still find them; a
+// lock-free reader probes the draining array first for the same reason.
+// Also reclaims what earlier writes retired, as every write passes here.
+static void hash_table_migrate(hash_table_t* table, size_t budget) {
+    reclaim_t* r = &table->reclaim;
+    if (r->retired[0].count > 0 || r->retired[1].count > 0) {
+        shard_reclaim(table, 0);
     }
 
-    pthread_mutex_init(&db->sub_lock, NULL);
-    db->next_sub_id = 1;
+    slot_array_t* old = &table->draining;
+    if (!old->slots) return;
 
-    // Initialize subscriptions
-    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
-        db->subscriptions[i].active = 0;
+    while (budget-- > 0 && table->migrate_pos < old->capacity) {
+        kv_slot_t* slot = &old->slots[table->migrate_pos++];
+        if (slot->entry != NULL && slot->entry != SLOT_TOMBSTONE) {
+            slot_array_insert(&table->active, slot->entry, slot->hash);
+            slot->entry = SLOT_TOMBSTONE;
+        }
     }
 
-    *out_db = db;
-    return 0;
+    if (table->migrate_pos == old->capacity) {
+        kv_slot_t* slots = old->slots;
+        memset(old, 0, sizeof(*old));
+        table->migrate_pos = 0;
+        hash_table_publish(table);
+        shard_retire(table, RETIRE_SLOTS, slots);
+    }
 }
 
-DITTO_API void ditto_close(ditto_db_t* db) {
-    if (!db) return;
+// Makes room for one more slot in the active array, starting a resize when
+// the load factor would be exceeded. The new capacity is sized from the live
+// count, so tombstone-heavy arrays are rebuilt rather than doubled.
+static int32_t hash_table_reserve(hash_table_t* table) {
+    slot_array_t* cur = &table->active;
+    if ((cur->used + 1) * HASH_MAX_LOAD_DEN <= cur->capacity * HASH_MAX_LOAD_NUM) {
+        return 0;
+    }
 
-    hash_table_destroy(db->table);
-    pthread_mutex_destroy(&db->sub_lock);
-    free(db);
-}
+    size_t capacity = HASH_MIN_CAPACITY;
+    while (capacity < (table->count + 1) * 2) {
+        capacity <<= 1;
+    }
 
-DITTO_API int32_t ditto_put(ditto_db_t* db, const char* key,
-                            const uint8_t* data, size_t len) {
-    if (!db || !key || !data) {
+    slot_array_t grown;
+    if (slot_array_init(&grown, capacity) != 0) {
         return -1;
     }
 
-    int32_t rc = hash_table_put(db->table, key, data, len);
-    if (rc == 0) {
-        // Notify subscribers on success
-        notify_subscribers(db, key);
+    if (table->draining.slots) {
+        // The active array filled up before the previous resize finished
+        // (only possible after heavy deletes); fold both arrays in one pass.
+        kv_slot_t* draining = table->draining.slots;
+        kv_slot_t* active = cur->slots;
+        slot_array_move_all(&grown, &table->draining);
+        slot_array_move_all(&grown, cur);
+        memset(&table->draining, 0, sizeof(table->draining));
+        table->active = grown;
+        table->migrate_pos = 0;
+        hash_table_publish(table);
+        shard_retire(table, RETIRE_SLOTS, draining);
+        shard_retire(table, RETIRE_SLOTS, active);
+        return 0;
     }
 
-    return rc;
+    table->draining = *cur;
+    table->active = grown;
+    table->migrate_pos = 0;
+    hash_table_publish(table);
+    return 0;
 }
 
-DITTO_API int32_t ditto_get(ditto_db_t* db, const char* key,
-                            uint8_t* out_buf, size_t* inout_len) {
-    if (!db || !key || !inout_len) {
-        return -1;
+// Starts rebuilding the active array at the size hash_table_reserve() would
+// pick (but not below its size at open) once deletes have left it
+// HASH_SHRINK_FACTOR times larger than that, or more than half tombstones;
+// the rebuild then drains like a resize.
+// Returns 1 if one was started. The caller holds the write lock.
+#define HASH_SHRINK_FACTOR 4
+static int hash_table_shrink(hash_table_t* table) {
+    slot_array_t* cur = &table->active;
+    if (table->draining.slots) return 0;
+
+    size_t capacity = table->min_capacity;
+    while (capacity < (table->count + 1) * 2) {
+        capacity <<= 1;
+    }
+    size_t tombstones = cur->used - table->count;
+    if (capacity * HASH_SHRINK_FACTOR > cur->capacity &&
+        tombstones * 2 <= cur->capacity) {
+        return 0;
     }
 
-    return hash_table_get(db->table, key, out_buf, inout_len);
+    slot_array_t fresh;
+    if (slot_array_init(&fresh, capacity) != 0) {
+        return 0;
+    }
+    table->draining = *cur;
+    table->active = fresh;
+    table->migrate_pos = 0;
+    hash_table_publish(table);
+    return 1;
 }
 
-DITTO_API int32_t ditto_delete(ditto_db_t* db, const char* key) {
-    if (!db || !key) {
+// Sizes the slot array for `expected` keys up front, so loading them does
+// not resize it.
+static int32_t hash_table_init(hash_table_t* table, size_t expected) {
+    memset(table, 0, sizeof(*table));
+    if (slab_create(&table->slab) != 0) {
         return -1;
     }
-
-    int32_t rc = hash_table_delete(db->table, key);
-    if (rc == 0) {
-        // Notify subscribers on success
-        notify_subscribers(db, key);
+    size_t capacity = HASH_MIN_CAPACITY;
+    while (capacity / HASH_MAX_LOAD_DEN * HASH_MAX_LOAD_NUM < expected &&
+           capacity <= SIZE_MAX / 2 / sizeof(kv_slot_t)) {
+        capacity <<= 1;
+    }
+    if (slot_array_init(&table->active, capacity) != 0) {
+        slab_destroy(table->slab);
+        return -1;
     }
+    table->min_capacity = capacity;
 
-    return rc;
+    hash_table_publish(table);
+    table->skip_rng = (uint32_t)(uintptr_t)table | 1;
+    pthread_rwlock_init(&table->lock, NULL);
+    return 0;
 }
 
-DITTO_API int32_t ditto_subscribe(ditto_db_t* db, ditto_on_change_cb cb,
-                                  void* user_data, int32_t* out_sub_id) {
-    if (!db || !cb || !out_sub_id) {
-        return -1;
+static void slot_array_release(slab_t* slab, slot_array_t* arr) {
+    for (size_t i = 0; arr->slots && i < arr->capacity; i++) {
+        kv_entry_t* entry = arr->slots[i].entry;
+        if (entry != NULL && entry != SLOT_TOMBSTONE) {
+            entry_free(slab, entry);
+        }
     }
+    slot_block_free(arr->slots);
+}
 
-    pthread_mutex_lock(&db->sub_lock);
+static void version_map_release(version_map_t* map);
+static void ttl_wheel_release(ttl_wheel_t* w);
+static void journal_release(change_journal_t* j);
 
-    // Find an empty subscription slot
-    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
-        if (!db->subscriptions[i].active) {
-            db->subscriptions[i].id = db->next_sub_id++;
-            db->subscriptions[i].callback = cb;
-            db->subscriptions[i].user_data = user_data;
-            db->subscriptions[i].active = 1;
+static void hash_table_release(hash_table_t* table) {
+    for (int i = 0; i < 2; i++) {
+        retire_list_free(table, &table->reclaim.retired[i]);
+        free(table->reclaim.retired[i].items);
+    }
+    version_map_release(&table->versions);
+    ttl_wheel_release(&table->ttl);
+    journal_release(&table->journal);
+    free(table->pack_buf);
+    slot_array_release(table->slab, &table->active);
+    slot_array_release(table->slab, &table->draining);
+    slab_destroy(table->slab);
+    if (table->base) {
+        snapshot_release(table->base);
+    }
 
-            *out_sub_id = db->subscriptions[i].id;
-            pthread_mutex_unlock(&db->sub_lock);
-            return 0;
-        }
+    pthread_rwlock_destroy(&table->lock);
+}
+
+// ============================================================================
+// Ordered Index
+// ============================================================================
+
+// Bytewise key order, the order snapshots are written in.
+static int key_compare(const char* a, size_t a_len, const char* b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) return c;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static uint8_t skip_random_height(hash_table_t* table) {
+    uint32_t x = table->skip_rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    table->skip_rng = x;
+
+    uint8_t height = 1;
+    while (height < SKIP_MAX_HEIGHT && (x & 3) == 0) {
+        height++;
+        x >>= 2;
     }
+    return height;
+}
 
-    pthread_mutex_unlock(&db->sub_lock);
-    return -1; // No available slots
+// Returns the forward pointer at `level` of `node`, or of the head for NULL.
+static kv_entry_t** skip_link(hash_table_t* table, kv_entry_t* node, int level) {
+    return node ? &entry_next(node)[level] : &table->skip_head[level];
 }
 
-DITTO_API int32_t ditto_unsubscribe(ditto_db_t* db, int32_t sub_id) {
-    if (!db) {
-        return -1;
+// Fills preds[l] with the last node on level l that sorts before `key` (or
+// at or before it when `inclusive` is zero); NULL stands for the head.
+static void skip_find_preds(hash_table_t* table, const char* key,
+                            size_t key_len, int inclusive, kv_entry_t** preds) {
+    kv_entry_t* node = NULL;
+    for (int level = SKIP_MAX_HEIGHT - 1; level >= 0; level--) {
+        kv_entry_t* next = *skip_link(table, node, level);
+        while (next) {
+            int cmp = key_compare(next->key, next->key_len, key, key_len);
+            if (cmp > 0 || (cmp == 0 && inclusive)) break;
+            node = next;
+            next = entry_next(node)[level];
+        }
+        preds[level] = node;
     }
+}
 
-    pthread_mutex_lock(&db->sub_lock);
+static void skip_insert(hash_table_t* table, kv_entry_t* entry) {
+    kv_entry_t* preds[SKIP_MAX_HEIGHT];
+    skip_find_preds(table, entry->key, entry->key_len, 1, preds);
 
-    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++) {
-        if (db->subscriptions[i].active && db->subscriptions[i].id == sub_id) {
-            db->subscriptions[i].active = 0;
-            db->subscriptions[i].callback = NULL;
-            db->subscriptions[i].user_data = NULL;
-            pthread_mutex_unlock(&db->sub_lock);
-            return 0;
+    kv_entry_t** next = entry_next(entry);
+    for (int level = 0; level < entry->height; level++) {
+        kv_entry_t** link = skip_link(table, preds[level], level);
+        next[level] = *link;
+        *link = entry;
+    }
+}
+
+static void skip_remove(hash_table_t* table, kv_entry_t* entry) {
+    kv_entry_t* preds[SKIP_MAX_HEIGHT];
+    skip_find_preds(table, entry->key, entry->key_len, 1, preds);
+
+    kv_entry_t** next = entry_next(entry);
+    for (int level = 0; level < entry->height; level++) {
+        kv_entry_t** link = skip_link(table, preds[level], level);
+        if (*link == entry) {
+            *link = next[level];
         }
     }
+}
 
-    pthread_mutex_unlock(&db->sub_lock);
-    return -1; // Subscription not found
+// First entry at or after `key` (strictly after unless `inclusive`), or the
+// first entry overall when key is NULL.
+static kv_entry_t* skip_seek(hash_table_t* table, const char* key,
+                             size_t key_len, int inclusive) {
+    if (!key) {
+        return table->skip_head[0];
+    }
+    kv_entry_t* preds[SKIP_MAX_HEIGHT];
+    skip_find_preds(table, key, key_len, inclusive, preds);
+    return *skip_link(table, preds[0], 0);
+}
+
+// Unlinks every entry changed at or before `seq` in one pass over the
+// bottom level. links[l] tracks the last forward pointer on level l that
+// still belongs to a kept node.
+static void skip_remove_through(hash_table_t* table, uint64_t seq) {
+    kv_entry_t** links[SKIP_MAX_HEIGHT];
+    for (int level = 0; level < SKIP_MAX_HEIGHT; level++) {
+        links[level] = &table->skip_head[level];
+    }
+
+    kv_entry_t* node = table->skip_head[0];
+    while (node) {
+        kv_entry_t** next = entry_next(node);
+        kv_entry_t* following = next[0];
+        for (int level = 0; level < node->height; level++) {
+            if (node->seq <= seq) {
+                *links[level] = next[level];
+            } else {
+                links[level] = &next[level];
+            }
+        }
+        node = following;
+    }
+}
+
+// ============================================================================
+// Timer Wheel
+// ============================================================================
+
+static uint64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static ttl_timer_t** ttl_bucket(ttl_wheel_t* w, uint64_t hash) {
+    return &w->buckets[hash & (w->bucket_count - 1)];
+}
+
+// Returns the link pointing at the key's timer, or NULL if it has none.
+static ttl_timer_t** ttl_find(ttl_wheel_t* w, const char* key, size_t key_len,
+                              uint64_t hash) {
+    if (!w->buckets) return NULL;
+
+    for (ttl_timer_t** link = ttl_bucket(w, hash); *link; link = &(*link)->chain) {
+        ttl_timer_t* t = *link;
+        if (t->hash == hash && t->key_len == key_len &&
+            memcmp(t->key, key, key_len) == 0) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+static int32_t ttl_index_grow(ttl_wheel_t* w) {
+    size_t count = w->bucket_count ? w->bucket_count * 2 : 64;
+    ttl_timer_t** buckets = (ttl_timer_t**)calloc(count, sizeof(ttl_timer_t*));
+    if (!buckets) return -1;
+
+    for (size_t i = 0; i < w->bucket_count; i++) {
+        ttl_timer_t* t = w->buckets[i];
+        while (t) {
+            ttl_timer_t* chain = t->chain;
+            ttl_timer_t** head = &buckets[t->hash & (count - 1)];
+            t->chain = *head;
+            *head = t;
+            t = chain;
+        }
+    }
+    free(w->buckets);
+    w->buckets = buckets;
+    w->bucket_count = count;
+    return 0;
+}
+
+// Files a timer in the slot for its expiry relative to the current tick.
+// Overdue timers go in the current tick; ones past the last level's range
+// wait in its furthest slot and are re-filed when it cascades.
+static void ttl_slot_link(ttl_wheel_t* w, ttl_timer_t* t) {
+    uint64_t tick = t->expires_ms / TTL_TICK_MS;
+    if (tick < w->current) tick = w->current;
+    uint64_t horizon = 1ull << (TTL_WHEEL_BITS * TTL_WHEEL_LEVELS);
+    if (tick - w->current >= horizon) tick = w->current + horizon - 1;
+
+    unsigned level = 0;
+    while (level + 1 < TTL_WHEEL_LEVELS &&
+           tick - w->current >= 1ull << (TTL_WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    t->level = (uint8_t)level;
+    t->slot = (uint8_t)((tick >> (TTL_WHEEL_BITS * level)) & (TTL_WHEEL_SLOTS - 1));
+
+    ttl_timer_t** head = &w->slots[level][t->slot];
+    t->prev = NULL;
+    t->next = *head;
+    if (*head) (*head)->prev = t;
+    *head = t;
+}
+
+static void ttl_slot_unlink(ttl_wheel_t* w, ttl_timer_t* t) {
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        w->slots[t->level][t->slot] = t->next;
+    }
+    if (t->next) t->next->prev = t->prev;
+}
+
+// Arms (or re-arms) the key's timer. The caller holds the shard's write
+// lock. Returns -1 if out of memory.
+static int32_t ttl_arm(ttl_wheel_t* w, const char* key, size_t key_len,
+                       uint64_t hash, uint64_t expires_ms) {
+    ttl_timer_t** link = ttl_find(w, key, key_len, hash);
+    if (link) {
+        ttl_timer_t* t = *link;
+        ttl_slot_unlink(w, t);
+        t->expires_ms = expires_ms;
+        ttl_slot_link(w, t);
+        return 0;
+    }
+
+    size_t count = atomic_load_explicit(&w->count, memory_order_relaxed);
+    if (count >= w->bucket_count && ttl_index_grow(w) != 0) {
+        return -1;
+    }
+    ttl_timer_t* t = (ttl_timer_t*)malloc(sizeof(ttl_timer_t) + key_len + 1);
+    if (!t) return -1;
+    t->expires_ms = expires_ms;
+    t->hash = hash;
+    t->key_len = (uint32_t)key_len;
+    memcpy(t->key, key, key_len);
+    t->key[key_len] = '\0';
+
+    if (count == 0) {
+        // An idle wheel has not been advanced; start it at the present
+        w->current = wall_clock_ms() / TTL_TICK_MS;
+    }
+    ttl_timer_t** head = ttl_bucket(w, hash);
+    t->chain = *head;
+    *head = t;
+    ttl_slot_link(w, t);
+    atomic_store_explicit(&w->count, count + 1, memory_order_relaxed);
+    return 0;
+}
+
+// Drops the key's timer, if any, because the key was written or deleted.
+static void ttl_cancel(ttl_wheel_t* w, const char* key, size_t key_len,
+                       uint64_t hash) {
+    if (atomic_load_explicit(&w->count, memory_order_relaxed) == 0) return;
+
+    ttl_timer_t** link = ttl_find(w, key, key_len, hash);
+    if (!link) return;
+    ttl_timer_t* t = *link;
+    *link = t->chain;
+    ttl_slot_unlink(w, t);
+    free(t);
+    atomic_fetch_sub_explicit(&w->count, 1, memory_order_relaxed);
+}
+
+// The first tick after the current one with work for ttl_advance(): a
+// level 0 slot to expire or a slot above to cascade. Each level's next
+// TTL_WHEEL_SLOTS boundaries cover everything filed there.
+static uint64_t ttl_next_work(const ttl_wheel_t* w) {
+    uint64_t next = UINT64_MAX;
+    for (unsigned level = 0; level < TTL_WHEEL_LEVELS; level++) {
+        unsigned shift = TTL_WHEEL_BITS * level;
+        uint64_t tick = ((w->current >> shift) + 1) << shift;
+        for (unsigned i = 0; i < TTL_WHEEL_SLOTS && tick < next; i++) {
+            if (w->slots[level][(tick >> shift) & (TTL_WHEEL_SLOTS - 1)]) {
+                next = tick;
+                break;
+            }
+            tick += 1ull << shift;
+        }
+    }
+    return next;
+}
+
+// Processes ticks up to and including `now_tick`, moving the timers due onto
+// the `due` list (linked through `next`); they are no longer filed by key.
+// Ticks with nothing to do are skipped, so catching up after a suspend or
+// a clock jump costs a step per slot with timers, not one per tick.
+static void ttl_advance(ttl_wheel_t* w, uint64_t now_tick, ttl_timer_t** due) {
+    while (w->current <= now_tick &&
+           atomic_load_explicit(&w->count, memory_order_relaxed) > 0) {
+        uint64_t tick = w->current;
+        for (unsigned level = 1; level < TTL_WHEEL_LEVELS; level++) {
+            if ((tick & ((1ull << (TTL_WHEEL_BITS * level)) - 1)) != 0) break;
+            size_t slot = (tick >> (TTL_WHEEL_BITS * level)) & (TTL_WHEEL_SLOTS - 1);
+            ttl_timer_t* t = w->slots[level][slot];
+            w->slots[level][slot] = NULL;
+            while (t) {
+                ttl_timer_t* next = t->next;
+                ttl_slot_link(w, t);
+                t = next;
+            }
+        }
+
+        ttl_timer_t* t = w->slots[0][tick & (TTL_WHEEL_SLOTS - 1)];
+        w->slots[0][tick & (TTL_WHEEL_SLOTS - 1)] = NULL;
+        while (t) {
+            ttl_timer_t* next = t->next;
+            ttl_timer_t** link = ttl_find(w, t->key, t->key_len, t->hash);
+            *link = t->chain;
+            atomic_fetch_sub_explicit(&w->count, 1, memory_order_relaxed);
+            t->next = *due;
+            *due = t;
+            t = next;
+        }
+        uint64_t next = tick < now_tick ? ttl_next_work(w) : tick + 1;
+        w->current = next <= now_tick ? next : now_tick + 1;
+    }
+}
+
+// Logs every armed timer again. A compaction calls this once the new
+// snapshot is installed, since the records that armed them may be in the
+// log generations it is about to remove. The caller holds the shard's
+// write lock, so the records land before any later write to their keys.
+static int32_t ttl_log_pending(ttl_wheel_t* w, wal_t* wal, uint64_t* inout_lsn) {
+    for (size_t i = 0; i < w->bucket_count; i++) {
+        for (ttl_timer_t* t = w->buckets[i]; t; t = t->chain) {
+            uint8_t expires[8];
+            put_u64(expires, t->expires_ms);
+            uint64_t lsn = 0;
+            if (wal_append(wal, WAL_RECORD_EXPIRE, t->key, t->key_len, expires,
+                           sizeof(expires), &lsn) != 0) {
+                return -1;
+            }
+            if (lsn > *inout_lsn) *inout_lsn = lsn;
+        }
+    }
+    return 0;
+}
+
+static void ttl_wheel_release(ttl_wheel_t* w) {
+    for (size_t i = 0; i < w->bucket_count; i++) {
+        ttl_timer_t* t = w->buckets[i];
+        while (t) {
+            ttl_timer_t* chain = t->chain;
+            free(t);
+            t = chain;
+        }
+    }
+    free(w->buckets);
+}
+
+// ============================================================================
+// Table Operations
+// ============================================================================
+
+// Looks the key up in the active array first, then in the one being drained.
+static kv_slot_t* hash_table_find(hash_table_t* table, const char* key,
+                                  size_t key_len, uint64_t hash) {
+    kv_slot_t* slot = slot_array_find(&table->active, key, key_len, hash);
+    if (!slot) {
+        slot = slot_array_find(&table->draining, key, key_len, hash);
+    }
+    return slot;
+}
+
+// Finds the key's value in the snapshot under the table, if any.
+static int hash_table_find_base(const hash_table_t* table, const char* key,
+                                size_t key_len, uint64_t hash,
+                                const uint8_t** out_value, size_t* out_len) {
+    if (!table->base) return 0;
+    return snapshot_find(table->base, key, key_len, hash, out_value, out_len);
+}
+
+// Sets the CLOCK bit. Readers run concurrently, so the bit is only written
+// when clear to keep hot entries' cache lines from bouncing.
+static void entry_touch(kv_entry_t* entry) {
+    if (!atomic_load_explicit(&entry->referenced, memory_order_relaxed)) {
+        atomic_store_explicit(&entry->referenced, 1, memory_order_relaxed);
+    }
+}
+
+// Resolves a key through the delta and then the base. Returns 1 with the
+// value's bytes if the key is live; *out_value is the delta's value, or NULL
+// when the bytes come from the snapshot. If that value is compressed the
+// bytes are its packed form and must be read through value_copy_out().
+// The caller holds the table's lock.
+static int hash_table_lookup(hash_table_t* table, const char* key,
+                             size_t key_len, uint64_t hash,
+                             const uint8_t** out_bytes, size_t* out_len,
+                             kv_value_t** out_value) {
+    kv_slot_t* slot = hash_table_find(table, key, key_len, hash);
+    *out_value = NULL;
+    if (slot) {
+        kv_value_t* value = slot->entry->value;
+        if (!value) return 0; // Deleted since the snapshot
+        entry_touch(slot->entry);
+        *out_bytes = value_bytes(value);
+        *out_len = value->len;
+        *out_value = value;
+        return 1;
+    }
+    return hash_table_find_base(table, key, key_len, hash, out_bytes, out_len);
+}
+
+// slot_array_find() over a published array, without the lock. The entry is
+// loaded before the hash: a slot being filled has its hash stored first.
+static kv_entry_t* slot_block_find(kv_slot_t* slots, const char* key,
+                                   size_t key_len, uint64_t hash,
+                                   size_t* out_idx) {
+    if (!slots) return NULL;
+
+    size_t mask = (size_t)atomic_load_explicit(&slots[-1].hash,
+                                               memory_order_relaxed) - 1;
+    size_t idx = hash & mask;
+    for (;;) {
+        kv_slot_t* slot = &slots[idx];
+        kv_entry_t* entry = atomic_load_explicit(&slot->entry, memory_order_acquire);
+        if (entry == NULL) {
+            return NULL;
+        }
+        if (entry != SLOT_TOMBSTONE &&
+            atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash &&
+            entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+            *out_idx = idx;
+            return entry;
+        }
+        idx = (idx + 1) & mask;
+    }
+}
+
+// Tries the active-array slot an interned key was last found in.
+static kv_entry_t* slot_block_hinted(kv_slot_t* slots, const char* key,
+                                     size_t key_len, uint64_t hash, size_t idx) {
+    size_t capacity = (size_t)atomic_load_explicit(&slots[-1].hash,
+                                                   memory_order_relaxed);
+    if (idx >= capacity) return NULL;
+    kv_slot_t* slot = &slots[idx];
+    kv_entry_t* entry = atomic_load_explicit(&slot->entry, memory_order_acquire);
+    if (entry != NULL && entry != SLOT_TOMBSTONE &&
+        atomic_load_explicit(&slot->hash, memory_order_relaxed) == hash &&
+        entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+        return entry;
+    }
+    return NULL;
+}
+
+// hash_table_lookup() for readers in a read section instead of holding the
+// lock. The bytes, *out_value and *out_base stay valid until the section
+// ends; with `retain` a delta value also gets a reference for the caller to
+// drop, so it can outlive the section. A miss is only trusted if `layout`
+// was even and unchanged across the probe: a resize can move an entry past
+// it, and one being published can pair the old draining array with the new
+// active one. `hint` may be NULL; any thread may refresh it.
+static int hash_table_read(hash_table_t* table, const char* key,
+                           size_t key_len, uint64_t hash, _Atomic size_t* hint,
+                           int retain, const uint8_t** out_bytes,
+                           size_t* out_len, kv_value_t** out_value,
+                           snapshot_t** out_base) {
+    *out_value = NULL;
+    for (;;) {
+        uint64_t layout = atomic_load(&table->layout);
+        if (layout & 1) {
+            sched_yield(); // A writer is between the two stores
+            continue;
+        }
+        kv_slot_t* draining = atomic_load(&table->read_draining);
+        kv_slot_t* active = atomic_load(&table->read_active);
+
+        kv_entry_t* entry = NULL;
+        size_t idx;
+        if (hint) {
+            entry = slot_block_hinted(active, key, key_len, hash,
+                                      atomic_load_explicit(hint, memory_order_relaxed));
+        }
+        if (!entry) {
+            entry = slot_block_find(draining, key, key_len, hash, &idx);
+        }
+        if (!entry && (entry = slot_block_find(active, key, key_len, hash, &idx)) &&
+            hint) {
+            atomic_store_explicit(hint, idx, memory_order_relaxed);
+        }
+
+        if (entry) {
+            kv_value_t* value = atomic_load(&entry->value);
+            if (!value) return 0; // Deleted since the snapshot
+            if (retain ? !value_try_retain(value)
+                       : (atomic_load(&value->refs) & VALUE_WRITING) != 0) {
+                sched_yield(); // It is being rewritten in place
+                continue;
+            }
+            entry_touch(entry);
+            *out_bytes = value_bytes(value);
+            *out_len = value->len;
+            *out_value = value;
+            return 1;
+        }
+
+        snapshot_t* base = atomic_load(&table->base);
+        int found = base && snapshot_find(base, key, key_len, hash, out_bytes,
+                                          out_len);
+        if (atomic_load(&table->layout) == layout) {
+            if (out_base) *out_base = base;
+            return found;
+        }
+    }
+}
+
+// Adds a fresh entry for a key absent from both arrays. `value` may be NULL
+// to record a deletion; it is owned by the entry on success.
+static int32_t hash_table_insert_entry(hash_table_t* table, const char* key,
+                                       size_t key_len, uint64_t hash,
+                                       kv_value_t* value, uint64_t seq) {
+    if (key_len > UINT32_MAX || hash_table_reserve(table) != 0) {
+        return -1;
+    }
+
+    uint8_t size_class;
+    uint8_t height = skip_random_height(table);
+    TRACE_BEGIN(span);
+    kv_entry_t* entry = (kv_entry_t*)slab_alloc(
+        table->slab, entry_block_size(key_len, height), &size_class);
+    TRACE_END(span, TRACE_ALLOC);
+    if (!entry) {
+        return -1;
+    }
+    atomic_init(&entry->value, value);
+    entry->seq = seq;
+    entry->key_len = (uint32_t)key_len;
+    entry->size_class = size_class;
+    entry->height = height;
+    atomic_init(&entry->referenced, 1);
+    memcpy(entry->key, key, key_len);
+    entry->key[key_len] = '\0';
+
+    slot_array_insert(&table->active, entry, hash);
+    skip_insert(table, entry);
+    table->count++;
+    table->payload_bytes += entry_payload(entry);
+    return 0;
+}
+
+// Insert or overwrite; the caller holds the table's write lock.
+static int32_t hash_table_put_locked(hash_table_t* table, const char* key,
+                                     size_t key_len, uint64_t hash,
+                                     const uint8_t* data, size_t len,
+                                     uint64_t seq) {
+    hash_table_migrate(table, HASH_MIGRATE_STEP);
+    ttl_cancel(&table->ttl, key, key_len, hash);
+
+    kv_slot_t* slot = hash_table_find(table, key, key_len, hash);
+
+    // Check if key exists
+    if (slot) {
+        // Update existing entry, in place unless a view still holds the
+        // old bytes
+        kv_entry_t* entry = slot->entry;
+        table->payload_bytes -= entry_payload(entry);
+        if (!entry->value || value_wants_packing(table, len) ||
+            !value_try_reuse(table, entry->value, data, len)) {
+            kv_value_t* value = value_create_for(table, data, len);
+            if (!value) {
+                table->payload_bytes += entry_payload(entry);
+                return -1;
+            }
+            // Views of the old value keep it alive until they are released,
+            // lock-free readers until they leave their read section
+            kv_value_t* old = entry->value;
+            entry->value = value;
+            if (old) {
+                shard_retire(table, RETIRE_VALUE, old);
+            }
+        }
+        entry->seq = seq;
+        entry_touch(entry);
+        table->payload_bytes += entry_payload(entry);
+        return 0;
+    }
+
+    kv_value_t* value = value_create_for(table, data, len);
+    if (!value) {
+        return -1;
+    }
+    if (hash_table_insert_entry(table, key, key_len, hash, value, seq) != 0) {
+        value_release(value);
+        return -1;
+    }
+    return 0;
+}
+
+// A copy of a value's `cur_len` bytes (from `old` if it is compressed) with
+// `len` bytes of `data` written at `offset`. A value that grows past the
+// slabs gets a power-of-two block, so appends reallocate O(log n) times.
+static kv_value_t* value_create_spliced(hash_table_t* table,
+                                        const uint8_t* bytes, size_t cur_len,
+                                        const kv_value_t* old, size_t offset,
+                                        const uint8_t* data, size_t len,
+                                        size_t new_len) {
+    size_t need = sizeof(kv_value_t) + new_len;
+    uint8_t size_class = SLAB_CLASS_NONE;
+    uint8_t shift = 0;
+    kv_value_t* value;
+    if (new_len > cur_len && need > SLAB_MAX_CLASS_SIZE) {
+        while (((size_t)1 << shift) < need) shift++;
+        value = (kv_value_t*)slab_alloc_large(table->slab, (size_t)1 << shift);
+    } else {
+        value = (kv_value_t*)slab_alloc(table->slab, need, &size_class);
+    }
+    if (!value) return NULL;
+    atomic_init(&value->refs, 1);
+    value->size_class = size_class;
+    value->mapped = 0;
+    value->compressed = 0;
+    value->block_shift = shift;
+    value->len = new_len;
+    value->owner = table->slab;
+
+    if (old && old->compressed) {
+        if (value_unpack(old, value->data) != 0) {
+            slab_free(table->slab, value, size_class, value_block_size(value));
+            return NULL;
+        }
+    } else if (cur_len > 0) {
+        memcpy(value->data, bytes, cur_len);
+    }
+    if (len > 0) {
+        memcpy(value->data + offset, data, len);
+    }
+    return value;
+}
+
+// Writes `len` bytes at *inout_offset into a key's value, extending it if
+// they run past its end; with `append` the offset is the value's length
+// and is returned in *inout_offset. A missing key is created when writing
+// at offset 0 and `create` is set, else reported as 2. The value is changed
+// in place when no reader references it and its block has room (it then
+// stays uncompressed until next rewritten whole). The caller holds the
+// table's write lock.
+static int32_t hash_table_splice_locked(hash_table_t* table, const char* key,
+                                        size_t key_len, uint64_t hash,
+                                        size_t* inout_offset, int append,
+                                        int create, const uint8_t* data,
+                                        size_t len, uint64_t seq) {
+    hash_table_migrate(table, HASH_MIGRATE_STEP);
+
+    kv_slot_t* slot = hash_table_find(table, key, key_len, hash);
+    kv_value_t* old = slot ? slot->entry->value : NULL;
+    const uint8_t* bytes = old ? value_bytes(old) : NULL;
+    size_t cur_len = old ? old->len : 0;
+    int found = slot ? old != NULL
+                     : hash_table_find_base(table, key, key_len, hash, &bytes,
+                                            &cur_len);
+    size_t offset = append ? cur_len : *inout_offset;
+    *inout_offset = offset;
+    if (!found) {
+        if (offset != 0 || !create) return 2;
+        return hash_table_put_locked(table, key, key_len, hash, data, len, seq);
+    }
+    if (offset > cur_len || len > SIZE_MAX / 4 - offset) {
+        return -1;
+    }
+    size_t new_len = offset + len > cur_len ? offset + len : cur_len;
+
+    if (old && !old->compressed && value_capacity(old) >= new_len &&
+        value_claim(table, old)) {
+        if (len > 0) {
+            memcpy(old->data + offset, data, len);
+        }
+        table->payload_bytes += new_len - cur_len;
+        old->len = new_len;
+        value_unclaim(old);
+        slot->entry->seq = seq;
+        entry_touch(slot->entry);
+        return 0;
+    }
+
+    kv_value_t* value = value_create_spliced(table, bytes, cur_len, old, offset,
+                                             data, len, new_len);
+    if (!value) {
+        return -1;
+    }
+    if (slot) {
+        kv_entry_t* entry = slot->entry;
+        table->payload_bytes -= entry_payload(entry);
+        entry->value = value;
+        shard_retire(table, RETIRE_VALUE, old); // Views of it keep it alive
+        entry->seq = seq;
+        entry_touch(entry);
+        table->payload_bytes += entry_payload(entry);
+        return 0;
+    }
+    if (hash_table_insert_entry(table, key, key_len, hash, value, seq) != 0) {
+        value_release(value);
+        return -1;
+    }
+    return 0;
+}
+
+// The two-step copy behind every get: returns 1 with the size needed if
+// out_buf is NULL or too small, else copies the value and returns 0.
+// `value` is the one the bytes belong to, or NULL; a compressed value is
+// expanded straight into out_buf.
+static int32_t value_copy_out(const uint8_t* bytes, size_t len,
+                              const kv_value_t* value, uint8_t* out_buf,
+                              size_t* inout_len) {
+    if (out_buf == NULL || *inout_len < len) {
+        *inout_len = len;
+        return 1; // Buffer too small
+    }
+    if (value && value->compressed) {
+        if (value_unpack(value, out_buf) != 0) return -1;
+    } else {
+        memcpy(out_buf, bytes, len);
+    }
+    *inout_len = len;
+    return 0;
+}
+
+// Never takes the shard lock: the value is found and copied (or expanded)
+// in a read section.
+static int32_t hash_table_get(hash_table_t* table, const char* key,
+                              size_t key_len, uint64_t hash,
+                              _Atomic size_t* hint, uint8_t* out_buf,
+                              size_t* inout_len) {
+    STAT_ADD(table->stats.gets, 1);
+    size_t side = shard_read_enter(table);
+
+    const uint8_t* bytes;
+    size_t len;
+    kv_value_t* value;
+    int32_t rc = 2; // Key not found
+    if (hash_table_read(table, key, key_len, hash, hint, 0, &bytes, &len, &value,
+                        NULL)) {
+        rc = value_copy_out(bytes, len, value, out_buf, inout_len);
+    }
+
+    shard_read_exit(table, side);
+    return rc;
+}
+
+// Copies up to *inout_len bytes of a value from `offset` and sets
+// *inout_len to the bytes copied; *out_value_len gets the whole length.
+// Lock-free like hash_table_get().
+static int32_t hash_table_get_range(hash_table_t* table, const char* key,
+                                    size_t key_len, uint64_t hash, size_t offset,
+                                    uint8_t* out_buf, size_t* inout_len,
+                                    size_t* out_value_len) {
+    STAT_ADD(table->stats.gets, 1);
+    size_t side = shard_read_enter(table);
+
+    const uint8_t* bytes;
+    size_t len;
+    kv_value_t* value;
+    if (!hash_table_read(table, key, key_len, hash, NULL, 1, &bytes, &len,
+                         &value, NULL)) {
+        shard_read_exit(table, side);
+        return 2; // Key not found
+    }
+    if (value) {
+        shard_read_exit(table, side); // The reference keeps the value
+    }
+
+    *out_value_len = len;
+    int32_t rc = -1;
+    if (offset <= len) {
+        size_t n = len - offset < *inout_len ? len - offset : *inout_len;
+        *inout_len = n;
+        rc = 0;
+        if (value && value->compressed) {
+            // Only the whole block can be expanded
+            kv_value_t* unpacked = value_create_unpacked(value);
+            if (unpacked) {
+                memcpy(out_buf, unpacked->data + offset, n);
+                value_release(unpacked);
+            } else {
+                rc = -1;
+            }
+        } else if (n > 0) {
+            memcpy(out_buf, bytes + offset, n);
+        }
+    }
+
+    if (value) {
+        value_release(value);
+    } else {
+        shard_read_exit(table, side);
+    }
+    return rc;
+}
+
+// Changes whenever the key's state may have: the seq of its delta entry, or
+// for keys only in (or absent from) the base, the point the base was
+// collected at. Seqs only grow and a compaction only folds entries at or
+// below its collection point, so an unchanged version means an unchanged
+// key. The caller holds the table's lock.
+static uint64_t table_version(hash_table_t* table, const char* key,
+                              size_t key_len, uint64_t hash) {
+    kv_slot_t* slot = hash_table_find(table, key, key_len, hash);
+    return slot ? slot->entry->seq : table->base_seq;
+}
+
+// Returns the current value with an extra reference for the caller, or NULL
+// if the key is missing. Sets *out_error when a mapped view cannot be made.
+static kv_value_t* hash_table_get_value(hash_table_t* table, const char* key,
+                                        size_t key_len, uint64_t hash,
+                                        _Atomic size_t* hint, int* out_error) {
+    STAT_ADD(table->stats.gets, 1);
+    size_t side = shard_read_enter(table);
+
+    const uint8_t* bytes;
+    size_t len;
+    kv_value_t* value = NULL;
+    snapshot_t* base;
+    *out_error = 0;
+    if (hash_table_read(table, key, key_len, hash, hint, 1, &bytes, &len, &value,
+                        &base) &&
+        !value) {
+        value = value_create_mapped(base, bytes, len);
+        *out_error = value == NULL;
+    }
+
+    shard_read_exit(table, side);
+
+    // Borrowers read the bytes in place, so they get an expanded copy
+    if (value && value->compressed) {
+        kv_value_t* unpacked = value_create_unpacked(value);
+        value_release(value);
+        value = unpacked;
+        *out_error = value == NULL;
+    }
+    return value;
+}
+
+// Remove a key; the caller holds the table's write lock. Keys that also live
+// in the snapshot, or in one being written, keep an entry without a value so
+// the base stays hidden.
+static int32_t hash_table_delete_locked(hash_table_t* table, const char* key,
+                                        size_t key_len, uint64_t hash,
+                                        uint64_t seq) {
+    hash_table_migrate(table, HASH_MIGRATE_STEP);
+    ttl_cancel(&table->ttl, key, key_len, hash);
+
+    const uint8_t* base_value;
+    size_t base_len;
+    int in_base = hash_table_find_base(table, key, key_len, hash, &base_value,
+                                       &base_len);
+
+    kv_slot_t* slot = hash_table_find(table, key, key_len, hash);
+    if (!slot) {
+        if (!in_base) {
+            return 2; // Key not found
+        }
+        return hash_table_insert_entry(table, key, key_len, hash, NULL, seq);
+    }
+
+    kv_entry_t* entry = slot->entry;
+    if (!entry->value) {
+        return 2; // Already deleted
+    }
+    table->payload_bytes -= entry_payload(entry);
+    if (in_base || table->compacting) {
+        kv_value_t* old = entry->value;
+        entry->value = NULL;
+        shard_retire(table, RETIRE_VALUE, old);
+        entry->seq = seq;
+        table->payload_bytes += entry_payload(entry);
+        return 0;
+    }
+
+    // Leave a tombstone so later probes continue past this slot
+    skip_remove(table, entry);
+    slot->entry = SLOT_TOMBSTONE;
+    shard_retire(table, RETIRE_ENTRY, entry);
+    table->count--;
+    return 0;
+}
+
+// Picks the shard for a key from the hash's high half, so the shard choice
+// does not use the low bits that index slots inside the shard.
+static size_t shard_index(const ditto_db_t* db, uint64_t hash) {
+    return (size_t)(hash >> 32) & (db->shard_count - 1);
+}
+
+static hash_table_t* shard_for(ditto_db_t* db, uint64_t hash) {
+    return &db->shards[shard_index(db, hash)];
+}
+
+// ============================================================================
+// Version History
+// ============================================================================
+
+// While read snapshots are open, every change first records the state it
+// replaces, tagged with the change's seq. A snapshot at seq S sees, for each
+// key, the state recorded by the first change numbered after S, or the
+// current state if there is none. A version is dropped once no open
+// snapshot is older than the change that replaced it. All of this runs
+// under the shard's lock: writes under the write lock, lookups under either.
+
+static void version_free(kv_version_t* version) {
+    if (version->value) {
+        value_release(version->value);
+    }
+    free(version);
+}
+
+static void version_map_release(version_map_t* map) {
+    kv_version_t* version = map->oldest;
+    while (version) {
+        kv_version_t* next = version->next;
+        version_free(version);
+        version = next;
+    }
+    free(map->buckets);
+    memset(map, 0, sizeof(*map));
+}
+
+// Doubles the bucket array. Chains stay newest first because versions are
+// moved over oldest first, each to the front of its new chain.
+static int version_map_grow(version_map_t* map) {
+    size_t count = map->bucket_count ? map->bucket_count * 2 : 64;
+    kv_version_t** buckets = (kv_version_t**)calloc(count, sizeof(kv_version_t*));
+    if (!buckets) return -1;
+
+    for (kv_version_t* v = map->oldest; v; v = v->next) {
+        size_t b = v->hash & (count - 1);
+        v->chain = buckets[b];
+        buckets[b] = v;
+    }
+    free(map->buckets);
+    map->buckets = buckets;
+    map->bucket_count = count;
+    return 0;
+}
+
+// Frees versions no snapshot at seq >= `oldest_view` can read.
+static void version_map_expire(version_map_t* map, uint64_t oldest_view) {
+    while (map->oldest && map->oldest->end <= oldest_view) {
+        kv_version_t* version = map->oldest;
+
+        // The oldest version is the last one in its chain
+        kv_version_t** link = &map->buckets[version->hash & (map->bucket_count - 1)];
+        while (*link != version) {
+            link = &(*link)->chain;
+        }
+        *link = NULL;
+
+        map->oldest = version->next;
+        if (!map->oldest) map->newest = NULL;
+        map->count--;
+        version_free(version);
+    }
+}
+
+// Records the key's state before the change numbered `seq`. Returns -1 if it
+// cannot, in which case the change must not be applied.
+static int32_t version_record(hash_table_t* table, const char* key,
+                              size_t key_len, uint64_t hash, uint64_t seq) {
+    version_map_t* map = &table->versions;
+    if (map->count >= map->bucket_count && version_map_grow(map) != 0) {
+        return -1;
+    }
+
+    const uint8_t* bytes;
+    size_t len;
+    kv_value_t* value = NULL;
+    if (hash_table_lookup(table, key, key_len, hash, &bytes, &len, &value)) {
+        if (value) {
+            value_retain(value);
+        } else if (!(value = value_create_mapped(table->base, bytes, len))) {
+            return -1;
+        }
+    }
+
+    kv_version_t* version = (kv_version_t*)malloc(sizeof(kv_version_t) + key_len);
+    if (!version) {
+        if (value) value_release(value);
+        return -1;
+    }
+    version->value = value;
+    version->end = seq;
+    version->hash = hash;
+    version->key_len = (uint32_t)key_len;
+    memcpy(version->key, key, key_len);
+
+    size_t b = hash & (map->bucket_count - 1);
+    version->chain = map->buckets[b];
+    map->buckets[b] = version;
+    version->next = NULL;
+    if (map->newest) {
+        map->newest->next = version;
+    } else {
+        map->oldest = version;
+    }
+    map->newest = version;
+    map->count++;
+    return 0;
+}
+
+// Finds the state a snapshot at `seq` sees. Returns 1 and sets *out_version
+// (whose value may be NULL for an absent key) if a later change replaced
+// it, 0 if the current state is the one to read.
+static int version_find(const version_map_t* map, const char* key,
+                        size_t key_len, uint64_t hash, uint64_t seq,
+                        const kv_version_t** out_version) {
+    if (!map->buckets) return 0;
+
+    const kv_version_t* found = NULL;
+    for (const kv_version_t* v = map->buckets[hash & (map->bucket_count - 1)];
+         v && v->end > seq; v = v->chain) {
+        if (v->hash == hash && v->key_len == key_len &&
+            memcmp(v->key, key, key_len) == 0) {
+            found = v; // Chains run newest first; keep the earliest change
+        }
+    }
+    *out_version = found;
+    return found != NULL;
+}
+
+// Called for every change with the shard's write lock held, after the change
+// is numbered. Seq-cst ordering pairs with ditto_snapshot_open(): either the
+// change sees the new view and records history, or the view's seq already
+// covers the change.
+static int32_t db_track_change(ditto_db_t* db, hash_table_t* table,
+                               const char* key, size_t key_len, uint64_t hash,
+                               uint64_t seq) {
+    uint64_t oldest = atomic_load(&db->view_oldest);
+    version_map_expire(&table->versions, oldest);
+    if (oldest == UINT64_MAX) {
+        return 0;
+    }
+    return version_record(table, key, key_len, hash, seq);
+}
+
+// ============================================================================
+// Change Journal
+// ============================================================================
+
+// Changes kept across all shards unless ditto_options_t says otherwise, and
+// the key bytes budgeted per record; longer keys just keep fewer records.
+#define DITTO_JOURNAL_CAPACITY 16384
+#define JOURNAL_KEY_BYTES      32
+
+static int32_t journal_init(change_journal_t* j, size_t records) {
+    if (records == 0) {
+        return 0;
+    }
+    size_t count = 1;
+    while (count < records) count <<= 1;
+    j->records = (journal_record_t*)malloc(count * sizeof(journal_record_t));
+    j->keys = (char*)malloc(count * JOURNAL_KEY_BYTES);
+    if (!j->records || !j->keys) {
+        journal_release(j);
+        return -1;
+    }
+    j->record_mask = count - 1;
+    j->key_mask = count * JOURNAL_KEY_BYTES - 1;
+    return 0;
+}
+
+static void journal_release(change_journal_t* j) {
+    free(j->records);
+    free(j->keys);
+    j->records = NULL;
+    j->keys = NULL;
+}
+
+// Records an applied change; called with the shard's write lock held, in
+// the critical section that numbered it, so records stay in seq order.
+static void journal_append(change_journal_t* j, uint64_t seq, uint32_t op,
+                           const char* key, size_t key_len) {
+    if (!j->records || key_len > j->key_mask + 1) {
+        // Nothing to keep it in: everything up to here is gone
+        j->head = j->tail;
+        j->key_head = j->key_tail;
+        j->floor = seq;
+        return;
+    }
+
+    while (j->tail - j->head > j->record_mask ||
+           j->key_tail + key_len - j->key_head > j->key_mask + 1) {
+        const journal_record_t* old = &j->records[j->head & j->record_mask];
+        j->floor = old->seq;
+        j->key_head = old->key_pos + old->key_len;
+        j->head++;
+    }
+
+    size_t pos = (size_t)(j->key_tail & j->key_mask);
+    size_t first = j->key_mask + 1 - pos;
+    if (first > key_len) first = key_len;
+    memcpy(j->keys + pos, key, first);
+    memcpy(j->keys, key + first, key_len - first);
+
+    j->records[j->tail & j->record_mask] = (journal_record_t){
+        seq, j->key_tail, (uint32_t)key_len, op};
+    j->tail++;
+    j->key_tail += key_len;
+}
+
+static void journal_copy_key(const change_journal_t* j,
+                             const journal_record_t* rec, char* dst) {
+    size_t pos = (size_t)(rec->key_pos & j->key_mask);
+    size_t first = j->key_mask + 1 - pos;
+    if (first > rec->key_len) first = rec->key_len;
+    memcpy(dst, j->keys + pos, first);
+    memcpy(dst + first, j->keys, rec->key_len - first);
+}
+
+// Index of the first record numbered after `seq`.
+static uint64_t journal_find(const change_journal_t* j, uint64_t seq) {
+    uint64_t lo = j->head;
+    uint64_t hi = j->tail;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (j->records[mid & j->record_mask].seq <= seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Changes copied out of the shards' journals by ditto_changes_since()
+typedef struct {
+    uint64_t seq;
+    uint32_t op;
+    uint32_t key_len;
+    size_t key_off;             // into journal_scan_t.keys
+} journal_hit_t;
+
+typedef struct {
+    journal_hit_t* hits;
+    size_t count;
+    size_t capacity;
+    char* keys;
+    size_t keys_len;
+    size_t keys_cap;
+} journal_scan_t;
+
+// Size of a change as ditto_changes_since() writes it: seq, op, key length
+#define JOURNAL_OUT_HEADER (sizeof(uint64_t) + 2 * sizeof(uint32_t))
+
+// Copies a shard's changes in (since, limit] whose seq order could put them
+// in a reply of `budget` bytes; called with the shard's lock held.
+static int32_t journal_collect(journal_scan_t* scan, const change_journal_t* j,
+                               uint64_t since, uint64_t limit, size_t budget) {
+    size_t bytes = 0;
+    for (uint64_t i = journal_find(j, since); i < j->tail && bytes <= budget; i++) {
+        const journal_record_t* rec = &j->records[i & j->record_mask];
+        if (rec->seq > limit) {
+            break;
+        }
+
+        if (scan->count == scan->capacity) {
+            size_t cap = scan->capacity ? scan->capacity * 2 : 64;
+            journal_hit_t* hits =
+                (journal_hit_t*)realloc(scan->hits, cap * sizeof(journal_hit_t));
+            if (!hits) return -1;
+            scan->hits = hits;
+            scan->capacity = cap;
+        }
+        if (scan->keys_cap - scan->keys_len < rec->key_len) {
+            size_t cap = scan->keys_cap ? scan->keys_cap : 1024;
+            while (cap - scan->keys_len < rec->key_len) cap *= 2;
+            char* keys = (char*)realloc(scan->keys, cap);
+            if (!keys) return -1;
+            scan->keys = keys;
+            scan->keys_cap = cap;
+        }
+
+        journal_copy_key(j, rec, scan->keys + scan->keys_len);
+        scan->hits[scan->count++] = (journal_hit_t){rec->seq, rec->op,
+                                                    rec->key_len, scan->keys_len};
+        scan->keys_len += rec->key_len;
+        bytes += JOURNAL_OUT_HEADER + rec->key_len;
+    }
+    return 0;
+}
+
+static int journal_hit_compare(const void* a, const void* b) {
+    uint64_t x = ((const journal_hit_t*)a)->seq;
+    uint64_t y = ((const journal_hit_t*)b)->seq;
+    return (x > y) - (x < y);
+}
+
+// ============================================================================
+// Logged Writes
+// ============================================================================
+
+// Numbers a change. Called under the shard's write lock, so a compaction that
+// reads the counter under the same lock knows which entries it has seen.
+// Sequentially consistent for db_track_change().
+static uint64_t db_next_seq(ditto_db_t* db) {
+    return atomic_fetch_add(&db->write_seq, 1) + 1;
+}
+
+// Applies a put to a shard whose write lock the caller holds, and appends it
+// to the log in the same critical section so log order matches apply order.
+// *inout_lsn is raised to the log position the caller must commit.
+static int32_t db_put_locked(ditto_db_t* db, hash_table_t* table,
+                             const char* key, size_t key_len, uint64_t hash,
+                             const uint8_t* data, size_t len,
+                             uint64_t* inout_lsn) {
+    if (db->wal && wal_failed(db->wal)) {
+        return -1;
+    }
+
+    uint64_t seq = db_next_seq(db);
+    if (db_track_change(db, table, key, key_len, hash, seq) != 0) {
+        return -1;
+    }
+
+    STAT_ADD(table->stats.puts, 1);
+    int32_t rc = hash_table_put_locked(table, key, key_len, hash, data, len, seq);
+    if (rc == 0) {
+        journal_append(&table->journal, seq, DITTO_OP_PUT, key, key_len);
+    }
+    if (rc == 0 && db->wal) {
+        uint64_t lsn = 0;
+        TRACE_BEGIN(span);
+        rc = wal_append(db->wal, WAL_RECORD_PUT, key, key_len, data, len, &lsn);
+        TRACE_END(span, TRACE_LOG_APPEND);
+        if (lsn > *inout_lsn) *inout_lsn = lsn;
+    }
+    return rc;
+}
+
+static int32_t db_delete_locked(ditto_db_t* db, hash_table_t* table,
+                                const char* key, size_t key_len, uint64_t hash,
+                                uint64_t* inout_lsn) {
+    if (db->wal && wal_failed(db->wal)) {
+        return -1;
+    }
+
+    uint64_t seq = db_next_seq(db);
+    if (db_track_change(db, table, key, key_len, hash, seq) != 0) {
+        return -1;
+    }
+
+    STAT_ADD(table->stats.deletes, 1);
+    int32_t rc = hash_table_delete_locked(table, key, key_len, hash, seq);
+    if (rc == 0) {
+        journal_append(&table->journal, seq, DITTO_OP_DELETE, key, key_len);
+    }
+    if (rc == 0 && db->wal) {
+        uint64_t lsn = 0;
+        TRACE_BEGIN(span);
+        rc = wal_append(db->wal, WAL_RECORD_DELETE, key, key_len, NULL, 0, &lsn);
+        TRACE_END(span, TRACE_LOG_APPEND);
+        if (lsn > *inout_lsn) *inout_lsn = lsn;
+    }
+    return rc;
+}
+
+// Waits for the log to cover `lsn` according to the durability mode.
+static int32_t db_commit(ditto_db_t* db, uint64_t lsn) {
+    if (!db->wal || lsn == 0) {
+        return 0;
+    }
+    TRACE_BEGIN(span);
+    int32_t rc = wal_commit(db->wal, lsn);
+    TRACE_END(span, TRACE_COMMIT);
+    return rc;
+}
+
+static int32_t replay_apply(void* ctx, uint8_t type, const char* key,
+                            size_t key_len, const uint8_t* value,
+                            size_t value_len) {
+    ditto_db_t* db = (ditto_db_t*)ctx;
+
+    uint64_t hash = hash_key(db, key, key_len);
+    hash_table_t* table = shard_for(db, hash);
+    int32_t rc;
+    shard_wrlock(table);
+    if (type == WAL_RECORD_PUT) {
+        rc = hash_table_put_locked(table, key, key_len, hash, value, value_len,
+                                   db_next_seq(db));
+    } else if (type == WAL_RECORD_EXPIRE) {
+        // Already expired ones fire as soon as the expiry thread starts
+        rc = ttl_arm(&table->ttl, key, key_len, hash, get_u64(value));
+    } else if (type == WAL_RECORD_RANGE) {
+        uint64_t offset = get_u64(value);
+        size_t at = (size_t)offset;
+        rc = offset > SIZE_MAX ? -1
+                               : hash_table_splice_locked(table, key, key_len, hash,
+                                                          &at, 0, 1, value + 8,
+                                                          value_len - 8,
+                                                          db_next_seq(db));
+        if (rc == 2) rc = 0; // As for a delete, a missing key is harmless
+    } else {
+        // A delete of a key that is already gone is harmless
+        rc = hash_table_delete_locked(table, key, key_len, hash, db_next_seq(db));
+        if (rc == 2) rc = 0;
+    }
+    pthread_rwlock_unlock(&table->lock);
+    return rc;
+}
+
+// ============================================================================
+// Snapshot Compaction
+// ============================================================================
+
+// Default compact_log_bytes: the maintenance worker folds the delta into a
+// new snapshot once the current log generation has grown past this.
+#ifndef DITTO_COMPACT_LOG_BYTES
+#define DITTO_COMPACT_LOG_BYTES (64u << 20)
+#endif
+#define DITTO_MAINT_IO_CHUNK (256u << 10)   // bytes written between rate checks
+
+// Paces maintenance to a share of one core and a write rate; a NULL pace
+// (ditto_compact_now()) runs flat out.
+typedef struct {
+    ditto_db_t* db;
+    uint32_t cpu_percent;       // 1-100
+    uint64_t io_rate;           // bytes per second, 0 = unlimited
+    uint64_t io_start_ns;
+    uint64_t io_bytes;          // written since io_start_ns
+    uint64_t io_checked;        // io_bytes at the last rate check
+} maint_pace_t;
+
+// Sleeps up to `ns` unless the store is closing; returns nonzero if it is.
+static int maint_sleep(ditto_db_t* db, uint64_t ns) {
+    pthread_mutex_lock(&db->maint_lock);
+    if (ns > 0 && !atomic_load(&db->maint_stopping)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t nsec = (uint64_t)deadline.tv_nsec + ns;
+        deadline.tv_sec += (time_t)(nsec / 1000000000u);
+        deadline.tv_nsec = (long)(nsec % 1000000000u);
+        pthread_cond_timedwait(&db->maint_wake, &db->maint_lock, &deadline);
+    }
+    int stopping = atomic_load(&db->maint_stopping);
+    pthread_mutex_unlock(&db->maint_lock);
+    return stopping;
+}
+
+// Rests after `work_ns` of work long enough to stay within the CPU share.
+// Returns nonzero once the store is closing.
+static int maint_pace_cpu(maint_pace_t* pace, uint64_t work_ns) {
+    if (!pace) return 0;
+    uint64_t rest = work_ns * (100 - pace->cpu_percent) / pace->cpu_percent;
+    return maint_sleep(pace->db, rest);
+}
+
+// Counts `bytes` written and rests whenever writing runs ahead of the rate.
+// Once the store is closing, the rest is written unthrottled.
+static void maint_pace_io(maint_pace_t* pace, size_t bytes) {
+    if (!pace || pace->io_rate == 0) return;
+    if (pace->io_bytes == 0) {
+        pace->io_start_ns = monotonic_ns();
+    }
+    pace->io_bytes += bytes;
+    if (pace->io_bytes - pace->io_checked < DITTO_MAINT_IO_CHUNK) return;
+
+    pace->io_checked = pace->io_bytes;
+    uint64_t due = (uint64_t)((double)pace->io_bytes * 1e9 / (double)pace->io_rate);
+    uint64_t elapsed = monotonic_ns() - pace->io_start_ns;
+    if (due > elapsed && maint_sleep(pace->db, due - elapsed)) {
+        pace->io_rate = 0;
+    }
+}
+
+// A delta entry copied out of its shard for the snapshot being written
+typedef struct {
+    char* key;
+    size_t key_len;
+    uint64_t hash;
+    kv_value_t* value;      // NULL = deleted
+} compact_item_t;
+
+typedef struct {
+    compact_item_t* items;
+    size_t count;
+    size_t capacity;
+} compact_list_t;
+
+static int compact_item_compare(const void* a, const void* b) {
+    const compact_item_t* x = (const compact_item_t*)a;
+    const compact_item_t* y = (const compact_item_t*)b;
+    return key_compare(x->key, x->key_len, y->key, y->key_len);
+}
+
+static int32_t compact_collect(compact_list_t* list, const slot_array_t* arr) {
+    for (size_t i = 0; arr->slots && i < arr->capacity; i++) {
+        const kv_slot_t* slot = &arr->slots[i];
+        if (slot->entry == NULL || slot->entry == SLOT_TOMBSTONE) continue;
+
+        if (list->count == list->capacity) {
+            size_t capacity = list->capacity ? list->capacity * 2 : 256;
+            compact_item_t* items = (compact_item_t*)realloc(
+                list->items, capacity * sizeof(compact_item_t));
+            if (!items) return -1;
+            list->items = items;
+            list->capacity = capacity;
+        }
+
+        kv_entry_t* entry = slot->entry;
+        compact_item_t* item = &list->items[list->count];
+        item->key = strdup(entry->key);
+        if (!item->key) return -1;
+        item->key_len = entry->key_len;
+        item->hash = slot->hash;
+        item->value = entry->value;
+        if (item->value) {
+            value_retain(item->value);
+        }
+        list->count++;
+    }
+    return 0;
+}
+
+static void compact_list_free(compact_list_t* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i].key);
+        if (list->items[i].value) {
+            value_release(list->items[i].value);
+        }
+    }
+    free(list->items);
+}
+
+// Merges the sorted delta with the old snapshot into a new one in `dir`.
+// Delta entries win over the base; deletions drop the key. Snapshots hold
+// values uncompressed, so readers of the mapping can use them in place.
+static int32_t compact_write(const char* dir, uint64_t hash_seed,
+                             const snapshot_t* base,
+                             const compact_list_t* delta, uint64_t log_gen,
+                             maint_pace_t* pace) {
+    snapshot_writer_t* w = NULL;
+    if (snapshot_writer_begin(dir, hash_seed, &w) != 0) {
+        return -1;
+    }
+
+    size_t n_base = base ? snapshot_count(base) : 0;
+    size_t bi = 0;
+    size_t di = 0;
+    uint8_t* unpacked = NULL;
+    size_t unpacked_cap = 0;
+    int32_t rc = 0;
+    while (rc == 0 && (bi < n_base || di < delta->count)) {
+        const char* key = NULL;
+        size_t key_len = 0;
+        uint64_t hash = 0;
+        const uint8_t* value = NULL;
+        size_t value_len = 0;
+        if (bi < n_base) {
+            snapshot_entry(base, bi, &key, &key_len, &hash, &value, &value_len);
+        }
+
+        int cmp;
+        if (bi == n_base) {
+            cmp = 1;
+        } else if (di == delta->count) {
+            cmp = -1;
+        } else {
+            const compact_item_t* item = &delta->items[di];
+            cmp = key_compare(key, key_len, item->key, item->key_len);
+        }
+
+        if (cmp < 0) {
+            rc = snapshot_writer_add(w, key, key_len, hash, value, value_len);
+            maint_pace_io(pace, key_len + value_len);
+            bi++;
+            continue;
+        }
+
+        const compact_item_t* item = &delta->items[di++];
+        if (cmp == 0) {
+            bi++; // Shadowed by the delta
+        }
+        if (item->value && item->value->compressed) {
+            if (unpacked_cap < item->value->len) {
+                uint8_t* buf = (uint8_t*)realloc(unpacked, item->value->len);
+                if (!buf) {
+                    rc = -1;
+                    break;
+                }
+                unpacked = buf;
+                unpacked_cap = item->value->len;
+            }
+            rc = value_unpack(item->value, unpacked);
+            if (rc == 0) {
+                rc = snapshot_writer_add(w, item->key, item->key_len, item->hash,
+                                         unpacked, item->value->len);
+            }
+        } else if (item->value) {
+            rc = snapshot_writer_add(w, item->key, item->key_len, item->hash,
+                                     value_bytes(item->value), item->value->len);
+        }
+        maint_pace_io(pace, item->key_len + (item->value ? item->value->len : 0));
+    }
+    free(unpacked);
+
+    if (rc != 0) {
+        snapshot_writer_abort(w);
+        return -1;
+    }
+    return snapshot_writer_finish(w, log_gen);
+}
+
+// Drops entries the new snapshot already holds: everything changed at or
+// before the shard's collection point `seq`.
+static void compact_fold(hash_table_t* table, slot_array_t* arr, uint64_t seq) {
+    for (size_t i = 0; arr->slots && i < arr->capacity; i++) {
+        kv_slot_t* slot = &arr->slots[i];
+        if (slot->entry == NULL || slot->entry == SLOT_TOMBSTONE) continue;
+        kv_entry_t* entry = slot->entry;
+        if (entry->seq <= seq) {
+            table->payload_bytes -= entry_payload(entry);
+            slot->entry = SLOT_TOMBSTONE;
+            shard_retire(table, RETIRE_ENTRY, entry);
+            table->count--;
+        }
+    }
+}
+
+// Folds the delta into a new snapshot and retires the log it replaces,
+// writing the snapshot at `pace` (NULL = flat out). Writers keep going
+// meanwhile: each shard is locked only to copy its delta out, and again to
+// swap in the new snapshot and drop what it now covers. Returns 0 on
+// success, -1 on error (the store is unchanged).
+static int32_t db_compact(ditto_db_t* db, maint_pace_t* pace) {
+    if (!db->wal) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&db->compact_lock);
+
+    // Changes applied before the rotation are all in generations below gen;
+    // later ones may also reach the snapshot, which replay tolerates since
+    // every record overwrites or deletes its key outright.
+    uint64_t gen = 0;
+    if (wal_rotate(db->wal, &gen) != 0) {
+        pthread_mutex_unlock(&db->compact_lock);
+        return -1;
+    }
+
+    // Every shard shares the snapshot installed by the previous compaction
+    snapshot_t* base = db->shards[0].base;
+    if (base) {
+        snapshot_retain(base);
+    }
+
+    compact_list_t delta = {0};
+    uint64_t* seqs = (uint64_t*)calloc(db->shard_count, sizeof(uint64_t));
+    int32_t rc = seqs ? 0 : -1;
+    size_t collected = 0;
+    for (; rc == 0 && collected < db->shard_count; collected++) {
+        hash_table_t* table = &db->shards[collected];
+        shard_wrlock(table);
+        seqs[collected] = atomic_load_explicit(&db->write_seq, memory_order_relaxed);
+        rc = compact_collect(&delta, &table->active);
+        if (rc == 0) {
+            rc = compact_collect(&delta, &table->draining);
+        }
+        // Until the new snapshot is installed, a delete of a collected key
+        // must leave a marker, or the snapshot would bring the key back
+        table->compacting = 1;
+        pthread_rwlock_unlock(&table->lock);
+    }
+
+    snapshot_t* snap = NULL;
+    if (rc == 0) {
+        qsort(delta.items, delta.count, sizeof(compact_item_t), compact_item_compare);
+        rc = compact_write(db->path, db->hash_seed, base, &delta, gen, pace);
+    }
+    if (rc == 0) {
+        rc = snapshot_open(db->path, &snap);
+        if (rc == 0 && !snap) rc = -1;
+    }
+
+    uint64_t lsn = 0;
+    int32_t relog_rc = 0;
+    for (size_t i = 0; i < collected; i++) {
+        hash_table_t* table = &db->shards[i];
+        shard_wrlock(table);
+        if (rc == 0 && relog_rc == 0) {
+            relog_rc = ttl_log_pending(&table->ttl, db->wal, &lsn);
+        }
+        if (rc == 0) {
+            // Lock-free readers look at the base after missing in the
+            // delta, so it must hold the keys before they are dropped
+            snapshot_t* old = table->base;
+            snapshot_retain(snap);
+            table->base = snap;
+            table->base_seq = seqs[i];
+            if (old) {
+                shard_retire(table, RETIRE_SNAPSHOT, old);
+            }
+            skip_remove_through(table, seqs[i]);
+            compact_fold(table, &table->active, seqs[i]);
+            compact_fold(table, &table->draining, seqs[i]);
+        }
+        table->compacting = 0;
+        pthread_rwlock_unlock(&table->lock);
+    }
+
+    if (rc == 0 && relog_rc == 0 && db_commit(db, lsn) == 0) {
+        wal_remove_before(db->wal, gen);
+    }
+    if (rc == 0) {
+        snapshot_release(snap);
+        STAT_ADD(db->compactions, 1);
+    }
+    if (base) {
+        snapshot_release(base);
+    }
+    compact_list_free(&delta);
+    free(seqs);
+    pthread_mutex_unlock(&db->compact_lock);
+    return rc;
+}
+
+// ============================================================================
+// Background Maintenance
+// ============================================================================
+
+// A worker thread wakes every maintenance_interval_ms to compact the log
+// once it passes compact_log_bytes, drain resizes and shrink tables left
+// sparse by deletes, and repack fragmented slabs. It works on one shard at a
+// time in bounded steps, skips a shard whose lock is taken rather than wait
+// for it, and rests after each step to stay within maintenance_cpu_percent
+// of one core. While foreground lock waits average above
+// maintenance_pause_wait_us it sits rounds out, at most DITTO_MAINT_MAX_PAUSES
+// in a row so the log cannot grow without bound.
+#ifndef DITTO_MAINT_INTERVAL_MS
+#define DITTO_MAINT_INTERVAL_MS 1000
+#endif
+#define DITTO_MAINT_CPU_PERCENT 10
+#define DITTO_MAINT_PAUSE_WAIT_US 1000
+#define DITTO_MAINT_MAX_PAUSES 8
+#define DITTO_MAINT_STEP 4096           // slots visited per lock hold
+#define DITTO_REPACK_FILL_PCT 25        // chunks this full or less are evacuated
+
+// Copies a slab value into a fresh block, so the caller can retire the old.
+static kv_value_t* value_move(hash_table_t* table, const kv_value_t* value) {
+    size_t stored = value_stored_len(value);
+    uint8_t size_class;
+    kv_value_t* moved = (kv_value_t*)slab_alloc(table->slab,
+                                                sizeof(kv_value_t) + stored,
+                                                &size_class);
+    if (!moved) return NULL;
+    atomic_init(&moved->refs, 1);
+    moved->size_class = size_class;
+    moved->mapped = 0;
+    moved->compressed = value->compressed;
+    moved->block_shift = 0;
+    moved->len = value->len;
+    moved->owner = table->slab;
+    memcpy(moved->data, value->data, stored);
+    return moved;
+}
+
+// Copies an entry into a fresh block and links the copy into the skiplist
+// in its place; the caller swaps it into the slot and retires the old block.
+static kv_entry_t* entry_move(hash_table_t* table, kv_entry_t* entry) {
+    uint8_t size_class;
+    kv_entry_t* moved = (kv_entry_t*)slab_alloc(
+        table->slab, entry_block_size(entry->key_len, entry->height), &size_class);
+    if (!moved) return NULL;
+    atomic_init(&moved->value, entry->value);
+    moved->seq = entry->seq;
+    moved->key_len = entry->key_len;
+    moved->size_class = size_class;
+    moved->height = entry->height;
+    atomic_init(&moved->referenced, atomic_load(&entry->referenced));
+    memcpy(moved->key, entry->key, entry->key_len + 1);
+    memcpy(entry_next(moved), entry_next(entry), entry->height * sizeof(kv_entry_t*));
+
+    kv_entry_t* preds[SKIP_MAX_HEIGHT];
+    skip_find_preds(table, entry->key, entry->key_len, 1, preds);
+    for (int level = 0; level < entry->height; level++) {
+        kv_entry_t** link = skip_link(table, preds[level], level);
+        if (*link == entry) {
+            *link = moved;
+        }
+    }
+    return moved;
+}
+
+// Moves the entries and values of up to `budget` slots out of the chunks the
+// slab is evacuating, continuing from repack_pos through the active and
+// then the draining array. Lock-free readers may still hold the old blocks,
+// so they are retired; views keep a value's old block until released.
+// Returns 1 once every slot was visited. The caller holds the write lock.
+static int hash_table_evacuate(hash_table_t* table, size_t budget) {
+    while (budget-- > 0) {
+        slot_array_t* arr = &table->active;
+        size_t pos = table->repack_pos;
+        if (pos >= arr->capacity) {
+            pos -= arr->capacity;
+            arr = &table->draining;
+            if (pos >= arr->capacity) return 1;
+        }
+        table->repack_pos++;
+
+        kv_slot_t* slot = &arr->slots[pos];
+        kv_entry_t* entry = slot->entry;
+        if (entry == NULL || entry == SLOT_TOMBSTONE) continue;
+        kv_value_t* value = entry->value;
+        if (value && slab_block_evacuating(value, value->size_class)) {
+            kv_value_t* moved = value_move(table, value);
+            if (moved) {
+                entry->value = moved;
+                shard_retire(table, RETIRE_VALUE, value);
+            }
+        }
+        if (slab_block_evacuating(entry, entry->size_class)) {
+            kv_entry_t* moved = entry_move(table, entry);
+            if (moved) {
+                slot->entry = moved;
+                shard_retire(table, RETIRE_MOVED, entry);
+            }
+        }
+    }
+    return 0;
+}
+
+// Whether the shard's slab holds at least twice what its entries need, by
+// a rough per-entry estimate, or still has chunks being evacuated.
+static int hash_table_fragmented(const hash_table_t* table) {
+    uint64_t live = table->payload_bytes +
+                    table->count * (sizeof(kv_entry_t) + sizeof(kv_value_t) + 32);
+    uint64_t held = slab_allocated_bytes(table->slab);
+    return table->evacuating > 0 || (held > live * 2 && held - live >= (256u << 10));
+}
+
+#define MAINT_RESIZE   0        // drain a resize, start a shrink
+#define MAINT_REPACK   1        // return empty chunks, mark sparse ones
+#define MAINT_EVACUATE 2        // move blocks out of the marked chunks
+#define MAINT_RELEASE  3        // ditto_compact_now(): return what emptied
+#define MAINT_DONE     4
+
+// One bounded step of a shard's maintenance; returns the phase to go on
+// with and adds chunk bytes returned to *released. `now` waits out readers
+// so retired blocks are freed at once. The caller holds the write lock.
+static int shard_maint_step(hash_table_t* table, int phase, int now,
+                            uint64_t* released) {
+    if (phase == MAINT_RESIZE) {
+        if (table->draining.slots) {
+            hash_table_migrate(table, DITTO_MAINT_STEP);
+            return MAINT_RESIZE;
+        }
+        return hash_table_shrink(table) ? MAINT_RESIZE : MAINT_REPACK;
+    }
+    if (phase == MAINT_EVACUATE) {
+        if (!hash_table_evacuate(table, DITTO_MAINT_STEP)) {
+            return MAINT_EVACUATE;
+        }
+        return now ? MAINT_RELEASE : MAINT_DONE;
+    }
+
+    shard_reclaim(table, now);
+    if (now) {
+        shard_reclaim(table, now);
+    }
+    if (!now && !hash_table_fragmented(table)) {
+        return MAINT_DONE;
+    }
+    uint64_t freed = 0;
+    table->evacuating = slab_repack(table->slab,
+                                    phase == MAINT_REPACK ? DITTO_REPACK_FILL_PCT : 0,
+                                    &freed);
+    *released += freed;
+    table->repack_pos = 0;
+    return phase == MAINT_REPACK && table->evacuating > 0 ? MAINT_EVACUATE : MAINT_DONE;
+}
+
+// Runs a shard's maintenance a step per lock hold. Paced, leaves the shard
+// for the next round if its lock is taken and rests between steps; unpaced,
+// waits for the lock. Returns nonzero once the store is closing.
+static int shard_maintain(hash_table_t* table, maint_pace_t* pace,
+                          uint64_t* released) {
+    int phase = MAINT_RESIZE;
+    while (phase != MAINT_DONE) {
+        uint64_t start = monotonic_ns();
+        if (!pace) {
+            shard_wrlock(table);
+        } else if (pthread_rwlock_trywrlock(&table->lock) != 0) {
+            return 0;
+        }
+        phase = shard_maint_step(table, phase, pace == NULL, released);
+        pthread_rwlock_unlock(&table->lock);
+        if (maint_pace_cpu(pace, monotonic_ns() - start)) return 1;
+    }
+    return 0;
+}
+
+// Maintains every shard once. Returns nonzero once the store is closing.
+static int db_maintain(ditto_db_t* db, maint_pace_t* pace) {
+    uint64_t released = 0;
+    int stopping = 0;
+    for (size_t i = 0; !stopping && i < db->shard_count; i++) {
+        stopping = shard_maintain(&db->shards[i], pace, &released);
+    }
+    STAT_ADD(db->slab_released, released);
+    if (!stopping) {
+        STAT_ADD(db->maint_rounds, 1);
+    }
+    return stopping;
+}
+
+// Whether shard lock waits since the last call averaged above the pause
+// threshold. Reads the lock statistics, so never with -DDITTO_STATS=OFF.
+static int maint_foreground_slow(ditto_db_t* db, uint64_t* contended,
+                                 uint64_t* wait_ns) {
+    uint64_t c = 0;
+    uint64_t w = 0;
+    for (size_t i = 0; i < db->shard_count; i++) {
+        c += stat_load(&db->shards[i].stats.lock.contended);
+        w += stat_load(&db->shards[i].stats.lock.wait_ns);
+    }
+    uint64_t waits = c - *contended;
+    uint64_t waited = w - *wait_ns;
+    *contended = c;
+    *wait_ns = w;
+    return db->maint_pause_wait_us > 0 && waits > 0 &&
+           waited / waits > (uint64_t)db->maint_pause_wait_us * 1000u;
+}
+
+// A worker round over one store: compacts its log once it has grown past
+// the threshold, then maintains its shards. Returns nonzero once the store
+// the pace belongs to is closing.
+static int maint_round(ditto_db_t* db, maint_pace_t* pace) {
+    if (db->wal && db->compact_log_bytes > 0 && !wal_failed(db->wal) &&
+        wal_generation_bytes(db->wal) >= db->compact_log_bytes) {
+        // A failed compaction leaves everything in place; retried next round
+        TRACE_BEGIN(compaction);
+        db_compact(db, pace);
+        TRACE_END(compaction, TRACE_COMPACTION);
+    }
+    TRACE_BEGIN(span);
+    int stopping = db_maintain(db, pace);
+    TRACE_END(span, TRACE_MAINTENANCE);
+    return stopping;
+}
+
+static void* maint_main(void* arg) {
+    ditto_db_t* db = (ditto_db_t*)arg;
+    uint64_t contended = 0;
+    uint64_t wait_ns = 0;
+    unsigned paused = 0;
+    TRACE_THREAD_NAME("ditto maintenance");
+    while (!maint_sleep(db, (uint64_t)db->maint_interval_ms * 1000000u)) {
+        if (maint_foreground_slow(db, &contended, &wait_ns) &&
+            paused < DITTO_MAINT_MAX_PAUSES) {
+            paused++;
+            STAT_ADD(db->maint_pauses, 1);
+            continue;
+        }
+        paused = 0;
+
+        // Collections share the store's worker and budget
+        maint_pace_t pace = {db, db->maint_cpu_percent, db->maint_io_rate, 0, 0, 0};
+        int stopping = maint_round(db, &pace);
+        for (ditto_coll_t* coll = atomic_load_explicit(&db->colls, memory_order_acquire);
+             coll && !stopping; coll = coll->next) {
+            stopping = maint_round(coll->db, &pace);
+        }
+        if (stopping) break;
+    }
+    return NULL;
+}
+
+static void maint_stop(ditto_db_t* db) {
+    if (!db->maint_running) return;
+
+    pthread_mutex_lock(&db->maint_lock);
+    atomic_store(&db->maint_stopping, 1);
+    pthread_cond_signal(&db->maint_wake);
+    pthread_mutex_unlock(&db->maint_lock);
+    pthread_join(db->maint, NULL);
+    db->maint_running = 0;
+}
+
+static int32_t db_compact_now(ditto_db_t* db) {
+    TRACE_BEGIN(compaction);
+    int32_t rc = db_compact(db, NULL);
+    TRACE_END(compaction, TRACE_COMPACTION);
+    TRACE_BEGIN(span);
+    db_maintain(db, NULL);
+    TRACE_END(span, TRACE_MAINTENANCE);
+    return rc;
+}
+
+DITTO_API int32_t ditto_compact_now(ditto_db_t* db) {
+    if (!db) return -1;
+
+    int32_t rc = db_compact_now(db);
+    for (ditto_coll_t* coll = atomic_load_explicit(&db->colls, memory_order_acquire);
+         coll; coll = coll->next) {
+        if (db_compact_now(coll->db) != 0) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+// ============================================================================
+// Ordered Scans
+// ============================================================================
+
+struct ditto_cursor {
+    ditto_db_t* db;
+    char* lower;                // NULL = from the first key
+    size_t lower_len;
+    int lower_inclusive;
+    char* upper;                // exclusive bound, NULL = through the last key
+    size_t upper_len;
+    int done;
+};
+
+// Merges every shard's skiplist with the snapshot it reads through to into
+// one ascending stream of live keys. A compaction swaps snapshots one shard
+// at a time, so shards may briefly disagree on their base; each base is
+// walked once, yielding only the keys of shards that use it. The caller
+// holds every shard's read lock while the iterator is in use.
+typedef struct {
+    ditto_db_t* db;
+    kv_entry_t* delta[DITTO_MAX_SHARDS];
+    size_t n_bases;
+    snapshot_t* bases[DITTO_MAX_SHARDS];
+    uint32_t base_shards[DITTO_MAX_SHARDS];     // shards reading each base
+    size_t base_pos[DITTO_MAX_SHARDS];
+} merge_iter_t;
+
+static void db_lock_all_read(ditto_db_t* db) {
+    for (size_t i = 0; i < db->shard_count; i++) {
+        shard_rdlock(&db->shards[i]);
+    }
+}
+
+static void db_unlock_all(ditto_db_t* db) {
+    for (size_t i = db->shard_count; i-- > 0;) {
+        pthread_rwlock_unlock(&db->shards[i].lock);
+    }
+}
+
+// Positions the iterator at the first key at or after `key` (strictly after
+// unless `inclusive`); a NULL key starts at the beginning.
+static void merge_iter_init(merge_iter_t* it, ditto_db_t* db, const char* key,
+                            size_t key_len, int inclusive) {
+    it->db = db;
+    it->n_bases = 0;
+    for (size_t i = 0; i < db->shard_count; i++) {
+        hash_table_t* table = &db->shards[i];
+        it->delta[i] = skip_seek(table, key, key_len, inclusive);
+        if (!table->base) continue;
+
+        size_t b = 0;
+        while (b < it->n_bases && it->bases[b] != table->base) b++;
+        if (b == it->n_bases) {
+            it->bases[b] = table->base;
+            it->base_shards[b] = 0;
+            it->base_pos[b] = 0;
+            if (key) {
+                size_t pos = snapshot_lower_bound(table->base, key, key_len);
+                const char* k;
+                size_t k_len;
+                const uint8_t* v;
+                size_t v_len;
+                if (!inclusive && pos < snapshot_count(table->base)) {
+                    snapshot_entry(table->base, pos, &k, &k_len, NULL, &v, &v_len);
+                    if (key_compare(k, k_len, key, key_len) == 0) pos++;
+                }
+                it->base_pos[b] = pos;
+            }
+            it->n_bases++;
+        }
+        it->base_shards[b] |= 1u << i;
+    }
+}
+
+// Returns 1 with the next live key and its value, 0 at the end. The bytes
+// stay valid while the shard locks are held. *out_packed is the value when
+// it is compressed, and NULL when *out_value holds the bytes themselves.
+static int merge_iter_next(merge_iter_t* it, const char** out_key,
+                           size_t* out_key_len, const uint8_t** out_value,
+                           size_t* out_value_len, const kv_value_t** out_packed) {
+    ditto_db_t* db = it->db;
+    for (;;) {
+        const char* key = NULL;
+        size_t key_len = 0;
+        size_t from_delta = SIZE_MAX;
+        size_t from_base = SIZE_MAX;
+        const uint8_t* base_value = NULL;
+        size_t base_len = 0;
+
+        for (size_t i = 0; i < db->shard_count; i++) {
+            kv_entry_t* entry = it->delta[i];
+            if (entry && (!key || key_compare(entry->key, entry->key_len,
+                                              key, key_len) < 0)) {
+                key = entry->key;
+                key_len = entry->key_len;
+                from_delta = i;
+            }
+        }
+
+        for (size_t b = 0; b < it->n_bases; b++) {
+            snapshot_t* snap = it->bases[b];
+            size_t count = snapshot_count(snap);
+            while (it->base_pos[b] < count) {
+                const char* k;
+                size_t k_len;
+                uint64_t hash;
+                const uint8_t* v;
+                size_t v_len;
+                snapshot_entry(snap, it->base_pos[b], &k, &k_len, &hash, &v, &v_len);
+                if (!(it->base_shards[b] & (1u << shard_index(db, hash)))) {
+                    it->base_pos[b]++;
+                    continue;
+                }
+                int cmp = key ? key_compare(k, k_len, key, key_len) : -1;
+                if (cmp < 0) {
+                    key = k;
+                    key_len = k_len;
+                    from_delta = SIZE_MAX;
+                    from_base = b;
+                    base_value = v;
+                    base_len = v_len;
+                } else if (cmp == 0) {
+                    from_base = b; // Shadowed by the delta entry
+                }
+                break;
+            }
+        }
+
+        if (!key) {
+            return 0;
+        }
+        if (from_base != SIZE_MAX) {
+            it->base_pos[from_base]++;
+        }
+        if (from_delta == SIZE_MAX) {
+            *out_key = key;
+            *out_key_len = key_len;
+            *out_value = base_value;
+            *out_value_len = base_len;
+            *out_packed = NULL;
+            return 1;
+        }
+
+        kv_entry_t* entry = it->delta[from_delta];
+        it->delta[from_delta] = entry_next(entry)[0];
+        if (entry->value) {
+            *out_key = entry->key;
+            *out_key_len = entry->key_len;
+            *out_value = value_bytes(entry->value);
+            *out_value_len = entry->value->len;
+            *out_packed = entry->value->compressed ? entry->value : NULL;
+            return 1;
+        }
+        // A deletion marker: the key is gone from the base it shadows
+    }
+}
+
+static int32_t cursor_create(ditto_db_t* db, const char* lower, size_t lower_len,
+                             const char* upper, size_t upper_len,
+                             ditto_cursor_t** out_cursor) {
+    ditto_cursor_t* cursor = (ditto_cursor_t*)calloc(1, sizeof(ditto_cursor_t));
+    if (!cursor) {
+        return -1;
+    }
+    cursor->db = db;
+    cursor->lower_inclusive = 1;
+    STAT_ADD(db->scans, 1);
+    if (lower) {
+        cursor->lower = (char*)malloc(lower_len + 1);
+        if (!cursor->lower) {
+            free(cursor);
+            return -1;
+        }
+        memcpy(cursor->lower, lower, lower_len);
+        cursor->lower[lower_len] = '\0';
+        cursor->lower_len = lower_len;
+    }
+    if (upper) {
+        cursor->upper = (char*)malloc(upper_len + 1);
+        if (!cursor->upper) {
+            free(cursor->lower);
+            free(cursor);
+            return -1;
+        }
+        memcpy(cursor->upper, upper, upper_len);
+        cursor->upper[upper_len] = '\0';
+        cursor->upper_len = upper_len;
+    }
+    *out_cursor = cursor;
+    return 0;
+}
+
+// ============================================================================
+// Subscription Management
+// ============================================================================
+
+// FNV-1a, which extends one byte at a time so every prefix of a key can be
+// hashed in a single pass.
+#define SUB_HASH_INIT 2166136261u
+static uint32_t sub_hash_extend(uint32_t hash, const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int32_t sub_list_push(sub_list_t* list, subscription_t* sub) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4;
+        subscription_t** items = (subscription_t**)realloc(
+            list->items, capacity * sizeof(subscription_t*));
+        if (!items) return -1;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = sub;
+    return 0;
+}
+
+// Removes `sub`, keeping the others in subscription order.
+static void sub_list_remove(sub_list_t* list, subscription_t* sub) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->items[i] == sub) {
+            memmove(&list->items[i], &list->items[i + 1],
+                    (list->count - i - 1) * sizeof(subscription_t*));
+            list->count--;
+            return;
+        }
+    }
+}
+
+static sub_group_t* sub_map_find(const sub_map_t* map, uint32_t hash,
+                                 const char* pattern, size_t len) {
+    if (!map->buckets) return NULL;
+    sub_group_t* group = map->buckets[hash & (map->capacity - 1)];
+    for (; group; group = group->next) {
+        if (group->hash == hash && group->pattern_len == len &&
+            memcmp(group->pattern, pattern, len) == 0) {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+static int32_t sub_map_grow(sub_map_t* map) {
+    size_t capacity = map->capacity ? map->capacity * 2 : 16;
+    sub_group_t** buckets = (sub_group_t**)calloc(capacity, sizeof(sub_group_t*));
+    if (!buckets) return -1;
+    for (size_t i = 0; i < map->capacity; i++) {
+        sub_group_t* group = map->buckets[i];
+        while (group) {
+            sub_group_t* next = group->next;
+            size_t b = group->hash & (capacity - 1);
+            group->next = buckets[b];
+            buckets[b] = group;
+            group = next;
+        }
+    }
+    free(map->buckets);
+    map->buckets = buckets;
+    map->capacity = capacity;
+    return 0;
+}
+
+// Drops `sub` from its group, and the group once empty. A group borrows its
+// pattern from a member, so it is re-pointed before that member goes away.
+static void sub_map_remove(sub_map_t* map, subscription_t* sub) {
+    uint32_t hash = sub_hash_extend(SUB_HASH_INIT, sub->pattern, sub->pattern_len);
+    sub_group_t** link = &map->buckets[hash & (map->capacity - 1)];
+    for (; *link; link = &(*link)->next) {
+        sub_group_t* group = *link;
+        if (group->hash != hash || group->pattern_len != sub->pattern_len ||
+            memcmp(group->pattern, sub->pattern, sub->pattern_len) != 0) {
+            continue;
+        }
+        sub_list_remove(&group->subs, sub);
+        if (group->subs.count > 0) {
+            group->pattern = group->subs.items[0]->pattern;
+            return;
+        }
+        *link = group->next;
+        free(group->subs.items);
+        free(group);
+        map->count--;
+        return;
+    }
+}
+
+static int32_t sub_map_add(sub_map_t* map, subscription_t* sub) {
+    uint32_t hash = sub_hash_extend(SUB_HASH_INIT, sub->pattern, sub->pattern_len);
+    sub_group_t* group = sub_map_find(map, hash, sub->pattern, sub->pattern_len);
+    if (!group) {
+        if (map->count >= map->capacity && sub_map_grow(map) != 0) {
+            return -1;
+        }
+        group = (sub_group_t*)calloc(1, sizeof(sub_group_t));
+        if (!group) return -1;
+        group->hash = hash;
+        group->pattern = sub->pattern;
+        group->pattern_len = sub->pattern_len;
+        size_t b = hash & (map->capacity - 1);
+        group->next = map->buckets[b];
+        map->buckets[b] = group;
+        map->count++;
+    }
+    if (sub_list_push(&group->subs, sub) != 0) {
+        if (group->subs.count == 0) {
+            sub_map_remove(map, sub);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+static void sub_map_release(sub_map_t* map) {
+    for (size_t i = 0; i < map->capacity; i++) {
+        sub_group_t* group = map->buckets[i];
+        while (group) {
+            sub_group_t* next = group->next;
+            free(group->subs.items);
+            free(group);
+            group = next;
+        }
+    }
+    free(map->buckets);
+}
+
+// Counts a subscription against its prefix length, keeping the lengths
+// sorted so matching can hash a key's prefixes in one ascending pass.
+static int32_t sub_prefix_len_add(sub_registry_t* reg, size_t len) {
+    size_t i = 0;
+    while (i < reg->n_prefix_lens && reg->prefix_lens[i] < len) i++;
+    if (i < reg->n_prefix_lens && reg->prefix_lens[i] == len) {
+        reg->prefix_len_refs[i]++;
+        return 0;
+    }
+
+    size_t n = reg->n_prefix_lens + 1;
+    size_t* lens = (size_t*)realloc(reg->prefix_lens, n * sizeof(size_t));
+    if (!lens) return -1;
+    reg->prefix_lens = lens;
+    size_t* refs = (size_t*)realloc(reg->prefix_len_refs, n * sizeof(size_t));
+    if (!refs) return -1;
+    reg->prefix_len_refs = refs;
+
+    memmove(&lens[i + 1], &lens[i], (n - 1 - i) * sizeof(size_t));
+    memmove(&refs[i + 1], &refs[i], (n - 1 - i) * sizeof(size_t));
+    lens[i] = len;
+    refs[i] = 1;
+    reg->n_prefix_lens = n;
+    return 0;
+}
+
+static void sub_prefix_len_remove(sub_registry_t* reg, size_t len) {
+    for (size_t i = 0; i < reg->n_prefix_lens; i++) {
+        if (reg->prefix_lens[i] != len) continue;
+        if (--reg->prefix_len_refs[i] == 0) {
+            size_t tail = reg->n_prefix_lens - i - 1;
+            memmove(&reg->prefix_lens[i], &reg->prefix_lens[i + 1], tail * sizeof(size_t));
+            memmove(&reg->prefix_len_refs[i], &reg->prefix_len_refs[i + 1],
+                    tail * sizeof(size_t));
+            reg->n_prefix_lens--;
+        }
+        return;
+    }
+}
+
+static void sub_registry_remove(sub_registry_t* reg, subscription_t* sub) {
+    switch (sub->match) {
+    case SUB_MATCH_ALL:
+        sub_list_remove(&reg->all_keys, sub);
+        break;
+    case SUB_MATCH_KEY:
+        sub_map_remove(&reg->keys, sub);
+        break;
+    case SUB_MATCH_PREFIX:
+        sub_map_remove(&reg->prefixes, sub);
+        sub_prefix_len_remove(reg, sub->pattern_len);
+        break;
+    case SUB_MATCH_EVICTED:
+        sub_list_remove(&reg->evicted, sub);
+        break;
+    }
+    sub_list_remove(&reg->everything, sub);
+}
+
+static int32_t sub_registry_add(sub_registry_t* reg, subscription_t* sub) {
+    if (sub_list_push(&reg->everything, sub) != 0) {
+        return -1;
+    }
+
+    int32_t rc = 0;
+    switch (sub->match) {
+    case SUB_MATCH_ALL:
+        rc = sub_list_push(&reg->all_keys, sub);
+        break;
+    case SUB_MATCH_KEY:
+        rc = sub_map_add(&reg->keys, sub);
+        break;
+    case SUB_MATCH_PREFIX:
+        rc = sub_prefix_len_add(reg, sub->pattern_len);
+        if (rc == 0 && sub_map_add(&reg->prefixes, sub) != 0) {
+            sub_prefix_len_remove(reg, sub->pattern_len);
+            rc = -1;
+        }
+        break;
+    case SUB_MATCH_EVICTED:
+        rc = sub_list_push(&reg->evicted, sub);
+        break;
+    }
+    if (rc != 0) {
+        sub_list_remove(&reg->everything, sub);
+    }
+    return rc;
+}
+
+static void subscription_free(subscription_t* sub) {
+    free(sub->pattern);
+    free(sub);
+}
+
+static void sub_registry_release(sub_registry_t* reg) {
+    for (size_t i = 0; i < reg->everything.count; i++) {
+        subscription_free(reg->everything.items[i]);
+    }
+    free(reg->everything.items);
+    free(reg->all_keys.items);
+    free(reg->evicted.items);
+    sub_map_release(&reg->keys);
+    sub_map_release(&reg->prefixes);
+    free(reg->prefix_lens);
+    free(reg->prefix_len_refs);
+}
+
+// Calls fn for every filtered (key or prefix) subscription matching `key`.
+static void sub_registry_match(const sub_registry_t* reg, const char* key,
+                               void (*fn)(subscription_t* sub, void* ctx),
+                               void* ctx) {
+    size_t len = strlen(key);
+    if (reg->keys.count > 0) {
+        uint32_t hash = sub_hash_extend(SUB_HASH_INIT, key, len);
+        sub_group_t* group = sub_map_find(&reg->keys, hash, key, len);
+        for (size_t i = 0; group && i < group->subs.count; i++) {
+            fn(group->subs.items[i], ctx);
+        }
+    }
+
+    uint32_t hash = SUB_HASH_INIT;
+    size_t hashed = 0;
+    for (size_t p = 0; p < reg->n_prefix_lens; p++) {
+        size_t plen = reg->prefix_lens[p];
+        if (plen > len) break;
+        hash = sub_hash_extend(hash, key + hashed, plen - hashed);
+        hashed = plen;
+        sub_group_t* group = sub_map_find(&reg->prefixes, hash, key, plen);
+        for (size_t i = 0; group && i < group->subs.count; i++) {
+            fn(group->subs.items[i], ctx);
+        }
+    }
+}
+
+// Call the callback (may be from a different thread)
+static void sub_invoke(subscription_t* sub, const char** keys, size_t n) {
+    if (sub->batch_callback) {
+        sub->batch_callback(sub->user_data, keys, n);
+    } else if (sub->callback) {
+        for (size_t k = 0; k < n; k++) {
+            sub->callback(sub->user_data, keys[k]);
+        }
+    }
+}
+
+typedef struct {
+    subscription_t* sub;
+    size_t key;                 // index into the delivered keys
+} sub_match_t;
+
+typedef struct {
+    const char** key;           // single-key delivery
+    sub_match_t* matches;       // grouped delivery
+    size_t n_matches;
+    size_t capacity;
+    size_t current;
+    int failed;
+} sub_delivery_t;
+
+static void deliver_one(subscription_t* sub, void* ctx) {
+    sub_invoke(sub, ((sub_delivery_t*)ctx)->key, 1);
+}
+
+static void collect_match(subscription_t* sub, void* ctx) {
+    sub_delivery_t* d = (sub_delivery_t*)ctx;
+    if (d->n_matches == d->capacity) {
+        size_t capacity = d->capacity ? d->capacity * 2 : 64;
+        sub_match_t* matches = (sub_match_t*)realloc(d->matches,
+                                                     capacity * sizeof(sub_match_t));
+        if (!matches) {
+            d->failed = 1;
+            return;
+        }
+        d->matches = matches;
+        d->capacity = capacity;
+    }
+    d->matches[d->n_matches].sub = sub;
+    d->matches[d->n_matches].key = d->current;
+    d->n_matches++;
+}
+
+static int sub_match_compare(const void* a, const void* b) {
+    const sub_match_t* x = (const sub_match_t*)a;
+    const sub_match_t* y = (const sub_match_t*)b;
+    if (x->sub->id != y->sub->id) return x->sub->id < y->sub->id ? -1 : 1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+// Delivers a set of changed keys to the subscribers they match, one call per
+// subscriber. Callers hold sub_lock for reading, which keeps unsubscribed
+// callbacks from running.
+static void deliver_changes(ditto_db_t* db, const char** keys, size_t n) {
+    sub_registry_t* reg = &db->subs;
+    for (size_t i = 0; i < reg->all_keys.count; i++) {
+        sub_invoke(reg->all_keys.items[i], keys, n);
+    }
+    if (reg->keys.count == 0 && reg->prefixes.count == 0) {
+        return;
+    }
+
+    sub_delivery_t d;
+    memset(&d, 0, sizeof(d));
+    if (n > 1) {
+        // Gather (subscription, key) pairs, then hand each subscriber its
+        // keys in one batch
+        for (d.current = 0; d.current < n && !d.failed; d.current++) {
+            sub_registry_match(reg, keys[d.current], collect_match, &d);
+        }
+        if (!d.failed) {
+            qsort(d.matches, d.n_matches, sizeof(sub_match_t), sub_match_compare);
+            const char** group = (const char**)malloc(n * sizeof(const char*));
+            d.failed = group == NULL;
+            for (size_t i = 0; group && i < d.n_matches;) {
+                size_t j = i;
+                size_t n_group = 0;
+                while (j < d.n_matches && d.matches[j].sub == d.matches[i].sub) {
+                    group[n_group++] = keys[d.matches[j++].key];
+                }
+                sub_invoke(d.matches[i].sub, group, n_group);
+                i = j;
+            }
+            free(group);
+        }
+        free(d.matches);
+        if (!d.failed) {
+            return;
+        }
+        // Out of memory: fall back to one delivery per key
+    }
+
+    for (size_t k = 0; k < n; k++) {
+        d.key = &keys[k];
+        sub_registry_match(reg, keys[k], deliver_one, &d);
+    }
+}
+
+// Reports keys the memory budget evicted to the eviction subscriptions.
+// Ordinary subscriptions see them through deliver_changes() as well.
+static void deliver_evictions(ditto_db_t* db, const char** keys, size_t n) {
+    sub_list_t* subs = &db->subs.evicted;
+    for (size_t i = 0; n > 0 && i < subs->count; i++) {
+        sub_invoke(subs->items[i], keys, n);
+    }
+}
+
+// Delivers under the shared subscription lock, timing the callbacks.
+// `evicted` lists the keys among `keys` that were evicted.
+static void deliver_changes_shared(ditto_db_t* db, const char** keys,
+                                   size_t n, const char** evicted,
+                                   size_t n_evicted) {
+    TRACE_BEGIN(span);
+    sub_rdlock(db);
+#if DITTO_ENABLE_STATS
+    uint64_t start = monotonic_ns();
+    deliver_changes(db, keys, n);
+    deliver_evictions(db, evicted, n_evicted);
+    uint64_t elapsed = monotonic_ns() - start;
+    STAT_ADD(db->notify_batches, 1);
+    STAT_ADD(db->notify_keys, n);
+    STAT_ADD(db->callback_ns, elapsed);
+    stat_max(&db->max_callback_ns, elapsed);
+#else
+    deliver_changes(db, keys, n);
+    deliver_evictions(db, evicted, n_evicted);
+#endif
+    pthread_rwlock_unlock(&db->sub_lock);
+    TRACE_END(span, TRACE_CALLBACKS);
+}
+
+static void dispatcher_wake(dispatcher_t* d) {
+    pthread_mutex_lock(&d->wake_lock);
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->wake_lock);
+}
+
+// Returns 0 if the key was queued, 1 if the queue is full.
+static int dispatcher_try_enqueue(dispatcher_t* d, const change_cell_t* change) {
+    size_t pos = atomic_load_explicit(&d->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        change_cell_t* cell = &d->cells[pos & d->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&d->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                cell->key = change->key;
+                cell->enqueued_ns = change->enqueued_ns;
+                cell->evicted = change->evicted;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return 1;
+        } else {
+            pos = atomic_load_explicit(&d->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Hands a change to the dispatcher thread. When the queue is full the writer
+// waits for the dispatcher to make room, which bounds memory under overload.
+// Never called on the dispatcher thread, which would wait for itself.
+// Returns 0, or -1 out of memory for the caller to deliver the change itself.
+static int dispatcher_enqueue(dispatcher_t* d, const char* key, int evicted) {
+    change_cell_t change;
+    change.key = strdup(key);
+    if (!change.key) return -1;
+    change.enqueued_ns = STAT_NOW();
+    change.evicted = evicted;
+
+    while (dispatcher_try_enqueue(d, &change) != 0) {
+        dispatcher_wake(d);
+        sched_yield();
+    }
+
+    // Pairs with the fence in dispatcher_main before it re-checks the queue
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&d->sleeping, memory_order_relaxed)) {
+        dispatcher_wake(d);
+    }
+    return 0;
+}
+
+static char* dispatcher_try_dequeue(dispatcher_t* d, uint64_t* out_enqueued_ns,
+                                    int* out_evicted) {
+    change_cell_t* cell = &d->cells[d->dequeue_pos & d->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    if (seq != d->dequeue_pos + 1) {
+        return NULL;
+    }
+    char* key = cell->key;
+    *out_enqueued_ns = cell->enqueued_ns;
+    *out_evicted = cell->evicted;
+    atomic_store_explicit(&cell->seq, d->dequeue_pos + d->mask + 1,
+                          memory_order_release);
+    d->dequeue_pos++;
+    return key;
+}
+
+// Adds key to the batch unless it is already there. `index` is a small
+// open-addressing set of positions in `unique` (0 = empty, else pos + 1).
+static void batch_add_unique(const ditto_db_t* db, const char** unique,
+                             size_t* n_unique, uint16_t* index,
+                             const char* key) {
+    size_t mask = DISPATCH_BATCH_MAX * 2 - 1;
+    size_t idx = hash_key(db, key, strlen(key)) & mask;
+    while (index[idx] != 0) {
+        if (strcmp(unique[index[idx] - 1], key) == 0) {
+            return;
+        }
+        idx = (idx + 1) & mask;
+    }
+    unique[*n_unique] = key;
+    index[idx] = (uint16_t)++(*n_unique);
+}
+
+// Drains up to DISPATCH_BATCH_MAX queued changes, coalesces repeated keys
+// and delivers them as one batch. Returns the number of changes dequeued.
+static size_t dispatcher_drain(ditto_db_t* db, dispatcher_t* d) {
+    char* drained[DISPATCH_BATCH_MAX];
+    const char* unique[DISPATCH_BATCH_MAX];
+    const char* evicted[DISPATCH_BATCH_MAX];
+    uint16_t index[DISPATCH_BATCH_MAX * 2];
+    uint64_t enqueued_ns[DISPATCH_BATCH_MAX];
+    size_t n = 0;
+    size_t n_unique = 0;
+    size_t n_evicted = 0;
+    TRACE_BEGIN(span);
+
+#if DITTO_ENABLE_STATS
+    // Changes waiting, including ones still being published
+    size_t depth = atomic_load_explicit(&d->enqueue_pos, memory_order_relaxed) -
+                   d->dequeue_pos;
+    stat_max(&d->max_depth, depth);
+#endif
+    while (n < DISPATCH_BATCH_MAX) {
+        int was_evicted;
+        char* key = dispatcher_try_dequeue(d, &enqueued_ns[n], &was_evicted);
+        if (!key) break;
+        if (n == 0) {
+            memset(index, 0, sizeof(index));
+        }
+        drained[n++] = key;
+        batch_add_unique(db, unique, &n_unique, index, key);
+        if (was_evicted) {
+            evicted[n_evicted++] = key;
+        }
+    }
+
+#if DITTO_ENABLE_STATS
+    if (n > 0) {
+        // A change's latency runs until its batch's callbacks start
+        uint64_t now = monotonic_ns();
+        uint64_t total = 0;
+        uint64_t max = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t wait = now - enqueued_ns[i];
+            total += wait;
+            if (wait > max) max = wait;
+        }
+        STAT_ADD(d->latency_ns, total);
+        stat_max(&d->max_latency_ns, max);
+        STAT_ADD(d->dispatched, n);
+    }
+#endif
+    if (n_unique > 0) {
+        deliver_changes_shared(db, unique, n_unique, evicted, n_evicted);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        free(drained[i]);
+    }
+    if (n > 0) {
+        TRACE_END(span, TRACE_DISPATCH);
+    }
+    return n;
+}
+
+static void* dispatcher_main(void* arg) {
+    dispatcher_t* d = (dispatcher_t*)arg;
+    ditto_db_t* db = d->db;
+    TRACE_THREAD_NAME("ditto dispatcher");
+
+    for (;;) {
+        if (dispatcher_drain(db, d) > 0) {
+            continue;
+        }
+        if (atomic_load(&d->stopping)) {
+            // Writers have finished; flush whatever is left and exit
+            while (dispatcher_drain(db, d) > 0) {
+            }
+            break;
+        }
+
+        pthread_mutex_lock(&d->wake_lock);
+        atomic_store_explicit(&d->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        change_cell_t* next = &d->cells[d->dequeue_pos & d->mask];
+        int ready = atomic_load_explicit(&next->seq, memory_order_acquire) ==
+                    d->dequeue_pos + 1;
+        if (!ready && !atomic_load(&d->stopping)) {
+            // The timeout is only a safety net; producers signal on enqueue
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100 * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&d->wake, &d->wake_lock, &deadline);
+        }
+        atomic_store_explicit(&d->sleeping, 0, memory_order_relaxed);
+        pthread_mutex_unlock(&d->wake_lock);
+    }
+    return NULL;
+}
+
+static void dispatcher_destroy(dispatcher_t* d) {
+    pthread_mutex_destroy(&d->wake_lock);
+    pthread_cond_destroy(&d->wake);
+    free(d->cells);
+    slab_aligned_free(d);
+}
+
+// Stops the dispatcher thread after it has delivered everything queued.
+static void dispatcher_stop(dispatcher_t* d) {
+    atomic_store(&d->stopping, 1);
+    dispatcher_wake(d);
+    pthread_join(d->thread, NULL);
+    dispatcher_destroy(d);
+}
+
+// Reports changed keys, all of them evicted ones when `evicted` is set.
+static void ring_publish(ditto_db_t* db, const char** keys, size_t n,
+                         int evicted);
+
+static void notify_changes(ditto_db_t* db, const char** keys, size_t n,
+                           int evicted) {
+    // Nobody to tell; skips the queue or sub_lock on every write
+    if (n == 0 || atomic_load_explicit(&db->sub_count, memory_order_relaxed) == 0) {
+        return;
+    }
+    TRACE_BEGIN(span);
+    ring_publish(db, keys, n, evicted);
+
+    dispatcher_t* d = atomic_load_explicit(&db->dispatcher, memory_order_acquire);
+    if (d && !pthread_equal(pthread_self(), d->thread)) {
+        for (size_t i = 0; i < n; i++) {
+            if (dispatcher_enqueue(d, keys[i], evicted) != 0) {
+                deliver_changes_shared(db, &keys[i], 1, &keys[i], evicted ? 1 : 0);
+            }
+        }
+    } else {
+        // A callback writing runs on the dispatcher thread, the only one that
+        // could make room in a full queue, so its changes are delivered here
+        deliver_changes_shared(db, keys, n, keys, evicted ? n : 0);
+    }
+    TRACE_END(span, TRACE_NOTIFY);
+}
+
+static void notify_subscribers_many(ditto_db_t* db, const char** keys,
+                                    size_t n) {
+    notify_changes(db, keys, n, 0);
+}
+
+static void notify_subscribers(ditto_db_t* db, const char* key) {
+    notify_subscribers_many(db, &key, 1);
+}
+
+// Notifies about a key given by length. Callbacks get C strings, so the key
+// is copied unless key[len] is already a NUL.
+static void notify_key(ditto_db_t* db, const char* key, size_t len,
+                       int terminated) {
+    if (terminated) {
+        notify_subscribers(db, key);
+        return;
+    }
+    if (atomic_load_explicit(&db->sub_count, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    char stack_copy[256];
+    char* copy = len < sizeof(stack_copy) ? stack_copy : (char*)malloc(len + 1);
+    if (!copy) return;
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+    notify_subscribers(db, copy);
+    if (copy != stack_copy) {
+        free(copy);
+    }
+}
+
+// ============================================================================
+// Change Ring
+// ============================================================================
+
+// Records and keys live in one block that consumers read in place, laid out
+// as ditto_change_ring_header_t, the records, then the key area. Writers
+// publish under ring_lock, so there is one producer at a time; consumers
+// never write the ring (bar arming the doorbell) and find out they were
+// lapped from the sequence numbers. Each record and key is guarded like a
+// seqlock: it is invalidated, then rewritten, then published.
+
+typedef struct {
+    _Atomic uint64_t seq;
+    _Atomic uint32_t kind;
+    _Atomic uint32_t key_len;
+    _Atomic uint64_t key_pos;
+} ring_record_t;
+
+typedef struct {
+    uint32_t version;
+    uint32_t record_capacity;
+    uint32_t key_capacity;
+    uint32_t records_offset;
+    uint32_t keys_offset;
+    _Atomic uint32_t doorbell_armed;
+    _Atomic uint64_t head;
+    _Atomic uint64_t key_head;
+} ring_header_t;
+
+_Static_assert(sizeof(ring_record_t) == sizeof(ditto_change_record_t),
+               "ring records must match the public layout");
+_Static_assert(sizeof(ring_header_t) == sizeof(ditto_change_ring_header_t),
+               "ring header must match the public layout");
+
+struct ditto_change_ring {
+    ditto_db_t* db;
+    ring_header_t* hdr;         // start of the shared block
+    ring_record_t* records;
+    _Atomic uint8_t* keys;
+    size_t size;
+    ditto_doorbell_cb doorbell;
+    void* user_data;
+};
+
+// Appends one record; the caller holds ring_lock.
+static void ring_push(ditto_change_ring_t* ring, const char* key, size_t len,
+                      uint32_t kind) {
+    ring_header_t* hdr = ring->hdr;
+    uint64_t seq = atomic_load_explicit(&hdr->head, memory_order_relaxed) + 1;
+    uint64_t key_pos = atomic_load_explicit(&hdr->key_head, memory_order_relaxed);
+    size_t mask = hdr->key_capacity - 1;
+    if (len > hdr->key_capacity) {
+        kind = DITTO_CHANGE_LOST;
+        len = 0;
+    } else {
+        // Keys never wrap: skip to the start of the area instead
+        if ((key_pos & mask) + len > hdr->key_capacity) {
+            key_pos = (key_pos | mask) + 1;
+        }
+        // Claim the bytes before overwriting them, so a reader still
+        // copying an older key from there notices
+        atomic_store_explicit(&hdr->key_head, key_pos + len, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        _Atomic uint8_t* dst = ring->keys + (key_pos & mask);
+        for (size_t i = 0; i < len; i++) {
+            atomic_store_explicit(&dst[i], (uint8_t)key[i], memory_order_relaxed);
+        }
+    }
+
+    ring_record_t* rec = &ring->records[seq & (hdr->record_capacity - 1)];
+    atomic_store_explicit(&rec->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&rec->kind, kind, memory_order_relaxed);
+    atomic_store_explicit(&rec->key_len, (uint32_t)len, memory_order_relaxed);
+    atomic_store_explicit(&rec->key_pos, key_pos, memory_order_relaxed);
+    atomic_store_explicit(&rec->seq, seq, memory_order_release);
+    atomic_store_explicit(&hdr->head, seq, memory_order_release);
+}
+
+static void ring_publish(ditto_db_t* db, const char** keys, size_t n,
+                         int evicted) {
+    if (!atomic_load_explicit(&db->ring, memory_order_relaxed)) {
+        return;
+    }
+
+    pthread_mutex_lock(&db->ring_lock);
+    ditto_change_ring_t* ring = atomic_load_explicit(&db->ring, memory_order_relaxed);
+    if (ring) {
+        uint32_t kind = evicted ? DITTO_CHANGE_EVICTED : DITTO_CHANGE_WRITTEN;
+        for (size_t i = 0; i < n; i++) {
+            ring_push(ring, keys[i], strlen(keys[i]), kind);
+        }
+        // One ring per arm, however many records were published since
+        if (atomic_exchange_explicit(&ring->hdr->doorbell_armed, 0,
+                                     memory_order_seq_cst) &&
+            ring->doorbell) {
+            ring->doorbell(ring->user_data);
+        }
+    }
+    pthread_mutex_unlock(&db->ring_lock);
+}
+
+// ============================================================================
+// Eviction
+// ============================================================================
+
+// With a memory budget, a write that leaves its shard holding more than its
+// share of payload bytes evicts keys until the shard is back under it. The
+// CLOCK hand walks the shard's slots (the draining array first while a
+// resize runs): an entry read or written since the hand last passed only
+// loses its reference bit, the first one without it is evicted. Evicting is
+// a logged delete, so the key stays gone after a reopen and open read
+// snapshots still see it.
+
+// Keys evicted under a shard lock, reported once it is released
+typedef struct {
+    char** keys;
+    size_t count;
+    size_t capacity;
+} evict_list_t;
+
+static void evict_list_release(evict_list_t* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->keys[i]);
+    }
+    free(list->keys);
+    memset(list, 0, sizeof(*list));
+}
+
+static kv_slot_t* clock_slot(hash_table_t* table, size_t pos) {
+    size_t draining = table->draining.capacity;
+    return pos < draining ? &table->draining.slots[pos]
+                          : &table->active.slots[pos - draining];
+}
+
+// Evicts one key from a shard whose write lock the caller holds. Returns 0
+// on success, 2 if no entry holds a value, -1 on error.
+static int32_t db_evict_one(ditto_db_t* db, hash_table_t* table,
+                            evict_list_t* evicted, uint64_t* inout_lsn) {
+    // Two laps: the first may do nothing but clear reference bits
+    size_t total = table->draining.capacity + table->active.capacity;
+    kv_entry_t* victim = NULL;
+    uint64_t hash = 0;
+    for (size_t step = 0; step < 2 * total && !victim; step++) {
+        kv_slot_t* slot = clock_slot(table, table->clock_hand++ % total);
+        kv_entry_t* entry = slot->entry;
+        if (entry == NULL || entry == SLOT_TOMBSTONE || !entry->value) {
+            continue;
+        }
+        if (atomic_load_explicit(&entry->referenced, memory_order_relaxed)) {
+            atomic_store_explicit(&entry->referenced, 0, memory_order_relaxed);
+            continue;
+        }
+        victim = entry;
+        hash = slot->hash;
+    }
+    if (!victim) {
+        return 2;
+    }
+
+    if (evicted->count == evicted->capacity) {
+        size_t capacity = evicted->capacity ? evicted->capacity * 2 : 8;
+        char** keys = (char**)realloc(evicted->keys, capacity * sizeof(char*));
+        if (!keys) return -1;
+        evicted->keys = keys;
+        evicted->capacity = capacity;
+    }
+    // The delete frees the entry, so it works on a copy of the key
+    size_t key_len = victim->key_len;
+    char* key = (char*)malloc(key_len + 1);
+    if (!key) return -1;
+    memcpy(key, victim->key, key_len + 1);
+
+    int32_t rc = db_delete_locked(db, table, key, key_len, hash, inout_lsn);
+    if (rc != 0) {
+        free(key);
+        return -1;
+    }
+    evicted->keys[evicted->count++] = key;
+    STAT_ADD(table->stats.evictions, 1);
+    return 0;
+}
+
+// Brings a shard back under its budget after a write. Failing to evict
+// leaves the shard over budget until a later write; it does not fail the
+// write that got it there.
+static void db_enforce_budget(ditto_db_t* db, hash_table_t* table,
+                              evict_list_t* evicted, uint64_t* inout_lsn) {
+    uint64_t budget = atomic_load_explicit(&db->shard_budget, memory_order_relaxed);
+    if (budget == 0 || table->payload_bytes <= budget) {
+        return;
+    }
+    TRACE_BEGIN(span);
+    while (table->payload_bytes > budget) {
+        if (db_evict_one(db, table, evicted, inout_lsn) != 0) {
+            break;
+        }
+    }
+    TRACE_END(span, TRACE_EVICT);
+}
+
+// Reports and frees the keys evicted, once no shard lock is held.
+static void notify_evicted(ditto_db_t* db, evict_list_t* evicted) {
+    notify_changes(db, (const char**)evicted->keys, evicted->count, 1);
+    evict_list_release(evicted);
+}
+
+// ============================================================================
+// Key Expiry
+// ============================================================================
+
+// Keys written with ditto_put_ttl() are deleted by a background thread that
+// advances every shard's timer wheel each tick. Expiring is a logged delete,
+// like an eviction, and everything that expires in one tick is reported as
+// one batch of changes.
+
+static size_t db_ttl_pending(ditto_db_t* db) {
+    size_t pending = 0;
+    for (size_t i = 0; i < db->shard_count; i++) {
+        pending += atomic_load_explicit(&db->shards[i].ttl.count, memory_order_relaxed);
+    }
+    return pending;
+}
+
+// Deletes the keys whose timers are due and notifies about them.
+static void db_expire_due(ditto_db_t* db) {
+    uint64_t now_tick = wall_clock_ms() / TTL_TICK_MS;
+    ttl_timer_t* expired = NULL;
+    size_t n_expired = 0;
+    uint64_t lsn = 0;
+
+    for (size_t i = 0; i < db->shard_count; i++) {
+        hash_table_t* table = &db->shards[i];
+        if (atomic_load_explicit(&table->ttl.count, memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        shard_wrlock(table);
+        ttl_timer_t* due = NULL;
+        ttl_advance(&table->ttl, now_tick, &due);
+        while (due) {
+            ttl_timer_t* t = due;
+            due = t->next;
+            if (db_delete_locked(db, table, t->key, t->key_len, t->hash, &lsn) == 0) {
+                STAT_ADD(table->stats.expirations, 1);
+                t->next = expired;
+                expired = t;
+                n_expired++;
+            } else {
+                free(t); // Already gone, or the log has failed
+            }
+        }
+        pthread_rwlock_unlock(&table->lock);
+    }
+    if (n_expired == 0) {
+        return;
+    }
+
+    const char** keys = (const char**)malloc(n_expired * sizeof(const char*));
+    size_t n = 0;
+    for (ttl_timer_t* t = expired; t; t = t->next) {
+        if (keys) {
+            keys[n++] = t->key;
+        } else {
+            notify_subscribers(db, t->key); // Out of memory: one at a time
+        }
+    }
+    notify_subscribers_many(db, keys, n);
+    free(keys);
+    db_commit(db, lsn);
+
+    while (expired) {
+        ttl_timer_t* next = expired->next;
+        free(expired);
+        expired = next;
+    }
+}
+
+static void* expirer_main(void* arg) {
+    ditto_db_t* db = (ditto_db_t*)arg;
+    TRACE_THREAD_NAME("ditto expiry");
+
+    pthread_mutex_lock(&db->expirer_lock);
+    while (!db->expirer_stopping) {
+        pthread_mutex_unlock(&db->expirer_lock);
+        TRACE_BEGIN(span);
+        db_expire_due(db);
+        TRACE_END(span, TRACE_EXPIRE);
+        pthread_mutex_lock(&db->expirer_lock);
+        if (db->expirer_stopping) break;
+
+        // Park while nothing is armed; pairs with the fence in expirer_kick()
+        atomic_store_explicit(&db->expirer_idle, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (db_ttl_pending(db) == 0) {
+            pthread_cond_wait(&db->expirer_wake, &db->expirer_lock);
+            atomic_store_explicit(&db->expirer_idle, 0, memory_order_relaxed);
+            continue;
+        }
+        atomic_store_explicit(&db->expirer_idle, 0, memory_order_relaxed);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TTL_TICK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&db->expirer_wake, &db->expirer_lock, &deadline);
+    }
+    pthread_mutex_unlock(&db->expirer_lock);
+    return NULL;
+}
+
+// Makes sure the expiry thread runs after a timer was armed: starts it the
+// first time and wakes it if it parked with nothing to do.
+static int32_t expirer_kick(ditto_db_t* db) {
+    atomic_thread_fence(memory_order_seq_cst);
+    int running = atomic_load_explicit(&db->expirer_started, memory_order_relaxed);
+    if (running && !atomic_load_explicit(&db->expirer_idle, memory_order_relaxed)) {
+        return 0;
+    }
+
+    int32_t rc = 0;
+    pthread_mutex_lock(&db->expirer_lock);
+    if (!db->expirer_running && !db->expirer_stopping) {
+        if (pthread_create(&db->expirer, NULL, expirer_main, db) == 0) {
+            db->expirer_running = 1;
+            atomic_store_explicit(&db->expirer_started, 1, memory_order_relaxed);
+        } else {
+            rc = -1;
+        }
+    } else {
+        pthread_cond_signal(&db->expirer_wake);
+    }
+    pthread_mutex_unlock(&db->expirer_lock);
+    return rc;
+}
+
+static void expirer_stop(ditto_db_t* db) {
+    pthread_mutex_lock(&db->expirer_lock);
+    db->expirer_stopping = 1;
+    int running = db->expirer_running;
+    pthread_cond_signal(&db->expirer_wake);
+    pthread_mutex_unlock(&db->expirer_lock);
+    if (running) {
+        pthread_join(db->expirer, NULL);
+    }
+}
+
+// ============================================================================
+// Transactions
+// ============================================================================
+
+// Transactions are expected to touch tens of keys, so their sets are
+// searched linearly.
+static txn_key_t* txn_set_find(txn_set_t* set, const char* key, size_t key_len) {
+    for (size_t i = 0; i < set->count; i++) {
+        txn_key_t* item = &set->items[i];
+        if (item->key_len == key_len && memcmp(item->key, key, key_len) == 0) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+static txn_key_t* txn_set_add(txn_set_t* set, const char* key, size_t key_len,
+                              uint64_t hash) {
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 8;
+        txn_key_t* grown = (txn_key_t*)realloc(set->items,
+                                               capacity * sizeof(txn_key_t));
+        if (!grown) return NULL;
+        set->items = grown;
+        set->capacity = capacity;
+    }
+
+    char* copy = (char*)malloc(key_len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, key, key_len + 1);
+
+    txn_key_t* item = &set->items[set->count++];
+    memset(item, 0, sizeof(*item));
+    item->key = copy;
+    item->key_len = key_len;
+    item->hash = hash;
+    return item;
+}
+
+static void txn_set_release(txn_set_t* set) {
+    for (size_t i = 0; i < set->count; i++) {
+        free(set->items[i].key);
+        free(set->items[i].value);
+    }
+    free(set->items);
+}
+
+static void txn_free(ditto_txn_t* txn) {
+    txn_set_release(&txn->reads);
+    txn_set_release(&txn->writes);
+    free(txn);
+}
+
+// Buffers a put (data != NULL) or delete, replacing any earlier write of
+// the same key in the transaction.
+static int32_t txn_write(ditto_txn_t* txn, const char* key, const uint8_t* data,
+                         size_t len) {
+    uint8_t* value = NULL;
+    if (data) {
+        value = (uint8_t*)malloc(len ? len : 1);
+        if (!value) return -1;
+        memcpy(value, data, len);
+    }
+
+    size_t key_len = strlen(key);
+    txn_key_t* item = txn_set_find(&txn->writes, key, key_len);
+    if (!item) {
+        item = txn_set_add(&txn->writes, key, key_len,
+                           hash_key(txn->db, key, key_len));
+        if (!item) {
+            free(value);
+            return -1;
+        }
+    }
+    free(item->value);
+    item->value = value;
+    item->value_len = len;
+    return 0;
+}
+
+// Locks every shard the transaction touches, in index order like
+// db_lock_all_read(): written shards exclusively, read-only ones shared.
+static void txn_lock(ditto_db_t* db, uint32_t read_mask, uint32_t write_mask) {
+    for (size_t i = 0; i < db->shard_count; i++) {
+        if (write_mask & (1u << i)) {
+            shard_wrlock(&db->shards[i]);
+        } else if (read_mask & (1u << i)) {
+            shard_rdlock(&db->shards[i]);
+        }
+    }
+}
+
+static void txn_unlock(ditto_db_t* db, uint32_t mask) {
+    for (size_t i = db->shard_count; i-- > 0;) {
+        if (mask & (1u << i)) {
+            pthread_rwlock_unlock(&db->shards[i].lock);
+        }
+    }
+}
+
+// Applies the writes of a validated transaction with its shards locked and
+// logs the applied ones as one batch. Their seqs are taken in one step so a
+// read snapshot sees all of the transaction or none of it.
+static int32_t txn_apply(ditto_txn_t* txn, const char** changed,
+                         size_t* out_changed, wal_op_t* log_ops,
+                         uint64_t* inout_lsn) {
+    ditto_db_t* db = txn->db;
+    size_t n = txn->writes.count;
+    uint64_t first_seq = atomic_fetch_add(&db->write_seq, n) + 1;
+
+    int32_t result = 0;
+    size_t n_logged = 0;
+    for (size_t i = 0; i < n && result == 0; i++) {
+        txn_key_t* item = &txn->writes.items[i];
+        hash_table_t* table = shard_for(db, item->hash);
+        uint64_t seq = first_seq + i;
+        int32_t rc = db_track_change(db, table, item->key, item->key_len,
+                                     item->hash, seq);
+        if (rc == 0 && item->value) {
+            STAT_ADD(table->stats.puts, 1);
+            rc = hash_table_put_locked(table, item->key, item->key_len,
+                                       item->hash, item->value,
+                                       item->value_len, seq);
+        } else if (rc == 0) {
+            STAT_ADD(table->stats.deletes, 1);
+            rc = hash_table_delete_locked(table, item->key, item->key_len,
+                                          item->hash, seq);
+        }
+        if (rc == 2) {
+            continue; // Deleting a missing key changes nothing
+        }
+        if (rc != 0) {
+            // Out of memory partway: log what was applied so the log still
+            // matches memory, and report the failure
+            result = -1;
+            break;
+        }
+
+        journal_append(&table->journal, seq,
+                       item->value ? DITTO_OP_PUT : DITTO_OP_DELETE,
+                       item->key, item->key_len);
+        changed[(*out_changed)++] = item->key;
+        log_ops[n_logged++] = (wal_op_t){
+            item->value ? WAL_RECORD_PUT : WAL_RECORD_DELETE, item->key,
+            item->key_len, item->value, item->value_len};
+    }
+
+    if (db->wal && n_logged > 0) {
+        uint64_t lsn = 0;
+        TRACE_BEGIN(span);
+        if (wal_append_batch(db->wal, log_ops, n_logged, &lsn) != 0) {
+            result = -1;
+        }
+        TRACE_END(span, TRACE_LOG_APPEND);
+        if (lsn > *inout_lsn) *inout_lsn = lsn;
+    }
+    return result;
+}
+
+// ============================================================================
+// Export and Import
+// ============================================================================
+
+// A stream is a run of self-contained chunks. A chunk is a 24-byte
+// little-endian header (magic, version, codec, two reserved bytes, record
+// count, payload size before and after compression, CRC32C of the stored
+// payload) and the payload. Payload records are laid out as cursor records
+// are, but little-endian: u32 key length, u32 value length (EXPORT_DELETE
+// for a delete, which has no value bytes), key, value.
+#define EXPORT_MAGIC   0x31584444u  // "DDX1"
+#define EXPORT_VERSION 1
+#define EXPORT_HEADER  24
+#define EXPORT_RECORD  (2 * sizeof(uint32_t))
+#define EXPORT_DELETE  UINT32_MAX
+
+typedef struct {
+    const char* key;
+    size_t len;
+} export_key_t;
+
+struct ditto_export {
+    ditto_db_t* db;
+    int32_t compression;
+    ditto_cursor_t* cursor;     // full export: every key, in order
+    journal_scan_t changed;     // delta export: owns the keys below
+    export_key_t* keys;         // distinct keys changed since the seq
+    size_t key_count;
+    size_t next_key;
+    uint8_t* raw;               // payload before compression
+    size_t raw_cap;
+};
+
+static int export_key_compare(const void* a, const void* b) {
+    const export_key_t* x = (const export_key_t*)a;
+    const export_key_t* y = (const export_key_t*)b;
+    return key_compare(x->key, x->len, y->key, y->len);
+}
+
+// Gathers the distinct keys journaled after `since`. Returns 2 if some of
+// those changes are no longer kept.
+static int32_t export_collect(ditto_export_t* exp, uint64_t since,
+                              uint64_t limit) {
+    ditto_db_t* db = exp->db;
+    journal_scan_t* scan = &exp->changed;
+    int32_t rc = since > limit ? 2 : 0;
+    for (size_t i = 0; i < db->shard_count && rc == 0; i++) {
+        hash_table_t* table = &db->shards[i];
+        shard_rdlock(table);
+        if (since < table->journal.floor) {
+            rc = 2;
+        } else {
+            rc = journal_collect(scan, &table->journal, since, limit, SIZE_MAX);
+        }
+        pthread_rwlock_unlock(&table->lock);
+    }
+    if (rc != 0 || scan->count == 0) {
+        return rc;
+    }
+
+    exp->keys = (export_key_t*)malloc(scan->count * sizeof(export_key_t));
+    if (!exp->keys) {
+        return -1;
+    }
+    for (size_t i = 0; i < scan->count; i++) {
+        exp->keys[i] = (export_key_t){scan->keys + scan->hits[i].key_off,
+                                      scan->hits[i].key_len};
+    }
+    qsort(exp->keys, scan->count, sizeof(export_key_t), export_key_compare);
+    size_t n = 1;
+    for (size_t i = 1; i < scan->count; i++) {
+        if (export_key_compare(&exp->keys[i], &exp->keys[n - 1]) != 0) {
+            exp->keys[n++] = exp->keys[i];
+        }
+    }
+    exp->key_count = n;
+    return 0;
+}
+
+// Fills `payload` with the next cursor batch, rewritten to little-endian.
+static int32_t export_fill_all(ditto_export_t* exp, uint8_t* payload,
+                               size_t* inout_len, size_t* out_count) {
+    int32_t rc = ditto_cursor_next(exp->cursor, payload, inout_len, out_count);
+    if (rc != 0) {
+        return rc;
+    }
+    for (size_t off = 0, i = 0; i < *out_count; i++) {
+        uint32_t lens[2];
+        memcpy(lens, payload + off, sizeof(lens));
+        put_u32(payload + off, lens[0]);
+        put_u32(payload + off + sizeof(uint32_t), lens[1]);
+        off += EXPORT_RECORD + lens[0] + lens[1];
+    }
+    return 0;
+}
+
+// Fills `payload` with the current state of the next changed keys.
+static int32_t export_fill_changed(ditto_export_t* exp, uint8_t* payload,
+                                   size_t* inout_len, size_t* out_count) {
+    size_t cap = *inout_len;
+    size_t used = 0;
+    size_t count = 0;
+    while (exp->next_key < exp->key_count) {
+        const export_key_t* k = &exp->keys[exp->next_key];
+        const uint8_t* value = NULL;
+        size_t value_len = 0;
+        ditto_view_t* view = NULL;
+        int32_t rc = ditto_get_view_n(exp->db, k->key, k->len, &value,
+                                      &value_len, &view);
+        if ((rc != 0 && rc != 2) || value_len >= EXPORT_DELETE) {
+            ditto_view_release(view);
+            return -1;
+        }
+
+        size_t need = EXPORT_RECORD + k->len + value_len;
+        if (cap - used < need) {
+            ditto_view_release(view);
+            if (count == 0) {
+                *inout_len = need;
+                return 1;
+            }
+            break;
+        }
+        put_u32(payload + used, (uint32_t)k->len);
+        put_u32(payload + used + sizeof(uint32_t),
+                rc == 0 ? (uint32_t)value_len : EXPORT_DELETE);
+        memcpy(payload + used + EXPORT_RECORD, k->key, k->len);
+        if (value_len > 0) {
+            memcpy(payload + used + EXPORT_RECORD + k->len, value, value_len);
+        }
+        ditto_view_release(view);
+        used += need;
+        count++;
+        exp->next_key++;
+    }
+    *inout_len = used;
+    *out_count = count;
+    return 0;
+}
+
+// Applies one chunk as a write batch. Returns its size, or 0 if it is
+// malformed or could not be applied.
+static size_t import_chunk(ditto_db_t* db, const uint8_t* data, size_t len) {
+    if (len < EXPORT_HEADER || get_u32(data) != EXPORT_MAGIC ||
+        data[4] != EXPORT_VERSION || data[6] != 0 || data[7] != 0) {
+        return 0;
+    }
+    int32_t codec = data[5];
+    size_t count = get_u32(data + 8);
+    size_t raw_len = get_u32(data + 12);
+    size_t stored = get_u32(data + 16);
+    if (stored > len - EXPORT_HEADER || count > raw_len / EXPORT_RECORD ||
+        ditto_crc32c(0, data + EXPORT_HEADER, stored) != get_u32(data + 20) ||
+        (codec == DITTO_COMPRESS_NONE && raw_len != stored) ||
+        (codec == DITTO_COMPRESS_LZ4 && raw_len / 255 > stored) ||
+        (codec != DITTO_COMPRESS_NONE && codec != DITTO_COMPRESS_LZ4)) {
+        return 0;
+    }
+    if (count == 0) {
+        return raw_len == 0 ? EXPORT_HEADER + stored : 0;
+    }
+
+    // Keys go to the batch as C strings, so each is copied out with a NUL
+    uint8_t* raw = NULL;
+    const uint8_t* payload = data + EXPORT_HEADER;
+    const char** keys = (const char**)malloc(count * sizeof(const char*));
+    const uint8_t** values = (const uint8_t**)malloc(count * sizeof(const uint8_t*));
+    size_t* lens = (size_t*)malloc(count * sizeof(size_t));
+    uint8_t* ops = (uint8_t*)malloc(count);
+    char* key_buf = (char*)malloc(raw_len);
+    int ok = keys && values && lens && ops && key_buf;
+    if (ok && codec == DITTO_COMPRESS_LZ4) {
+        raw = (uint8_t*)malloc(raw_len);
+        ok = raw && ditto_lz_decompress(payload, stored, raw, raw_len) == 0;
+        payload = raw;
+    }
+
+    size_t off = 0;
+    size_t key_off = 0;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (raw_len - off < EXPORT_RECORD) {
+            ok = 0;
+            break;
+        }
+        size_t key_len = get_u32(payload + off);
+        uint32_t value_len = get_u32(payload + off + sizeof(uint32_t));
+        off += EXPORT_RECORD;
+        size_t value_bytes = value_len == EXPORT_DELETE ? 0 : value_len;
+        if (key_len > raw_len - off || value_bytes > raw_len - off - key_len ||
+            memchr(payload + off, 0, key_len)) {
+            ok = 0;
+            break;
+        }
+
+        // The record header just read leaves room for the NUL
+        memcpy(key_buf + key_off, payload + off, key_len);
+        key_buf[key_off + key_len] = '\0';
+        keys[i] = key_buf + key_off;
+        key_off += key_len + 1;
+        off += key_len;
+        ops[i] = value_len == EXPORT_DELETE ? DITTO_OP_DELETE : DITTO_OP_PUT;
+        values[i] = payload + off;
+        lens[i] = value_bytes;
+        off += value_bytes;
+    }
+    ok = ok && off == raw_len &&
+         ditto_write_batch(db, count, keys, values, lens, ops, NULL) == 0;
+
+    free(keys);
+    free(values);
+    free(lens);
+    free(ops);
+    free(key_buf);
+    free(raw);
+    return ok ? EXPORT_HEADER + stored : 0;
+}
+
+// ============================================================================
+// Public API Implementation
+// ============================================================================
+
+DITTO_API void ditto_options_init(ditto_options_t* opts) {
+    if (!opts) return;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->struct_size = sizeof(*opts);
+    opts->shard_count = DITTO_SHARD_COUNT;
+    opts->durability = DITTO_DURABILITY_OS;
+    opts->eviction_policy = DITTO_EVICT_NONE;
+    opts->compression = DITTO_COMPRESS_NONE;
+    opts->change_journal_capacity = DITTO_JOURNAL_CAPACITY;
+    opts->maintenance_interval_ms = DITTO_MAINT_INTERVAL_MS;
+    opts->maintenance_cpu_percent = DITTO_MAINT_CPU_PERCENT;
+    opts->maintenance_pause_wait_us = DITTO_MAINT_PAUSE_WAIT_US;
+    opts->compact_log_bytes = DITTO_COMPACT_LOG_BYTES;
+}
+
+// Reads the caller's options over the defaults: fields past its struct_size
+// are from a later version of the struct and keep their defaults.
+static int32_t options_load(const ditto_options_t* in, ditto_options_t* out) {
+    ditto_options_init(out);
+    if (!in) return 0;
+    if (in->struct_size < sizeof(uint32_t)) return -1;
+
+    size_t size = in->struct_size < sizeof(*out) ? in->struct_size : sizeof(*out);
+    memcpy(out, in, size);
+    out->struct_size = sizeof(*out);
+
+    uint32_t shards = out->shard_count;
+    if (shards == 0 || shards > DITTO_MAX_SHARDS || (shards & (shards - 1)) != 0 ||
+        out->durability < DITTO_DURABILITY_OS ||
+        out->durability > DITTO_DURABILITY_PERIODIC ||
+        (out->durability == DITTO_DURABILITY_PERIODIC &&
+         out->durability_interval_ms == 0) ||
+        (out->eviction_policy != DITTO_EVICT_NONE &&
+         out->eviction_policy != DITTO_EVICT_CLOCK) ||
+        (out->compression != DITTO_COMPRESS_NONE &&
+         out->compression != DITTO_COMPRESS_LZ4) ||
+        out->maintenance_cpu_percent == 0 || out->maintenance_cpu_percent > 100) {
+        return -1;
+    }
+    return 0;
+}
+
+DITTO_API int32_t ditto_open(const char* path, ditto_db_t** out_db) {
+    return ditto_open_ex(path, NULL, out_db);
+}
+
+DITTO_API int32_t ditto_open_ex(const char* path, const ditto_options_t* options,
+                                ditto_db_t** out_db) {
+    ditto_options_t opts;
+    if (!path || !out_db || options_load(options, &opts) != 0) {
+        return -1;
+    }
+
+    ditto_db_t* db = (ditto_db_t*)calloc(1, sizeof(ditto_db_t));
+    if (!db) {
+        return -1;
+    }
+
+    db->shard_count = opts.shard_count;
+    db->shards = (hash_table_t*)slab_aligned_alloc(_Alignof(hash_table_t),
+                                                   db->shard_count * sizeof(hash_table_t));
+    if (!db->shards) {
+        free(db);
+        return -1;
+    }
+    size_t per_shard = (size_t)(opts.initial_capacity / db->shard_count);
+    for (size_t i = 0; i < db->shard_count; i++) {
+        if (hash_table_init(&db->shards[i], per_shard) != 0) {
+            while (i-- > 0) {
+                hash_table_release(&db->shards[i]);
+            }
+            slab_aligned_free(db->shards);
+            free(db);
+            return -1;
+        }
+    }
+
+    pthread_rwlock_init(&db->sub_lock, NULL);
+    atomic_init(&db->sub_count, 0);
+    pthread_mutex_init(&db->compact_lock, NULL);
+    pthread_mutex_init(&db->maint_lock, NULL);
+    pthread_cond_init(&db->maint_wake, NULL);
+    atomic_init(&db->maint_stopping, 0);
+    db->maint_interval_ms = opts.maintenance_interval_ms;
+    db->maint_cpu_percent = opts.maintenance_cpu_percent;
+    db->maint_pause_wait_us = opts.maintenance_pause_wait_us;
+    db->maint_io_rate = opts.maintenance_io_bytes_per_sec;
+    db->compact_log_bytes = opts.compact_log_bytes;
+    pthread_mutex_init(&db->expirer_lock, NULL);
+    pthread_cond_init(&db->expirer_wake, NULL);
+    pthread_mutex_init(&db->ring_lock, NULL);
+    pthread_mutex_init(&db->coll_lock, NULL);
+    db->next_sub_id = 1;
+    db->hash_seed = ditto_hash_random_seed();
+    db->incarnation = ditto_hash_random_seed() | 1;
+    pthread_mutex_init(&db->view_lock, NULL);
+    atomic_init(&db->view_oldest, UINT64_MAX);
+    size_t per_journal = (opts.change_journal_capacity + db->shard_count - 1) /
+                         db->shard_count;
+    for (size_t i = 0; i < db->shard_count; i++) {
+        if (journal_init(&db->shards[i].journal, per_journal) != 0) {
+            ditto_close(db);
+            return -1;
+        }
+    }
+    // Before replay, so replayed values are compressed too
+    ditto_set_compression(db, opts.compression, (size_t)opts.compression_min_size);
+
+    if (strcmp(path, DITTO_MEMORY_PATH) != 0) {
+        // Map the snapshot, then replay the log written since on top of it.
+        // Opening the log first locks the directory against other processes.
+        wal_t* wal = NULL;
+        snapshot_t* snap = NULL;
+        db->path = strdup(path);
+        if (!db->path || wal_open(path, &wal) != 0) {
+            ditto_close(db);
+            return -1;
+        }
+        if (snapshot_open(path, &snap) != 0) {
+            wal_close(wal);
+            ditto_close(db);
+            return -1;
+        }
+        for (size_t i = 0; snap && i < db->shard_count; i++) {
+            snapshot_retain(snap);
+            db->shards[i].base = snap;
+        }
+        uint64_t min_gen = snap ? snapshot_log_gen(snap) : 0;
+        if (snap) {
+            // The snapshot's hash index only works under its own seed
+            db->hash_seed = snapshot_hash_seed(snap);
+            snapshot_release(snap);
+        }
+
+        if (wal_replay(wal, min_gen, replay_apply, db) != 0) {
+            wal_close(wal);
+            ditto_close(db);
+            return -1;
+        }
+        // Replayed changes are not journaled; a consumer catches up on them
+        // by reading everything
+        uint64_t replayed = atomic_load(&db->write_seq);
+        for (size_t i = 0; i < db->shard_count; i++) {
+            db->shards[i].journal.floor = replayed;
+        }
+        db->wal = wal;
+        if (wal_set_durability(wal, opts.durability,
+                               opts.durability_interval_ms) != 0) {
+            ditto_close(db);
+            return -1;
+        }
+
+        if (db_ttl_pending(db) > 0 && expirer_kick(db) != 0) {
+            ditto_close(db);
+            return -1;
+        }
+    }
+
+    if (opts.maintenance_interval_ms > 0) {
+        if (pthread_create(&db->maint, NULL, maint_main, db) != 0) {
+            ditto_close(db);
+            return -1;
+        }
+        db->maint_running = 1;
+    }
+
+    if ((opts.memory_budget > 0 &&
+         ditto_set_memory_budget(db, opts.memory_budget, opts.eviction_policy) != 0) ||
+        (opts.async_queue_capacity > 0 &&
+         ditto_enable_async_notifications(db, opts.async_queue_capacity) != 0)) {
+        ditto_close(db);
+        return -1;
+    }
+
+    *out_db = db;
+    return 0;
+}
+
+static void db_close(ditto_db_t* db) {
+    // Expiring keys notifies, so the expiry thread stops first
+    expirer_stop(db);
+
+    dispatcher_t* d = atomic_exchange(&db->dispatcher, NULL);
+    if (d) {
+        dispatcher_stop(d);
+    }
+
+    // The worker also maintains the collections, so they close after it
+    maint_stop(db);
+    ditto_coll_t* coll = atomic_load(&db->colls);
+    while (coll) {
+        ditto_coll_t* next = coll->next;
+        db_close(coll->db);
+        free(coll);
+        coll = next;
+    }
+    wal_close(db->wal);
+
+    for (size_t i = 0; i < db->shard_count; i++) {
+        hash_table_release(&db->shards[i]);
+    }
+    slab_aligned_free(db->shards);
+    sub_registry_release(&db->subs);
+    pthread_rwlock_destroy(&db->sub_lock);
+    pthread_mutex_destroy(&db->compact_lock);
+    pthread_mutex_destroy(&db->maint_lock);
+    pthread_cond_destroy(&db->maint_wake);
+    pthread_mutex_destroy(&db->expirer_lock);
+    pthread_cond_destroy(&db->expirer_wake);
+    pthread_mutex_destroy(&db->ring_lock);
+    pthread_mutex_destroy(&db->view_lock);
+    pthread_mutex_destroy(&db->coll_lock);
+    free(db->path);
+    free(db);
+}
+
+DITTO_API void ditto_close(ditto_db_t* db) {
+    // A collection closes with its owner
+    if (!db || db->owner) return;
+
+    db_close(db);
+}
+
+// ============================================================================
+// Collections
+// ============================================================================
+
+#define DITTO_COLL_NAME_MAX 64
+#define DITTO_COLL_DIR_PREFIX "coll-"   // a collection's directory in its owner's
+
+static int collection_name_valid(const char* name) {
+    size_t len = 0;
+    for (; name[len]; len++) {
+        char c = name[len];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.')) {
+            return 0;
+        }
+    }
+    return len > 0 && len <= DITTO_COLL_NAME_MAX && name[0] != '.';
+}
+
+// Opens a collection's store and publishes it. Caller holds coll_lock.
+static int32_t collection_create(ditto_db_t* db, const char* name,
+                                 ditto_options_t* opts, ditto_coll_t** out_coll) {
+    size_t name_len = strlen(name);
+    ditto_coll_t* coll = (ditto_coll_t*)calloc(1, sizeof(ditto_coll_t) + name_len + 1);
+    if (!coll) {
+        return -1;
+    }
+    memcpy(coll->name, name, name_len + 1);
+
+    char* path = NULL;
+    if (db->path) {
+        char dir[sizeof(DITTO_COLL_DIR_PREFIX) + DITTO_COLL_NAME_MAX];
+        snprintf(dir, sizeof(dir), DITTO_COLL_DIR_PREFIX "%s", name);
+        path = path_join(db->path, dir);
+        if (!path) {
+            free(coll);
+            return -1;
+        }
+    }
+    // The owner's worker maintains it
+    opts->maintenance_interval_ms = 0;
+    int32_t rc = ditto_open_ex(path ? path : DITTO_MEMORY_PATH, opts, &coll->db);
+    free(path);
+    if (rc != 0) {
+        free(coll);
+        return -1;
+    }
+
+    coll->db->owner = db;
+    coll->next = atomic_load_explicit(&db->colls, memory_order_relaxed);
+    atomic_store_explicit(&db->colls, coll, memory_order_release);
+    *out_coll = coll;
+    return 0;
+}
+
+DITTO_API int32_t ditto_collection_open(ditto_db_t* db, const char* name,
+                                        ditto_coll_t** out_coll) {
+    return ditto_collection_open_ex(db, name, NULL, out_coll);
+}
+
+DITTO_API int32_t ditto_collection_open_ex(ditto_db_t* db, const char* name,
+                                           const ditto_options_t* options,
+                                           ditto_coll_t** out_coll) {
+    ditto_options_t opts;
+    if (!db || db->owner || !name || !out_coll || !collection_name_valid(name) ||
+        options_load(options, &opts) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&db->coll_lock);
+    ditto_coll_t* coll = atomic_load_explicit(&db->colls, memory_order_relaxed);
+    while (coll && strcmp(coll->name, name) != 0) {
+        coll = coll->next;
+    }
+    int32_t rc = 0;
+    if (!coll) {
+        rc = collection_create(db, name, &opts, &coll);
+    }
+    pthread_mutex_unlock(&db->coll_lock);
+
+    if (rc == 0) {
+        *out_coll = coll;
+    }
+    return rc;
+}
+
+DITTO_API ditto_db_t* ditto_collection_db(ditto_coll_t* coll) {
+    return coll ? coll->db : NULL;
+}
+
+DITTO_API int32_t ditto_coll_put(ditto_coll_t* coll, const char* key,
+                                 const uint8_t* data, size_t len) {
+    return coll ? ditto_put(coll->db, key, data, len) : -1;
+}
+
+DITTO_API int32_t ditto_coll_get(ditto_coll_t* coll, const char* key,
+                                 uint8_t* out_buf, size_t* inout_len) {
+    return coll ? ditto_get(coll->db, key, out_buf, inout_len) : -1;
+}
+
+DITTO_API int32_t ditto_coll_delete(ditto_coll_t* coll, const char* key) {
+    return coll ? ditto_delete(coll->db, key) : -1;
+}
+
+DITTO_API int32_t ditto_coll_subscribe(ditto_coll_t* coll, ditto_on_change_cb cb,
+                                       void* user_data, int32_t* out_sub_id) {
+    return coll ? ditto_subscribe(coll->db, cb, user_data, out_sub_id) : -1;
+}
+
+DITTO_API int32_t ditto_coll_subscribe_key(ditto_coll_t* coll, const char* key,
+                                           ditto_on_change_cb cb, void* user_data,
+                                           int32_t* out_sub_id) {
+    return coll ? ditto_subscribe_key(coll->db, key, cb, user_data, out_sub_id) : -1;
+}
+
+DITTO_API int32_t ditto_coll_unsubscribe(ditto_coll_t* coll, int32_t sub_id) {
+    return coll ? ditto_unsubscribe(coll->db, sub_id) : -1;
+}
+
+// Key operations shared by the C-string, length-prefixed and interned entry
+// points. `terminated` says whether key[key_len] is a NUL, so notifications
+// can skip copying the key; `hint` is an interned key's slot hint or NULL.
+static int32_t db_put(ditto_db_t* db, const char* key, size_t key_len,
+                      uint64_t hash, int terminated, const uint8_t* data,
+                      size_t len) {
+    hash_table_t* table = shard_for(db, hash);
+    uint64_t lsn = 0;
+    evict_list_t evicted = {0};
+    TRACE_BEGIN(span);
+
+    shard_wrlock(table);
+    int32_t rc = db_put_locked(db, table, key, key_len, hash, data, len, &lsn);
+    if (rc == 0) {
+        db_enforce_budget(db, table, &evicted, &lsn);
+    }
+    pthread_rwlock_unlock(&table->lock);
+
+    if (rc == 0) {
+        // Notify subscribers on success
+        notify_key(db, key, key_len, terminated);
+        notify_evicted(db, &evicted);
+        rc = db_commit(db, lsn);
+    }
+
+    TRACE_END(span, TRACE_PUT);
+    return rc;
+}
+
+// A put that also arms the key's expiry timer. The value and the deadline
+// are logged as one record so a reopen never sees one without the other.
+static int32_t db_put_ttl(ditto_db_t* db, const char* key, size_t key_len,
+                          uint64_t hash, const uint8_t* data, size_t len,
+                          uint32_t ttl_ms) {
+    hash_table_t* table = shard_for(db, hash);
+    uint64_t expires_ms = wall_clock_ms() + ttl_ms;
+    uint64_t lsn = 0;
+    evict_list_t evicted = {0};
+    TRACE_BEGIN(span);
+
+    shard_wrlock(table);
+    int32_t rc = -1;
+    if (!db->wal || !wal_failed(db->wal)) {
+        uint64_t seq = db_next_seq(db);
+        rc = db_track_change(db, table, key, key_len, hash, seq);
+        if (rc == 0) {
+            STAT_ADD(table->stats.puts, 1);
+            rc = hash_table_put_locked(table, key, key_len, hash, data, len, seq);
+        }
+        if (rc == 0) {
+            journal_append(&table->journal, seq, DITTO_OP_PUT, key, key_len);
+            rc = ttl_arm(&table->ttl, key, key_len, hash, expires_ms);
+        }
+        if (rc == 0 && db->wal) {
+            uint8_t deadline[8];
+            put_u64(deadline, expires_ms);
+            wal_op_t ops[2] = {
+                {WAL_RECORD_PUT, key, key_len, data, len},
+                {WAL_RECORD_EXPIRE, key, key_len, deadline, sizeof(deadline)},
+            };
+            TRACE_BEGIN(span);
+            rc = wal_append_batch(db->wal, ops, 2, &lsn);
+            TRACE_END(span, TRACE_LOG_APPEND);
+        }
+    }
+    if (rc == 0) {
+        db_enforce_budget(db, table, &evicted, &lsn);
+    }
+    pthread_rwlock_unlock(&table->lock);
+
+    if (rc == 0) {
+        notify_subscribers(db, key);
+        notify_evicted(db, &evicted);
+        rc = expirer_kick(db);
+        if (rc == 0) {
+            rc = db_commit(db, lsn);
+        }
+    }
+
+    TRACE_END(span, TRACE_PUT_TTL);
+    return rc;
+}
+
+// A range write or append, logged with the offset it landed at: the
+// record rewrites the same bytes however often it is replayed.
+static int32_t db_put_range(ditto_db_t* db, const char* key, size_t key_len,
+                            uint64_t hash, size_t offset, int append,
+                            const uint8_t* data, size_t len) {
+    hash_table_t* table = shard_for(db, hash);
+    uint64_t lsn = 0;
+    evict_list_t evicted = {0};
+    TRACE_BEGIN(span);
+
+    shard_wrlock(table);
+    int32_t rc = -1;
+    if (!db->wal || !wal_failed(db->wal)) {
+        uint64_t seq = db_next_seq(db);
+        rc = db_track_change(db, table, key, key_len, hash, seq);
+        if (rc == 0) {
+            STAT_ADD(table->stats.puts, 1);
+            rc = hash_table_splice_locked(table, key, key_len, hash, &offset,
+                                          append, append, data, len, seq);
+        }
+        if (rc == 0) {
+            journal_append(&table->journal, seq, DITTO_OP_PUT, key, key_len);
+        }
+        if (rc == 0 && db->wal) {
+            TRACE_BEGIN(span);
+            rc = wal_append_range(db->wal, key, key_len, offset, data, len, &lsn);
+            TRACE_END(span, TRACE_LOG_APPEND);
+        }
+    }
+    if (rc == 0) {
+        db_enforce_budget(db, table, &evicted, &lsn);
+    }
+    pthread_rwlock_unlock(&table->lock);
+
+    if (rc == 0) {
+        notify_key(db, key, key_len, 1);
+        notify_evicted(db, &evicted);
+        rc = db_commit(db, lsn);
+    }
+
+    TRACE_END(span, TRACE_PUT_RANGE);
+    return rc;
+}
+
+static int32_t db_get(ditto_db_t* db, const char* key, size_t key_len,
+                      uint64_t hash, _Atomic size_t* hint, uint8_t* out_buf,
+                      size_t* inout_len) {
+    TRACE_BEGIN(span);
+    int32_t rc = hash_table_get(shard_for(db, hash), key, key_len, hash, hint,
+                                out_buf, inout_len);
+    TRACE_END(span, TRACE_GET);
+    return rc;
+}
+
+static int32_t db_get_view(ditto_db_t* db, const char* key, size_t key_len,
+                           uint64_t hash, _Atomic size_t* hint,
+                           const uint8_t** out_ptr, size_t* out_len,
+                           ditto_view_t** out_view) {
+    int error;
+    TRACE_BEGIN(span);
+    kv_value_t* value = hash_table_get_value(shard_for(db, hash), key, key_len,
+                                             hash, hint, &error);
+    TRACE_END(span, TRACE_GET_VIEW);
+    if (!value) {
+        return error ? -1 : 2; // 2 = key not found
+    }
+
+    *out_ptr = value_bytes(value);
+    *out_len = value->len;
+    *out_view = value;
+    return 0;
+}
+
+static int32_t db_delete(ditto_db_t* db, const char* key, size_t key_len,
+                         uint64_t hash, int terminated) {
+    hash_table_t* table = shard_for(db, hash);
+    uint64_t lsn = 0;
+    TRACE_BEGIN(span);
+
+    shard_wrlock(table);
+    int32_t rc = db_delete_locked(db, table, key, key_len, hash, &lsn);
+    pthread_rwlock_unlock(&table->lock);
+
+    if (rc == 0) {
+        // Notify subscribers on success
+        notify_key(db, key, key_len, terminated);
+        rc = db_commit(db, lsn);
+    }
+
+    TRACE_END(span, TRACE_DELETE);
+    return rc;
+}
+
+DITTO_API int32_t ditto_put(ditto_db_t* db, const char* key,
+                            const uint8_t* data, size_t len) {
+    if (!db || !key || !data) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    return db_put(db, key, key_len, hash_key(db, key, key_len), 1, data, len);
+}
+
+DITTO_API int32_t ditto_put_ttl(ditto_db_t* db, const char* key,
+                                const uint8_t* data, size_t len,
+                                uint32_t ttl_ms) {
+    if (!db || !key || !data || ttl_ms == 0) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    return db_put_ttl(db, key, key_len, hash_key(db, key, key_len), data, len,
+                      ttl_ms);
+}
+
+DITTO_API int32_t ditto_put_range(ditto_db_t* db, const char* key,
+                                  size_t offset, const uint8_t* data, size_t len) {
+    if (!db || !key || (!data && len > 0)) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    return db_put_range(db, key, key_len, hash_key(db, key, key_len), offset, 0,
+                        data, len);
+}
+
+DITTO_API int32_t ditto_append(ditto_db_t* db, const char* key,
+                               const uint8_t* data, size_t len) {
+    if (!db || !key || (!data && len > 0)) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    return db_put_range(db, key, key_len, hash_key(db, key, key_len), 0, 1,
+                        data, len);
+}
+
+DITTO_API int32_t ditto_get_range(ditto_db_t* db, const char* key, size_t offset,
+                                  uint8_t* out_buf, size_t* inout_len,
+                                  size_t* out_value_len) {
+    if (!db || !key || !inout_len || (!out_buf && *inout_len > 0)) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    size_t value_len;
+    uint64_t hash = hash_key(db, key, key_len);
+    TRACE_BEGIN(span);
+    int32_t rc = hash_table_get_range(shard_for(db, hash), key, key_len, hash,
+                                      offset, out_buf, inout_len, &value_len);
+    TRACE_END(span, TRACE_GET_RANGE);
+    if (rc != 2 && out_value_len) {
+        *out_value_len = value_len;
+    }
+    return rc;
+}
+
+DITTO_API int32_t ditto_get(ditto_db_t* db, const char* key,
+                            uint8_t* out_buf, size_t* inout_len) {
+    if (!db || !key || !inout_len) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    return db_get(db, key, key_len, hash_key(db, key, key_len), NULL, out_buf,
+                  inout_len);
+}
+
+DITTO_API int32_t ditto_get_view(ditto_db_t* db, const char* key,
+                                 const uint8_t** out_ptr, size_t* out_len,
+                                 ditto_view_t** out_view) {
+    if (!db || !key || !out_ptr || !out_len || !out_view) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    return db_get_view(db, key, key_len, hash_key(db, key, key_len), NULL, out_ptr,
+                       out_len, out_view);
+}
+
+DITTO_API void ditto_view_release(ditto_view_t* view) {
+    if (!view) return;
+
+    value_release(view);
+}
+
+DITTO_API int32_t ditto_delete(ditto_db_t* db, const char* key) {
+    if (!db || !key) {
+        return -1;
+    }
+
+    size_t key_len = strlen(key);
+    return db_delete(db, key, key_len, hash_key(db, key, key_len), 1);
+}
+
+// Keys are stored and reported as C strings, so a length-prefixed key may
+// not contain a NUL byte.
+static int valid_key_n(const char* key, size_t key_len) {
+    return key && memchr(key, '\0', key_len) == NULL;
+}
+
+DITTO_API int32_t ditto_put_n(ditto_db_t* db, const char* key, size_t key_len,
+                              const uint8_t* data, size_t len) {
+    if (!db || !valid_key_n(key, key_len) || !data) {
+        return -1;
+    }
+
+    return db_put(db, key, key_len, hash_key(db, key, key_len), 0, data, len);
+}
+
+DITTO_API int32_t ditto_get_n(ditto_db_t* db, const char* key, size_t key_len,
+                              uint8_t* out_buf, size_t* inout_len) {
+    if (!db || !valid_key_n(key, key_len) || !inout_len) {
+        return -1;
+    }
+
+    return db_get(db, key, key_len, hash_key(db, key, key_len), NULL, out_buf,
+                  inout_len);
+}
+
+DITTO_API int32_t ditto_get_view_n(ditto_db_t* db, const char* key,
+                                   size_t key_len, const uint8_t** out_ptr,
+                                   size_t* out_len, ditto_view_t** out_view) {
+    if (!db || !valid_key_n(key, key_len) || !out_ptr || !out_len || !out_view) {
+        return -1;
+    }
+
+    return db_get_view(db, key, key_len, hash_key(db, key, key_len), NULL, out_ptr,
+                       out_len, out_view);
+}
+
+DITTO_API int32_t ditto_delete_n(ditto_db_t* db, const char* key, size_t key_len) {
+    if (!db || !valid_key_n(key, key_len)) {
+        return -1;
+    }
+
+    return db_delete(db, key, key_len, hash_key(db, key, key_len), 0);
+}
+
+DITTO_API int32_t ditto_key_intern(ditto_db_t* db, const char* key,
+                                   size_t key_len, ditto_key_t** out_key) {
+    if (!db || !valid_key_n(key, key_len) || !out_key) {
+        return -1;
+    }
+
+    ditto_key_t* handle = (ditto_key_t*)malloc(sizeof(ditto_key_t) + key_len + 1);
+    if (!handle) {
+        return -1;
+    }
+    handle->db = db;
+    handle->len = key_len;
+    handle->hash = hash_key(db, key, key_len);
+    atomic_init(&handle->slot_hint, SIZE_MAX);
+    memcpy(handle->key, key, key_len);
+    handle->key[key_len] = '\0';
+
+    *out_key = handle;
+    return 0;
+}
+
+DITTO_API void ditto_key_release(ditto_key_t* key) {
+    free(key);
+}
+
+DITTO_API int32_t ditto_put_k(ditto_db_t* db, const ditto_key_t* key,
+                              const uint8_t* data, size_t len) {
+    if (!db || !key || key->db != db || !data) {
+        return -1;
+    }
+
+    return db_put(db, key->key, key->len, key->hash, 1, data, len);
+}
+
+DITTO_API int32_t ditto_get_k(ditto_db_t* db, ditto_key_t* key,
+                              uint8_t* out_buf, size_t* inout_len) {
+    if (!db || !key || key->db != db || !inout_len) {
+        return -1;
+    }
+
+    return db_get(db, key->key, key->len, key->hash, &key->slot_hint, out_buf,
+                  inout_len);
+}
+
+DITTO_API int32_t ditto_get_view_k(ditto_db_t* db, ditto_key_t* key,
+                                   const uint8_t** out_ptr, size_t* out_len,
+                                   ditto_view_t** out_view) {
+    if (!db || !key || key->db != db || !out_ptr || !out_len || !out_view) {
+        return -1;
+    }
+
+    return db_get_view(db, key->key, key->len, key->hash, &key->slot_hint,
+                       out_ptr, out_len, out_view);
+}
+
+DITTO_API int32_t ditto_delete_k(ditto_db_t* db, const ditto_key_t* key) {
+    if (!db || !key || key->db != db) {
+        return -1;
+    }
+
+    return db_delete(db, key->key, key->len, key->hash, 1);
+}
+
+// Keys of a batch call grouped by shard, so each shard is locked once.
+// order[] lists key indices shard by shard, stably, so operations on the
+// same key keep their relative order; shard s's run ends at starts[s].
+typedef struct {
+    uint64_t* hashes;
+    size_t* key_lens;
+    size_t* order;
+    size_t* starts;
+} shard_order_t;
+
+static void shard_order_release(shard_order_t* so) {
+    free(so->hashes);
+    free(so->key_lens);
+    free(so->order);
+    free(so->starts);
+}
+
+// NULL keys are grouped with shard 0; callers report them as errors.
+static int32_t shard_order_init(shard_order_t* so, ditto_db_t* db,
+                                const char* const* keys, size_t count) {
+    so->hashes = (uint64_t*)malloc(count * sizeof(uint64_t));
+    so->key_lens = (size_t*)malloc(count * sizeof(size_t));
+    so->order = (size_t*)malloc(count * sizeof(size_t));
+    so->starts = (size_t*)calloc(db->shard_count + 1, sizeof(size_t));
+    if (!so->hashes || !so->key_lens || !so->order || !so->starts) {
+        shard_order_release(so);
+        return -1;
+    }
+
+    // A stable counting sort by shard
+    size_t* starts = so->starts;
+    for (size_t i = 0; i < count; i++) {
+        so->key_lens[i] = keys[i] ? strlen(keys[i]) : 0;
+        so->hashes[i] = keys[i] ? hash_key(db, keys[i], so->key_lens[i]) : 0;
+        starts[shard_index(db, so->hashes[i]) + 1]++;
+    }
+    for (size_t s = 0; s < db->shard_count; s++) {
+        starts[s + 1] += starts[s];
+    }
+    for (size_t i = 0; i < count; i++) {
+        so->order[starts[shard_index(db, so->hashes[i])]++] = i;
+    }
+    return 0;
+}
+
+DITTO_API int32_t ditto_write_batch(ditto_db_t* db, size_t count,
+                                    const char* const* keys,
+                                    const uint8_t* const* values,
+                                    const size_t* lens,
+                                    const uint8_t* ops,
+                                    int32_t* out_status) {
+    if (!db || (count > 0 && !keys)) {
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    TRACE_BEGIN(span);
+    shard_order_t so;
+    if (shard_order_init(&so, db, keys, count) != 0) {
+        return -1;
+    }
+    const char** changed = (const char**)malloc(count * sizeof(const char*));
+    if (!changed) {
+        shard_order_release(&so);
+        return -1;
+    }
+    const uint64_t* hashes = so.hashes;
+    const size_t* key_lens = so.key_lens;
+
+    int32_t result = 0;
+    size_t n_changed = 0;
+    uint64_t lsn = 0;
+    evict_list_t evicted = {0};
+    size_t begin = 0;
+    for (size_t s = 0; s < db->shard_count; s++) {
+        size_t end = so.starts[s];
+        if (begin == end) continue;
+
+        hash_table_t* table = &db->shards[s];
+        shard_wrlock(table);
+        for (size_t j = begin; j < end; j++) {
+            size_t i = so.order[j];
+            int is_delete = ops && ops[i] == DITTO_OP_DELETE;
+            int32_t rc;
+            if (!keys[i] || (ops && ops[i] != DITTO_OP_PUT && !is_delete)) {
+                rc = -1;
+            } else if (is_delete) {
+                rc = db_delete_locked(db, table, keys[i], key_lens[i], hashes[i],
+                                      &lsn);
+            } else if (!values || !lens || !values[i]) {
+                rc = -1;
+            } else {
+                rc = db_put_locked(db, table, keys[i], key_lens[i], hashes[i],
+                                   values[i], lens[i], &lsn);
+            }
+
+            if (rc == 0) {
+                changed[n_changed++] = keys[i];
+            } else if (rc != 2) {
+                result = -1;
+            }
+            if (out_status) {
+                out_status[i] = rc;
+            }
+        }
+        db_enforce_budget(db, table, &evicted, &lsn);
+        pthread_rwlock_unlock(&table->lock);
+        begin = end;
+    }
+
+    // One fan-out and one commit for the whole batch
+    notify_subscribers_many(db, changed, n_changed);
+    notify_evicted(db, &evicted);
+    if (db_commit(db, lsn) != 0) {
+        result = -1;
+    }
+
+    shard_order_release(&so);
+    free(changed);
+    TRACE_END(span, TRACE_WRITE_BATCH);
+    return result;
+}
+
+DITTO_API int32_t ditto_multi_get(ditto_db_t* db, const char* const* keys,
+                                  size_t count, uint8_t* arena,
+                                  size_t* inout_arena_len, size_t* out_offsets,
+                                  size_t* out_lens, int32_t* out_status) {
+    if (!db || !inout_arena_len || (count > 0 &&
+        (!keys || !out_offsets || !out_lens || !out_status))) {
+        return -1;
+    }
+    if (count == 0) {
+        *inout_arena_len = 0;
+        return 0;
+    }
+
+    TRACE_BEGIN(span);
+    shard_order_t so;
+    if (shard_order_init(&so, db, keys, count) != 0) {
+        return -1;
+    }
+
+    // Values are packed in shard order as they are found; the ones that no
+    // longer fit still count towards the size reported back
+    size_t cap = arena ? *inout_arena_len : 0;
+    size_t used = 0;
+    size_t needed = 0;
+    int32_t result = 0;
+    size_t begin = 0;
+    for (size_t s = 0; s < db->shard_count; s++) {
+        size_t end = so.starts[s];
+        if (begin == end) continue;
+
+        hash_table_t* table = &db->shards[s];
+        STAT_ADD(table->stats.gets, end - begin);
+        size_t side = shard_read_enter(table);
+        for (size_t j = begin; j < end; j++) {
+            size_t i = so.order[j];
+            out_offsets[i] = 0;
+            out_lens[i] = 0;
+            if (!keys[i]) {
+                out_status[i] = -1;
+                result = -1;
+                continue;
+            }
+
+            const uint8_t* bytes;
+            size_t len;
+            kv_value_t* value;
+            if (!hash_table_read(table, keys[i], so.key_lens[i], so.hashes[i],
+                                 NULL, 0, &bytes, &len, &value, NULL)) {
+                out_status[i] = 2; // Key not found
+                continue;
+            }
+
+            size_t room = cap - used;
+            int32_t rc = value_copy_out(bytes, len, value,
+                                        arena ? arena + used : NULL, &room);
+            out_lens[i] = len;
+            out_status[i] = rc;
+            needed += len;
+            if (rc == 0) {
+                out_offsets[i] = used;
+                used += len;
+            } else if (rc == 1) {
+                if (result == 0) result = 1;
+            } else {
+                result = -1;
+            }
+        }
+        shard_read_exit(table, side);
+        begin = end;
+    }
+
+    *inout_arena_len = needed; // == used unless something did not fit
+    shard_order_release(&so);
+    TRACE_END(span, TRACE_MULTI_GET);
+    return result;
+}
+
+DITTO_API int32_t ditto_txn_begin(ditto_db_t* db, ditto_txn_t** out_txn) {
+    if (!db || !out_txn) {
+        return -1;
+    }
+
+    ditto_txn_t* txn = (ditto_txn_t*)calloc(1, sizeof(ditto_txn_t));
+    if (!txn) {
+        return -1;
+    }
+    txn->db = db;
+    *out_txn = txn;
+    return 0;
+}
+
+DITTO_API int32_t ditto_txn_get(ditto_txn_t* txn, const char* key,
+                                uint8_t* out_buf, size_t* inout_len) {
+    if (!txn || !key || !inout_len) {
+        return -1;
+    }
+
+    // The transaction's own writes come first
+    size_t key_len = strlen(key);
+    txn_key_t* write = txn_set_find(&txn->writes, key, key_len);
+    if (write) {
+        if (!write->value) {
+            return 2; // Deleted in this transaction
+        }
+        return value_copy_out(write->value, write->value_len, NULL, out_buf,
+                              inout_len);
+    }
+
+    txn_key_t* read = txn_set_find(&txn->reads, key, key_len);
+    uint64_t hash = read ? read->hash : hash_key(txn->db, key, key_len);
+    hash_table_t* table = shard_for(txn->db, hash);
+    shard_rdlock(table);
+    STAT_ADD(table->stats.gets, 1);
+
+    // Keep the first version seen; if the key changed since, commit fails
+    // either way
+    if (!read) {
+        read = txn_set_add(&txn->reads, key, key_len, hash);
+        if (!read) {
+            pthread_rwlock_unlock(&table->lock);
+            return -1;
+        }
+        read->version = table_version(table, key, key_len, hash);
+    }
+
+    const uint8_t* bytes;
+    size_t len;
+    kv_value_t* value;
+    int32_t rc = 2; // Key not found
+    if (hash_table_lookup(table, key, key_len, hash, &bytes, &len, &value)) {
+        rc = value_copy_out(bytes, len, value, out_buf, inout_len);
+    }
+
+    pthread_rwlock_unlock(&table->lock);
+    return rc;
+}
+
+DITTO_API int32_t ditto_txn_put(ditto_txn_t* txn, const char* key,
+                                const uint8_t* data, size_t len) {
+    if (!txn || !key || !data) {
+        return -1;
+    }
+
+    return txn_write(txn, key, data, len);
+}
+
+DITTO_API int32_t ditto_txn_delete(ditto_txn_t* txn, const char* key) {
+    if (!txn || !key) {
+        return -1;
+    }
+
+    return txn_write(txn, key, NULL, 0);
+}
+
+DITTO_API int32_t ditto_txn_commit(ditto_txn_t* txn) {
+    if (!txn) {
+        return -1;
+    }
+
+    ditto_db_t* db = txn->db;
+    size_t n_writes = txn->writes.count;
+    TRACE_BEGIN(span);
+    const char** changed = (const char**)malloc((n_writes + 1) * sizeof(const char*));
+    wal_op_t* log_ops = (wal_op_t*)malloc((n_writes + 1) * sizeof(wal_op_t));
+    if (!changed || !log_ops) {
+        free(changed);
+        free(log_ops);
+        txn_free(txn);
+        return -1;
+    }
+
+    uint32_t read_mask = 0;
+    uint32_t write_mask = 0;
+    for (size_t i = 0; i < txn->reads.count; i++) {
+        read_mask |= 1u << shard_index(db, txn->reads.items[i].hash);
+    }
+    for (size_t i = 0; i < n_writes; i++) {
+        write_mask |= 1u << shard_index(db, txn->writes.items[i].hash);
+    }
+    txn_lock(db, read_mask, write_mask);
+
+    int32_t rc = 0;
+    for (size_t i = 0; i < txn->reads.count; i++) {
+        txn_key_t* read = &txn->reads.items[i];
+        hash_table_t* table = shard_for(db, read->hash);
+        if (table_version(table, read->key, read->key_len, read->hash) !=
+            read->version) {
+            rc = 3; // Conflict: a key read has changed since
+            break;
+        }
+    }
+    if (rc == 0 && db->wal && wal_failed(db->wal)) {
+        rc = -1;
+    }
+
+    size_t n_changed = 0;
+    uint64_t lsn = 0;
+    evict_list_t evicted = {0};
+    if (rc == 0 && n_writes > 0) {
+        rc = txn_apply(txn, changed, &n_changed, log_ops, &lsn);
+        for (size_t i = 0; rc == 0 && i < db->shard_count; i++) {
+            if (write_mask & (1u << i)) {
+                db_enforce_budget(db, &db->shards[i], &evicted, &lsn);
+            }
+        }
+    }
+    txn_unlock(db, read_mask | write_mask);
+    if (rc == 0) {
+        STAT_ADD(db->txn_commits, 1);
+    } else if (rc == 3) {
+        STAT_ADD(db->txn_conflicts, 1);
+    }
+
+    // One fan-out and one commit for the whole transaction
+    notify_subscribers_many(db, changed, n_changed);
+    notify_evicted(db, &evicted);
+    if (db_commit(db, lsn) != 0) {
+        rc = -1;
+    }
+
+    free(changed);
+    free(log_ops);
+    txn_free(txn);
+    TRACE_END(span, TRACE_TXN_COMMIT);
+    return rc;
+}
+
+DITTO_API void ditto_txn_abort(ditto_txn_t* txn) {
+    if (!txn) return;
+
+    txn_free(txn);
+}
+
+DITTO_API int32_t ditto_scan_range(ditto_db_t* db, const char* start,
+                                   const char* end, ditto_cursor_t** out_cursor) {
+    if (!db || !out_cursor) {
+        return -1;
+    }
+
+    return cursor_create(db, start, start ? strlen(start) : 0,
+                         end, end ? strlen(end) : 0, out_cursor);
+}
+
+DITTO_API int32_t ditto_scan_prefix(ditto_db_t* db, const char* prefix,
+                                    ditto_cursor_t** out_cursor) {
+    if (!db || !prefix || !out_cursor) {
+        return -1;
+    }
+
+    // Keys with the prefix sort before the prefix with its last byte below
+    // 0xff incremented; without such a byte the scan runs to the end
+    size_t len = strlen(prefix);
+    size_t upper_len = len;
+    while (upper_len > 0 && (uint8_t)prefix[upper_len - 1] == 0xff) {
+        upper_len--;
+    }
+    if (upper_len == 0) {
+        return cursor_create(db, prefix, len, NULL, 0, out_cursor);
+    }
+
+    int32_t rc = cursor_create(db, prefix, len, prefix, upper_len, out_cursor);
+    if (rc == 0) {
+        (*out_cursor)->upper[upper_len - 1]++;
+    }
+    return rc;
+}
+
+DITTO_API int32_t ditto_cursor_next(ditto_cursor_t* cursor, uint8_t* out_buf,
+                                    size_t* inout_len, size_t* out_count) {
+    if (!cursor || !inout_len || !out_count) {
+        return -1;
+    }
+
+    *out_count = 0;
+    if (cursor->done) {
+        *inout_len = 0;
+        return 0;
+    }
+
+    ditto_db_t* db = cursor->db;
+    TRACE_BEGIN(span);
+    db_lock_all_read(db);
+
+    merge_iter_t it;
+    merge_iter_init(&it, db, cursor->lower, cursor->lower_len,
+                    cursor->lower_inclusive);
+
+    int32_t rc = 0;
+    size_t used = 0;
+    size_t count = 0;
+    const char* last_key = NULL;
+    size_t last_len = 0;
+    for (;;) {
+        const char* key;
+        size_t key_len;
+        const uint8_t* value;
+        size_t value_len;
+        const kv_value_t* packed;
+        if (!merge_iter_next(&it, &key, &key_len, &value, &value_len, &packed) ||
+            (cursor->upper &&
+             key_compare(key, key_len, cursor->upper, cursor->upper_len) >= 0)) {
+            cursor->done = 1;
+            break;
+        }
+        if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+            rc = -1;
+            break;
+        }
+
+        size_t need = 2 * sizeof(uint32_t) + key_len + value_len;
+        if (!out_buf || *inout_len - used < need) {
+            if (count == 0) {
+                // Buffer too small for even one record
+                *inout_len = need;
+                rc = 1;
+            }
+            break;
+        }
+
+        uint32_t lens[2] = {(uint32_t)key_len, (uint32_t)value_len};
+        uint8_t* rec = out_buf + used;
+        memcpy(rec, lens, sizeof(lens));
+        memcpy(rec + sizeof(lens), key, key_len);
+        if (packed) {
+            if (value_unpack(packed, rec + sizeof(lens) + key_len) != 0) {
+                rc = -1;
+                break;
+            }
+        } else {
+            memcpy(rec + sizeof(lens) + key_len, value, value_len);
+        }
+        used += need;
+        count++;
+        last_key = key;
+        last_len = key_len;
+    }
+
+    // Resume after the last key handed out; copy it while still locked
+    if (count > 0) {
+        char* lower = (char*)malloc(last_len + 1);
+        if (lower) {
+            memcpy(lower, last_key, last_len);
+            lower[last_len] = '\0';
+            free(cursor->lower);
+            cursor->lower = lower;
+            cursor->lower_len = last_len;
+            cursor->lower_inclusive = 0;
+        } else {
+            rc = -1;
+            count = 0;
+            cursor->done = 0;
+        }
+    }
+
+    db_unlock_all(db);
+
+    if (rc == 0) {
+        *inout_len = used;
+    }
+    *out_count = count;
+    TRACE_END(span, TRACE_CURSOR_NEXT);
+    return rc;
+}
+
+DITTO_API void ditto_cursor_close(ditto_cursor_t* cursor) {
+    if (!cursor) return;
+
+    free(cursor->lower);
+    free(cursor->upper);
+    free(cursor);
+}
+
+DITTO_API int32_t ditto_snapshot_open(ditto_db_t* db, ditto_snapshot_t** out_snap) {
+    if (!db || !out_snap) {
+        return -1;
+    }
+
+    ditto_snapshot_t* snap = (ditto_snapshot_t*)calloc(1, sizeof(ditto_snapshot_t));
+    if (!snap) {
+        return -1;
+    }
+    snap->db = db;
+
+    pthread_mutex_lock(&db->view_lock);
+    // Publish that a view exists before choosing its seq, and expire nothing
+    // meanwhile; see db_track_change()
+    if (!db->views_head) {
+        atomic_store(&db->view_oldest, 0);
+    }
+    snap->seq = atomic_load(&db->write_seq);
+    if (!db->views_head) {
+        atomic_store(&db->view_oldest, snap->seq);
+    }
+    snap->prev = db->views_tail;
+    if (db->views_tail) {
+        db->views_tail->next = snap;
+    } else {
+        db->views_head = snap;
+    }
+    db->views_tail = snap;
+    pthread_mutex_unlock(&db->view_lock);
+
+    *out_snap = snap;
+    return 0;
+}
+
+DITTO_API int32_t ditto_snapshot_get(ditto_snapshot_t* snap, const char* key,
+                                     uint8_t* out_buf, size_t* inout_len) {
+    if (!snap || !key || !inout_len) {
+        return -1;
+    }
+
+    ditto_db_t* db = snap->db;
+    size_t key_len = strlen(key);
+    uint64_t hash = hash_key(db, key, key_len);
+    hash_table_t* table = shard_for(db, hash);
+    shard_rdlock(table);
+    STAT_ADD(table->stats.gets, 1);
+
+    const kv_version_t* version;
+    const uint8_t* bytes = NULL;
+    size_t len = 0;
+    kv_value_t* value = NULL;
+    int found;
+    if (version_find(&table->versions, key, key_len, hash, snap->seq, &version)) {
+        found = version->value != NULL;
+        if (found) {
+            value = version->value;
+            bytes = value_bytes(version->value);
+            len = version->value->len;
+        }
+    } else {
+        found = hash_table_lookup(table, key, key_len, hash, &bytes, &len,
+                                  &value);
+    }
+
+    int32_t rc = found ? value_copy_out(bytes, len, value, out_buf, inout_len)
+                       : 2; // Key not found
+
+    pthread_rwlock_unlock(&table->lock);
+    return rc;
+}
+
+DITTO_API void ditto_snapshot_close(ditto_snapshot_t* snap) {
+    if (!snap) return;
+
+    ditto_db_t* db = snap->db;
+    pthread_mutex_lock(&db->view_lock);
+    if (snap->prev) {
+        snap->prev->next = snap->next;
+    } else {
+        db->views_head = snap->next;
+    }
+    if (snap->next) {
+        snap->next->prev = snap->prev;
+    } else {
+        db->views_tail = snap->prev;
+    }
+    int was_oldest = snap->prev == NULL;
+    uint64_t oldest = db->views_head ? db->views_head->seq : UINT64_MAX;
+    atomic_store(&db->view_oldest, oldest);
+    pthread_mutex_unlock(&db->view_lock);
+    free(snap);
+
+    // Writes expire history as they go, but shards nobody writes to would
+    // hold on to what only this view needed
+    for (size_t i = 0; was_oldest && i < db->shard_count; i++) {
+        hash_table_t* table = &db->shards[i];
+        shard_wrlock(table);
+        version_map_expire(&table->versions, atomic_load(&db->view_oldest));
+        pthread_rwlock_unlock(&table->lock);
+    }
+}
+
+static int32_t add_subscription(ditto_db_t* db, int match, const char* pattern,
+                                ditto_on_change_cb cb,
+                                ditto_on_changes_cb batch_cb, void* user_data,
+                                int32_t* out_sub_id) {
+    subscription_t* sub = (subscription_t*)calloc(1, sizeof(subscription_t));
+    if (!sub) {
+        return -1;
+    }
+    sub->match = match;
+    if (pattern) {
+        sub->pattern = strdup(pattern);
+        if (!sub->pattern) {
+            free(sub);
+            return -1;
+        }
+        sub->pattern_len = strlen(pattern);
+    }
+    sub->callback = cb;
+    sub->batch_callback = batch_cb;
+    sub->user_data = user_data;
+
+    sub_wrlock(db);
+    sub->id = db->next_sub_id++;
+    int32_t rc = sub_registry_add(&db->subs, sub);
+    if (rc == 0) {
+        atomic_fetch_add_explicit(&db->sub_count, 1, memory_order_relaxed);
+    }
+    pthread_rwlock_unlock(&db->sub_lock);
+
+    if (rc != 0) {
+        subscription_free(sub);
+        return -1;
+    }
+    *out_sub_id = sub->id;
+    return 0;
+}
+
+DITTO_API int32_t ditto_subscribe(ditto_db_t* db, ditto_on_change_cb cb,
+                                  void* user_data, int32_t* out_sub_id) {
+    if (!db || !cb || !out_sub_id) {
+        return -1;
+    }
+
+    return add_subscription(db, SUB_MATCH_ALL, NULL, cb, NULL, user_data, out_sub_id);
+}
+
+DITTO_API int32_t ditto_subscribe_batch(ditto_db_t* db, ditto_on_changes_cb cb,
+                                        void* user_data, int32_t* out_sub_id) {
+    if (!db || !cb || !out_sub_id) {
+        return -1;
+    }
+
+    return add_subscription(db, SUB_MATCH_ALL, NULL, NULL, cb, user_data, out_sub_id);
+}
+
+DITTO_API int32_t ditto_subscribe_key(ditto_db_t* db, const char* key,
+                                      ditto_on_change_cb cb, void* user_data,
+                                      int32_t* out_sub_id) {
+    if (!db || !key || !cb || !out_sub_id) {
+        return -1;
+    }
+
+    return add_subscription(db, SUB_MATCH_KEY, key, cb, NULL, user_data, out_sub_id);
+}
+
+DITTO_API int32_t ditto_subscribe_prefix(ditto_db_t* db, const char* prefix,
+                                         ditto_on_change_cb cb, void* user_data,
+                                         int32_t* out_sub_id) {
+    if (!db || !prefix || !cb || !out_sub_id) {
+        return -1;
+    }
+
+    return add_subscription(db, SUB_MATCH_PREFIX, prefix, cb, NULL, user_data,
+                            out_sub_id);
+}
+
+DITTO_API int32_t ditto_subscribe_prefix_batch(ditto_db_t* db, const char* prefix,
+                                               ditto_on_changes_cb cb,
+                                               void* user_data,
+                                               int32_t* out_sub_id) {
+    if (!db || !prefix || !cb || !out_sub_id) {
+        return -1;
+    }
+
+    return add_subscription(db, SUB_MATCH_PREFIX, prefix, NULL, cb, user_data,
+                            out_sub_id);
+}
+
+DITTO_API int32_t ditto_enable_async_notifications(ditto_db_t* db,
+                                                   size_t queue_capacity) {
+    if (!db || queue_capacity == 0) {
+        return -1;
+    }
+    if (atomic_load(&db->dispatcher)) {
+        return 0; // Already enabled
+    }
+
+    size_t capacity = 2;
+    while (capacity < queue_capacity) {
+        capacity <<= 1;
+    }
+
+    dispatcher_t* d = (dispatcher_t*)slab_aligned_alloc(_Alignof(dispatcher_t),
+                                                        sizeof(dispatcher_t));
+    if (!d) {
+        return -1;
+    }
+    memset(d, 0, sizeof(*d));
+    d->cells = (change_cell_t*)calloc(capacity, sizeof(change_cell_t));
+    if (!d->cells) {
+        slab_aligned_free(d);
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&d->cells[i].seq, i);
+    }
+    d->db = db;
+    d->mask = capacity - 1;
+    pthread_mutex_init(&d->wake_lock, NULL);
+    pthread_cond_init(&d->wake, NULL);
+
+    if (pthread_create(&d->thread, NULL, dispatcher_main, d) != 0) {
+        dispatcher_destroy(d);
+        return -1;
+    }
+
+    // Another thread may be enabling at the same time; the first one wins
+    dispatcher_t* expected = NULL;
+    if (!atomic_compare_exchange_strong(&db->dispatcher, &expected, d)) {
+        dispatcher_stop(d);
+    }
+    return 0;
+}
+
+DITTO_API int32_t ditto_unsubscribe(ditto_db_t* db, int32_t sub_id) {
+    if (!db) {
+        return -1;
+    }
+
+    sub_wrlock(db);
+
+    sub_list_t* all = &db->subs.everything;
+    for (size_t i = 0; i < all->count; i++) {
+        subscription_t* sub = all->items[i];
+        if (sub->id == sub_id) {
+            sub_registry_remove(&db->subs, sub);
+            atomic_fetch_sub_explicit(&db->sub_count, 1, memory_order_relaxed);
+            pthread_rwlock_unlock(&db->sub_lock);
+            subscription_free(sub);
+            return 0;
+        }
+    }
+
+    pthread_rwlock_unlock(&db->sub_lock);
+    return -1; // Subscription not found
+}
+
+DITTO_API int32_t ditto_change_ring_open(ditto_db_t* db, uint32_t record_capacity,
+                                         uint32_t key_capacity,
+                                         ditto_doorbell_cb doorbell,
+                                         void* user_data,
+                                         ditto_change_ring_t** out_ring) {
+    if (!db || !out_ring || record_capacity == 0 || key_capacity == 0 ||
+        record_capacity > (1u << 24) || key_capacity > (1u << 30)) {
+        return -1;
+    }
+
+    uint32_t records = 2;
+    while (records < record_capacity) records <<= 1;
+    uint32_t key_bytes = 64;
+    while (key_bytes < key_capacity) key_bytes <<= 1;
+
+    // The header gets a cache line of its own
+    size_t records_offset = 64;
+    size_t keys_offset = records_offset + (size_t)records * sizeof(ring_record_t);
+    size_t size = (keys_offset + key_bytes + 63) & ~(size_t)63;
+
+    ditto_change_ring_t* ring = (ditto_change_ring_t*)calloc(1, sizeof(*ring));
+    uint8_t* block = (uint8_t*)slab_aligned_alloc(64, size);
+    if (!ring || !block) {
+        free(ring);
+        slab_aligned_free(block);
+        return -1;
+    }
+    memset(block, 0, size);
+    ring->db = db;
+    ring->hdr = (ring_header_t*)block;
+    ring->records = (ring_record_t*)(block + records_offset);
+    ring->keys = (_Atomic uint8_t*)(block + keys_offset);
+    ring->size = size;
+    ring->doorbell = doorbell;
+    ring->user_data = user_data;
+    ring->hdr->version = DITTO_CHANGE_RING_VERSION;
+    ring->hdr->record_capacity = records;
+    ring->hdr->key_capacity = key_bytes;
+    ring->hdr->records_offset = (uint32_t)records_offset;
+    ring->hdr->keys_offset = (uint32_t)keys_offset;
+    atomic_init(&ring->hdr->doorbell_armed, 1);
+
+    pthread_mutex_lock(&db->ring_lock);
+    int32_t rc = -1;
+    if (!atomic_load_explicit(&db->ring, memory_order_relaxed)) {
+        atomic_store_explicit(&db->ring, ring, memory_order_relaxed);
+        // Writes skip notifying altogether while sub_count is zero
+        atomic_fetch_add_explicit(&db->sub_count, 1, memory_order_relaxed);
+        rc = 0;
+    }
+    pthread_mutex_unlock(&db->ring_lock);
+
+    if (rc != 0) {
+        slab_aligned_free(block);
+        free(ring);
+        return rc;
+    }
+    *out_ring = ring;
+    return 0;
+}
+
+DITTO_API int32_t ditto_change_ring_memory(ditto_change_ring_t* ring,
+                                           const uint8_t** out_base,
+                                           size_t* out_size) {
+    if (!ring || !out_base || !out_size) {
+        return -1;
+    }
+
+    *out_base = (const uint8_t*)ring->hdr;
+    *out_size = ring->size;
+    return 0;
+}
+
+DITTO_API int32_t ditto_change_ring_read(ditto_change_ring_t* ring,
+                                         uint64_t* inout_cursor,
+                                         uint8_t* out_buf,
+                                         size_t* inout_len,
+                                         size_t* out_count,
+                                         uint64_t* out_lost) {
+    if (!ring || !inout_cursor || !inout_len || !out_count) {
+        return -1;
+    }
+
+    ring_header_t* hdr = ring->hdr;
+    uint64_t head = atomic_load_explicit(&hdr->head, memory_order_acquire);
+    uint64_t cursor = *inout_cursor;
+    if (cursor > head) {
+        return -1;
+    }
+
+    // Records more than a lap behind are gone
+    uint64_t lost = 0;
+    if (head - cursor > hdr->record_capacity) {
+        lost = head - hdr->record_capacity - cursor;
+        cursor = head - hdr->record_capacity;
+    }
+
+    int32_t rc = 0;
+    size_t used = 0;
+    size_t count = 0;
+    size_t key_mask = hdr->key_capacity - 1;
+    for (; cursor < head; cursor++) {
+        uint64_t seq = cursor + 1;
+        ring_record_t* rec = &ring->records[seq & (hdr->record_capacity - 1)];
+        if (atomic_load_explicit(&rec->seq, memory_order_acquire) != seq) {
+            lost++; // Overwritten since head was read
+            continue;
+        }
+        uint32_t kind = atomic_load_explicit(&rec->kind, memory_order_relaxed);
+        uint32_t key_len = atomic_load_explicit(&rec->key_len, memory_order_relaxed);
+        uint64_t key_pos = atomic_load_explicit(&rec->key_pos, memory_order_relaxed);
+        if ((key_pos & key_mask) + key_len > hdr->key_capacity) {
+            lost++; // Torn: fields of a newer record
+            continue;
+        }
+
+        size_t need = 2 * sizeof(uint32_t) + key_len;
+        if (!out_buf || *inout_len - used < need) {
+            if (count == 0 && lost == 0) {
+                *inout_len = need;
+                rc = 1; // Buffer too small for even one record
+            }
+            break;
+        }
+        uint8_t* dst = out_buf + used + 2 * sizeof(uint32_t);
+        const _Atomic uint8_t* src = ring->keys + (key_pos & key_mask);
+        for (uint32_t i = 0; i < key_len; i++) {
+            dst[i] = atomic_load_explicit(&src[i], memory_order_relaxed);
+        }
+
+        // Valid only if neither the record nor its key bytes were rewritten
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&rec->seq, memory_order_relaxed) != seq ||
+            atomic_load_explicit(&hdr->key_head, memory_order_relaxed) - key_pos >
+                hdr->key_capacity) {
+            lost++;
+            continue;
+        }
+        uint32_t lens[2] = {kind, key_len};
+        memcpy(out_buf + used, lens, sizeof(lens));
+        used += need;
+        count++;
+    }
+
+    if (rc == 0) {
+        *inout_len = used;
+    }
+    *inout_cursor = cursor;
+    *out_count = count;
+    if (out_lost) *out_lost = lost;
+    return rc;
+}
+
+DITTO_API int32_t ditto_change_ring_arm(ditto_change_ring_t* ring, uint64_t cursor) {
+    if (!ring) {
+        return -1;
+    }
+
+    // Pairs with the exchange in ring_publish(): either that sees the flag
+    // or this sees the newer head
+    atomic_store_explicit(&ring->hdr->doorbell_armed, 1, memory_order_seq_cst);
+    uint64_t head = atomic_load_explicit(&ring->hdr->head, memory_order_seq_cst);
+    return head > cursor ? 1 : 0;
+}
+
+DITTO_API void ditto_change_ring_close(ditto_change_ring_t* ring) {
+    if (!ring) return;
+
+    ditto_db_t* db = ring->db;
+    pthread_mutex_lock(&db->ring_lock);
+    if (atomic_load_explicit(&db->ring, memory_order_relaxed) == ring) {
+        atomic_store_explicit(&db->ring, NULL, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&db->sub_count, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&db->ring_lock);
+
+    slab_aligned_free(ring->hdr);
+    free(ring);
+}
+
+DITTO_API int32_t ditto_changes_since(ditto_db_t* db, uint64_t* inout_incarnation,
+                                      uint64_t since_seq, uint8_t* out_buf,
+                                      size_t* inout_len, size_t* out_count,
+                                      uint64_t* out_seq) {
+    if (!db || !inout_incarnation || !inout_len || !out_count || !out_seq) {
+        return -1;
+    }
+
+    // Every change numbered up to `limit` was journaled in the critical
+    // section that numbered it, so each shard's lock shows all of its own
+    size_t cap = out_buf ? *inout_len : 0;
+    uint64_t limit = atomic_load(&db->write_seq);
+    journal_scan_t scan = {0};
+    // A seq from an earlier open numbers different changes, even when it is
+    // in range
+    int truncated = since_seq > 0 && (*inout_incarnation != db->incarnation ||
+                                      since_seq > limit);
+    *inout_incarnation = db->incarnation;
+    int32_t rc = 0;
+    for (size_t i = 0; i < db->shard_count && !truncated && rc == 0; i++) {
+        hash_table_t* table = &db->shards[i];
+        shard_rdlock(table);
+        if (since_seq < table->journal.floor) {
+            truncated = 1;
+        } else {
+            rc = journal_collect(&scan, &table->journal, since_seq, limit, cap);
+        }
+        pthread_rwlock_unlock(&table->lock);
+    }
+
+    *out_count = 0;
+    if (rc != 0 || truncated) {
+        free(scan.hits);
+        free(scan.keys);
+        if (rc != 0) return -1;
+        *inout_len = 0;
+        *out_seq = limit;
+        return 2;
+    }
+
+    if (scan.count > 1) {
+        qsort(scan.hits, scan.count, sizeof(journal_hit_t), journal_hit_compare);
+    }
+    size_t used = 0;
+    size_t count = 0;
+    for (; count < scan.count; count++) {
+        const journal_hit_t* hit = &scan.hits[count];
+        size_t need = JOURNAL_OUT_HEADER + hit->key_len;
+        if (cap - used < need) {
+            break;
+        }
+        uint32_t fields[2] = {hit->op, hit->key_len};
+        memcpy(out_buf + used, &hit->seq, sizeof(hit->seq));
+        memcpy(out_buf + used + sizeof(hit->seq), fields, sizeof(fields));
+        memcpy(out_buf + used + JOURNAL_OUT_HEADER, scan.keys + hit->key_off,
+               hit->key_len);
+        used += need;
+    }
+
+    if (count == 0 && scan.count > 0) {
+        *inout_len = JOURNAL_OUT_HEADER + scan.hits[0].key_len;
+        *out_seq = since_seq;
+        rc = 1; // Buffer too small for even one change
+    } else {
+        *inout_len = used;
+        *out_count = count;
+        *out_seq = count < scan.count ? scan.hits[count - 1].seq : limit;
+    }
+    free(scan.hits);
+    free(scan.keys);
+    return rc;
+}
+
+DITTO_API int32_t ditto_export_begin(ditto_db_t* db, uint64_t* inout_incarnation,
+                                     uint64_t since_seq, int32_t compression,
+                                     ditto_export_t** out_export,
+                                     uint64_t* out_seq) {
+    if (!db || !inout_incarnation || !out_export || !out_seq ||
+        (compression != DITTO_COMPRESS_NONE && compression != DITTO_COMPRESS_LZ4)) {
+        return -1;
+    }
+
+    ditto_export_t* exp = (ditto_export_t*)calloc(1, sizeof(*exp));
+    if (!exp) {
+        return -1;
+    }
+    exp->db = db;
+    exp->compression = compression;
+
+    // Changes after `limit` may or may not make it in; an export since
+    // `limit` sends them again either way
+    uint64_t limit = atomic_load(&db->write_seq);
+    int32_t rc;
+    if (since_seq == 0) {
+        rc = ditto_scan_range(db, NULL, NULL, &exp->cursor);
+    } else if (*inout_incarnation != db->incarnation) {
+        rc = 2; // Seq from an earlier open, see ditto_changes_since()
+    } else {
+        rc = export_collect(exp, since_seq, limit);
+    }
+    if (rc != -1) *inout_incarnation = db->incarnation;
+    if (rc != 0) {
+        ditto_export_close(exp);
+        if (rc == 2) *out_seq = limit;
+        return rc;
+    }
+
+    *out_seq = limit;
+    *out_export = exp;
+    return 0;
+}
+
+DITTO_API int32_t ditto_export_next(ditto_export_t* exp, uint8_t* out_buf,
+                                    size_t* inout_len) {
+    if (!exp || !out_buf || !inout_len) {
+        return -1;
+    }
+
+    size_t cap = *inout_len > EXPORT_HEADER ? *inout_len - EXPORT_HEADER : 0;
+    uint8_t* payload = out_buf + EXPORT_HEADER;
+    if (exp->compression == DITTO_COMPRESS_LZ4) {
+        if (exp->raw_cap < cap) {
+            uint8_t* raw = (uint8_t*)realloc(exp->raw, cap);
+            if (!raw) return -1;
+            exp->raw = raw;
+            exp->raw_cap = cap;
+        }
+        payload = exp->raw;
+    }
+
+    size_t used = cap;
+    size_t count = 0;
+    int32_t rc = exp->cursor ? export_fill_all(exp, payload, &used, &count)
+                             : export_fill_changed(exp, payload, &used, &count);
+    if (rc != 0) {
+        if (rc == 1) *inout_len = EXPORT_HEADER + used;
+        return rc;
+    }
+    if (count == 0) {
+        *inout_len = 0; // Finished
+        return 0;
+    }
+
+    uint8_t codec = DITTO_COMPRESS_NONE;
+    size_t stored = used;
+    if (exp->compression == DITTO_COMPRESS_LZ4) {
+        size_t packed = ditto_lz_compress(payload, used, out_buf + EXPORT_HEADER,
+                                          used - 1);
+        if (packed > 0) {
+            codec = DITTO_COMPRESS_LZ4;
+            stored = packed;
+        } else {
+            memcpy(out_buf + EXPORT_HEADER, payload, used);
+        }
+    }
+
+    put_u32(out_buf, EXPORT_MAGIC);
+    out_buf[4] = EXPORT_VERSION;
+    out_buf[5] = codec;
+    out_buf[6] = 0;
+    out_buf[7] = 0;
+    put_u32(out_buf + 8, (uint32_t)count);
+    put_u32(out_buf + 12, (uint32_t)used);
+    put_u32(out_buf + 16, (uint32_t)stored);
+    put_u32(out_buf + 20, ditto_crc32c(0, out_buf + EXPORT_HEADER, stored));
+    *inout_len = EXPORT_HEADER + stored;
+    return 0;
+}
+
+DITTO_API void ditto_export_close(ditto_export_t* exp) {
+    if (!exp) return;
+
+    ditto_cursor_close(exp->cursor);
+    free(exp->changed.hits);
+    free(exp->changed.keys);
+    free(exp->keys);
+    free(exp->raw);
+    free(exp);
+}
+
+DITTO_API int32_t ditto_import_stream(ditto_db_t* db, const uint8_t* data,
+                                      size_t len) {
+    if (!db || (len > 0 && !data)) {
+        return -1;
+    }
+
+    for (size_t off = 0; off < len;) {
+        size_t n = import_chunk(db, data + off, len - off);
+        if (n == 0) {
+            return -1;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+DITTO_API int32_t ditto_set_durability(ditto_db_t* db, int32_t mode,
+                                       uint32_t interval_ms) {
+    if (!db) {
+        return -1;
+    }
+    if (!db->wal) {
+        return 0; // Nothing to make durable
+    }
+
+    return wal_set_durability(db->wal, mode, interval_ms);
+}
+
+DITTO_API int32_t ditto_set_memory_budget(ditto_db_t* db, uint64_t max_bytes,
+                                          int32_t policy) {
+    if (!db || (policy != DITTO_EVICT_NONE && policy != DITTO_EVICT_CLOCK)) {
+        return -1;
+    }
+
+    // Keys spread evenly over the shards, so each gets an equal share
+    uint64_t shard_budget = 0;
+    if (policy == DITTO_EVICT_CLOCK && max_bytes > 0) {
+        shard_budget = max_bytes / db->shard_count;
+        if (shard_budget == 0) shard_budget = 1;
+    }
+    atomic_store_explicit(&db->shard_budget, shard_budget, memory_order_relaxed);
+
+    // Apply a smaller budget now rather than on each shard's next write
+    int32_t rc = 0;
+    for (size_t i = 0; shard_budget > 0 && i < db->shard_count; i++) {
+        hash_table_t* table = &db->shards[i];
+        evict_list_t evicted = {0};
+        uint64_t lsn = 0;
+        shard_wrlock(table);
+        db_enforce_budget(db, table, &evicted, &lsn);
+        pthread_rwlock_unlock(&table->lock);
+        notify_evicted(db, &evicted);
+        if (db_commit(db, lsn) != 0) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+DITTO_API int32_t ditto_set_compression(ditto_db_t* db, int32_t codec,
+                                        size_t min_size) {
+    if (!db || (codec != DITTO_COMPRESS_NONE && codec != DITTO_COMPRESS_LZ4)) {
+        return -1;
+    }
+
+    size_t min = 0;
+    if (codec == DITTO_COMPRESS_LZ4) {
+        min = min_size > 0 ? min_size : 1;
+    }
+    for (size_t i = 0; i < db->shard_count; i++) {
+        atomic_store_explicit(&db->shards[i].compress_min, min, memory_order_relaxed);
+    }
+    return 0;
+}
+
+DITTO_API int32_t ditto_subscribe_evictions(ditto_db_t* db, ditto_on_change_cb cb,
+                                            void* user_data, int32_t* out_sub_id) {
+    if (!db || !cb || !out_sub_id) {
+        return -1;
+    }
+
+    return add_subscription(db, SUB_MATCH_EVICTED, NULL, cb, NULL, user_data,
+                            out_sub_id);
+}
+
+DITTO_API int32_t ditto_get_stats(ditto_db_t* db, ditto_stats_t* out_stats,
+                                  size_t stats_size) {
+    if (!db || !out_stats) {
+        return -1;
+    }
+
+    ditto_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    uint64_t probe_total = 0;
+    uint64_t probed = 0;
+    for (size_t i = 0; i < db->shard_count; i++) {
+        hash_table_t* table = &db->shards[i];
+        shard_rdlock(table);
+        size_t slots = table->active.capacity + table->draining.capacity;
+        stats.payload_bytes += table->payload_bytes;
+        stats.allocated_bytes += slab_allocated_bytes(table->slab) +
+                                 slots * sizeof(kv_slot_t);
+        if (i == 0 && table->base) {
+            stats.mapped_bytes = snapshot_file_size(table->base);
+        }
+        slot_array_probe_stats(&table->active, &probe_total,
+                               &stats.max_probe_distance, &probed);
+        slot_array_probe_stats(&table->draining, &probe_total,
+                               &stats.max_probe_distance, &probed);
+        slot_array_packed_stats(&table->active, &stats.compressed_values,
+                                &stats.compressed_bytes, &stats.uncompressed_bytes);
+        slot_array_packed_stats(&table->draining, &stats.compressed_values,
+                                &stats.compressed_bytes, &stats.uncompressed_bytes);
+        pthread_rwlock_unlock(&table->lock);
+
+        stats.gets += stat_load(&table->stats.gets);
+        stats.puts += stat_load(&table->stats.puts);
+        stats.deletes += stat_load(&table->stats.deletes);
+        stats.evictions += stat_load(&table->stats.evictions);
+        stats.expirations += stat_load(&table->stats.expirations);
+        stats.shard_lock_contended += stat_load(&table->stats.lock.contended);
+        stats.shard_lock_wait_ns += stat_load(&table->stats.lock.wait_ns);
+    }
+    stats.entries = probed;
+    stats.avg_probe_distance = probed ? (double)probe_total / (double)probed : 0.0;
+
+    stats.scans = stat_load(&db->scans);
+    stats.txn_commits = stat_load(&db->txn_commits);
+    stats.txn_conflicts = stat_load(&db->txn_conflicts);
+    stats.sub_lock_contended = stat_load(&db->sub_lock_stats.contended);
+    stats.sub_lock_wait_ns = stat_load(&db->sub_lock_stats.wait_ns);
+    stats.notify_batches = stat_load(&db->notify_batches);
+    stats.notify_keys = stat_load(&db->notify_keys);
+    stats.callback_ns = stat_load(&db->callback_ns);
+    stats.max_callback_ns = stat_load(&db->max_callback_ns);
+    stats.maintenance_passes = stat_load(&db->maint_rounds);
+    stats.maintenance_pauses = stat_load(&db->maint_pauses);
+    stats.compactions = stat_load(&db->compactions);
+    stats.slab_bytes_released = stat_load(&db->slab_released);
+
+    dispatcher_t* d = atomic_load_explicit(&db->dispatcher, memory_order_acquire);
+    if (d) {
+        stats.dispatched = stat_load(&d->dispatched);
+        stats.dispatch_latency_ns = stat_load(&d->latency_ns);
+        stats.max_dispatch_latency_ns = stat_load(&d->max_latency_ns);
+        stats.max_queue_depth = stat_load(&d->max_depth);
+#if DITTO_ENABLE_STATS
+        size_t enqueued = atomic_load_explicit(&d->enqueue_pos, memory_order_relaxed);
+        if (enqueued > stats.dispatched) {
+            stats.queue_depth = enqueued - stats.dispatched;
+        }
+#endif
+    }
+
+    memcpy(out_stats, &stats, stats_size < sizeof(stats) ? stats_size : sizeof(stats));
+    return 0;
+}
+
+DITTO_API int32_t ditto_trace_start(size_t events_per_thread) {
+    return trace_start(events_per_thread);
+}
+
+DITTO_API int32_t ditto_trace_stop(void) {
+    if (!DITTO_ENABLE_TRACE) return -1;
+
+    trace_stop();
+    return 0;
+}
+
+DITTO_API int32_t ditto_trace_export(char* out_buf, size_t* inout_len) {
+    return trace_export(out_buf, inout_len);
 }
 
 DITTO_API const char* ditto_version(void) {
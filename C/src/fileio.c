@@ -0,0 +1,264 @@
+// fileio.c - File helpers shared by the log and snapshot code
+#include "fileio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int file_open(const char* path, int flags) {
+    int oflags = (flags & FILE_WRITE) ? O_RDWR : O_RDONLY;
+    if (flags & FILE_CREATE) oflags |= O_CREAT;
+    if (flags & FILE_TRUNCATE) oflags |= O_TRUNC;
+    int fd;
+    do {
+        fd = open(path, oflags, 0644);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+void file_close(int fd) {
+    if (fd >= 0) close(fd);
+}
+
+int64_t file_size(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    return (int64_t)st.st_size;
+}
+
+int file_seek(int fd, uint64_t offset) {
+    return lseek(fd, (off_t)offset, SEEK_SET) < 0 ? -1 : 0;
+}
+
+int file_truncate(int fd, uint64_t size) {
+    return ftruncate(fd, (off_t)size);
+}
+
+int file_lock(int fd) {
+    return flock(fd, LOCK_EX | LOCK_NB);
+}
+
+int file_rename(const char* from, const char* to) {
+    return rename(from, to);
+}
+
+int file_remove(const char* path) {
+    return unlink(path);
+}
+
+int write_all(int fd, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int write_all_at(int fd, const uint8_t* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+int read_exact(int fd, uint8_t* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return 1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int sync_fd(int fd) {
+#if defined(__APPLE__)
+    // fsync on macOS does not flush the drive cache
+    if (fcntl(fd, F_FULLFSYNC) == 0) return 0;
+    return fsync(fd);
+#elif defined(__linux__)
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+int sync_dir(const char* dir) {
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+int dir_create(const char* dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    return 0;
+}
+
+int dir_list(const char* dir, int (*fn)(void* ctx, const char* name), void* ctx) {
+    DIR* d = opendir(dir);
+    if (!d) return -1;
+    int rc = 0;
+    struct dirent* ent;
+    while (rc == 0 && (ent = readdir(d)) != NULL) {
+        if (fn(ctx, ent->d_name) != 0) rc = -1;
+    }
+    closedir(d);
+    return rc;
+}
+
+const uint8_t* file_map(int fd, size_t size) {
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+    madvise(map, size, MADV_RANDOM);
+    return (const uint8_t*)map;
+}
+
+void file_unmap(const uint8_t* map, size_t size) {
+    if (map) munmap((void*)map, size);
+}
+
+#else // _WIN32
+
+// No file backend yet: the log never opens, so neither does a store on disk
+
+int file_open(const char* path, int flags) {
+    (void)path;
+    (void)flags;
+    return -1;
+}
+
+void file_close(int fd) {
+    (void)fd;
+}
+
+int64_t file_size(int fd) {
+    (void)fd;
+    return -1;
+}
+
+int file_seek(int fd, uint64_t offset) {
+    (void)fd;
+    (void)offset;
+    return -1;
+}
+
+int file_truncate(int fd, uint64_t size) {
+    (void)fd;
+    (void)size;
+    return -1;
+}
+
+int file_lock(int fd) {
+    (void)fd;
+    return -1;
+}
+
+int file_rename(const char* from, const char* to) {
+    (void)from;
+    (void)to;
+    return -1;
+}
+
+int file_remove(const char* path) {
+    (void)path;
+    return -1;
+}
+
+int write_all(int fd, const uint8_t* data, size_t len) {
+    (void)fd;
+    (void)data;
+    (void)len;
+    return -1;
+}
+
+int write_all_at(int fd, const uint8_t* data, size_t len, uint64_t offset) {
+    (void)fd;
+    (void)data;
+    (void)len;
+    (void)offset;
+    return -1;
+}
+
+int read_exact(int fd, uint8_t* buf, size_t len) {
+    (void)fd;
+    (void)buf;
+    (void)len;
+    return -1;
+}
+
+int sync_fd(int fd) {
+    (void)fd;
+    return -1;
+}
+
+int sync_dir(const char* dir) {
+    (void)dir;
+    return -1;
+}
+
+int dir_create(const char* dir) {
+    (void)dir;
+    return -1;
+}
+
+int dir_list(const char* dir, int (*fn)(void* ctx, const char* name), void* ctx) {
+    (void)dir;
+    (void)fn;
+    (void)ctx;
+    return -1;
+}
+
+const uint8_t* file_map(int fd, size_t size) {
+    (void)fd;
+    (void)size;
+    return NULL;
+}
+
+void file_unmap(const uint8_t* map, size_t size) {
+    (void)map;
+    (void)size;
+}
+
+#endif
+
+char* path_join(const char* dir, const char* name) {
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char* path = (char*)malloc(len);
+    if (path) {
+        snprintf(path, len, "%s/%s", dir, name);
+    }
+    return path;
+}
@@ -0,0 +1,71 @@
+// fileio.h - File helpers shared by the log and snapshot code
+//
+// Every file, directory, lock and mapping the store touches goes through
+// here, so the log and snapshot code stay free of platform calls. POSIX
+// builds implement all of it. Windows builds have no file backend yet:
+// every call fails, so ditto_open() on a path returns -1 there and only the
+// in-memory store (DITTO_MEMORY_PATH) is available.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Flags for file_open(). Without FILE_WRITE the file is opened read-only.
+#define FILE_WRITE 1
+#define FILE_CREATE 2
+#define FILE_TRUNCATE 4
+
+// Opens `path`. Returns a descriptor, or -1.
+int file_open(const char* path, int flags);
+
+void file_close(int fd);
+
+// Size of an open file in bytes, or -1.
+int64_t file_size(int fd);
+
+// Moves the file position to `offset`. Returns 0 or -1.
+int file_seek(int fd, uint64_t offset);
+
+// Cuts or extends the file to `size` bytes. Returns 0 or -1.
+int file_truncate(int fd, uint64_t size);
+
+// Takes an exclusive lock on the file without waiting. It is held until
+// the descriptor is closed. Returns 0, or -1 if another process has it.
+int file_lock(int fd);
+
+// Renames `from` over `to`, replacing it. Returns 0 or -1.
+int file_rename(const char* from, const char* to);
+
+// Deletes `path`. Returns 0 or -1.
+int file_remove(const char* path);
+
+// Writes all of `data`, retrying short writes. Returns 0 or -1.
+int write_all(int fd, const uint8_t* data, size_t len);
+
+// Writes all of `data` at `offset` without moving the file position.
+int write_all_at(int fd, const uint8_t* data, size_t len, uint64_t offset);
+
+// Reads exactly `len` bytes. Returns 0, 1 on end of file, -1 on error.
+int read_exact(int fd, uint8_t* buf, size_t len);
+
+// Forces file data to stable storage (F_FULLFSYNC on macOS).
+int sync_fd(int fd);
+
+// Makes a create/rename/unlink inside `dir` durable.
+int sync_dir(const char* dir);
+
+// Creates `dir` unless it already exists. Returns 0, or -1 if it cannot be
+// created or is not a directory.
+int dir_create(const char* dir);
+
+// Calls fn(ctx, name) for each entry of `dir`, stopping early if fn returns
+// nonzero. Returns 0, or -1 if the directory cannot be read or fn stopped.
+int dir_list(const char* dir, int (*fn)(void* ctx, const char* name), void* ctx);
+
+// Maps the first `size` bytes of an open file read-only, advised for random
+// access. The mapping outlives the descriptor. Returns NULL on error.
+const uint8_t* file_map(int fd, size_t size);
+
+void file_unmap(const uint8_t* map, size_t size);
+
+// Returns malloc'ed "dir/name", or NULL.
+char* path_join(const char* dir, const char* name);
@@ -0,0 +1,120 @@
+// hash.c - Seeded 64-bit hash (wyhash-derived)
+#include "hash.h"
+#include "bytes.h"
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <bcrypt.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const uint64_t hash_secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+// 64x64 -> 128 bit multiply, low half into *a and high half into *b
+static inline void mul128(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    mul128(&a, &b);
+    return a ^ b;
+}
+
+// Keys of 1-3 bytes: first, middle and last byte
+static inline uint64_t read3(const uint8_t* p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t ditto_hash64(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = (const uint8_t*)data;
+    seed ^= mix(seed ^ hash_secret[0], hash_secret[1]);
+
+    uint64_t a;
+    uint64_t b;
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two possibly overlapping 4-byte reads from each end
+            size_t mid = (len >> 3) << 2;
+            a = ((uint64_t)get_u32(p) << 32) | get_u32(p + mid);
+            b = ((uint64_t)get_u32(p + len - 4) << 32) | get_u32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            // Three independent lanes keep the multipliers busy
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = mix(get_u64(p) ^ hash_secret[1], get_u64(p + 8) ^ seed);
+                seed1 = mix(get_u64(p + 16) ^ hash_secret[2], get_u64(p + 24) ^ seed1);
+                seed2 = mix(get_u64(p + 32) ^ hash_secret[3], get_u64(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = mix(get_u64(p) ^ hash_secret[1], get_u64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // The last 16 bytes, overlapping what was already consumed
+        a = get_u64(p + i - 16);
+        b = get_u64(p + i - 8);
+    }
+
+    a ^= hash_secret[1];
+    b ^= seed;
+    mul128(&a, &b);
+    return mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
+
+uint64_t ditto_hash_random_seed(void) {
+    uint8_t bytes[8];
+#if defined(_WIN32)
+    if (BCryptGenRandom(NULL, bytes, sizeof(bytes),
+                        BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0) {
+        return get_u64(bytes);
+    }
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, bytes, sizeof(bytes));
+        close(fd);
+        if (n == (ssize_t)sizeof(bytes)) {
+            return get_u64(bytes);
+        }
+    }
+#endif
+
+    // No entropy source: fall back to the clock and an address, which is
+    // still unpredictable enough to defeat precomputed collisions
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t t = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    return mix(t ^ hash_secret[2], (uint64_t)(uintptr_t)&ts ^ hash_secret[3]);
+}
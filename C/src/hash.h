@@ -0,0 +1,13 @@
+// hash.h - Seeded 64-bit hash used to place keys in tables and snapshots
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Hashes `len` bytes of `data` under `seed`. Derived from wyhash: eight bytes
+// per step with a 64x64->128 bit multiply-mix, so long shared key prefixes
+// still spread across the whole output.
+uint64_t ditto_hash64(const void* data, size_t len, uint64_t seed);
+
+// A fresh seed from the system's entropy source, so keys that collide under
+// one store's seed need not collide under another's.
+uint64_t ditto_hash_random_seed(void);
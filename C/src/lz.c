@@ -0,0 +1,176 @@
+// lz.c - LZ4 block format compressor
+//
+// A block is a run of sequences, each a token byte (literal count in the
+// high nibble, match length minus 4 in the low one, 15 meaning more length
+// bytes follow), the literals, and a 2-byte little-endian match offset. The
+// last sequence has literals only. As the format requires, the last 5 bytes
+// are always literals and no match starts within the last 12.
+#include "lz.h"
+#include <string.h>
+
+#define LZ_MIN_MATCH     4
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT      12
+#define LZ_MAX_OFFSET    65535
+#define LZ_HASH_BITS     12
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Appends the continuation bytes of a length that did not fit its nibble.
+static uint8_t* put_length(uint8_t* op, const uint8_t* end, size_t n) {
+    for (; n >= 255; n -= 255) {
+        if (op == end) return NULL;
+        *op++ = 255;
+    }
+    if (op == end) return NULL;
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+// Appends one sequence; match_len 0 writes the final, literal-only one.
+// Returns the new end of output, or NULL if it does not fit.
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* end,
+                             const uint8_t* literals, size_t lit_len,
+                             size_t offset, size_t match_len) {
+    if (op == end) return NULL;
+    uint8_t* token = op++;
+    uint8_t lit_code = lit_len >= 15 ? 15 : (uint8_t)lit_len;
+    if (lit_code == 15 && !(op = put_length(op, end, lit_len - 15))) {
+        return NULL;
+    }
+    if ((size_t)(end - op) < lit_len) return NULL;
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    *token = (uint8_t)(lit_code << 4);
+    if (match_len == 0) {
+        return op;
+    }
+
+    if (end - op < 2) return NULL;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    size_t ml = match_len - LZ_MIN_MATCH;
+    uint8_t ml_code = ml >= 15 ? 15 : (uint8_t)ml;
+    if (ml_code == 15 && !(op = put_length(op, end, ml - 15))) {
+        return NULL;
+    }
+    *token |= ml_code;
+    return op;
+}
+
+size_t ditto_lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap) {
+    uint8_t* op = dst;
+    const uint8_t* end = dst + cap;
+    const uint8_t* anchor = src;
+
+    if (len > LZ_MF_LIMIT && len <= UINT32_MAX) {
+        // Last position seen per hash of 4 bytes; stale or colliding entries
+        // are weeded out by comparing the bytes
+        uint32_t table[1u << LZ_HASH_BITS];
+        memset(table, 0, sizeof(table));
+
+        const uint8_t* ip = src;
+        const uint8_t* mf_limit = src + len - LZ_MF_LIMIT;
+        const uint8_t* match_limit = src + len - LZ_LAST_LITERALS;
+        while (ip <= mf_limit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash4(seq);
+            const uint8_t* ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+                // Step faster through data that keeps failing to match
+                ip += 1 + ((size_t)(ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* m = ip + LZ_MIN_MATCH;
+            const uint8_t* r = ref + LZ_MIN_MATCH;
+            while (m < match_limit && *m == *r) {
+                m++;
+                r++;
+            }
+
+            op = put_sequence(op, end, anchor, (size_t)(ip - anchor),
+                              (size_t)(ip - ref), (size_t)(m - ip));
+            if (!op) return 0;
+            ip = m;
+            anchor = m;
+            if (ip <= mf_limit) {
+                table[hash4(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+            }
+        }
+    }
+
+    op = put_sequence(op, end, anchor, (size_t)(src + len - anchor), 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+static int32_t get_length(const uint8_t** ip, const uint8_t* end, size_t* n) {
+    uint8_t b;
+    do {
+        if (*ip == end) return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+int32_t ditto_lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst,
+                            size_t dst_len) {
+    const uint8_t* ip = src;
+    const uint8_t* ip_end = src + src_len;
+    uint8_t* op = dst;
+    uint8_t* op_end = dst + dst_len;
+
+    for (;;) {
+        if (ip == ip_end) return -1;
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && get_length(&ip, ip_end, &lit_len) != 0) {
+            return -1;
+        }
+        if ((size_t)(ip_end - ip) < lit_len || (size_t)(op_end - op) < lit_len) {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+        if (ip == ip_end) {
+            return op == op_end ? 0 : -1; // The final sequence has no match
+        }
+
+        if (ip_end - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && get_length(&ip, ip_end, &match_len) != 0) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if ((size_t)(op_end - op) < match_len) return -1;
+
+        // An offset shorter than the match repeats the last `offset` bytes;
+        // copying at most `offset` at a time keeps each copy disjoint
+        while (match_len > 0) {
+            size_t n = match_len < offset ? match_len : offset;
+            memcpy(op, op - offset, n);
+            op += n;
+            match_len -= n;
+        }
+    }
+}
@@ -0,0 +1,15 @@
+// lz.h - LZ4 block format compressor used for large values
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Compresses `len` bytes of `src` into at most `cap` bytes of `dst` as one
+// LZ4 block (greedy matching over a 4-byte hash, 64 KiB window) and returns
+// the compressed size, or 0 if it does not fit. Passing a `cap` below `len`
+// doubles as the check that compressing is worth it.
+size_t ditto_lz_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
+
+// Decompresses a block that must expand to exactly `dst_len` bytes.
+// Returns 0 on success, -1 if the block is malformed or of another length.
+int32_t ditto_lz_decompress(const uint8_t* src, size_t src_len, uint8_t* dst,
+                            size_t dst_len);
@@ -0,0 +1,304 @@
+// slab.c - Size-class allocator for entries and values
+//
+// Each class keeps two free lists: `local`, touched only by the (serialized)
+// allocating side, and `remote`, a lock-free stack any thread may push a
+// freed block onto. When `local` runs dry the allocator takes the whole
+// remote stack in one exchange, so pops never race with each other and the
+// stack needs no ABA protection.
+//
+// Chunks are aligned to their size, so a block finds its chunk's header by
+// masking its address. slab_repack() counts the free blocks of every chunk
+// to return the empty ones and to pick sparse ones to evacuate: their free
+// blocks are held back from allocation, so once the caller has moved their
+// live blocks elsewhere they empty out for a later pass to return.
+#include "slab.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#define SLAB_CHUNK_SIZE (64u << 10)
+#define SLAB_CHUNK_HEADER 16    // slab_chunk_t, keeps blocks 16-aligned
+
+// Roughly 25% apart so internal waste stays under a quarter of a block
+static const uint16_t class_sizes[] = {
+    32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320,
+    384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+#define SLAB_CLASS_COUNT (sizeof(class_sizes) / sizeof(class_sizes[0]))
+_Static_assert(SLAB_MAX_CLASS_SIZE == 2048, "must match the last class size");
+
+typedef struct free_block {
+    struct free_block* next;
+} free_block_t;
+
+#define CHUNK_IN_USE    0
+#define CHUNK_EVACUATE  1       // sparse: free blocks are held back
+#define CHUNK_EMPTY     2       // every block free, about to be returned
+typedef struct slab_chunk {
+    struct slab_chunk* next;
+    uint32_t free_count;        // scratch for slab_repack()
+    uint8_t size_class;
+    uint8_t state;              // CHUNK_*
+} slab_chunk_t;
+_Static_assert(sizeof(slab_chunk_t) <= SLAB_CHUNK_HEADER, "chunk header too large");
+
+typedef struct {
+    free_block_t* local;
+    _Atomic(free_block_t*) remote;
+    free_block_t* held;         // free blocks of evacuating chunks
+    uint8_t* bump;              // uncarved tail of the newest chunk
+    size_t bump_left;
+} slab_class_t;
+
+struct slab {
+    slab_class_t classes[SLAB_CLASS_COUNT];
+    slab_chunk_t* chunks;
+    size_t evacuating;          // chunks in state CHUNK_EVACUATE
+    _Atomic uint64_t chunk_bytes;
+    _Atomic uint64_t large_bytes;
+};
+
+static slab_chunk_t* chunk_of(const void* block) {
+    return (slab_chunk_t*)((uintptr_t)block & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+}
+
+static uint8_t class_for(size_t size) {
+    for (uint8_t c = 0; c < SLAB_CLASS_COUNT; c++) {
+        if (size <= class_sizes[c]) return c;
+    }
+    return SLAB_CLASS_NONE;
+}
+
+int32_t slab_create(slab_t** out_slab) {
+    slab_t* slab = (slab_t*)calloc(1, sizeof(slab_t));
+    if (!slab) return -1;
+    for (size_t c = 0; c < SLAB_CLASS_COUNT; c++) {
+        atomic_init(&slab->classes[c].remote, NULL);
+    }
+    atomic_init(&slab->chunk_bytes, 0);
+    atomic_init(&slab->large_bytes, 0);
+    *out_slab = slab;
+    return 0;
+}
+
+void slab_destroy(slab_t* slab) {
+    if (!slab) return;
+
+    slab_chunk_t* chunk = slab->chunks;
+    while (chunk) {
+        slab_chunk_t* next = chunk->next;
+        slab_aligned_free(chunk);
+        chunk = next;
+    }
+    free(slab);
+}
+
+void* slab_alloc_large(slab_t* slab, size_t size) {
+    void* block = malloc(size);
+    if (block) {
+        atomic_fetch_add_explicit(&slab->large_bytes, size, memory_order_relaxed);
+    }
+    return block;
+}
+
+// Moves the blocks of evacuating chunks from `list` to the held list and
+// returns the rest.
+static free_block_t* hold_back(slab_class_t* cls, free_block_t* list) {
+    free_block_t* kept = NULL;
+    while (list) {
+        free_block_t* next = list->next;
+        free_block_t** dst = chunk_of(list)->state == CHUNK_EVACUATE ? &cls->held
+                                                                     : &kept;
+        list->next = *dst;
+        *dst = list;
+        list = next;
+    }
+    return kept;
+}
+
+void* slab_alloc(slab_t* slab, size_t size, uint8_t* out_class) {
+    uint8_t c = class_for(size);
+    *out_class = c;
+    if (c == SLAB_CLASS_NONE) {
+        return slab_alloc_large(slab, size);
+    }
+
+    slab_class_t* cls = &slab->classes[c];
+    if (!cls->local) {
+        cls->local = atomic_exchange_explicit(&cls->remote, NULL, memory_order_acquire);
+        if (slab->evacuating > 0) {
+            cls->local = hold_back(cls, cls->local);
+        }
+    }
+    if (cls->local) {
+        free_block_t* block = cls->local;
+        cls->local = block->next;
+        return block;
+    }
+
+    size_t block_size = class_sizes[c];
+    if (cls->bump_left < block_size) {
+        slab_chunk_t* chunk = (slab_chunk_t*)slab_aligned_alloc(SLAB_CHUNK_SIZE,
+                                                                SLAB_CHUNK_SIZE);
+        if (!chunk) return NULL;
+        chunk->next = slab->chunks;
+        chunk->free_count = 0;
+        chunk->size_class = c;
+        chunk->state = CHUNK_IN_USE;
+        slab->chunks = chunk;
+        atomic_fetch_add_explicit(&slab->chunk_bytes, SLAB_CHUNK_SIZE,
+                                  memory_order_relaxed);
+        cls->bump = (uint8_t*)chunk + SLAB_CHUNK_HEADER;
+        cls->bump_left = SLAB_CHUNK_SIZE - SLAB_CHUNK_HEADER;
+    }
+
+    void* block = cls->bump;
+    cls->bump += block_size;
+    cls->bump_left -= block_size;
+    return block;
+}
+
+void slab_free(slab_t* slab, void* block, uint8_t size_class, size_t size) {
+    if (size_class == SLAB_CLASS_NONE) {
+        atomic_fetch_sub_explicit(&slab->large_bytes, size, memory_order_relaxed);
+        free(block);
+        return;
+    }
+
+    slab_class_t* cls = &slab->classes[size_class];
+    free_block_t* node = (free_block_t*)block;
+    free_block_t* head = atomic_load_explicit(&cls->remote, memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&cls->remote, &head, node,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+void* slab_aligned_alloc(size_t align, size_t size) {
+#if defined(_WIN32)
+    return _aligned_malloc(size, align);
+#else
+    return aligned_alloc(align, size);
+#endif
+}
+
+void slab_aligned_free(void* block) {
+#if defined(_WIN32)
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+size_t slab_class_size(uint8_t size_class) {
+    return size_class == SLAB_CLASS_NONE ? 0 : class_sizes[size_class];
+}
+
+uint64_t slab_allocated_bytes(slab_t* slab) {
+    return atomic_load_explicit(&slab->chunk_bytes, memory_order_relaxed) +
+           atomic_load_explicit(&slab->large_bytes, memory_order_relaxed);
+}
+
+// Pushes every block of `src` onto `dst` and returns the new head.
+static free_block_t* list_move_all(free_block_t* dst, free_block_t* src) {
+    while (src) {
+        free_block_t* next = src->next;
+        src->next = dst;
+        dst = src;
+        src = next;
+    }
+    return dst;
+}
+
+// Blocks carved from a chunk so far: all that fit, except in the chunk its
+// class is still carving.
+static uint32_t chunk_carved(const slab_t* slab, const slab_chunk_t* chunk) {
+    const slab_class_t* cls = &slab->classes[chunk->size_class];
+    size_t block_size = class_sizes[chunk->size_class];
+    if (cls->bump && chunk_of(cls->bump - 1) == chunk) {
+        return (uint32_t)((size_t)(cls->bump - (uint8_t*)chunk - SLAB_CHUNK_HEADER) /
+                          block_size);
+    }
+    return (uint32_t)((SLAB_CHUNK_SIZE - SLAB_CHUNK_HEADER) / block_size);
+}
+
+size_t slab_repack(slab_t* slab, unsigned max_fill_pct, uint64_t* out_released) {
+    // Every free block the allocating side can see, counted into its chunk
+    for (slab_chunk_t* chunk = slab->chunks; chunk; chunk = chunk->next) {
+        chunk->free_count = 0;
+    }
+    free_block_t* lists[SLAB_CLASS_COUNT];
+    for (size_t c = 0; c < SLAB_CLASS_COUNT; c++) {
+        slab_class_t* cls = &slab->classes[c];
+        free_block_t* list = atomic_exchange_explicit(&cls->remote, NULL,
+                                                      memory_order_acquire);
+        list = list_move_all(list, cls->local);
+        list = list_move_all(list, cls->held);
+        cls->local = NULL;
+        cls->held = NULL;
+        for (free_block_t* block = list; block; block = block->next) {
+            chunk_of(block)->free_count++;
+        }
+        lists[c] = list;
+    }
+
+    slab->evacuating = 0;
+    for (slab_chunk_t* chunk = slab->chunks; chunk; chunk = chunk->next) {
+        const slab_class_t* cls = &slab->classes[chunk->size_class];
+        uint32_t carved = chunk_carved(slab, chunk);
+        uint64_t live = carved - chunk->free_count;
+        int carving = cls->bump && chunk_of(cls->bump - 1) == chunk;
+        if (live == 0) {
+            chunk->state = CHUNK_EMPTY;
+        } else if (!carving && live * 100 <= (uint64_t)carved * max_fill_pct) {
+            chunk->state = CHUNK_EVACUATE;
+            slab->evacuating++;
+        } else {
+            chunk->state = CHUNK_IN_USE;
+        }
+    }
+
+    // Blocks of empty chunks leave the lists with their chunk
+    for (size_t c = 0; c < SLAB_CLASS_COUNT; c++) {
+        slab_class_t* cls = &slab->classes[c];
+        free_block_t* list = lists[c];
+        while (list) {
+            free_block_t* next = list->next;
+            uint8_t state = chunk_of(list)->state;
+            if (state != CHUNK_EMPTY) {
+                free_block_t** dst = state == CHUNK_EVACUATE ? &cls->held : &cls->local;
+                list->next = *dst;
+                *dst = list;
+            }
+            list = next;
+        }
+    }
+
+    uint64_t released = 0;
+    slab_chunk_t** link = &slab->chunks;
+    while (*link) {
+        slab_chunk_t* chunk = *link;
+        if (chunk->state != CHUNK_EMPTY) {
+            link = &chunk->next;
+            continue;
+        }
+        slab_class_t* cls = &slab->classes[chunk->size_class];
+        if (cls->bump && chunk_of(cls->bump - 1) == chunk) {
+            cls->bump = NULL;
+            cls->bump_left = 0;
+        }
+        *link = chunk->next;
+        slab_aligned_free(chunk);
+        released += SLAB_CHUNK_SIZE;
+    }
+    atomic_fetch_sub_explicit(&slab->chunk_bytes, released, memory_order_relaxed);
+    if (out_released) *out_released = released;
+    return slab->evacuating;
+}
+
+int slab_block_evacuating(const void* block, uint8_t size_class) {
+    return size_class != SLAB_CLASS_NONE && chunk_of(block)->state == CHUNK_EVACUATE;
+}
@@ -0,0 +1,55 @@
+// slab.h - Size-class allocator for entries and values
+//
+// Small blocks are carved out of 64 KiB chunks and recycled through one free
+// list per size class, which avoids per-block malloc headers and keeps
+// fragmentation bounded. Larger blocks fall back to malloc.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct slab slab_t;
+
+// Size class of blocks that bypass the slabs.
+#define SLAB_CLASS_NONE 0xff
+
+// Largest block size served from the slabs.
+#define SLAB_MAX_CLASS_SIZE 2048
+
+int32_t slab_create(slab_t** out_slab);
+
+// Frees every chunk. Blocks still allocated become invalid.
+void slab_destroy(slab_t* slab);
+
+// Returns a block of at least `size` bytes and its size class. Calls must be
+// serialized by the caller; frees need not be.
+void* slab_alloc(slab_t* slab, size_t size, uint8_t* out_class);
+
+// Returns a block that bypasses the slabs (class SLAB_CLASS_NONE) whatever
+// its size. Unlike slab_alloc(), safe from any thread.
+void* slab_alloc_large(slab_t* slab, size_t size);
+
+// Returns a block to its class. Safe from any thread. `size` is the size
+// passed to slab_alloc() and only matters for SLAB_CLASS_NONE blocks.
+void slab_free(slab_t* slab, void* block, uint8_t size_class, size_t size);
+
+// aligned_alloc() and the free that matches it, which differs on Windows.
+// `size` must be a multiple of `align`.
+void* slab_aligned_alloc(size_t align, size_t size);
+void slab_aligned_free(void* block);
+
+// Usable bytes of a block in `size_class`, 0 for SLAB_CLASS_NONE.
+size_t slab_class_size(uint8_t size_class);
+
+// Bytes obtained from the system: whole chunks plus malloc'ed large blocks.
+uint64_t slab_allocated_bytes(slab_t* slab);
+
+// Fragmentation. Frees leave blocks scattered over chunks that stay
+// allocated. slab_repack() returns the chunks whose every block is free and
+// marks those at most max_fill_pct full for evacuation: their free blocks
+// are no longer handed out, so once the caller moves the live blocks that
+// slab_block_evacuating() reports, a later call can return them too. Stores
+// the bytes returned in *out_released (if not NULL) and returns how many
+// chunks are being evacuated. Both calls must be serialized with
+// slab_alloc().
+size_t slab_repack(slab_t* slab, unsigned max_fill_pct, uint64_t* out_released);
+int slab_block_evacuating(const void* block, uint8_t size_class);
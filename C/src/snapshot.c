@@ -0,0 +1,459 @@
+// snapshot.c - Immutable, memory-mapped snapshot of a store
+//
+// File layout (integers little-endian):
+//
+//   header   72 bytes, see SNAP_* offsets below
+//   heap     key and value bytes, written in key order
+//   entries  entry_count records of 40 bytes, sorted by key:
+//              u64 key_off, u64 hash, u64 value_off, u64 value_len,
+//              u32 key_len, u32 reserved (0)
+//   index    index_capacity u32 slots (entry number + 1, 0 = empty),
+//            probed linearly from hash & (index_capacity - 1)
+//
+// Hashes are only meaningful under the header's hash seed, which the store
+// adopts when it opens the snapshot.
+//
+// The header and the entries/index arrays are checksummed and validated on
+// open; value bytes are not, so opening stays independent of data size.
+#include "snapshot.h"
+#include "bytes.h"
+#include "checksum.h"
+#include "fileio.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAP_FILE_NAME "ditto.snap"
+#define SNAP_TMP_NAME "ditto.snap.tmp"
+#define SNAP_MAGIC "DITTOSNP"
+#define SNAP_VERSION 2
+#define SNAP_HEADER_SIZE 72
+#define SNAP_ENTRY_SIZE 40
+#define SNAP_WRITE_BUFFER (1 << 20)
+
+// Header field offsets
+#define SNAP_OFF_VERSION      8
+#define SNAP_OFF_HEADER_CRC  12
+#define SNAP_OFF_COUNT       16
+#define SNAP_OFF_ENTRIES     24
+#define SNAP_OFF_INDEX       32
+#define SNAP_OFF_INDEX_CAP   40
+#define SNAP_OFF_LOG_GEN     48
+#define SNAP_OFF_META_CRC    56
+#define SNAP_OFF_HASH_SEED   64
+
+// Entry field offsets
+#define SNAP_E_KEY_OFF        0
+#define SNAP_E_HASH           8
+#define SNAP_E_VALUE_OFF     16
+#define SNAP_E_VALUE_LEN     24
+#define SNAP_E_KEY_LEN       32
+
+struct snapshot {
+    _Atomic uint32_t refs;
+    const uint8_t* map;
+    uint64_t size;
+    uint64_t count;
+    const uint8_t* entries;
+    const uint8_t* index;
+    uint64_t index_mask;
+    uint64_t log_gen;
+    uint64_t hash_seed;
+};
+
+struct snapshot_writer {
+    int fd;
+    char* tmp_path;
+    char* final_path;
+    char* dir;
+    uint64_t hash_seed;
+    uint8_t* buf;
+    size_t buf_len;
+    uint64_t offset;              // file offset of buf[0]
+    uint8_t* entries;             // encoded entry records
+    uint64_t count;
+    uint64_t entries_cap;
+    char* last_key;
+    size_t last_key_len;
+    size_t last_key_cap;
+};
+
+static uint32_t header_crc(const uint8_t* header) {
+    uint8_t copy[SNAP_HEADER_SIZE];
+    memcpy(copy, header, SNAP_HEADER_SIZE);
+    put_u32(copy + SNAP_OFF_HEADER_CRC, 0);
+    return ditto_crc32c(0, copy, SNAP_HEADER_SIZE);
+}
+
+static int validate(snapshot_t* snap) {
+    const uint8_t* h = snap->map;
+    if (snap->size < SNAP_HEADER_SIZE || memcmp(h, SNAP_MAGIC, 8) != 0 ||
+        get_u32(h + SNAP_OFF_VERSION) != SNAP_VERSION ||
+        get_u32(h + SNAP_OFF_HEADER_CRC) != header_crc(h)) {
+        return -1;
+    }
+
+    uint64_t count = get_u64(h + SNAP_OFF_COUNT);
+    uint64_t entries_off = get_u64(h + SNAP_OFF_ENTRIES);
+    uint64_t index_off = get_u64(h + SNAP_OFF_INDEX);
+    uint64_t index_cap = get_u64(h + SNAP_OFF_INDEX_CAP);
+    // Bound the offsets and count first, so the products below cannot wrap.
+    // Index slots hold an entry number plus one as a u32.
+    if (entries_off < SNAP_HEADER_SIZE || entries_off > snap->size ||
+        count >= UINT32_MAX ||
+        count > (snap->size - entries_off) / SNAP_ENTRY_SIZE) {
+        return -1;
+    }
+    if (index_cap == 0 || (index_cap & (index_cap - 1)) != 0 ||
+        index_cap < count * 2 ||
+        index_off != entries_off + count * SNAP_ENTRY_SIZE ||
+        index_cap > (snap->size - index_off) / 4) {
+        return -1;
+    }
+
+    uint32_t crc = ditto_crc32c(0, h + entries_off,
+                                count * SNAP_ENTRY_SIZE + index_cap * 4);
+    if (crc != get_u32(h + SNAP_OFF_META_CRC)) {
+        return -1;
+    }
+
+    // Lookups follow index slots unchecked and stop at an empty one
+    uint64_t filled = 0;
+    for (uint64_t i = 0; i < index_cap; i++) {
+        uint32_t slot = get_u32(h + index_off + i * 4);
+        if (slot > count) return -1;
+        filled += slot != 0;
+    }
+    if (filled != count) {
+        return -1;
+    }
+
+    // Every key and value must lie inside the heap
+    for (uint64_t i = 0; i < count; i++) {
+        const uint8_t* e = h + entries_off + i * SNAP_ENTRY_SIZE;
+        uint64_t key_off = get_u64(e + SNAP_E_KEY_OFF);
+        uint64_t key_len = get_u32(e + SNAP_E_KEY_LEN);
+        uint64_t value_off = get_u64(e + SNAP_E_VALUE_OFF);
+        uint64_t value_len = get_u64(e + SNAP_E_VALUE_LEN);
+        if (key_off < SNAP_HEADER_SIZE || key_off > entries_off ||
+            key_len > entries_off - key_off || value_off < SNAP_HEADER_SIZE ||
+            value_off > entries_off || value_len > entries_off - value_off) {
+            return -1;
+        }
+    }
+
+    snap->count = count;
+    snap->entries = h + entries_off;
+    snap->index = h + index_off;
+    snap->index_mask = index_cap - 1;
+    snap->log_gen = get_u64(h + SNAP_OFF_LOG_GEN);
+    snap->hash_seed = get_u64(h + SNAP_OFF_HASH_SEED);
+    return 0;
+}
+
+int32_t snapshot_open(const char* dir, snapshot_t** out_snap) {
+    *out_snap = NULL;
+
+    char* path = path_join(dir, SNAP_FILE_NAME);
+    if (!path) return -1;
+    int fd = file_open(path, 0);
+    free(path);
+    if (fd < 0) {
+        return 0; // No snapshot yet
+    }
+
+    int64_t size = file_size(fd);
+    if (size < SNAP_HEADER_SIZE) {
+        file_close(fd);
+        return -1;
+    }
+
+    // Lookups jump around the index; entries and heap are read on demand
+    const uint8_t* map = file_map(fd, (size_t)size);
+    file_close(fd);
+    if (!map) {
+        return -1;
+    }
+
+    snapshot_t* snap = (snapshot_t*)calloc(1, sizeof(snapshot_t));
+    if (!snap) {
+        file_unmap(map, (size_t)size);
+        return -1;
+    }
+    atomic_init(&snap->refs, 1);
+    snap->map = map;
+    snap->size = (uint64_t)size;
+    if (validate(snap) != 0) {
+        file_unmap(map, (size_t)size);
+        free(snap);
+        return -1;
+    }
+
+    *out_snap = snap;
+    return 0;
+}
+
+void snapshot_retain(snapshot_t* snap) {
+    atomic_fetch_add_explicit(&snap->refs, 1, memory_order_relaxed);
+}
+
+void snapshot_release(snapshot_t* snap) {
+    if (!snap) return;
+    if (atomic_fetch_sub_explicit(&snap->refs, 1, memory_order_acq_rel) == 1) {
+        file_unmap(snap->map, (size_t)snap->size);
+        free(snap);
+    }
+}
+
+uint64_t snapshot_log_gen(const snapshot_t* snap) {
+    return snap->log_gen;
+}
+
+uint64_t snapshot_hash_seed(const snapshot_t* snap) {
+    return snap->hash_seed;
+}
+
+size_t snapshot_count(const snapshot_t* snap) {
+    return (size_t)snap->count;
+}
+
+uint64_t snapshot_file_size(const snapshot_t* snap) {
+    return snap->size;
+}
+
+void snapshot_entry(const snapshot_t* snap, size_t i, const char** out_key,
+                    size_t* out_key_len, uint64_t* out_hash,
+                    const uint8_t** out_value, size_t* out_value_len) {
+    const uint8_t* e = snap->entries + i * SNAP_ENTRY_SIZE;
+    *out_key = (const char*)(snap->map + get_u64(e + SNAP_E_KEY_OFF));
+    *out_key_len = get_u32(e + SNAP_E_KEY_LEN);
+    if (out_hash) *out_hash = get_u64(e + SNAP_E_HASH);
+    *out_value = snap->map + get_u64(e + SNAP_E_VALUE_OFF);
+    *out_value_len = (size_t)get_u64(e + SNAP_E_VALUE_LEN);
+}
+
+static int key_less(const char* a, size_t a_len, const char* b, size_t b_len) {
+    size_t n = a_len < b_len ? a_len : b_len;
+    int c = memcmp(a, b, n);
+    return c < 0 || (c == 0 && a_len < b_len);
+}
+
+size_t snapshot_lower_bound(const snapshot_t* snap, const char* key,
+                            size_t key_len) {
+    size_t lo = 0;
+    size_t hi = (size_t)snap->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const uint8_t* e = snap->entries + mid * SNAP_ENTRY_SIZE;
+        if (key_less((const char*)(snap->map + get_u64(e + SNAP_E_KEY_OFF)),
+                     get_u32(e + SNAP_E_KEY_LEN), key, key_len)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int snapshot_find(const snapshot_t* snap, const char* key, size_t key_len,
+                  uint64_t hash, const uint8_t** out_value, size_t* out_len) {
+    uint64_t idx = hash & snap->index_mask;
+    for (;;) {
+        uint32_t slot = get_u32(snap->index + idx * 4);
+        if (slot == 0) {
+            return 0;
+        }
+        const uint8_t* e = snap->entries + (uint64_t)(slot - 1) * SNAP_ENTRY_SIZE;
+        if (get_u64(e + SNAP_E_HASH) == hash &&
+            get_u32(e + SNAP_E_KEY_LEN) == key_len &&
+            memcmp(snap->map + get_u64(e + SNAP_E_KEY_OFF), key, key_len) == 0) {
+            *out_value = snap->map + get_u64(e + SNAP_E_VALUE_OFF);
+            *out_len = (size_t)get_u64(e + SNAP_E_VALUE_LEN);
+            return 1;
+        }
+        idx = (idx + 1) & snap->index_mask;
+    }
+}
+
+// ============================================================================
+// Writer
+// ============================================================================
+
+static int writer_flush(snapshot_writer_t* w) {
+    if (write_all(w->fd, w->buf, w->buf_len) != 0) {
+        return -1;
+    }
+    w->offset += w->buf_len;
+    w->buf_len = 0;
+    return 0;
+}
+
+// Appends bytes to the file through the write buffer; returns their offset.
+static int writer_emit(snapshot_writer_t* w, const void* data, size_t len,
+                       uint64_t* out_off) {
+    if (out_off) *out_off = w->offset + w->buf_len;
+    const uint8_t* p = (const uint8_t*)data;
+    while (len > 0) {
+        if (w->buf_len == SNAP_WRITE_BUFFER && writer_flush(w) != 0) {
+            return -1;
+        }
+        size_t n = SNAP_WRITE_BUFFER - w->buf_len;
+        if (n > len) n = len;
+        memcpy(w->buf + w->buf_len, p, n);
+        w->buf_len += n;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void writer_free(snapshot_writer_t* w) {
+    file_close(w->fd);
+    free(w->tmp_path);
+    free(w->final_path);
+    free(w->dir);
+    free(w->buf);
+    free(w->entries);
+    free(w->last_key);
+    free(w);
+}
+
+int32_t snapshot_writer_begin(const char* dir, uint64_t hash_seed,
+                              snapshot_writer_t** out_writer) {
+    snapshot_writer_t* w = (snapshot_writer_t*)calloc(1, sizeof(snapshot_writer_t));
+    if (!w) return -1;
+    w->fd = -1;
+    w->hash_seed = hash_seed;
+    w->tmp_path = path_join(dir, SNAP_TMP_NAME);
+    w->final_path = path_join(dir, SNAP_FILE_NAME);
+    w->dir = strdup(dir);
+    w->buf = (uint8_t*)malloc(SNAP_WRITE_BUFFER);
+    if (!w->tmp_path || !w->final_path || !w->dir || !w->buf) {
+        writer_free(w);
+        return -1;
+    }
+
+    w->fd = file_open(w->tmp_path, FILE_WRITE | FILE_CREATE | FILE_TRUNCATE);
+    if (w->fd < 0) {
+        writer_free(w);
+        return -1;
+    }
+
+    // The header is written last, once the offsets are known
+    uint8_t zeros[SNAP_HEADER_SIZE] = {0};
+    writer_emit(w, zeros, sizeof(zeros), NULL);
+
+    *out_writer = w;
+    return 0;
+}
+
+int32_t snapshot_writer_add(snapshot_writer_t* w, const char* key,
+                            size_t key_len, uint64_t hash,
+                            const uint8_t* value, size_t value_len) {
+    // Index slots number entries from 1 in a u32
+    if (key_len > UINT32_MAX || w->count >= UINT32_MAX - 1) return -1;
+    if (w->count > 0 && !key_less(w->last_key, w->last_key_len, key, key_len)) {
+        return -1; // Out of order or duplicate
+    }
+
+    if (w->count == w->entries_cap) {
+        uint64_t cap = w->entries_cap ? w->entries_cap * 2 : 1024;
+        uint8_t* grown = (uint8_t*)realloc(w->entries, cap * SNAP_ENTRY_SIZE);
+        if (!grown) return -1;
+        w->entries = grown;
+        w->entries_cap = cap;
+    }
+    if (key_len > w->last_key_cap) {
+        char* grown = (char*)realloc(w->last_key, key_len);
+        if (!grown) return -1;
+        w->last_key = grown;
+        w->last_key_cap = key_len;
+    }
+
+    uint64_t key_off;
+    uint64_t value_off;
+    if (writer_emit(w, key, key_len, &key_off) != 0 ||
+        writer_emit(w, value, value_len, &value_off) != 0) {
+        return -1;
+    }
+
+    uint8_t* e = w->entries + w->count * SNAP_ENTRY_SIZE;
+    put_u64(e + SNAP_E_KEY_OFF, key_off);
+    put_u64(e + SNAP_E_HASH, hash);
+    put_u64(e + SNAP_E_VALUE_OFF, value_off);
+    put_u64(e + SNAP_E_VALUE_LEN, value_len);
+    put_u32(e + SNAP_E_KEY_LEN, (uint32_t)key_len);
+    put_u32(e + SNAP_E_KEY_LEN + 4, 0);
+    w->count++;
+
+    memcpy(w->last_key, key, key_len);
+    w->last_key_len = key_len;
+    return 0;
+}
+
+int32_t snapshot_writer_finish(snapshot_writer_t* w, uint64_t log_gen) {
+    uint64_t index_cap = 16;
+    while (index_cap < w->count * 2) index_cap <<= 1;
+
+    uint8_t* index = (uint8_t*)calloc(index_cap, 4);
+    if (!index) {
+        snapshot_writer_abort(w);
+        return -1;
+    }
+    for (uint64_t i = 0; i < w->count; i++) {
+        uint64_t hash = get_u64(w->entries + i * SNAP_ENTRY_SIZE + SNAP_E_HASH);
+        uint64_t idx = hash & (index_cap - 1);
+        while (get_u32(index + idx * 4) != 0) {
+            idx = (idx + 1) & (index_cap - 1);
+        }
+        put_u32(index + idx * 4, (uint32_t)(i + 1));
+    }
+
+    // Align the arrays so they can be read with plain loads
+    static const uint8_t pad[8] = {0};
+    uint64_t end = w->offset + w->buf_len;
+    uint64_t entries_off = 0;
+    uint64_t index_off = 0;
+    int rc = writer_emit(w, pad, (size_t)((8 - end % 8) % 8), NULL);
+    rc |= writer_emit(w, w->entries, w->count * SNAP_ENTRY_SIZE, &entries_off);
+    rc |= writer_emit(w, index, index_cap * 4, &index_off);
+    rc |= writer_flush(w);
+
+    uint32_t meta_crc = ditto_crc32c(0, w->entries, w->count * SNAP_ENTRY_SIZE);
+    meta_crc = ditto_crc32c(meta_crc, index, index_cap * 4);
+    free(index);
+
+    uint8_t header[SNAP_HEADER_SIZE] = {0};
+    memcpy(header, SNAP_MAGIC, 8);
+    put_u32(header + SNAP_OFF_VERSION, SNAP_VERSION);
+    put_u64(header + SNAP_OFF_COUNT, w->count);
+    put_u64(header + SNAP_OFF_ENTRIES, entries_off);
+    put_u64(header + SNAP_OFF_INDEX, index_off);
+    put_u64(header + SNAP_OFF_INDEX_CAP, index_cap);
+    put_u64(header + SNAP_OFF_LOG_GEN, log_gen);
+    put_u32(header + SNAP_OFF_META_CRC, meta_crc);
+    put_u64(header + SNAP_OFF_HASH_SEED, w->hash_seed);
+    put_u32(header + SNAP_OFF_HEADER_CRC, header_crc(header));
+
+    if (rc != 0 || write_all_at(w->fd, header, sizeof(header), 0) != 0 ||
+        sync_fd(w->fd) != 0) {
+        snapshot_writer_abort(w);
+        return -1;
+    }
+
+    // Readers see either the old snapshot or the complete new one
+    if (file_rename(w->tmp_path, w->final_path) != 0 || sync_dir(w->dir) != 0) {
+        snapshot_writer_abort(w);
+        return -1;
+    }
+
+    writer_free(w);
+    return 0;
+}
+
+void snapshot_writer_abort(snapshot_writer_t* w) {
+    if (!w) return;
+    file_remove(w->tmp_path);
+    writer_free(w);
+}
@@ -0,0 +1,60 @@
+// snapshot.h - Immutable, memory-mapped snapshot of a store
+//
+// A snapshot is a single file (ditto.snap) holding every live key sorted
+// bytewise, a hash index over them and a heap of key and value bytes. It is
+// mapped read-only, so values are only paged in when they are touched.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct snapshot snapshot_t;
+typedef struct snapshot_writer snapshot_writer_t;
+
+// Maps the directory's snapshot. Returns 0 with *out_snap == NULL when the
+// directory has none, -1 if it exists but is unreadable or corrupt.
+int32_t snapshot_open(const char* dir, snapshot_t** out_snap);
+
+// Snapshots are refcounted; the mapping goes away with the last reference.
+void snapshot_retain(snapshot_t* snap);
+void snapshot_release(snapshot_t* snap);
+
+// First log generation not contained in the snapshot.
+uint64_t snapshot_log_gen(const snapshot_t* snap);
+
+// Seed the snapshot's key hashes were computed with.
+uint64_t snapshot_hash_seed(const snapshot_t* snap);
+
+// Number of keys and total size of the mapped file.
+size_t snapshot_count(const snapshot_t* snap);
+uint64_t snapshot_file_size(const snapshot_t* snap);
+
+// Looks a key up through the hash index. Returns 1 and sets the value if
+// present, 0 otherwise.
+int snapshot_find(const snapshot_t* snap, const char* key, size_t key_len,
+                  uint64_t hash, const uint8_t** out_value, size_t* out_len);
+
+// Reads the i-th key in sorted order.
+void snapshot_entry(const snapshot_t* snap, size_t i, const char** out_key,
+                    size_t* out_key_len, uint64_t* out_hash,
+                    const uint8_t** out_value, size_t* out_value_len);
+
+// Index of the first key not less than `key` in sorted order.
+size_t snapshot_lower_bound(const snapshot_t* snap, const char* key,
+                            size_t key_len);
+
+// Starts writing a new snapshot into a temporary file in `dir`. Keys' hashes
+// must all be computed under `hash_seed`.
+int32_t snapshot_writer_begin(const char* dir, uint64_t hash_seed,
+                              snapshot_writer_t** out_writer);
+
+// Adds one key. Keys must arrive in strictly ascending bytewise order.
+int32_t snapshot_writer_add(snapshot_writer_t* w, const char* key,
+                            size_t key_len, uint64_t hash,
+                            const uint8_t* value, size_t value_len);
+
+// Writes the index and header, syncs and atomically replaces the
+// directory's snapshot. Frees the writer whether or not it succeeds.
+int32_t snapshot_writer_finish(snapshot_writer_t* w, uint64_t log_gen);
+
+// Discards a partially written snapshot.
+void snapshot_writer_abort(snapshot_writer_t* w);
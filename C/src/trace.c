@@ -0,0 +1,357 @@
+// trace.c - Per-thread trace buffers for per-phase latency attribution
+#include "trace.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#define TRACE_DEFAULT_EVENTS 16384
+#define TRACE_MAX_EVENTS (1u << 24)
+#define TRACE_TIME_BITS 56          // begin_ns bits kept, over two years of uptime
+#define TRACE_TIME_MASK ((1ull << TRACE_TIME_BITS) - 1)
+
+_Atomic int trace_enabled;
+
+uint64_t trace_now_ns(void) {
+    struct timespec ts;
+#if defined(__APPLE__)
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#if DITTO_ENABLE_TRACE
+
+static const char* const trace_span_names[TRACE_SPAN_COUNT] = {
+    "ditto_put",
+    "ditto_put_ttl",
+    "ditto_put_range",
+    "ditto_get",
+    "ditto_get_view",
+    "ditto_get_range",
+    "ditto_delete",
+    "ditto_write_batch",
+    "ditto_multi_get",
+    "ditto_txn_commit",
+    "ditto_cursor_next",
+    "hash",
+    "lock_wait",
+    "alloc",
+    "log_append",
+    "evict",
+    "notify",
+    "callbacks",
+    "commit",
+    "dispatch",
+    "expire",
+    "maintenance",
+    "compaction",
+};
+
+// One span, written by the owning thread and read racily by exports, which
+// discard any slot the owner may have been rewriting meanwhile.
+typedef struct {
+    _Atomic uint64_t start;     // span << TRACE_TIME_BITS | begin_ns
+    _Atomic uint64_t dur_ns;
+} trace_event_t;
+
+// A thread's ring. Only the owner records into it; the list, gen, retired
+// and the reset of head are changed under trace_lock.
+typedef struct trace_buf {
+    struct trace_buf* next;
+    uint64_t tid;
+    const char* thread_name;
+    uint32_t gen;               // trace_start() it was last reset for
+    int retired;                // owner exited or moved to a bigger ring
+    size_t mask;
+    _Atomic uint64_t head;      // spans recorded since the reset
+    trace_event_t events[];
+} trace_buf_t;
+
+static _Atomic uint32_t trace_gen;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;     // retires a ring when its thread exits
+static trace_buf_t* trace_bufs;
+static size_t trace_events;         // ring size since the last trace_start()
+static _Thread_local trace_buf_t* trace_local;
+static _Thread_local const char* trace_local_name;
+
+// The id the OS and Dart's Timeline give the thread, where there is one
+static uint64_t trace_thread_id(void) {
+#if defined(__linux__)
+    return (uint64_t)syscall(SYS_gettid);
+#elif defined(__APPLE__)
+    uint64_t tid = 0;
+    pthread_threadid_np(NULL, &tid);
+    return tid;
+#else
+    static _Atomic uint64_t next_tid;
+    return atomic_fetch_add(&next_tid, 1) + 1;
+#endif
+}
+
+static void trace_thread_exit(void* arg) {
+    trace_buf_t* buf = (trace_buf_t*)arg;
+    pthread_mutex_lock(&trace_lock);
+    buf->retired = 1;
+    pthread_mutex_unlock(&trace_lock);
+    trace_local = NULL;
+}
+
+static void trace_key_create(void) {
+    pthread_key_create(&trace_key, trace_thread_exit);
+}
+
+// Gives the calling thread an empty ring of the current size, reusing its
+// own when the size is unchanged.
+static trace_buf_t* trace_attach(void) {
+    pthread_mutex_lock(&trace_lock);
+    trace_buf_t* buf = trace_local;
+    if (buf && buf->mask + 1 != trace_events) {
+        buf->retired = 1;
+        buf = NULL;
+    }
+    if (!buf && trace_events > 0) {
+        buf = (trace_buf_t*)calloc(1, sizeof(trace_buf_t) +
+                                          trace_events * sizeof(trace_event_t));
+        if (buf) {
+            buf->tid = trace_thread_id();
+            buf->mask = trace_events - 1;
+            buf->next = trace_bufs;
+            trace_bufs = buf;
+            pthread_setspecific(trace_key, buf);
+        }
+    }
+    if (buf) {
+        buf->gen = atomic_load(&trace_gen);
+        buf->thread_name = trace_local_name;
+        atomic_store_explicit(&buf->head, 0, memory_order_relaxed);
+    }
+    trace_local = buf;
+    pthread_mutex_unlock(&trace_lock);
+    return buf;
+}
+
+void trace_record(trace_span_t span, uint64_t begin_ns, uint64_t end_ns) {
+    trace_buf_t* buf = trace_local;
+    if (!buf || buf->gen != atomic_load_explicit(&trace_gen, memory_order_acquire)) {
+        buf = trace_attach();
+        if (!buf) return;
+    }
+
+    uint64_t head = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    trace_event_t* event = &buf->events[head & buf->mask];
+    // Exports that see this write also see head at its index
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&event->start,
+                          (uint64_t)span << TRACE_TIME_BITS | (begin_ns & TRACE_TIME_MASK),
+                          memory_order_relaxed);
+    atomic_store_explicit(&event->dur_ns, end_ns - begin_ns, memory_order_relaxed);
+    atomic_store_explicit(&buf->head, head + 1, memory_order_release);
+}
+
+void trace_thread_name(const char* name) {
+    trace_local_name = name;
+    if (trace_local) {
+        pthread_mutex_lock(&trace_lock);
+        trace_local->thread_name = name;
+        pthread_mutex_unlock(&trace_lock);
+    }
+}
+
+int32_t trace_start(size_t events_per_thread) {
+    if (events_per_thread == 0) events_per_thread = TRACE_DEFAULT_EVENTS;
+    if (events_per_thread > TRACE_MAX_EVENTS) return -1;
+    size_t events = 1;
+    while (events < events_per_thread) events <<= 1;
+
+    pthread_once(&trace_once, trace_key_create);
+    pthread_mutex_lock(&trace_lock);
+    // No thread records into a retired ring any more
+    trace_buf_t** link = &trace_bufs;
+    while (*link) {
+        trace_buf_t* buf = *link;
+        if (buf->retired) {
+            *link = buf->next;
+            free(buf);
+        } else {
+            link = &buf->next;
+        }
+    }
+    trace_events = events;
+    atomic_fetch_add(&trace_gen, 1);
+    atomic_store(&trace_enabled, 1);
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
+}
+
+void trace_stop(void) {
+    atomic_store(&trace_enabled, 0);
+}
+
+// ============================================================================
+// Export
+// ============================================================================
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+    int failed;
+} trace_out_t;
+
+static void out_printf(trace_out_t* out, const char* fmt, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, fmt);
+        size_t room = out->cap - out->len;
+        int n = vsnprintf(out->buf ? out->buf + out->len : NULL, room, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            out->failed = 1;
+            return;
+        }
+        if ((size_t)n < room) {
+            out->len += (size_t)n;
+            return;
+        }
+        size_t cap = out->cap ? out->cap * 2 : 64 * 1024;
+        while (cap - out->len <= (size_t)n) cap *= 2;
+        char* grown = (char*)realloc(out->buf, cap);
+        if (!grown) {
+            out->failed = 1;
+            return;
+        }
+        out->buf = grown;
+        out->cap = cap;
+    }
+}
+
+static const char* trace_category(uint32_t span) {
+    if (span < TRACE_HASH) return "ditto";
+    if (span < TRACE_DISPATCH) return "ditto.phase";
+    return "ditto.background";
+}
+
+// Appends a ring's spans. Slots are copied out first and kept only if the
+// owner cannot have been rewriting them during the copy.
+static void trace_export_buf(trace_out_t* out, trace_buf_t* buf, long pid,
+                             int* first) {
+    if (buf->thread_name) {
+        out_printf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,"
+                   "\"tid\":%llu,\"args\":{\"name\":\"%s\"}}",
+                   *first ? "" : ",", pid, (unsigned long long)buf->tid,
+                   buf->thread_name);
+        *first = 0;
+    }
+
+    size_t cap = buf->mask + 1;
+    uint64_t head = atomic_load_explicit(&buf->head, memory_order_acquire);
+    uint64_t lo = head > cap ? head - cap : 0;
+    size_t n = (size_t)(head - lo);
+    if (n == 0) return;
+    uint64_t* copy = (uint64_t*)malloc(n * 2 * sizeof(uint64_t));
+    if (!copy) {
+        out->failed = 1;
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        trace_event_t* event = &buf->events[(lo + i) & buf->mask];
+        copy[2 * i] = atomic_load_explicit(&event->start, memory_order_relaxed);
+        copy[2 * i + 1] = atomic_load_explicit(&event->dur_ns, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    // The owner may be writing index `now`, over index now - cap
+    uint64_t now = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    uint64_t valid = now >= cap ? now - cap + 1 : 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (lo + i < valid) continue;
+        uint32_t span = (uint32_t)(copy[2 * i] >> TRACE_TIME_BITS);
+        uint64_t begin = copy[2 * i] & TRACE_TIME_MASK;
+        uint64_t dur = copy[2 * i + 1];
+        if (span >= TRACE_SPAN_COUNT) continue;
+        // Microseconds, to the nanosecond
+        out_printf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                   "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%ld,\"tid\":%llu}",
+                   *first ? "" : ",", trace_span_names[span], trace_category(span),
+                   (unsigned long long)(begin / 1000), (unsigned)(begin % 1000),
+                   (unsigned long long)(dur / 1000), (unsigned)(dur % 1000), pid,
+                   (unsigned long long)buf->tid);
+        *first = 0;
+    }
+    free(copy);
+}
+
+int32_t trace_export(char* out_buf, size_t* inout_len) {
+    if (!inout_len || (!out_buf && *inout_len > 0)) return -1;
+
+    trace_out_t out = {0};
+    int first = 1;
+    long pid = (long)getpid();
+    out_printf(&out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    pthread_mutex_lock(&trace_lock);
+    uint32_t gen = atomic_load(&trace_gen);
+    for (trace_buf_t* buf = trace_bufs; buf && !out.failed; buf = buf->next) {
+        // Rings not reset since the last start hold an older trace
+        if (gen > 0 && buf->gen == gen) {
+            trace_export_buf(&out, buf, pid, &first);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    out_printf(&out, "\n]}\n");
+
+    int32_t rc = 0;
+    if (out.failed) {
+        rc = -1;
+    } else if (*inout_len < out.len) {
+        rc = 1;
+    } else {
+        memcpy(out_buf, out.buf, out.len);
+    }
+    if (rc >= 0) *inout_len = out.len;
+    free(out.buf);
+    return rc;
+}
+
+#else
+
+int32_t trace_start(size_t events_per_thread) {
+    (void)events_per_thread;
+    return -1;
+}
+
+void trace_stop(void) {
+}
+
+int32_t trace_export(char* out_buf, size_t* inout_len) {
+    (void)out_buf;
+    (void)inout_len;
+    return -1;
+}
+
+void trace_thread_name(const char* name) {
+    (void)name;
+}
+
+void trace_record(trace_span_t span, uint64_t begin_ns, uint64_t end_ns) {
+    (void)span;
+    (void)begin_ns;
+    (void)end_ns;
+}
+
+#endif
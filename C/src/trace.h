@@ -0,0 +1,87 @@
+// trace.h - Per-thread trace buffers for per-phase latency attribution
+//
+// Spans (a name, a start and an end in nanoseconds) are recorded into a
+// ring per thread without locks, and exported as Chrome trace JSON, which
+// Perfetto and Flutter DevTools load. Build with DITTO_ENABLE_TRACE=1 to
+// compile the spans in; otherwise TRACE_BEGIN/TRACE_END expand to nothing
+// and tracing cannot be started.
+#pragma once
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef DITTO_ENABLE_TRACE
+#define DITTO_ENABLE_TRACE 0
+#endif
+
+// Span names; trace_span_names[] in trace.c must follow this order
+typedef enum {
+    // Calls, each covering its phases
+    TRACE_PUT,
+    TRACE_PUT_TTL,
+    TRACE_PUT_RANGE,
+    TRACE_GET,
+    TRACE_GET_VIEW,
+    TRACE_GET_RANGE,
+    TRACE_DELETE,
+    TRACE_WRITE_BATCH,
+    TRACE_MULTI_GET,
+    TRACE_TXN_COMMIT,
+    TRACE_CURSOR_NEXT,
+    // Phases of a call
+    TRACE_HASH,
+    TRACE_LOCK_WAIT,
+    TRACE_ALLOC,
+    TRACE_LOG_APPEND,
+    TRACE_EVICT,
+    TRACE_NOTIFY,
+    TRACE_CALLBACKS,
+    TRACE_COMMIT,
+    // Background threads
+    TRACE_DISPATCH,
+    TRACE_EXPIRE,
+    TRACE_MAINTENANCE,
+    TRACE_COMPACTION,
+    TRACE_SPAN_COUNT
+} trace_span_t;
+
+extern _Atomic int trace_enabled;
+
+// Clock of every timestamp: the monotonic clock Dart's Timeline reads, so
+// an export lines up with a Flutter timeline from the same process.
+uint64_t trace_now_ns(void);
+
+// Starts recording into a fresh ring of `events_per_thread` spans (rounded
+// up to a power of two) per thread, dropping anything recorded before.
+// Returns 0, or -1 when built without tracing or out of memory.
+int32_t trace_start(size_t events_per_thread);
+
+// Stops recording; what was recorded stays exportable.
+void trace_stop(void);
+
+// Writes the recorded spans as Chrome trace JSON, as ditto_trace_export().
+int32_t trace_export(char* out_buf, size_t* inout_len);
+
+// Names the calling thread's track in exports. `name` must outlive the
+// thread.
+void trace_thread_name(const char* name);
+
+// Appends a span to the calling thread's ring.
+void trace_record(trace_span_t span, uint64_t begin_ns, uint64_t end_ns);
+
+#if DITTO_ENABLE_TRACE
+// A span costs a relaxed load and a branch while tracing is stopped
+#define TRACE_BEGIN(var)                                                   \
+    uint64_t var = atomic_load_explicit(&trace_enabled, memory_order_relaxed) \
+                       ? trace_now_ns()                                    \
+                       : 0
+#define TRACE_END(var, span)                              \
+    do {                                                  \
+        if (var) trace_record((span), (var), trace_now_ns()); \
+    } while (0)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#else
+#define TRACE_BEGIN(var) ((void)0)
+#define TRACE_END(var, span) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
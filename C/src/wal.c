@@ -0,0 +1,747 @@
+// wal.c - Append-only write-ahead log with group commit
+//
+// Each generation file (ditto-<gen>.wal) starts with an 8-byte magic and a
+// 4-byte format version, followed by records of the form
+//
+//   u32 crc32c      over everything after this field
+//   u32 body_len
+//   body
+//
+// where a body is one operation
+//
+//   u8  type        WAL_RECORD_PUT, WAL_RECORD_DELETE or WAL_RECORD_EXPIRE
+//   u32 key_len
+//   u64 value_len   (all but deletes; 8 for expiries)
+//   key bytes, value bytes
+//
+// or a batch that replays all or nothing: u8 WAL_RECORD_BATCH, u32 count,
+// then `count` operations back to back.
+//
+// All integers are little-endian. LSNs are logical byte positions that keep
+// increasing across generations; they only order commits within a process.
+#include "wal.h"
+#include "bytes.h"
+#include "checksum.h"
+#include "fileio.h"
+#include "../include/ditto.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WAL_LOCK_NAME "LOCK"
+#define WAL_MAGIC "DITTOWAL"
+#define WAL_VERSION 1
+#define WAL_HEADER_SIZE 12
+#define WAL_RECORD_HEADER 8       // crc + body_len
+
+struct wal {
+    char* dir;
+    int lock_fd;
+    int fd;                       // current generation, -1 until replayed
+    uint64_t gen;
+    uint64_t gen_start_lsn;       // LSN at which the current generation began
+    pthread_mutex_t lock;
+    pthread_cond_t progress;      // flush/sync state changed
+    uint8_t* buf;                 // records not yet handed to the OS
+    size_t buf_len;
+    size_t buf_cap;
+    uint8_t* spare;               // the buffer the flush leader is writing
+    size_t spare_cap;
+    uint64_t appended_lsn;        // end of the last buffered record
+    uint64_t written_lsn;         // end of the data written to the file
+    uint64_t synced_lsn;          // end of the data known to be durable
+    int flushing;                 // a leader (or rotation) owns the file
+    int syncing;                  // the syncer is fsyncing the file
+    _Atomic int failed;
+    int32_t mode;
+    uint32_t interval_ms;
+
+    // Background fsync for DITTO_DURABILITY_PERIODIC
+    pthread_t syncer;
+    int syncer_running;
+    int syncer_stopping;
+    pthread_cond_t syncer_wake;
+};
+
+static char* generation_path(const wal_t* wal, uint64_t gen) {
+    char name[48];
+    snprintf(name, sizeof(name), "ditto-%06llu.wal", (unsigned long long)gen);
+    return path_join(wal->dir, name);
+}
+
+int32_t wal_open(const char* dir, wal_t** out_wal) {
+    if (dir_create(dir) != 0) {
+        return -1;
+    }
+
+    char* lock_path = path_join(dir, WAL_LOCK_NAME);
+    if (!lock_path) return -1;
+    int lock_fd = file_open(lock_path, FILE_WRITE | FILE_CREATE);
+    free(lock_path);
+    if (lock_fd < 0) {
+        return -1;
+    }
+    if (file_lock(lock_fd) != 0) {
+        file_close(lock_fd);
+        return -1; // Another process has this store open
+    }
+
+    wal_t* wal = (wal_t*)calloc(1, sizeof(wal_t));
+    char* dir_copy = strdup(dir);
+    if (!wal || !dir_copy) {
+        free(wal);
+        free(dir_copy);
+        file_close(lock_fd);
+        return -1;
+    }
+    wal->dir = dir_copy;
+    wal->lock_fd = lock_fd;
+    wal->fd = -1;
+    wal->mode = DITTO_DURABILITY_OS;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->progress, NULL);
+    pthread_cond_init(&wal->syncer_wake, NULL);
+
+    *out_wal = wal;
+    return 0;
+}
+
+// Creates an empty generation file and makes its existence durable.
+static int create_generation(wal_t* wal, uint64_t gen) {
+    char* path = generation_path(wal, gen);
+    if (!path) return -1;
+    int fd = file_open(path, FILE_WRITE | FILE_CREATE | FILE_TRUNCATE);
+    free(path);
+    if (fd < 0) return -1;
+
+    uint8_t header[WAL_HEADER_SIZE];
+    memcpy(header, WAL_MAGIC, 8);
+    put_u32(header + 8, WAL_VERSION);
+    if (write_all(fd, header, sizeof(header)) != 0 || sync_fd(fd) != 0 ||
+        sync_dir(wal->dir) != 0) {
+        file_close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int compare_gen(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    uint64_t* gens;
+    size_t n;
+    size_t cap;
+} gen_list_t;
+
+static int collect_generation(void* ctx, const char* name) {
+    gen_list_t* list = (gen_list_t*)ctx;
+    unsigned long long gen;
+    char tail[8];
+    if (sscanf(name, "ditto-%llu.wa%1s", &gen, tail) != 2 || strcmp(tail, "l") != 0) {
+        return 0;
+    }
+    if (list->n == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 8;
+        uint64_t* grown = (uint64_t*)realloc(list->gens, cap * sizeof(uint64_t));
+        if (!grown) return -1;
+        list->gens = grown;
+        list->cap = cap;
+    }
+    list->gens[list->n++] = gen;
+    return 0;
+}
+
+// Lists the generations present in the directory, sorted ascending.
+static int list_generations(const wal_t* wal, uint64_t** out_gens, size_t* out_n) {
+    gen_list_t list = {0};
+    if (dir_list(wal->dir, collect_generation, &list) != 0) {
+        free(list.gens);
+        return -1;
+    }
+
+    if (list.n > 0) qsort(list.gens, list.n, sizeof(uint64_t), compare_gen);
+    *out_gens = list.gens;
+    *out_n = list.n;
+    return 0;
+}
+
+static size_t op_header_size(uint8_t type) {
+    return type == WAL_RECORD_DELETE ? 5 : 13;
+}
+
+// Decodes the framing of one operation from the `avail` bytes at `p`.
+// Returns its encoded size, or 0 if it is malformed.
+static size_t parse_op(const uint8_t* p, size_t avail, uint64_t* out_key_len,
+                       uint64_t* out_value_len) {
+    if (avail < 5 || (p[0] != WAL_RECORD_PUT && p[0] != WAL_RECORD_DELETE &&
+                      p[0] != WAL_RECORD_EXPIRE && p[0] != WAL_RECORD_RANGE)) {
+        return 0;
+    }
+    size_t header = op_header_size(p[0]);
+    if (avail < header) return 0;
+
+    uint64_t key_len = get_u32(p + 1);
+    uint64_t value_len = p[0] != WAL_RECORD_DELETE ? get_u64(p + 5) : 0;
+    if (key_len > avail - header || value_len > avail - header - key_len ||
+        (p[0] == WAL_RECORD_EXPIRE && value_len != 8) ||
+        (p[0] == WAL_RECORD_RANGE && value_len < 8)) {
+        return 0;
+    }
+    *out_key_len = key_len;
+    *out_value_len = value_len;
+    return header + (size_t)key_len + (size_t)value_len;
+}
+
+// Hands one operation, already checked by parse_op(), to `apply`.
+static int32_t apply_op(const uint8_t* p, uint64_t key_len, uint64_t value_len,
+                        char** scratch, size_t* scratch_cap, wal_apply_fn apply,
+                        void* ctx) {
+    size_t header = op_header_size(p[0]);
+
+    // Keys are handed out NUL-terminated
+    if (key_len + 1 > *scratch_cap) {
+        char* grown = (char*)realloc(*scratch, key_len + 1);
+        if (!grown) return -1;
+        *scratch = grown;
+        *scratch_cap = key_len + 1;
+    }
+    memcpy(*scratch, p + header, key_len);
+    (*scratch)[key_len] = '\0';
+
+    return apply(ctx, p[0], *scratch, key_len, p + header + key_len, value_len);
+}
+
+// Checks that a batch body holds exactly `count` well-formed operations, so
+// a batch is never applied in part.
+static int batch_well_formed(const uint8_t* p, size_t len, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t key_len;
+        uint64_t value_len;
+        size_t used = parse_op(p, len, &key_len, &value_len);
+        if (used == 0) return 0;
+        p += used;
+        len -= used;
+    }
+    return len == 0;
+}
+
+// Parses one record body and hands its operations to `apply`. Returns -1 if
+// the body is malformed, otherwise the first non-zero apply result.
+static int32_t apply_record(uint8_t* body, size_t body_len, char** scratch,
+                            size_t* scratch_cap, wal_apply_fn apply, void* ctx) {
+    uint64_t key_len;
+    uint64_t value_len;
+    if (body_len >= 5 && body[0] == WAL_RECORD_BATCH) {
+        uint32_t count = get_u32(body + 1);
+        if (!batch_well_formed(body + 5, body_len - 5, count)) return -1;
+
+        size_t off = 5;
+        for (uint32_t i = 0; i < count; i++) {
+            size_t used = parse_op(body + off, body_len - off, &key_len, &value_len);
+            int32_t rc = apply_op(body + off, key_len, value_len, scratch,
+                                  scratch_cap, apply, ctx);
+            if (rc != 0) return rc;
+            off += used;
+        }
+        return 0;
+    }
+
+    if (parse_op(body, body_len, &key_len, &value_len) != body_len) return -1;
+    return apply_op(body, key_len, value_len, scratch, scratch_cap, apply, ctx);
+}
+
+// Replays one generation file and truncates anything after its last good
+// record. Returns the file's remaining size, or -1.
+static int64_t replay_file(int fd, wal_apply_fn apply, void* ctx) {
+    int64_t size = file_size(fd);
+    if (size < 0 || file_seek(fd, 0) != 0) {
+        return -1;
+    }
+
+    uint8_t header[WAL_HEADER_SIZE];
+    if (size < WAL_HEADER_SIZE) {
+        // Crashed while being created
+        memcpy(header, WAL_MAGIC, 8);
+        put_u32(header + 8, WAL_VERSION);
+        if (file_truncate(fd, 0) != 0 || write_all(fd, header, sizeof(header)) != 0 ||
+            sync_fd(fd) != 0) {
+            return -1;
+        }
+        return WAL_HEADER_SIZE;
+    }
+
+    if (read_exact(fd, header, sizeof(header)) != 0 ||
+        memcmp(header, WAL_MAGIC, 8) != 0 || get_u32(header + 8) != WAL_VERSION) {
+        return -1; // Not a log we understand; refuse rather than overwrite it
+    }
+
+    uint8_t* body = NULL;
+    size_t body_cap = 0;
+    char* scratch = NULL;
+    size_t scratch_cap = 0;
+    uint64_t good_end = WAL_HEADER_SIZE;
+    int32_t rc = 0;
+
+    for (;;) {
+        uint8_t rec[WAL_RECORD_HEADER];
+        if (read_exact(fd, rec, sizeof(rec)) != 0) break;
+
+        uint32_t crc = get_u32(rec);
+        uint64_t body_len = get_u32(rec + 4);
+        if (good_end + WAL_RECORD_HEADER + body_len > (uint64_t)size) break;
+
+        if (body_len > body_cap) {
+            uint8_t* grown = (uint8_t*)realloc(body, body_len);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            body = grown;
+            body_cap = body_len;
+        }
+        if (read_exact(fd, body, body_len) != 0) break;
+
+        uint32_t actual = ditto_crc32c(0, rec + 4, 4);
+        actual = ditto_crc32c(actual, body, body_len);
+        if (actual != crc) break;
+
+        if (apply_record(body, body_len, &scratch, &scratch_cap, apply, ctx) != 0) {
+            rc = -1;
+            break;
+        }
+        good_end += WAL_RECORD_HEADER + body_len;
+    }
+
+    free(body);
+    free(scratch);
+    if (rc != 0) {
+        return rc;
+    }
+
+    // Drop a torn tail so new records are not appended after garbage
+    if ((uint64_t)size != good_end) {
+        if (file_truncate(fd, good_end) != 0 || sync_fd(fd) != 0) {
+            return -1;
+        }
+    }
+    if (file_seek(fd, good_end) != 0) {
+        return -1;
+    }
+    return (int64_t)good_end;
+}
+
+int32_t wal_replay(wal_t* wal, uint64_t min_gen, wal_apply_fn apply, void* ctx) {
+    uint64_t* gens = NULL;
+    size_t n = 0;
+    if (list_generations(wal, &gens, &n) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    uint64_t gen = 0;
+    int64_t size = 0;
+    for (size_t i = 0; i < n; i++) {
+        char* path = generation_path(wal, gens[i]);
+        if (!path) {
+            size = -1;
+            break;
+        }
+        if (gens[i] < min_gen) {
+            // Already folded into the snapshot
+            file_remove(path);
+            free(path);
+            continue;
+        }
+
+        file_close(fd);
+        fd = file_open(path, FILE_WRITE);
+        free(path);
+        gen = gens[i];
+        size = fd < 0 ? -1 : replay_file(fd, apply, ctx);
+        if (size < 0) break;
+    }
+    free(gens);
+
+    if (size < 0) {
+        file_close(fd);
+        return -1;
+    }
+
+    if (fd < 0) {
+        gen = min_gen > 0 ? min_gen : 1;
+        fd = create_generation(wal, gen);
+        if (fd < 0) return -1;
+        size = WAL_HEADER_SIZE;
+    }
+
+    // The newest generation stays open for appends
+    wal->fd = fd;
+    wal->gen = gen;
+    wal->gen_start_lsn = 0;
+    wal->appended_lsn = wal->written_lsn = wal->synced_lsn = (uint64_t)size;
+    return 0;
+}
+
+static void* syncer_main(void* arg) {
+    wal_t* wal = (wal_t*)arg;
+
+    pthread_mutex_lock(&wal->lock);
+    while (!wal->syncer_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wal->interval_ms / 1000;
+        deadline.tv_nsec += (long)(wal->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wal->syncer_wake, &wal->lock, &deadline);
+        if (wal->syncer_stopping) break;
+
+        uint64_t target = wal->written_lsn;
+        if (target <= wal->synced_lsn || wal->flushing) continue;
+
+        // fsync may run alongside a leader's write; it covers at least
+        // target. Rotation waits for it so the descriptor stays valid.
+        wal->syncing = 1;
+        int fd = wal->fd;
+        pthread_mutex_unlock(&wal->lock);
+        int rc = sync_fd(fd);
+        pthread_mutex_lock(&wal->lock);
+        wal->syncing = 0;
+        if (rc != 0) {
+            atomic_store(&wal->failed, 1);
+        } else if (target > wal->synced_lsn) {
+            wal->synced_lsn = target;
+        }
+        pthread_cond_broadcast(&wal->progress);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+static void syncer_stop(wal_t* wal) {
+    pthread_mutex_lock(&wal->lock);
+    int running = wal->syncer_running;
+    wal->syncer_stopping = 1;
+    wal->syncer_running = 0;
+    pthread_cond_signal(&wal->syncer_wake);
+    pthread_mutex_unlock(&wal->lock);
+
+    if (running) {
+        pthread_join(wal->syncer, NULL);
+    }
+    wal->syncer_stopping = 0;
+}
+
+int32_t wal_set_durability(wal_t* wal, int32_t mode, uint32_t interval_ms) {
+    if (mode != DITTO_DURABILITY_OS && mode != DITTO_DURABILITY_SYNC &&
+        mode != DITTO_DURABILITY_PERIODIC) {
+        return -1;
+    }
+    if (mode == DITTO_DURABILITY_PERIODIC && interval_ms == 0) {
+        return -1;
+    }
+
+    syncer_stop(wal);
+
+    pthread_mutex_lock(&wal->lock);
+    wal->mode = mode;
+    wal->interval_ms = interval_ms;
+    int32_t rc = 0;
+    if (mode == DITTO_DURABILITY_PERIODIC) {
+        if (pthread_create(&wal->syncer, NULL, syncer_main, wal) == 0) {
+            wal->syncer_running = 1;
+        } else {
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return rc;
+}
+
+// Encodes one operation at `p`; returns its size.
+static size_t encode_op(uint8_t* p, uint8_t type, const char* key,
+                        size_t key_len, const uint8_t* value, size_t value_len) {
+    size_t header = op_header_size(type);
+    p[0] = type;
+    put_u32(p + 1, (uint32_t)key_len);
+    if (type == WAL_RECORD_DELETE) {
+        value_len = 0;
+    } else {
+        put_u64(p + 5, value_len);
+    }
+    memcpy(p + header, key, key_len);
+    if (value_len > 0) {
+        memcpy(p + header + key_len, value, value_len);
+    }
+    return header + key_len + value_len;
+}
+
+// Encoded size of an operation, or 0 if it cannot be logged.
+static uint64_t op_size(uint8_t type, size_t key_len, size_t value_len) {
+    if (key_len > UINT32_MAX) return 0;
+    return op_header_size(type) + (uint64_t)key_len +
+           (type != WAL_RECORD_DELETE ? (uint64_t)value_len : 0);
+}
+
+// Makes room for a record with a `body_len` byte body and returns it, with
+// the lock held. Returns NULL, with the lock released, on failure.
+static uint8_t* reserve_record(wal_t* wal, uint64_t body_len) {
+    if (body_len > UINT32_MAX) {
+        return NULL;
+    }
+    size_t rec_len = WAL_RECORD_HEADER + (size_t)body_len;
+
+    pthread_mutex_lock(&wal->lock);
+    if (atomic_load(&wal->failed)) {
+        pthread_mutex_unlock(&wal->lock);
+        return NULL;
+    }
+
+    if (wal->buf_len + rec_len > wal->buf_cap) {
+        size_t cap = wal->buf_cap ? wal->buf_cap : 64 * 1024;
+        while (cap < wal->buf_len + rec_len) cap *= 2;
+        uint8_t* grown = (uint8_t*)realloc(wal->buf, cap);
+        if (!grown) {
+            pthread_mutex_unlock(&wal->lock);
+            return NULL;
+        }
+        wal->buf = grown;
+        wal->buf_cap = cap;
+    }
+
+    uint8_t* rec = wal->buf + wal->buf_len;
+    put_u32(rec + 4, (uint32_t)body_len);
+    return rec;
+}
+
+// Checksums a record filled in after reserve_record() and releases the lock.
+static void publish_record(wal_t* wal, uint8_t* rec, uint64_t* out_lsn) {
+    size_t rec_len = WAL_RECORD_HEADER + get_u32(rec + 4);
+    put_u32(rec, ditto_crc32c(0, rec + 4, rec_len - 4));
+
+    wal->buf_len += rec_len;
+    wal->appended_lsn += rec_len;
+    *out_lsn = wal->appended_lsn;
+    pthread_mutex_unlock(&wal->lock);
+}
+
+int32_t wal_append(wal_t* wal, uint8_t type, const char* key, size_t key_len,
+                   const uint8_t* value, size_t value_len, uint64_t* out_lsn) {
+    uint64_t body_len = op_size(type, key_len, value_len);
+    uint8_t* rec = body_len ? reserve_record(wal, body_len) : NULL;
+    if (!rec) {
+        return -1;
+    }
+
+    encode_op(rec + WAL_RECORD_HEADER, type, key, key_len, value, value_len);
+    publish_record(wal, rec, out_lsn);
+    return 0;
+}
+
+int32_t wal_append_range(wal_t* wal, const char* key, size_t key_len,
+                         uint64_t offset, const uint8_t* data, size_t len,
+                         uint64_t* out_lsn) {
+    if (len > SIZE_MAX - 8) {
+        return -1;
+    }
+    uint64_t body_len = op_size(WAL_RECORD_RANGE, key_len, 8 + len);
+    uint8_t* rec = body_len ? reserve_record(wal, body_len) : NULL;
+    if (!rec) {
+        return -1;
+    }
+
+    // Encoded as a put whose value starts with the offset
+    uint8_t* p = rec + WAL_RECORD_HEADER;
+    size_t off = encode_op(p, WAL_RECORD_RANGE, key, key_len, NULL, 0);
+    put_u64(p + 5, 8 + (uint64_t)len);
+    put_u64(p + off, offset);
+    if (len > 0) {
+        memcpy(p + off + 8, data, len);
+    }
+    publish_record(wal, rec, out_lsn);
+    return 0;
+}
+
+int32_t wal_append_batch(wal_t* wal, const wal_op_t* ops, size_t count,
+                         uint64_t* out_lsn) {
+    if (count > UINT32_MAX) {
+        return -1;
+    }
+    uint64_t body_len = 5;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t n = op_size(ops[i].type, ops[i].key_len, ops[i].value_len);
+        if (n == 0) return -1;
+        body_len += n;
+    }
+
+    uint8_t* rec = reserve_record(wal, body_len);
+    if (!rec) {
+        return -1;
+    }
+
+    uint8_t* p = rec + WAL_RECORD_HEADER;
+    p[0] = WAL_RECORD_BATCH;
+    put_u32(p + 1, (uint32_t)count);
+    p += 5;
+    for (size_t i = 0; i < count; i++) {
+        p += encode_op(p, ops[i].type, ops[i].key, ops[i].key_len, ops[i].value,
+                       ops[i].value_len);
+    }
+    publish_record(wal, rec, out_lsn);
+    return 0;
+}
+
+// Writes (and optionally fsyncs) whatever is buffered. Called with the lock
+// held by the one thread that set `flushing`; drops the lock while doing I/O.
+static void flush_as_leader(wal_t* wal, int sync) {
+    uint8_t* data = wal->buf;
+    size_t len = wal->buf_len;
+    size_t cap = wal->buf_cap;
+    uint64_t end = wal->appended_lsn;
+
+    // Appenders keep filling the spare buffer while this one is written
+    wal->buf = wal->spare;
+    wal->buf_cap = wal->spare_cap;
+    wal->buf_len = 0;
+    wal->spare = NULL;
+    wal->spare_cap = 0;
+    pthread_mutex_unlock(&wal->lock);
+
+    int rc = write_all(wal->fd, data, len);
+    if (rc == 0 && sync) {
+        rc = sync_fd(wal->fd);
+    }
+
+    pthread_mutex_lock(&wal->lock);
+    wal->spare = data;
+    wal->spare_cap = cap;
+    if (rc != 0) {
+        atomic_store(&wal->failed, 1);
+    } else {
+        wal->written_lsn = end;
+        if (sync && end > wal->synced_lsn) {
+            wal->synced_lsn = end;
+        }
+    }
+}
+
+int32_t wal_commit(wal_t* wal, uint64_t lsn) {
+    pthread_mutex_lock(&wal->lock);
+    for (;;) {
+        if (atomic_load(&wal->failed)) {
+            pthread_mutex_unlock(&wal->lock);
+            return -1;
+        }
+        int sync = wal->mode == DITTO_DURABILITY_SYNC;
+        if (wal->written_lsn >= lsn && (!sync || wal->synced_lsn >= lsn)) {
+            break;
+        }
+        if (wal->flushing) {
+            // Someone is already writing; their write may well cover us
+            pthread_cond_wait(&wal->progress, &wal->lock);
+            continue;
+        }
+
+        wal->flushing = 1;
+        flush_as_leader(wal, sync);
+        wal->flushing = 0;
+        pthread_cond_broadcast(&wal->progress);
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return 0;
+}
+
+int32_t wal_rotate(wal_t* wal, uint64_t* out_gen) {
+    pthread_mutex_lock(&wal->lock);
+    while (wal->flushing || wal->syncing) {
+        pthread_cond_wait(&wal->progress, &wal->lock);
+    }
+    if (atomic_load(&wal->failed)) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+
+    // Own the file: finish the old generation, then switch descriptors
+    wal->flushing = 1;
+    flush_as_leader(wal, 1);
+    uint64_t next_gen = wal->gen + 1;
+    int32_t rc = -1;
+    if (!atomic_load(&wal->failed)) {
+        pthread_mutex_unlock(&wal->lock);
+        int fd = create_generation(wal, next_gen);
+        pthread_mutex_lock(&wal->lock);
+        if (fd >= 0) {
+            file_close(wal->fd);
+            wal->fd = fd;
+            wal->gen = next_gen;
+            wal->gen_start_lsn = wal->written_lsn;
+            rc = 0;
+        }
+    }
+    wal->flushing = 0;
+    pthread_cond_broadcast(&wal->progress);
+    pthread_mutex_unlock(&wal->lock);
+
+    *out_gen = next_gen;
+    return rc;
+}
+
+void wal_remove_before(wal_t* wal, uint64_t gen) {
+    uint64_t* gens = NULL;
+    size_t n = 0;
+    if (list_generations(wal, &gens, &n) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < n && gens[i] < gen; i++) {
+        char* path = generation_path(wal, gens[i]);
+        if (path) file_remove(path);
+        free(path);
+    }
+    free(gens);
+    sync_dir(wal->dir);
+}
+
+uint64_t wal_generation_bytes(wal_t* wal) {
+    pthread_mutex_lock(&wal->lock);
+    uint64_t bytes = wal->appended_lsn - wal->gen_start_lsn;
+    pthread_mutex_unlock(&wal->lock);
+    return bytes;
+}
+
+int wal_failed(wal_t* wal) {
+    return atomic_load(&wal->failed);
+}
+
+void wal_close(wal_t* wal) {
+    if (!wal) return;
+
+    syncer_stop(wal);
+
+    if (wal->fd >= 0) {
+        // A clean shutdown is always durable, whatever the mode
+        pthread_mutex_lock(&wal->lock);
+        wal->mode = DITTO_DURABILITY_SYNC;
+        uint64_t end = wal->appended_lsn;
+        pthread_mutex_unlock(&wal->lock);
+        wal_commit(wal, end);
+        file_close(wal->fd);
+    }
+
+    file_close(wal->lock_fd);
+    pthread_mutex_destroy(&wal->lock);
+    pthread_cond_destroy(&wal->progress);
+    pthread_cond_destroy(&wal->syncer_wake);
+    free(wal->buf);
+    free(wal->spare);
+    free(wal->dir);
+    free(wal);
+}
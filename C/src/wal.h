@@ -0,0 +1,82 @@
+// wal.h - Append-only write-ahead log with group commit
+//
+// The log is a sequence of generation files in the store directory. A
+// snapshot covers every generation below the one recorded in it, so after
+// rotating to a fresh generation and writing a snapshot, older generations
+// can be removed.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct wal wal_t;
+
+// Record types
+#define WAL_RECORD_PUT    1
+#define WAL_RECORD_DELETE 2
+#define WAL_RECORD_BATCH  3       // operations replayed all or nothing
+#define WAL_RECORD_EXPIRE 4       // value: u64 wall-clock expiry time in ms
+#define WAL_RECORD_RANGE  5       // value: u64 offset, then the bytes written there
+
+// One operation of a batch. `value` is ignored for deletes.
+typedef struct {
+    uint8_t type;                 // WAL_RECORD_PUT, _DELETE or _EXPIRE
+    const char* key;
+    size_t key_len;
+    const uint8_t* value;
+    size_t value_len;
+} wal_op_t;
+
+// Called for every operation of every intact record during replay. `key`
+// is NUL-terminated and, like `value`, only valid for the duration of the
+// call.
+typedef int32_t (*wal_apply_fn)(void* ctx, uint8_t type, const char* key,
+                                size_t key_len, const uint8_t* value,
+                                size_t value_len);
+
+// Opens the log in directory `dir`, creating the directory if needed. The
+// directory is locked so a second process cannot open the same store.
+int32_t wal_open(const char* dir, wal_t** out_wal);
+
+// Removes generations below `min_gen` and replays the rest, oldest first,
+// through `apply`. A torn or corrupt tail left by a crash is truncated so
+// new records follow the last good one. Must run once before appending.
+int32_t wal_replay(wal_t* wal, uint64_t min_gen, wal_apply_fn apply, void* ctx);
+
+// Selects one of the DITTO_DURABILITY_* modes from ditto.h.
+int32_t wal_set_durability(wal_t* wal, int32_t mode, uint32_t interval_ms);
+
+// Buffers a record and returns the log position that covers it. Records
+// must be appended in the order their changes were applied.
+int32_t wal_append(wal_t* wal, uint8_t type, const char* key, size_t key_len,
+                   const uint8_t* value, size_t value_len, uint64_t* out_lsn);
+
+// Buffers a WAL_RECORD_RANGE record for `len` bytes written at `offset`.
+// Same ordering rule as wal_append().
+int32_t wal_append_range(wal_t* wal, const char* key, size_t key_len,
+                         uint64_t offset, const uint8_t* data, size_t len,
+                         uint64_t* out_lsn);
+
+// Buffers `count` operations as one record, so a crash loses either all of
+// them or none. Same ordering rule as wal_append().
+int32_t wal_append_batch(wal_t* wal, const wal_op_t* ops, size_t count,
+                         uint64_t* out_lsn);
+
+// Waits until everything up to `lsn` is written (and synced, in
+// DITTO_DURABILITY_SYNC mode). Concurrent callers share one write/fsync.
+int32_t wal_commit(wal_t* wal, uint64_t lsn);
+
+// Syncs the current generation and starts a new one. Every change applied
+// before the call is in a generation below *out_gen.
+int32_t wal_rotate(wal_t* wal, uint64_t* out_gen);
+
+// Deletes generations below `gen` once a snapshot covers them.
+void wal_remove_before(wal_t* wal, uint64_t gen);
+
+// Bytes appended to the current generation.
+uint64_t wal_generation_bytes(wal_t* wal);
+
+// Non-zero once an I/O error has made the log unusable.
+int wal_failed(wal_t* wal);
+
+// Flushes and syncs pending records, then closes the log.
+void wal_close(wal_t* wal);
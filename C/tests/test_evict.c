@@ -0,0 +1,184 @@
+// test_evict.c - Memory budget eviction and how evictions are reported
+//
+// Fills a store past its budget with keys of one size, chosen so that the
+// budget split into per-shard shares holds fewer bytes than the budget as a
+// whole, and checks the store never holds more than the shares. Every key
+// evicted must read as missing, reach the eviction subscription once and
+// the per-key one as a change, appear in the change ring as an eviction and
+// in the change journal as a delete, and stay gone after a reopen; a key
+// kept must only be reported for its put.
+//
+// Usage: ditto_test_evict
+#include "test_util.h"
+
+#define SHARDS 4
+#define KEYS 2000
+#define ENTRY_BYTES 100 // "key:00000" and a 91-byte value
+#define BUDGET 20399    // shares of 5099, so 50 entries a shard
+#define HELD (SHARDS * (BUDGET / SHARDS / ENTRY_BYTES) * ENTRY_BYTES)
+#define SMALL_BUDGET 8000
+
+typedef struct {
+    int evicted_cb[KEYS];     // calls to the eviction subscription
+    int changed_cb[KEYS];     // calls to the per-key subscription
+    int ring_written[KEYS];
+    int ring_evicted[KEYS];
+    int journal_put[KEYS];
+    int journal_deleted[KEYS];
+} reports_t;
+
+static reports_t reports;
+
+static int key_number(const char* key, size_t len) {
+    // Records are packed, so the key is not NUL-terminated
+    CHECK(len == 9 && memcmp(key, "key:", 4) == 0);
+    int i = 0;
+    for (size_t d = 4; d < len; d++) {
+        CHECK(key[d] >= '0' && key[d] <= '9');
+        i = i * 10 + (key[d] - '0');
+    }
+    CHECK(i < KEYS);
+    return i;
+}
+
+static void on_evicted(void* user_data, const char* key) {
+    (void)user_data;
+    reports.evicted_cb[key_number(key, strlen(key))]++;
+}
+
+static void on_changed(void* user_data, const char* key) {
+    (void)user_data;
+    reports.changed_cb[key_number(key, strlen(key))]++;
+}
+
+static ditto_stats_t stats(ditto_db_t* db) {
+    ditto_stats_t s;
+    CHECK(ditto_get_stats(db, &s, sizeof(s)) == 0);
+    return s;
+}
+
+static void read_ring(ditto_change_ring_t* ring) {
+    static uint8_t buf[1 << 16];
+    uint64_t cursor = 0;
+    for (;;) {
+        size_t len = sizeof(buf);
+        size_t count;
+        uint64_t lost = 0;
+        CHECK(ditto_change_ring_read(ring, &cursor, buf, &len, &count, &lost) == 0);
+        CHECK(lost == 0);
+        if (count == 0) break;
+        for (size_t off = 0; off < len;) {
+            uint32_t kind;
+            uint32_t key_len;
+            memcpy(&kind, buf + off, 4);
+            memcpy(&key_len, buf + off + 4, 4);
+            int i = key_number((const char*)buf + off + 8, key_len);
+            CHECK(kind == DITTO_CHANGE_WRITTEN || kind == DITTO_CHANGE_EVICTED);
+            if (kind == DITTO_CHANGE_EVICTED) {
+                reports.ring_evicted[i]++;
+            } else {
+                reports.ring_written[i]++;
+            }
+            off += 8 + key_len;
+        }
+    }
+}
+
+static void read_journal(ditto_db_t* db) {
+    static uint8_t buf[1 << 16];
+    uint64_t incarnation = 0;
+    uint64_t seq = 0;
+    for (;;) {
+        size_t len = sizeof(buf);
+        size_t count;
+        CHECK(ditto_changes_since(db, &incarnation, seq, buf, &len, &count, &seq) == 0);
+        if (count == 0) break;
+        for (size_t off = 0; off < len;) {
+            uint32_t op;
+            uint32_t key_len;
+            memcpy(&op, buf + off + 8, 4);
+            memcpy(&key_len, buf + off + 12, 4);
+            int i = key_number((const char*)buf + off + 16, key_len);
+            if (op == DITTO_OP_DELETE) {
+                reports.journal_deleted[i]++;
+            } else {
+                CHECK(op == DITTO_OP_PUT);
+                reports.journal_put[i]++;
+            }
+            off += 16 + key_len;
+        }
+    }
+}
+
+static void key_name(char* key, size_t cap, int i) {
+    snprintf(key, cap, "key:%05d", i);
+}
+
+int main(void) {
+    char* dir = test_dir_create();
+    ditto_options_t opts;
+    ditto_options_init(&opts);
+    opts.maintenance_interval_ms = 0;
+    opts.shard_count = SHARDS;
+    opts.change_journal_capacity = 4 * KEYS;
+    ditto_db_t* db;
+    CHECK(ditto_open_ex(dir, &opts, &db) == 0);
+    CHECK(ditto_set_memory_budget(db, BUDGET, DITTO_EVICT_CLOCK) == 0);
+
+    int32_t sub;
+    CHECK(ditto_subscribe_evictions(db, on_evicted, NULL, &sub) == 0);
+    CHECK(ditto_subscribe(db, on_changed, NULL, &sub) == 0);
+    ditto_change_ring_t* ring;
+    CHECK(ditto_change_ring_open(db, 4 * KEYS, 64 * KEYS, NULL, NULL, &ring) == 0);
+
+    // Each shard stays within its share, not just the store within the
+    // budget, which here would leave room for three more entries
+    char key[16];
+    char value[ENTRY_BYTES];
+    memset(value, 'v', sizeof(value));
+    for (int i = 0; i < KEYS; i++) {
+        key_name(key, sizeof(key), i);
+        CHECK(ditto_put(db, key, (const uint8_t*)value, ENTRY_BYTES - 9) == 0);
+        CHECK(stats(db).payload_bytes <= HELD);
+    }
+    CHECK(stats(db).payload_bytes == HELD);
+    CHECK(test_count(db) == HELD / ENTRY_BYTES);
+
+    // A smaller budget evicts straight away
+    CHECK(ditto_set_memory_budget(db, SMALL_BUDGET, DITTO_EVICT_CLOCK) == 0);
+    CHECK(stats(db).payload_bytes == SMALL_BUDGET);
+    size_t kept = test_count(db);
+    CHECK(kept == SMALL_BUDGET / ENTRY_BYTES);
+
+    read_ring(ring);
+    read_journal(db);
+    size_t evicted = 0;
+    for (int i = 0; i < KEYS; i++) {
+        key_name(key, sizeof(key), i);
+        int gone = test_has(db, key, NULL);
+        evicted += (size_t)gone;
+        CHECK(reports.evicted_cb[i] == gone);
+        CHECK(reports.changed_cb[i] == 1 + gone);
+        CHECK(reports.ring_written[i] == 1);
+        CHECK(reports.ring_evicted[i] == gone);
+        CHECK(reports.journal_put[i] == 1);
+        CHECK(reports.journal_deleted[i] == gone);
+    }
+    CHECK(evicted == KEYS - kept);
+    CHECK(stats(db).evictions == evicted);
+
+    // Evicting is a logged delete: without a budget the store reopens with
+    // only the keys kept
+    ditto_change_ring_close(ring);
+    ditto_close(db);
+    CHECK(ditto_open_ex(dir, &opts, &db) == 0);
+    CHECK(test_count(db) == kept);
+    for (int i = 0; i < KEYS; i++) {
+        key_name(key, sizeof(key), i);
+        CHECK(test_has(db, key, NULL) == (reports.evicted_cb[i] == 1));
+    }
+    ditto_close(db);
+    test_dir_remove(dir);
+    printf("eviction ok\n");
+    return 0;
+}
@@ -0,0 +1,140 @@
+// test_read_resize.c - Lock-free point reads racing table resizes
+//
+// Readers ditto_get() (and ditto_get_k(), which probes by slot hint) a fixed
+// set of keys while a writer grows one shard with filler keys, deletes them
+// and shrinks it back with ditto_compact_now(), over and over. Every read
+// must find its key with its value; a read that pairs the arrays of two
+// layouts would miss it.
+//
+// Usage: ditto_test_read_resize [seconds]
+#include "ditto.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FIXED_KEYS 256
+#define FILLER_KEYS 2000
+#define READERS 4
+
+typedef struct {
+    ditto_db_t* db;
+    ditto_key_t* interned[FIXED_KEYS];
+    _Atomic int stop;
+    _Atomic uint64_t reads;
+    _Atomic uint64_t failures;
+    _Atomic uint64_t cycles;
+} test_t;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void fixed_key(char* buf, size_t cap, int i) {
+    snprintf(buf, cap, "fixed:%04d", i);
+}
+
+static void* reader_main(void* arg) {
+    test_t* t = (test_t*)arg;
+    uint64_t reads = 0;
+    for (int round = 0; !atomic_load(&t->stop); round++) {
+        for (int i = 0; i < FIXED_KEYS; i++) {
+            char key[32];
+            char want[32];
+            uint8_t buf[32];
+            size_t len = sizeof(buf);
+            fixed_key(key, sizeof(key), i);
+            snprintf(want, sizeof(want), "value:%04d", i);
+            int32_t rc = (round & 1) ? ditto_get_k(t->db, t->interned[i], buf, &len)
+                                     : ditto_get(t->db, key, buf, &len);
+            if (rc != 0 || len != strlen(want) || memcmp(buf, want, len) != 0) {
+                if (atomic_fetch_add(&t->failures, 1) < 10) {
+                    fprintf(stderr, "read of %s returned %d\n", key, rc);
+                }
+            }
+            reads++;
+        }
+    }
+    atomic_fetch_add(&t->reads, reads);
+    return NULL;
+}
+
+static void* writer_main(void* arg) {
+    test_t* t = (test_t*)arg;
+    const uint8_t filler[8] = {0};
+    while (!atomic_load(&t->stop)) {
+        char key[32];
+        for (int i = 0; i < FILLER_KEYS; i++) {
+            snprintf(key, sizeof(key), "filler:%06d", i);
+            ditto_put(t->db, key, filler, sizeof(filler));
+        }
+        for (int i = 0; i < FILLER_KEYS; i++) {
+            snprintf(key, sizeof(key), "filler:%06d", i);
+            ditto_delete(t->db, key);
+        }
+        // Shrinks the table the deletes left sparse
+        ditto_compact_now(t->db);
+        atomic_fetch_add(&t->cycles, 1);
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+
+    // One shard, so every resize is under the readers' keys
+    ditto_options_t opts;
+    ditto_options_init(&opts);
+    opts.shard_count = 1;
+    opts.maintenance_interval_ms = 0;
+    test_t t = {0};
+    if (ditto_open_ex(DITTO_MEMORY_PATH, &opts, &t.db) != 0) {
+        fprintf(stderr, "open failed\n");
+        return 1;
+    }
+    for (int i = 0; i < FIXED_KEYS; i++) {
+        char key[32];
+        char value[32];
+        fixed_key(key, sizeof(key), i);
+        snprintf(value, sizeof(value), "value:%04d", i);
+        if (ditto_put(t.db, key, (const uint8_t*)value, strlen(value)) != 0 ||
+            ditto_key_intern(t.db, key, strlen(key), &t.interned[i]) != 0) {
+            fprintf(stderr, "setup failed\n");
+            return 1;
+        }
+    }
+
+    pthread_t readers[READERS];
+    pthread_t writer;
+    for (int i = 0; i < READERS; i++) {
+        pthread_create(&readers[i], NULL, reader_main, &t);
+    }
+    pthread_create(&writer, NULL, writer_main, &t);
+    double end = now_seconds() + seconds;
+    while (now_seconds() < end && atomic_load(&t.failures) == 0) {
+        struct timespec nap = {0, 10 * 1000 * 1000};
+        nanosleep(&nap, NULL);
+    }
+    atomic_store(&t.stop, 1);
+    pthread_join(writer, NULL);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    for (int i = 0; i < FIXED_KEYS; i++) {
+        ditto_key_release(t.interned[i]);
+    }
+    ditto_close(t.db);
+
+    uint64_t failures = atomic_load(&t.failures);
+    printf("%llu reads over %llu grow/shrink cycles, %llu failed\n",
+           (unsigned long long)atomic_load(&t.reads),
+           (unsigned long long)atomic_load(&t.cycles),
+           (unsigned long long)failures);
+    return failures == 0 && atomic_load(&t.cycles) > 0 ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+// test_ttl.c - The expiry timer wheel, driven tick by tick and in real time
+//
+// The wheel half includes ditto.c and feeds ttl_advance() made-up ticks, so
+// it is deterministic: every timer must come due exactly at its tick, one
+// tick at a time or after any jump ahead, on both sides of each level's
+// cascade boundary (64, 4096 and 262144 ticks) and past the last level's
+// range. The store half checks the same through the expiry thread: a TTL
+// longer than level 0 holds, an idle wheel restarts at the present, and
+// deadlines survive a compaction and reopen through the log's EXPIRE
+// records.
+//
+// Usage: ditto_test_ttl
+#include "../src/ditto.c"
+#include "test_util.h"
+
+#define MAX_TIMERS 64
+
+typedef struct {
+    ttl_wheel_t wheel;
+    uint64_t base;                // w->current when the first timer was armed
+    uint64_t ticks[MAX_TIMERS];   // expected tick of each armed key
+    int armed[MAX_TIMERS];        // still expected to fire
+    int n;
+} wheel_case_t;
+
+static void case_begin(wheel_case_t* c) {
+    memset(c, 0, sizeof(*c));
+    // An anchor far out starts the wheel at the present tick
+    uint64_t anchor = wall_clock_ms() / TTL_TICK_MS + (1ull << 30);
+    CHECK(ttl_arm(&c->wheel, "anchor", 6, 0, anchor * TTL_TICK_MS) == 0);
+    c->base = c->wheel.current;
+    c->ticks[0] = anchor;
+    c->armed[0] = 1;
+    c->n = 1;
+}
+
+static int key_index(const char* key) {
+    return strcmp(key, "anchor") == 0 ? 0 : atoi(key + 1);
+}
+
+// Arms (or re-arms) key "t<i>" for `tick`; a deadline anywhere inside the
+// tick files it there
+static void arm(wheel_case_t* c, int i, uint64_t tick, uint64_t ms_in_tick) {
+    char key[16];
+    snprintf(key, sizeof(key), "t%d", i);
+    CHECK(ttl_arm(&c->wheel, key, strlen(key), (uint64_t)i * 7919u,
+                  tick * TTL_TICK_MS + ms_in_tick) == 0);
+    c->ticks[i] = tick < c->base ? c->base : tick; // Overdue goes at once
+    c->armed[i] = 1;
+    if (i >= c->n) c->n = i + 1;
+}
+
+static void cancel(wheel_case_t* c, int i) {
+    char key[16];
+    snprintf(key, sizeof(key), i == 0 ? "anchor" : "t%d", i);
+    ttl_cancel(&c->wheel, key, strlen(key), (uint64_t)i * 7919u);
+    c->armed[i] = 0;
+}
+
+// Advances to `now` and checks that exactly the timers expected by then
+// came due, each no later than expected, and none early
+static void advance(wheel_case_t* c, uint64_t now, int exact) {
+    ttl_timer_t* due = NULL;
+    ttl_advance(&c->wheel, now, &due);
+    while (due) {
+        ttl_timer_t* t = due;
+        due = t->next;
+        int i = key_index(t->key);
+        CHECK(i < c->n && c->armed[i]);
+        CHECK(c->ticks[i] <= now);
+        if (exact) CHECK(c->ticks[i] == now);
+        c->armed[i] = 0;
+        free(t);
+    }
+    for (int i = 0; i < c->n; i++) {
+        CHECK(!c->armed[i] || c->ticks[i] > now);
+    }
+}
+
+// Jumps to just before each expected tick, then onto it
+static void advance_by_jumps(wheel_case_t* c) {
+    for (;;) {
+        uint64_t next = UINT64_MAX;
+        for (int i = 0; i < c->n; i++) {
+            if (c->armed[i] && c->ticks[i] < next) next = c->ticks[i];
+        }
+        if (next == UINT64_MAX) break;
+        if (next > c->wheel.current) advance(c, next - 1, 1);
+        advance(c, next, 1);
+    }
+    CHECK(atomic_load(&c->wheel.count) == 0);
+    ttl_wheel_release(&c->wheel);
+}
+
+// Timers on both sides of the next boundary of every level
+static void arm_boundaries(wheel_case_t* c, uint64_t limit) {
+    int i = 1;
+    for (unsigned level = 1; level <= TTL_WHEEL_LEVELS; level++) {
+        uint64_t span = 1ull << (TTL_WHEEL_BITS * level);
+        if (span > limit) break;
+        uint64_t boundary = (c->base / span + 1) * span;
+        arm(c, i++, boundary - 1, 9);
+        arm(c, i++, boundary, 0);
+        arm(c, i++, boundary + 1, 5);
+        arm(c, i++, c->base + span - 1, 0); // Furthest slot of the level below
+        arm(c, i++, c->base + span, 0);     // Nearest slot of this level
+        arm(c, i++, c->base + span + 1, 0);
+    }
+    arm(c, i++, c->base, 3);      // Due in the current tick
+    arm(c, i++, c->base - 50, 0); // Already overdue
+    arm(c, i++, c->base + 1, 0);
+}
+
+static void test_wheel_steps(void) {
+    // One tick at a time across the level 1 and level 2 boundaries
+    wheel_case_t c;
+    case_begin(&c);
+    arm_boundaries(&c, 1u << 12);
+    uint64_t end = c.base + (2u << 12) + 2;
+    for (uint64_t now = c.base; now <= end; now++) {
+        advance(&c, now, 1);
+    }
+    cancel(&c, 0);
+    CHECK(atomic_load(&c.wheel.count) == 0);
+    ttl_wheel_release(&c.wheel);
+}
+
+static void test_wheel_jumps(void) {
+    wheel_case_t c;
+    case_begin(&c);
+    arm_boundaries(&c, UINT64_MAX);
+    // Past the last level's range: parked in its furthest slot and re-filed
+    uint64_t horizon = 1ull << (TTL_WHEEL_BITS * TTL_WHEEL_LEVELS);
+    arm(&c, 40, c.base + horizon + 12345, 0);
+    arm(&c, 41, c.base + 3 * horizon, 0);
+    advance_by_jumps(&c);
+}
+
+static void test_wheel_rearm(void) {
+    wheel_case_t c;
+    case_begin(&c);
+    // Moved between levels in both directions, and cancelled
+    arm(&c, 1, c.base + 5000, 0);
+    arm(&c, 2, c.base + 70, 0);
+    arm(&c, 3, c.base + 300000, 0);
+    arm(&c, 1, c.base + 10, 0);
+    arm(&c, 2, c.base + 100000, 0);
+    cancel(&c, 3);
+    advance(&c, c.base + 9, 1);
+    advance(&c, c.base + 10, 1);
+    // Re-armed after the wheel moved on: filed relative to the new tick
+    arm(&c, 4, c.base + 75, 0);
+    arm(&c, 5, c.base + 4100, 0);
+    advance_by_jumps(&c);
+}
+
+static void test_wheel_idle(void) {
+    // A catch-up far past everything fires it all in one call
+    wheel_case_t c;
+    case_begin(&c);
+    for (int i = 1; i < 40; i++) {
+        arm(&c, i, c.base + (uint64_t)i * i * i * 97, (uint64_t)i % TTL_TICK_MS);
+    }
+    uint64_t far = c.base + 40ull * 40 * 40 * 97;
+    advance(&c, c.base + 20ull * 20 * 20 * 97, 0);
+    advance(&c, far, 0);
+    cancel(&c, 0);
+    CHECK(atomic_load(&c.wheel.count) == 0);
+    CHECK(c.wheel.current == far + 1);
+
+    // Once empty it restarts at the present rather than where it stopped,
+    // so new timers are filed relative to now
+    c.base = wall_clock_ms() / TTL_TICK_MS;
+    arm(&c, 1, c.base + 100, 0);
+    CHECK(c.wheel.current + 1 >= c.base && c.wheel.current <= c.base + 1);
+    c.base = c.wheel.current;
+    arm(&c, 2, c.base + 64, 0);
+    advance_by_jumps(&c);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Waits for `key` to expire and checks it went no earlier than the tick of
+// its deadline and within `slack_ms` after it. The deadline is taken before
+// the put, so it is never later than the store's own.
+static void check_expires(ditto_db_t* db, const char* key, uint64_t deadline_ms,
+                          uint64_t slack_ms) {
+    for (;;) {
+        int gone = test_has(db, key, NULL);
+        uint64_t seen = now_ms();
+        if (gone) {
+            CHECK(seen + TTL_TICK_MS >= deadline_ms);
+            return;
+        }
+        CHECK(seen <= deadline_ms + slack_ms);
+        test_sleep_ms(2);
+    }
+}
+
+static void test_store(void) {
+    const uint64_t slack = 1500; // Generous for loaded machines
+    ditto_db_t* db;
+    CHECK(ditto_open(DITTO_MEMORY_PATH, &db) == 0);
+
+    // Longer than level 0 covers, so it waits in level 1 and cascades
+    uint64_t start = now_ms();
+    CHECK(ditto_put_ttl(db, "cascade", (const uint8_t*)"v", 1, 800) == 0);
+    check_expires(db, "cascade", start + 800, slack);
+
+    // The thread parks with nothing armed; a timer armed after a while idle
+    // must neither fire at once nor wait for the old schedule
+    test_sleep_ms(300);
+    start = now_ms();
+    CHECK(ditto_put_ttl(db, "after-idle", (const uint8_t*)"v", 1, 50) == 0);
+    check_expires(db, "after-idle", start + 50, slack);
+    ditto_close(db);
+
+    // Deadlines are wall-clock times in the log. A compaction logs pending
+    // timers again, since it removes the generations that armed them
+    char* dir = test_dir_create();
+    ditto_options_t opts;
+    ditto_options_init(&opts);
+    opts.maintenance_interval_ms = 0;
+    CHECK(ditto_open_ex(dir, &opts, &db) == 0);
+    start = now_ms();
+    CHECK(ditto_put_ttl(db, "reopen", (const uint8_t*)"v", 1, 900) == 0);
+    CHECK(ditto_put_ttl(db, "compacted", (const uint8_t*)"v", 1, 1400) == 0);
+    CHECK(ditto_compact_now(db) == 0);
+    ditto_close(db);
+    CHECK(ditto_open_ex(dir, &opts, &db) == 0);
+    CHECK(test_has(db, "reopen", "v"));
+    CHECK(test_has(db, "compacted", "v"));
+    check_expires(db, "reopen", start + 900, slack);
+    check_expires(db, "compacted", start + 1400, slack);
+    ditto_close(db);
+
+    // The expiries were logged deletes
+    CHECK(ditto_open_ex(dir, &opts, &db) == 0);
+    CHECK(test_count(db) == 0);
+    ditto_close(db);
+    test_dir_remove(dir);
+}
+
+int main(void) {
+    test_wheel_steps();
+    test_wheel_jumps();
+    test_wheel_rearm();
+    test_wheel_idle();
+    test_store();
+    printf("ttl wheel ok\n");
+    return 0;
+}
@@ -0,0 +1,167 @@
+// test_txn.c - Transaction conflicts and commit notifications
+//
+// A write by someone else to a key the transaction read, between
+// ditto_txn_get() and ditto_txn_commit(), must make the commit return 3 and
+// leave the store, the journal and the subscribers exactly as that write
+// left them. A commit that goes through reaches a batch subscriber as one
+// notification holding every key it changed.
+//
+// Usage: ditto_test_txn
+#include "test_util.h"
+
+typedef struct {
+    int calls;
+    size_t keys;
+    char last[8][32];
+} batch_log_t;
+
+static void on_batch(void* user_data, const char** keys, size_t n) {
+    batch_log_t* log = (batch_log_t*)user_data;
+    for (size_t i = 0; i < n && i < 8; i++) {
+        snprintf(log->last[i], sizeof(log->last[i]), "%s", keys[i]);
+    }
+    log->calls++;
+    log->keys = n;
+}
+
+static void on_key(void* user_data, const char* key) {
+    (void)key;
+    (*(int*)user_data)++;
+}
+
+static int logged(const batch_log_t* log, const char* key) {
+    for (size_t i = 0; i < log->keys && i < 8; i++) {
+        if (strcmp(log->last[i], key) == 0) return 1;
+    }
+    return 0;
+}
+
+// Newest change seq, from the journal
+static uint64_t newest_seq(ditto_db_t* db) {
+    uint64_t incarnation = 0;
+    uint64_t seq = 0;
+    for (;;) {
+        uint8_t buf[4096];
+        size_t len = sizeof(buf);
+        size_t count;
+        int32_t rc = ditto_changes_since(db, &incarnation, seq, buf, &len, &count, &seq);
+        CHECK(rc == 0 || rc == 2);
+        if (rc == 2 || count == 0) return seq;
+    }
+}
+
+static ditto_txn_t* read_then_write(ditto_db_t* db, const char* read_key) {
+    ditto_txn_t* txn;
+    CHECK(ditto_txn_begin(db, &txn) == 0);
+    uint8_t buf[32];
+    size_t len = sizeof(buf);
+    int32_t rc = ditto_txn_get(txn, read_key, buf, &len);
+    CHECK(rc == 0 || rc == 2);
+    CHECK(ditto_txn_put(txn, "b", (const uint8_t*)"txn", 3) == 0);
+    CHECK(ditto_txn_put(txn, "c", (const uint8_t*)"txn", 3) == 0);
+    CHECK(ditto_txn_delete(txn, "d") == 0);
+    return txn;
+}
+
+static void check_untouched(ditto_db_t* db) {
+    CHECK(test_has(db, "b", "2"));
+    CHECK(test_has(db, "c", NULL));
+    CHECK(test_has(db, "d", "4"));
+}
+
+static void test_conflicts(ditto_db_t* db, batch_log_t* log, int* per_key) {
+    test_put(db, "a", "1");
+    test_put(db, "b", "2");
+    test_put(db, "d", "4");
+
+    // The key read is overwritten
+    ditto_txn_t* txn = read_then_write(db, "a");
+    test_put(db, "a", "external");
+    int calls = log->calls;
+    int keys = *per_key;
+    uint64_t seq = newest_seq(db);
+    CHECK(ditto_txn_commit(txn) == 3);
+    CHECK(test_has(db, "a", "external"));
+    check_untouched(db);
+    CHECK(log->calls == calls && *per_key == keys);
+    CHECK(newest_seq(db) == seq);
+
+    // ... deleted
+    txn = read_then_write(db, "a");
+    CHECK(ditto_delete(db, "a") == 0);
+    CHECK(ditto_txn_commit(txn) == 3);
+    CHECK(test_has(db, "a", NULL));
+    check_untouched(db);
+
+    // ... or created after being read as missing
+    txn = read_then_write(db, "a");
+    test_put(db, "a", "back");
+    CHECK(ditto_txn_commit(txn) == 3);
+    check_untouched(db);
+
+    // Rewriting a key with its own value still changes its version
+    txn = read_then_write(db, "a");
+    test_put(db, "a", "back");
+    CHECK(ditto_txn_commit(txn) == 3);
+    check_untouched(db);
+
+    // A write to a key the transaction only wrote is not a conflict
+    txn = read_then_write(db, "a");
+    test_put(db, "c", "external");
+    CHECK(ditto_txn_commit(txn) == 0);
+    CHECK(test_has(db, "b", "txn"));
+    CHECK(test_has(db, "c", "txn"));
+    CHECK(test_has(db, "d", NULL));
+}
+
+static void test_notification(ditto_db_t* db, batch_log_t* log, int* per_key) {
+    test_put(db, "x", "0");
+    CHECK(ditto_delete(db, "y") == 2);
+    ditto_txn_t* txn;
+    CHECK(ditto_txn_begin(db, &txn) == 0);
+    uint8_t buf[32];
+    size_t len = sizeof(buf);
+    CHECK(ditto_txn_get(txn, "x", buf, &len) == 0);
+    CHECK(ditto_txn_put(txn, "x", (const uint8_t*)"1", 1) == 0);
+    CHECK(ditto_txn_put(txn, "y", (const uint8_t*)"1", 1) == 0);
+    CHECK(ditto_txn_put(txn, "z", (const uint8_t*)"1", 1) == 0);
+    CHECK(ditto_txn_put(txn, "y", (const uint8_t*)"2", 1) == 0);
+    CHECK(ditto_txn_delete(txn, "b") == 0);
+
+    int calls = log->calls;
+    int keys = *per_key;
+    uint64_t seq = newest_seq(db);
+    CHECK(ditto_txn_commit(txn) == 0);
+    CHECK(log->calls == calls + 1);
+    CHECK(log->keys == 4);
+    CHECK(logged(log, "x") && logged(log, "y") && logged(log, "z") && logged(log, "b"));
+    CHECK(*per_key == keys + 4);
+    CHECK(newest_seq(db) == seq + 4);
+    CHECK(test_has(db, "y", "2"));
+    CHECK(test_has(db, "b", NULL));
+
+    // Nothing to write: nothing to report
+    CHECK(ditto_txn_begin(db, &txn) == 0);
+    len = sizeof(buf);
+    CHECK(ditto_txn_get(txn, "x", buf, &len) == 0);
+    CHECK(ditto_txn_commit(txn) == 0);
+    CHECK(log->calls == calls + 1);
+}
+
+int main(void) {
+    ditto_db_t* db;
+    CHECK(ditto_open(DITTO_MEMORY_PATH, &db) == 0);
+    batch_log_t log = {0};
+    int per_key = 0;
+    int32_t batch_sub;
+    int32_t key_sub;
+    CHECK(ditto_subscribe_batch(db, on_batch, &log, &batch_sub) == 0);
+    CHECK(ditto_subscribe(db, on_key, &per_key, &key_sub) == 0);
+
+    test_conflicts(db, &log, &per_key);
+    test_notification(db, &log, &per_key);
+
+    ditto_close(db);
+    printf("transactions ok\n");
+    return 0;
+}
@@ -0,0 +1,261 @@
+// test_wal.c - Write-ahead log replay across close and reopen
+//
+// Each case writes to an on-disk store, closes it, sometimes cuts the newest
+// log generation part way through its last record, reopens and checks
+// exactly what survived: every record before the cut, nothing of the torn
+// one, and writes after the reopen landing where replay stopped.
+//
+// Usage: ditto_test_wal
+#include "test_util.h"
+#include <sys/stat.h>
+
+static ditto_db_t* open_store(const char* dir) {
+    ditto_options_t opts;
+    ditto_options_init(&opts);
+    opts.maintenance_interval_ms = 0; // Everything stays in the log
+    ditto_db_t* db;
+    CHECK(ditto_open_ex(dir, &opts, &db) == 0);
+    return db;
+}
+
+// Path of the newest log generation, in a static buffer
+static const char* newest_log(const char* dir) {
+    static char name[256];
+    unsigned long long newest = 0;
+    DIR* d = opendir(dir);
+    CHECK(d != NULL);
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        unsigned long long gen;
+        if (sscanf(ent->d_name, "ditto-%llu.wal", &gen) == 1 && gen >= newest) {
+            newest = gen;
+            snprintf(name, sizeof(name), "%s", ent->d_name);
+        }
+    }
+    closedir(d);
+    CHECK(newest > 0);
+    return test_path(dir, name);
+}
+
+static off_t log_size(const char* dir) {
+    struct stat st;
+    CHECK(stat(newest_log(dir), &st) == 0);
+    return st.st_size;
+}
+
+// Cuts the newest generation to `size` bytes, as a crash mid-write would
+static void cut_log(const char* dir, off_t size) {
+    CHECK(truncate(newest_log(dir), size) == 0);
+}
+
+static void test_reopen(void) {
+    char* dir = test_dir_create();
+    ditto_db_t* db = open_store(dir);
+    char key[32];
+    char value[32];
+    for (int i = 0; i < 100; i++) {
+        snprintf(key, sizeof(key), "k%03d", i);
+        snprintf(value, sizeof(value), "v%d", i);
+        test_put(db, key, value);
+    }
+    for (int i = 0; i < 100; i += 3) {
+        snprintf(key, sizeof(key), "k%03d", i);
+        test_put(db, key, "overwritten");
+    }
+    for (int i = 0; i < 100; i += 5) {
+        snprintf(key, sizeof(key), "k%03d", i);
+        CHECK(ditto_delete(db, key) == 0);
+    }
+    ditto_close(db);
+
+    // Twice, so a replayed store replays the same again
+    for (int round = 0; round < 2; round++) {
+        db = open_store(dir);
+        CHECK(test_count(db) == 80);
+        for (int i = 0; i < 100; i++) {
+            snprintf(key, sizeof(key), "k%03d", i);
+            snprintf(value, sizeof(value), "v%d", i);
+            CHECK(test_has(db, key, i % 5 == 0 ? NULL : i % 3 == 0 ? "overwritten" : value));
+        }
+        ditto_close(db);
+    }
+    test_dir_remove(dir);
+}
+
+static void test_torn_tail(void) {
+    char* dir = test_dir_create();
+    ditto_db_t* db = open_store(dir);
+    test_put(db, "a", "1");
+    test_put(db, "b", "2");
+    ditto_close(db);
+    off_t good = log_size(dir);
+
+    db = open_store(dir);
+    test_put(db, "torn", "this record loses its last bytes");
+    ditto_close(db);
+    off_t full = log_size(dir);
+    CHECK(full > good);
+
+    for (off_t cut = full - 1; cut > good; cut -= (full - good) / 3 + 1) {
+        cut_log(dir, cut);
+        db = open_store(dir);
+        CHECK(test_count(db) == 2);
+        CHECK(test_has(db, "a", "1"));
+        CHECK(test_has(db, "b", "2"));
+        CHECK(test_has(db, "torn", NULL));
+        ditto_close(db);
+        CHECK(log_size(dir) == good); // Replay drops the torn bytes
+    }
+
+    // New records follow the last good one rather than the garbage
+    db = open_store(dir);
+    test_put(db, "after", "3");
+    ditto_close(db);
+    db = open_store(dir);
+    CHECK(test_count(db) == 3);
+    CHECK(test_has(db, "after", "3"));
+    ditto_close(db);
+    test_dir_remove(dir);
+}
+
+// A transaction commit is logged as one batch record across its shards
+static void write_batch(ditto_db_t* db) {
+    ditto_txn_t* txn;
+    CHECK(ditto_txn_begin(db, &txn) == 0);
+    CHECK(ditto_txn_put(txn, "base1", (const uint8_t*)"B1", 2) == 0);
+    CHECK(ditto_txn_delete(txn, "base2") == 0);
+    CHECK(ditto_txn_put(txn, "new1", (const uint8_t*)"N1", 2) == 0);
+    CHECK(ditto_txn_put(txn, "new2", (const uint8_t*)"N2", 2) == 0);
+    CHECK(ditto_txn_put(txn, "new1", (const uint8_t*)"N1b", 3) == 0);
+    CHECK(ditto_txn_commit(txn) == 0);
+}
+
+static void test_batch(void) {
+    // Whole: every operation replays, in order
+    char* dir = test_dir_create();
+    ditto_db_t* db = open_store(dir);
+    test_put(db, "base1", "b1");
+    test_put(db, "base2", "b2");
+    write_batch(db);
+    ditto_close(db);
+    db = open_store(dir);
+    CHECK(test_count(db) == 3);
+    CHECK(test_has(db, "base1", "B1"));
+    CHECK(test_has(db, "base2", NULL));
+    CHECK(test_has(db, "new1", "N1b"));
+    CHECK(test_has(db, "new2", "N2"));
+    ditto_close(db);
+    test_dir_remove(dir);
+
+    // Torn anywhere: none of it does
+    dir = test_dir_create();
+    db = open_store(dir);
+    test_put(db, "base1", "b1");
+    test_put(db, "base2", "b2");
+    ditto_close(db);
+    off_t good = log_size(dir);
+    db = open_store(dir);
+    write_batch(db);
+    ditto_close(db);
+    off_t full = log_size(dir);
+    for (off_t cut = full - 1; cut > good; cut -= 7) {
+        cut_log(dir, cut);
+        db = open_store(dir);
+        CHECK(test_count(db) == 2);
+        CHECK(test_has(db, "base1", "b1"));
+        CHECK(test_has(db, "base2", "b2"));
+        CHECK(test_has(db, "new1", NULL));
+        CHECK(test_has(db, "new2", NULL));
+        ditto_close(db);
+    }
+    test_dir_remove(dir);
+}
+
+static int wait_gone(ditto_db_t* db, const char* key, unsigned timeout_ms) {
+    for (unsigned waited = 0; waited < timeout_ms; waited += 10) {
+        if (test_has(db, key, NULL)) return 1;
+        test_sleep_ms(10);
+    }
+    return test_has(db, key, NULL);
+}
+
+static void test_expire(void) {
+    char* dir = test_dir_create();
+    ditto_db_t* db = open_store(dir);
+    CHECK(ditto_put_ttl(db, "short", (const uint8_t*)"s", 1, 100) == 0);
+    CHECK(ditto_put_ttl(db, "mid", (const uint8_t*)"m", 1, 1500) == 0);
+    CHECK(ditto_put_ttl(db, "cleared", (const uint8_t*)"c", 1, 100) == 0);
+    test_put(db, "cleared", "kept"); // A later put clears the TTL
+    CHECK(ditto_put_ttl(db, "torn", (const uint8_t*)"t", 1, 100) == 0);
+    ditto_close(db);
+
+    // The last put_ttl is a batch of its put and its deadline; tearing it
+    // loses both, so the key is simply absent
+    off_t full = log_size(dir);
+    cut_log(dir, full - 4);
+
+    // "short" expired while the store was closed and goes as soon as the
+    // expiry thread starts; "mid" is still live and keeps its deadline
+    test_sleep_ms(200);
+    db = open_store(dir);
+    CHECK(test_has(db, "mid", "m"));
+    CHECK(test_has(db, "torn", NULL));
+    CHECK(wait_gone(db, "short", 1000));
+    ditto_close(db);
+
+    db = open_store(dir);
+    CHECK(test_has(db, "short", NULL));
+    CHECK(wait_gone(db, "mid", 3000));
+    CHECK(test_has(db, "cleared", "kept"));
+    ditto_close(db);
+
+    db = open_store(dir);
+    CHECK(test_count(db) == 1);
+    CHECK(test_has(db, "cleared", "kept"));
+    ditto_close(db);
+    test_dir_remove(dir);
+}
+
+static void test_range(void) {
+    char* dir = test_dir_create();
+    ditto_db_t* db = open_store(dir);
+    test_put(db, "doc", "hello world");
+    CHECK(ditto_put_range(db, "doc", 6, (const uint8_t*)"WORLD", 5) == 0);
+    CHECK(ditto_append(db, "doc", (const uint8_t*)"!!", 2) == 0);
+    CHECK(ditto_put_range(db, "doc", 12, (const uint8_t*)"??", 2) == 0); // Extends
+    CHECK(ditto_append(db, "log", (const uint8_t*)"a", 1) == 0); // Creates
+    CHECK(ditto_append(db, "log", (const uint8_t*)"b", 1) == 0);
+    ditto_close(db);
+    off_t good = log_size(dir);
+
+    db = open_store(dir);
+    CHECK(test_has(db, "doc", "hello WORLD!??"));
+    CHECK(test_has(db, "log", "ab"));
+    CHECK(ditto_put_range(db, "doc", 0, (const uint8_t*)"HELLO", 5) == 0);
+    ditto_close(db);
+    off_t full = log_size(dir);
+    CHECK(full > good);
+
+    cut_log(dir, full - 2);
+    db = open_store(dir);
+    CHECK(test_has(db, "doc", "hello WORLD!??"));
+    CHECK(ditto_put_range(db, "doc", 0, (const uint8_t*)"Hello", 5) == 0);
+    ditto_close(db);
+
+    db = open_store(dir);
+    CHECK(test_count(db) == 2);
+    CHECK(test_has(db, "doc", "Hello WORLD!??"));
+    CHECK(test_has(db, "log", "ab"));
+    ditto_close(db);
+    test_dir_remove(dir);
+}
+
+int main(void) {
+    test_reopen();
+    test_torn_tail();
+    test_batch();
+    test_expire();
+    test_range();
+    printf("wal replay ok\n");
+    return 0;
+}
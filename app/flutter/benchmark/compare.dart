@@ -0,0 +1,73 @@
+// compare.dart - Side by side view of two ffi_bench / ditto_bench_ffi runs
+//
+// Usage: dart run benchmark/compare.dart BASE.json NEW.json [--threshold PCT]
+//
+// Cases are matched on group, name, value size and batch; each variant of
+// NEW is set against BASE's matching variant, or BASE's only variant of the
+// case when there is no such variant (so a C run is the base of every Dart
+// variant). Prints ns per call of both and the difference.
+// With two runs of the same harness, exits 1 if any case got slower by more
+// than --threshold percent (default 10), for use as a regression check.
+import 'dart:convert';
+import 'dart:io';
+
+String _caseKey(Map<String, dynamic> r) =>
+    '${r['group']}/${r['name']}/${r['value_size']}/${r['batch']}';
+
+Map<String, dynamic> _load(String path) =>
+    jsonDecode(File(path).readAsStringSync()) as Map<String, dynamic>;
+
+void main(List<String> args) {
+  var threshold = 10.0;
+  final paths = <String>[];
+  for (var i = 0; i < args.length; i++) {
+    if (args[i] == '--threshold' && i + 1 < args.length) {
+      threshold = double.tryParse(args[++i]) ?? threshold;
+    } else {
+      paths.add(args[i]);
+    }
+  }
+  if (paths.length != 2) {
+    stderr.writeln('usage: dart run benchmark/compare.dart BASE.json NEW.json '
+        '[--threshold PCT]');
+    exit(1);
+  }
+
+  final base = _load(paths[0]);
+  final next = _load(paths[1]);
+  final regression = base['harness'] == next['harness'];
+  final baseCases = <String, Map<String, Map<String, dynamic>>>{};
+  for (final r in (base['results'] as List).cast<Map<String, dynamic>>()) {
+    baseCases.putIfAbsent(_caseKey(r), () => {})[r['variant'] as String] = r;
+  }
+
+  stdout.writeln('base: ${base['harness']} ${base['platform']}');
+  stdout.writeln('new:  ${next['harness']} ${next['platform']}');
+  stdout.writeln('${'case'.padRight(58)}${'variant'.padRight(14)}'
+      '${'base ns'.padLeft(12)}${'new ns'.padLeft(12)}${'diff'.padLeft(10)}');
+  var slower = 0;
+  for (final r in (next['results'] as List).cast<Map<String, dynamic>>()) {
+    final variants = baseCases[_caseKey(r)];
+    if (variants == null) continue;
+    final b = variants[r['variant']] ??
+        (variants.length == 1 ? variants.values.first : null);
+    if (b == null) continue;
+
+    final was = (b['ns_per_call'] as num).toDouble();
+    final now = (r['ns_per_call'] as num).toDouble();
+    final pct = was > 0 ? (now - was) / was * 100 : 0.0;
+    final flag = regression && pct > threshold;
+    if (flag) slower++;
+    stdout.writeln('${_caseKey(r).padRight(58)}'
+        '${(r['variant'] as String).padRight(14)}'
+        '${was.toStringAsFixed(1).padLeft(12)}'
+        '${now.toStringAsFixed(1).padLeft(12)}'
+        '${'${pct >= 0 ? '+' : ''}${pct.toStringAsFixed(1)}%'.padLeft(10)}'
+        '${flag ? '  SLOWER' : ''}');
+  }
+  if (slower > 0) {
+    stderr.writeln('$slower case(s) slower than ${paths[0]} by more than '
+        '$threshold%');
+    exit(1);
+  }
+}
@@ -0,0 +1,876 @@
+// ffi_bench.dart - Per-call cost of the ditto.h API through dart:ffi
+//
+// Usage, from app/flutter after `flutter pub get`:
+//   dart run benchmark/ffi_bench.dart [--lib PATH] [--iterations N]
+//       [--runs N] [--keys N] [--out FILE]
+//
+// The Dart side of C/bench/bench_ffi.c: the same cases, loop shapes and
+// JSON, so setting the two outputs from one machine side by side should give
+// the cost of crossing the boundary. Not yet run against this library; check
+// that compare.dart matches every case before relying on the numbers. Each
+// case reports one or more variants:
+//   "preencoded"  keys, buffers and values set up before timing, as the C
+//                 harness ("native") does
+//   "leaf"        the same call bound with isLeaf: true, for calls that
+//                 never call back into Dart
+//   "marshalled"  what a plain binding does per call: encode the String
+//                 key, copy values in and out of native memory
+// The callback cases time a put until the Dart callback runs: inline
+// through NativeCallable.isolateLocal, and from the dispatcher thread
+// through NativeCallable.listener.
+//
+// --lib defaults to the library built into C/ for this platform. Needs
+// Dart 3.3 (NativeCallable, pointer arithmetic).
+import 'dart:async';
+import 'dart:convert';
+import 'dart:ffi';
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:ffi/ffi.dart';
+
+const _keyCap = 32;
+const _maxBatch = 256;
+const _maxValue = 64 << 10;
+const _maxLoadBytes = 64 << 20;
+const _scanKeys = 100;
+const _bufBytes = _maxValue + (64 << 10);
+const _statsBytes = 4096;
+
+// ============================================================================
+// Bindings
+// ============================================================================
+
+typedef _OnChangeC = Void Function(Pointer<Void>, Pointer<Utf8>);
+
+typedef _VersionC = Pointer<Utf8> Function();
+typedef _VersionD = Pointer<Utf8> Function();
+typedef _OpenC = Int32 Function(Pointer<Utf8>, Pointer<Pointer<Void>>);
+typedef _OpenD = int Function(Pointer<Utf8>, Pointer<Pointer<Void>>);
+typedef _CloseC = Void Function(Pointer<Void>);
+typedef _CloseD = void Function(Pointer<Void>);
+typedef _PutC = Int32 Function(Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, Size);
+typedef _PutD = int Function(Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, int);
+typedef _PutNC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Size, Pointer<Uint8>, Size);
+typedef _PutND = int Function(Pointer<Void>, Pointer<Utf8>, int, Pointer<Uint8>, int);
+typedef _PutTtlC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, Size, Uint32);
+typedef _PutTtlD = int Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, int, int);
+typedef _GetC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, Pointer<Size>);
+typedef _GetD = int Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, Pointer<Size>);
+typedef _GetNC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Size, Pointer<Uint8>, Pointer<Size>);
+typedef _GetND = int Function(
+    Pointer<Void>, Pointer<Utf8>, int, Pointer<Uint8>, Pointer<Size>);
+typedef _GetViewC = Int32 Function(Pointer<Void>, Pointer<Utf8>,
+    Pointer<Pointer<Uint8>>, Pointer<Size>, Pointer<Pointer<Void>>);
+typedef _GetViewD = int Function(Pointer<Void>, Pointer<Utf8>,
+    Pointer<Pointer<Uint8>>, Pointer<Size>, Pointer<Pointer<Void>>);
+typedef _GetRangeC = Int32 Function(Pointer<Void>, Pointer<Utf8>, Size,
+    Pointer<Uint8>, Pointer<Size>, Pointer<Size>);
+typedef _GetRangeD = int Function(Pointer<Void>, Pointer<Utf8>, int,
+    Pointer<Uint8>, Pointer<Size>, Pointer<Size>);
+typedef _PutRangeC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Size, Pointer<Uint8>, Size);
+typedef _PutRangeD = int Function(
+    Pointer<Void>, Pointer<Utf8>, int, Pointer<Uint8>, int);
+typedef _DeleteC = Int32 Function(Pointer<Void>, Pointer<Utf8>);
+typedef _DeleteD = int Function(Pointer<Void>, Pointer<Utf8>);
+typedef _DeleteNC = Int32 Function(Pointer<Void>, Pointer<Utf8>, Size);
+typedef _DeleteND = int Function(Pointer<Void>, Pointer<Utf8>, int);
+typedef _InternC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Size, Pointer<Pointer<Void>>);
+typedef _InternD = int Function(
+    Pointer<Void>, Pointer<Utf8>, int, Pointer<Pointer<Void>>);
+typedef _PutKC = Int32 Function(Pointer<Void>, Pointer<Void>, Pointer<Uint8>, Size);
+typedef _PutKD = int Function(Pointer<Void>, Pointer<Void>, Pointer<Uint8>, int);
+typedef _GetKC = Int32 Function(
+    Pointer<Void>, Pointer<Void>, Pointer<Uint8>, Pointer<Size>);
+typedef _GetKD = int Function(
+    Pointer<Void>, Pointer<Void>, Pointer<Uint8>, Pointer<Size>);
+typedef _DeleteKC = Int32 Function(Pointer<Void>, Pointer<Void>);
+typedef _DeleteKD = int Function(Pointer<Void>, Pointer<Void>);
+typedef _WriteBatchC = Int32 Function(Pointer<Void>, Size, Pointer<Pointer<Utf8>>,
+    Pointer<Pointer<Uint8>>, Pointer<Size>, Pointer<Uint8>, Pointer<Int32>);
+typedef _WriteBatchD = int Function(Pointer<Void>, int, Pointer<Pointer<Utf8>>,
+    Pointer<Pointer<Uint8>>, Pointer<Size>, Pointer<Uint8>, Pointer<Int32>);
+typedef _MultiGetC = Int32 Function(Pointer<Void>, Pointer<Pointer<Utf8>>, Size,
+    Pointer<Uint8>, Pointer<Size>, Pointer<Size>, Pointer<Size>, Pointer<Int32>);
+typedef _MultiGetD = int Function(Pointer<Void>, Pointer<Pointer<Utf8>>, int,
+    Pointer<Uint8>, Pointer<Size>, Pointer<Size>, Pointer<Size>, Pointer<Int32>);
+typedef _BeginC = Int32 Function(Pointer<Void>, Pointer<Pointer<Void>>);
+typedef _BeginD = int Function(Pointer<Void>, Pointer<Pointer<Void>>);
+typedef _HandleGetC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, Pointer<Size>);
+typedef _HandleGetD = int Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, Pointer<Size>);
+typedef _TxnPutC = Int32 Function(Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, Size);
+typedef _TxnPutD = int Function(Pointer<Void>, Pointer<Utf8>, Pointer<Uint8>, int);
+typedef _HandleC = Int32 Function(Pointer<Void>);
+typedef _HandleD = int Function(Pointer<Void>);
+typedef _ScanC = Int32 Function(
+    Pointer<Void>, Pointer<Utf8>, Pointer<Pointer<Void>>);
+typedef _ScanD = int Function(Pointer<Void>, Pointer<Utf8>, Pointer<Pointer<Void>>);
+typedef _CursorNextC = Int32 Function(
+    Pointer<Void>, Pointer<Uint8>, Pointer<Size>, Pointer<Size>);
+typedef _CursorNextD = int Function(
+    Pointer<Void>, Pointer<Uint8>, Pointer<Size>, Pointer<Size>);
+typedef _SubscribeC = Int32 Function(Pointer<Void>,
+    Pointer<NativeFunction<_OnChangeC>>, Pointer<Void>, Pointer<Int32>);
+typedef _SubscribeD = int Function(Pointer<Void>,
+    Pointer<NativeFunction<_OnChangeC>>, Pointer<Void>, Pointer<Int32>);
+typedef _SubscribeKeyC = Int32 Function(Pointer<Void>, Pointer<Utf8>,
+    Pointer<NativeFunction<_OnChangeC>>, Pointer<Void>, Pointer<Int32>);
+typedef _SubscribeKeyD = int Function(Pointer<Void>, Pointer<Utf8>,
+    Pointer<NativeFunction<_OnChangeC>>, Pointer<Void>, Pointer<Int32>);
+typedef _UnsubscribeC = Int32 Function(Pointer<Void>, Int32);
+typedef _UnsubscribeD = int Function(Pointer<Void>, int);
+typedef _EnableAsyncC = Int32 Function(Pointer<Void>, Size);
+typedef _EnableAsyncD = int Function(Pointer<Void>, int);
+typedef _StatsC = Int32 Function(Pointer<Void>, Pointer<Uint8>, Size);
+typedef _StatsD = int Function(Pointer<Void>, Pointer<Uint8>, int);
+
+class _Ditto {
+  _Ditto(DynamicLibrary lib)
+      : version = lib.lookupFunction<_VersionC, _VersionD>('ditto_version'),
+        versionLeaf = lib.lookupFunction<_VersionC, _VersionD>('ditto_version',
+            isLeaf: true),
+        open = lib.lookupFunction<_OpenC, _OpenD>('ditto_open'),
+        close = lib.lookupFunction<_CloseC, _CloseD>('ditto_close'),
+        put = lib.lookupFunction<_PutC, _PutD>('ditto_put'),
+        putN = lib.lookupFunction<_PutNC, _PutND>('ditto_put_n'),
+        putTtl = lib.lookupFunction<_PutTtlC, _PutTtlD>('ditto_put_ttl'),
+        get = lib.lookupFunction<_GetC, _GetD>('ditto_get'),
+        getLeaf = lib.lookupFunction<_GetC, _GetD>('ditto_get', isLeaf: true),
+        getN = lib.lookupFunction<_GetNC, _GetND>('ditto_get_n'),
+        getView = lib.lookupFunction<_GetViewC, _GetViewD>('ditto_get_view'),
+        viewRelease = lib.lookupFunction<_CloseC, _CloseD>('ditto_view_release'),
+        getRange = lib.lookupFunction<_GetRangeC, _GetRangeD>('ditto_get_range'),
+        putRange = lib.lookupFunction<_PutRangeC, _PutRangeD>('ditto_put_range'),
+        delete = lib.lookupFunction<_DeleteC, _DeleteD>('ditto_delete'),
+        deleteN = lib.lookupFunction<_DeleteNC, _DeleteND>('ditto_delete_n'),
+        keyIntern = lib.lookupFunction<_InternC, _InternD>('ditto_key_intern'),
+        keyRelease = lib.lookupFunction<_CloseC, _CloseD>('ditto_key_release'),
+        putK = lib.lookupFunction<_PutKC, _PutKD>('ditto_put_k'),
+        getK = lib.lookupFunction<_GetKC, _GetKD>('ditto_get_k'),
+        deleteK = lib.lookupFunction<_DeleteKC, _DeleteKD>('ditto_delete_k'),
+        writeBatch =
+            lib.lookupFunction<_WriteBatchC, _WriteBatchD>('ditto_write_batch'),
+        multiGet = lib.lookupFunction<_MultiGetC, _MultiGetD>('ditto_multi_get'),
+        txnBegin = lib.lookupFunction<_BeginC, _BeginD>('ditto_txn_begin'),
+        txnGet = lib.lookupFunction<_HandleGetC, _HandleGetD>('ditto_txn_get'),
+        txnPut = lib.lookupFunction<_TxnPutC, _TxnPutD>('ditto_txn_put'),
+        txnCommit = lib.lookupFunction<_HandleC, _HandleD>('ditto_txn_commit'),
+        snapshotOpen = lib.lookupFunction<_BeginC, _BeginD>('ditto_snapshot_open'),
+        snapshotGet =
+            lib.lookupFunction<_HandleGetC, _HandleGetD>('ditto_snapshot_get'),
+        snapshotClose = lib.lookupFunction<_CloseC, _CloseD>('ditto_snapshot_close'),
+        scanPrefix = lib.lookupFunction<_ScanC, _ScanD>('ditto_scan_prefix'),
+        cursorNext =
+            lib.lookupFunction<_CursorNextC, _CursorNextD>('ditto_cursor_next'),
+        cursorClose = lib.lookupFunction<_CloseC, _CloseD>('ditto_cursor_close'),
+        subscribe = lib.lookupFunction<_SubscribeC, _SubscribeD>('ditto_subscribe'),
+        subscribeKey = lib
+            .lookupFunction<_SubscribeKeyC, _SubscribeKeyD>('ditto_subscribe_key'),
+        unsubscribe =
+            lib.lookupFunction<_UnsubscribeC, _UnsubscribeD>('ditto_unsubscribe'),
+        enableAsync = lib.lookupFunction<_EnableAsyncC, _EnableAsyncD>(
+            'ditto_enable_async_notifications'),
+        getStats = lib.lookupFunction<_StatsC, _StatsD>('ditto_get_stats');
+
+  final _VersionD version;
+  final _VersionD versionLeaf;
+  final _OpenD open;
+  final _CloseD close;
+  final _PutD put;
+  final _PutND putN;
+  final _PutTtlD putTtl;
+  final _GetD get;
+  final _GetD getLeaf;
+  final _GetND getN;
+  final _GetViewD getView;
+  final _CloseD viewRelease;
+  final _GetRangeD getRange;
+  final _PutRangeD putRange;
+  final _DeleteD delete;
+  final _DeleteND deleteN;
+  final _InternD keyIntern;
+  final _CloseD keyRelease;
+  final _PutKD putK;
+  final _GetKD getK;
+  final _DeleteKD deleteK;
+  final _WriteBatchD writeBatch;
+  final _MultiGetD multiGet;
+  final _BeginD txnBegin;
+  final _HandleGetD txnGet;
+  final _TxnPutD txnPut;
+  final _HandleD txnCommit;
+  final _BeginD snapshotOpen;
+  final _HandleGetD snapshotGet;
+  final _CloseD snapshotClose;
+  final _ScanD scanPrefix;
+  final _CursorNextD cursorNext;
+  final _CloseD cursorClose;
+  final _SubscribeD subscribe;
+  final _SubscribeKeyD subscribeKey;
+  final _UnsubscribeD unsubscribe;
+  final _EnableAsyncD enableAsync;
+  final _StatsD getStats;
+}
+
+String _defaultLibrary() {
+  final root = File.fromUri(Platform.script).parent.parent.parent.parent.path;
+  if (Platform.isMacOS) return '$root/C/macos/libdittoffi.dylib';
+  if (Platform.isWindows) return '$root\\C\\windows\\dittoffi.dll';
+  return '$root/C/linux/libdittoffi.so';
+}
+
+// ============================================================================
+// Timing
+// ============================================================================
+
+final _clock = Stopwatch()..start();
+final double _nsPerTick = 1e9 / _clock.frequency;
+
+int _nowNs() => (_clock.elapsedTicks * _nsPerTick).round();
+
+// Sorts the samples and returns their value at `pct`
+int _percentile(List<int> samples, int n, double pct) {
+  final sorted = samples.sublist(0, n)..sort();
+  return sorted[(pct / 100.0 * (n - 1) + 0.5).floor()];
+}
+
+// ============================================================================
+// Cases
+// ============================================================================
+
+// A store loaded with `live` of the `keys` keys, all holding `valueSize`
+// bytes, plus everything the cases pass in, allocated once
+class _Bench {
+  _Bench(this.d, this.keys)
+      : names = List.generate(
+            keys, (k) => 'bench:${k.toString().padLeft(8, '0')}'),
+        prefixes = List.generate(
+            keys ~/ _scanKeys, (p) => 'bench:${p.toString().padLeft(6, '0')}'),
+        cNames = calloc<Uint8>(keys * _keyCap),
+        cPrefixes = calloc<Uint8>((keys ~/ _scanKeys) * _keyCap),
+        interned = calloc<Pointer<Void>>(keys),
+        batchKeys = calloc<Pointer<Utf8>>(_maxBatch),
+        batchValues = calloc<Pointer<Uint8>>(_maxBatch),
+        batchLens = calloc<Size>(_maxBatch),
+        offsets = calloc<Size>(_maxBatch),
+        lens = calloc<Size>(_maxBatch),
+        status = calloc<Int32>(_maxBatch),
+        value = calloc<Uint8>(_maxValue),
+        buf = calloc<Uint8>(_bufBytes),
+        stats = calloc<Uint8>(_statsBytes),
+        lenCell = calloc<Size>(),
+        countCell = calloc<Size>(),
+        ptrCell = calloc<Pointer<Uint8>>(),
+        handleCell = calloc<Pointer<Void>>(),
+        idCell = calloc<Int32>(),
+        dartValue = Uint8List(_maxValue)..fillRange(0, _maxValue, 0x76);
+
+  final _Ditto d;
+  final int keys;
+  final List<String> names;
+  final List<String> prefixes;
+  final Pointer<Uint8> cNames;
+  final Pointer<Uint8> cPrefixes;
+  final Pointer<Pointer<Void>> interned;
+  final Pointer<Pointer<Utf8>> batchKeys;
+  final Pointer<Pointer<Uint8>> batchValues;
+  final Pointer<Size> batchLens;
+  final Pointer<Size> offsets;
+  final Pointer<Size> lens;
+  final Pointer<Int32> status;
+  final Pointer<Uint8> value;
+  final Pointer<Uint8> buf;
+  final Pointer<Uint8> stats;
+  final Pointer<Size> lenCell;
+  final Pointer<Size> countCell;
+  final Pointer<Pointer<Uint8>> ptrCell;
+  final Pointer<Pointer<Void>> handleCell;
+  final Pointer<Int32> idCell;
+  final Uint8List dartValue;
+  late final List<int> samples;
+  late final Pointer<Void> db;
+  late final Pointer<Void> asyncDb;
+  int live = 0; // keys loaded, fewer for large values
+  int valueSize = 0; // of the loaded values, 0 = nothing loaded
+
+  Pointer<Utf8> name(int k) => (cNames + k * _keyCap).cast<Utf8>();
+  Pointer<Utf8> prefix(int p) => (cPrefixes + p * _keyCap).cast<Utf8>();
+  int nameLen(int k) => names[k].length;
+  int next(int k) => k + 1 == live ? 0 : k + 1;
+
+  void init(int iterations) {
+    value.asTypedList(_maxValue).fillRange(0, _maxValue, 0x76);
+    samples = List<int>.filled(iterations, 0);
+    live = keys;
+    for (var k = 0; k < keys; k++) {
+      final bytes = utf8.encode(names[k]);
+      (cNames + k * _keyCap).asTypedList(_keyCap).setAll(0, bytes);
+    }
+    for (var p = 0; p < prefixes.length; p++) {
+      final bytes = utf8.encode(prefixes[p]);
+      (cPrefixes + p * _keyCap).asTypedList(_keyCap).setAll(0, bytes);
+    }
+    final path = ':memory:'.toNativeUtf8();
+    final cell = calloc<Pointer<Void>>();
+    if (d.open(path, cell) != 0) throw StateError('cannot open the store');
+    db = cell.value;
+    if (d.open(path, cell) != 0 || d.enableAsync(cell.value, 1024) != 0) {
+      throw StateError('cannot open the store');
+    }
+    asyncDb = cell.value;
+    calloc.free(cell);
+    calloc.free(path);
+    for (var k = 0; k < keys; k++) {
+      if (d.keyIntern(db, name(k), nameLen(k), interned + k) != 0) {
+        throw StateError('ditto_key_intern failed');
+      }
+    }
+  }
+
+  // Puts every live key with a value of `size` bytes
+  void load(int size) {
+    live = keys < _maxLoadBytes ~/ size ? keys : _maxLoadBytes ~/ size;
+    for (var k = 0; k < live; k++) {
+      if (d.put(db, name(k), value, size) != 0) throw StateError('load failed');
+    }
+    valueSize = size;
+  }
+
+  void release() {
+    for (var k = 0; k < keys; k++) {
+      d.keyRelease(interned[k]);
+    }
+    d.close(db);
+    d.close(asyncDb);
+    for (final p in [cNames, cPrefixes, value, buf, stats]) {
+      calloc.free(p);
+    }
+    calloc.free(interned);
+    calloc.free(batchKeys);
+    calloc.free(batchValues);
+    calloc.free(batchLens);
+    calloc.free(offsets);
+    calloc.free(lens);
+    calloc.free(status);
+    calloc.free(lenCell);
+    calloc.free(countCell);
+    calloc.free(ptrCell);
+    calloc.free(handleCell);
+    calloc.free(idCell);
+  }
+}
+
+class _Case {
+  const _Case(this.group, this.name, this.variant, this.valueSize, this.run,
+      {this.batch = 1,
+      this.scale = 1,
+      this.consumes = false,
+      this.sampled = false});
+
+  final String group;
+  final String name;
+  final String variant;
+  final int valueSize; // of the loaded values, 0 = any
+  final FutureOr<void> Function(_Bench b, _Case c, int n) run;
+  final int batch; // keys per call
+  final int scale; // runs iterations / scale calls
+  final bool consumes; // deletes the keys it visits: reloads each run
+  final bool sampled; // fills samples; reports their mean
+}
+
+void _version(_Bench b, _Case c, int n) {
+  final d = b.d;
+  for (var i = 0; i < n; i++) {
+    d.version();
+  }
+}
+
+void _versionLeaf(_Bench b, _Case c, int n) {
+  final d = b.d;
+  for (var i = 0; i < n; i++) {
+    d.versionLeaf();
+  }
+}
+
+void _put(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    d.put(db, b.name(k), b.value, size);
+  }
+}
+
+// A Dart String key and Uint8List value, copied into native memory per call
+void _putMarshalled(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  final data = Uint8List.sublistView(b.dartValue, 0, size);
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    final key = b.names[k].toNativeUtf8();
+    final value = malloc<Uint8>(size);
+    value.asTypedList(size).setAll(0, data);
+    d.put(db, key, value, size);
+    malloc.free(value);
+    malloc.free(key);
+  }
+}
+
+void _putN(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    d.putN(db, b.name(k), b.nameLen(k), b.value, size);
+  }
+}
+
+void _putK(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    d.putK(db, b.interned[k], b.value, size);
+  }
+}
+
+void _putTtl(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    d.putTtl(db, b.name(k), b.value, size, 3600000);
+  }
+}
+
+void _get(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, len = b.lenCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    len.value = _bufBytes;
+    d.get(db, b.name(k), b.buf, len);
+  }
+}
+
+void _getLeaf(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, len = b.lenCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    len.value = _bufBytes;
+    d.getLeaf(db, b.name(k), b.buf, len);
+  }
+}
+
+// Encodes the key, then copies the value out into a new Uint8List
+void _getMarshalled(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, len = b.lenCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    final key = b.names[k].toNativeUtf8();
+    len.value = _bufBytes;
+    if (d.get(db, key, b.buf, len) == 0) {
+      Uint8List.fromList(b.buf.asTypedList(len.value));
+    }
+    malloc.free(key);
+  }
+}
+
+void _getN(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, len = b.lenCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    len.value = _bufBytes;
+    d.getN(db, b.name(k), b.nameLen(k), b.buf, len);
+  }
+}
+
+void _getK(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, len = b.lenCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    len.value = _bufBytes;
+    d.getK(db, b.interned[k], b.buf, len);
+  }
+}
+
+void _getView(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    if (d.getView(db, b.name(k), b.ptrCell, b.lenCell, b.handleCell) == 0) {
+      d.viewRelease(b.handleCell.value);
+    }
+  }
+}
+
+// 64 bytes from the middle of a 1 KiB value
+void _getRange(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, len = b.lenCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    len.value = 64;
+    d.getRange(db, b.name(k), 512, b.buf, len, nullptr);
+  }
+}
+
+void _putRange(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    d.putRange(db, b.name(k), 512, b.value, 64);
+  }
+}
+
+void _delete(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db;
+  for (var i = 0; i < n; i++) {
+    d.delete(db, b.name(i));
+  }
+}
+
+void _deleteMarshalled(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db;
+  for (var i = 0; i < n; i++) {
+    final key = b.names[i].toNativeUtf8();
+    d.delete(db, key);
+    malloc.free(key);
+  }
+}
+
+void _deleteN(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db;
+  for (var i = 0; i < n; i++) {
+    d.deleteN(db, b.name(i), b.nameLen(i));
+  }
+}
+
+void _deleteK(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db;
+  for (var i = 0; i < n; i++) {
+    d.deleteK(db, b.interned[i]);
+  }
+}
+
+void _intern(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, cell = b.handleCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    if (d.keyIntern(db, b.name(k), b.nameLen(k), cell) == 0) {
+      d.keyRelease(cell.value);
+    }
+  }
+}
+
+void _txn(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, cell = b.handleCell, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    if (d.txnBegin(db, cell) != 0) continue;
+    final txn = cell.value;
+    b.lenCell.value = _bufBytes;
+    d.txnGet(txn, b.name(k), b.buf, b.lenCell);
+    d.txnPut(txn, b.name(k), b.value, size);
+    d.txnCommit(txn);
+  }
+}
+
+void _snapshot(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, cell = b.handleCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    if (d.snapshotOpen(db, cell) != 0) continue;
+    final snap = cell.value;
+    b.lenCell.value = _bufBytes;
+    d.snapshotGet(snap, b.name(k), b.buf, b.lenCell);
+    d.snapshotClose(snap);
+  }
+}
+
+void _scan(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, cell = b.handleCell, count = b.countCell;
+  final prefixes = b.prefixes.length;
+  for (var i = 0, p = 0; i < n; i++, p = p + 1 == prefixes ? 0 : p + 1) {
+    if (d.scanPrefix(db, b.prefix(p), cell) != 0) continue;
+    final cursor = cell.value;
+    do {
+      b.lenCell.value = _bufBytes;
+      if (d.cursorNext(cursor, b.buf, b.lenCell, count) != 0) break;
+    } while (count.value > 0);
+    d.cursorClose(cursor);
+  }
+}
+
+void _onChangeNoop(Pointer<Void> userData, Pointer<Utf8> key) {}
+
+final _noop = NativeCallable<_OnChangeC>.isolateLocal(_onChangeNoop);
+
+void _subscribe(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, cb = _noop.nativeFunction, id = b.idCell;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    if (d.subscribeKey(db, b.name(k), cb, nullptr, id) == 0) {
+      d.unsubscribe(db, id.value);
+    }
+  }
+}
+
+void _stats(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db;
+  for (var i = 0; i < n; i++) {
+    d.getStats(db, b.stats, _statsBytes);
+  }
+}
+
+// `batch` single gets per iteration, to set against one ditto_multi_get()
+void _getBatch(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, len = b.lenCell;
+  for (var i = 0, k = 0; i < n; i++) {
+    for (var j = 0; j < c.batch; j++, k = b.next(k)) {
+      len.value = _bufBytes;
+      d.get(db, b.name(k), b.buf, len);
+    }
+  }
+}
+
+void _multiGet(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, keys = b.batchKeys;
+  for (var i = 0, k = 0; i < n; i++) {
+    for (var j = 0; j < c.batch; j++, k = b.next(k)) {
+      keys[j] = b.name(k);
+    }
+    b.lenCell.value = _bufBytes;
+    d.multiGet(db, keys, c.batch, b.buf, b.lenCell, b.offsets, b.lens, b.status);
+  }
+}
+
+void _putBatch(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++) {
+    for (var j = 0; j < c.batch; j++, k = b.next(k)) {
+      d.put(db, b.name(k), b.value, size);
+    }
+  }
+}
+
+void _writeBatch(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++) {
+    for (var j = 0; j < c.batch; j++, k = b.next(k)) {
+      b.batchKeys[j] = b.name(k);
+      b.batchValues[j] = b.value;
+      b.batchLens[j] = size;
+    }
+    d.writeBatch(db, c.batch, b.batchKeys, b.batchValues, b.batchLens, nullptr,
+        nullptr);
+  }
+}
+
+int _notifiedNs = 0;
+Completer<void>? _notified;
+
+// Must not read `key`: a listener runs after the call that passed it returned
+void _onNotify(Pointer<Void> userData, Pointer<Utf8> key) {
+  _notifiedNs = _nowNs();
+  _notified?.complete();
+  _notified = null;
+}
+
+// From calling ditto_put() to the Dart callback starting
+void _notifyInline(_Bench b, _Case c, int n) {
+  final d = b.d, db = b.db, size = b.valueSize;
+  final cb = NativeCallable<_OnChangeC>.isolateLocal(_onNotify);
+  if (d.subscribe(db, cb.nativeFunction, nullptr, b.idCell) != 0) {
+    cb.close();
+    return;
+  }
+  final id = b.idCell.value;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    final start = _nowNs();
+    d.put(db, b.name(k), b.value, size);
+    b.samples[i] = _notifiedNs - start;
+  }
+  d.unsubscribe(db, id);
+  cb.close();
+}
+
+// The dispatcher thread runs the callback, which posts it to this isolate
+late final NativeCallable<_OnChangeC> _listener;
+
+Future<void> _notifyAsync(_Bench b, _Case c, int n) async {
+  final d = b.d, db = b.asyncDb, size = b.valueSize;
+  for (var i = 0, k = 0; i < n; i++, k = b.next(k)) {
+    final done = Completer<void>();
+    _notified = done;
+    final start = _nowNs();
+    d.put(db, b.name(k), b.value, size);
+    await done.future;
+    b.samples[i] = _notifiedNs - start;
+  }
+}
+
+// As C/bench/bench_ffi.c, grouped by loaded value size, with the Dart-only
+// variants after the one every harness has
+final _cases = <_Case>[
+  _Case('call', 'ditto_version', 'preencoded', 0, _version),
+  _Case('call', 'ditto_version', 'leaf', 0, _versionLeaf),
+  _Case('call', 'ditto_key_intern+release', 'preencoded', 0, _intern),
+  _Case('call', 'ditto_subscribe_key+unsubscribe', 'preencoded', 0, _subscribe),
+  _Case('call', 'ditto_put', 'preencoded', 16, _put),
+  _Case('call', 'ditto_put', 'marshalled', 16, _putMarshalled),
+  _Case('call', 'ditto_put_n', 'preencoded', 16, _putN),
+  _Case('call', 'ditto_put_k', 'preencoded', 16, _putK),
+  _Case('call', 'ditto_put_ttl', 'preencoded', 16, _putTtl),
+  _Case('call', 'ditto_get', 'preencoded', 16, _get),
+  _Case('call', 'ditto_get', 'leaf', 16, _getLeaf),
+  _Case('call', 'ditto_get', 'marshalled', 16, _getMarshalled),
+  _Case('call', 'ditto_get_n', 'preencoded', 16, _getN),
+  _Case('call', 'ditto_get_k', 'preencoded', 16, _getK),
+  _Case('call', 'ditto_get_view+release', 'preencoded', 16, _getView),
+  _Case('call', 'ditto_txn_begin+get+put+commit', 'preencoded', 16, _txn),
+  _Case('call', 'ditto_snapshot_open+get+close', 'preencoded', 16, _snapshot),
+  _Case('call', 'ditto_scan_prefix+cursor_next+close', 'preencoded', 16, _scan,
+      batch: _scanKeys, scale: 100),
+  _Case('call', 'ditto_get_stats', 'preencoded', 16, _stats, scale: 1000),
+  _Case('call', 'ditto_delete', 'preencoded', 16, _delete, consumes: true),
+  _Case('call', 'ditto_delete', 'marshalled', 16, _deleteMarshalled,
+      consumes: true),
+  _Case('call', 'ditto_delete_n', 'preencoded', 16, _deleteN, consumes: true),
+  _Case('call', 'ditto_delete_k', 'preencoded', 16, _deleteK, consumes: true),
+  for (final batch in const [1, 16, 256]) ...[
+    _Case('batch', 'ditto_get', 'preencoded', 16, _getBatch,
+        batch: batch, scale: batch),
+    _Case('batch', 'ditto_multi_get', 'preencoded', 16, _multiGet,
+        batch: batch, scale: batch),
+  ],
+  for (final batch in const [1, 16, 256]) ...[
+    _Case('batch', 'ditto_put', 'preencoded', 16, _putBatch,
+        batch: batch, scale: batch),
+    _Case('batch', 'ditto_write_batch', 'preencoded', 16, _writeBatch,
+        batch: batch, scale: batch),
+  ],
+  _Case('callback', 'notify_inline', 'isolate_local', 16, _notifyInline,
+      sampled: true),
+  _Case('callback', 'notify_async', 'listener', 16, _notifyAsync,
+      scale: 10, sampled: true),
+  _Case('call', 'ditto_put', 'preencoded', 1024, _put),
+  _Case('call', 'ditto_put', 'marshalled', 1024, _putMarshalled),
+  _Case('call', 'ditto_get', 'preencoded', 1024, _get),
+  _Case('call', 'ditto_get', 'marshalled', 1024, _getMarshalled),
+  _Case('call', 'ditto_get_range', 'preencoded', 1024, _getRange),
+  _Case('call', 'ditto_put_range', 'preencoded', 1024, _putRange),
+  _Case('call', 'ditto_put', 'preencoded', 65536, _put, scale: 10),
+  _Case('call', 'ditto_put', 'marshalled', 65536, _putMarshalled, scale: 10),
+  _Case('call', 'ditto_get', 'preencoded', 65536, _get, scale: 10),
+  _Case('call', 'ditto_get', 'marshalled', 65536, _getMarshalled, scale: 10),
+];
+
+// ============================================================================
+// Harness
+// ============================================================================
+
+Future<Map<String, Object>> _runCase(
+    _Bench b, int iterations, int runs, _Case c) async {
+  var n = iterations ~/ c.scale;
+  if (c.consumes && n > b.live) n = b.live;
+  if (n == 0) n = 1;
+
+  final perCall = <double>[];
+  final p50 = <int>[];
+  final p99 = <int>[];
+  // Run -1 is the warm-up
+  for (var r = -1; r < runs; r++) {
+    if ((c.valueSize != 0 && c.valueSize != b.valueSize) || c.consumes) {
+      b.load(c.valueSize != 0 ? c.valueSize : b.valueSize);
+      if (c.consumes && n > b.live) n = b.live;
+    }
+    final start = _nowNs();
+    final pending = c.run(b, c, n);
+    if (pending is Future) await pending;
+    final elapsed = _nowNs() - start;
+    if (r < 0) continue;
+
+    if (c.sampled) {
+      var sum = 0;
+      for (var i = 0; i < n; i++) {
+        sum += b.samples[i];
+      }
+      perCall.add(sum / n);
+      p50.add(_percentile(b.samples, n, 50));
+      p99.add(_percentile(b.samples, n, 99));
+    } else {
+      perCall.add(elapsed / n);
+    }
+  }
+
+  // The median run, and the percentiles of that run
+  final median = (List.of(perCall)..sort())[runs ~/ 2];
+  final pick = perCall.indexOf(median);
+  return {
+    'group': c.group,
+    'name': c.name,
+    'variant': c.variant,
+    'value_size': c.valueSize,
+    'batch': c.batch,
+    'calls': n,
+    'ns_per_call': double.parse(median.toStringAsFixed(1)),
+    'ns_per_key': double.parse((median / c.batch).toStringAsFixed(1)),
+    if (c.sampled) 'p50_ns': p50[pick],
+    if (c.sampled) 'p99_ns': p99[pick],
+  };
+}
+
+Never _usage() {
+  stderr.writeln('usage: dart run benchmark/ffi_bench.dart [--lib PATH] '
+      '[--iterations N] [--runs N] [--keys N] [--out FILE]');
+  exit(1);
+}
+
+Future<void> main(List<String> args) async {
+  var libPath = _defaultLibrary();
+  var iterations = 200000, runs = 5, keys = 10000;
+  String? outPath;
+  for (var i = 0; i < args.length; i += 2) {
+    if (i + 1 >= args.length) _usage();
+    final val = args[i + 1];
+    switch (args[i]) {
+      case '--lib':
+        libPath = val;
+      case '--iterations':
+        iterations = int.tryParse(val) ?? 0;
+      case '--runs':
+        runs = int.tryParse(val) ?? 0;
+      case '--keys':
+        keys = int.tryParse(val) ?? 0;
+      case '--out':
+        outPath = val;
+      default:
+        _usage();
+    }
+  }
+  if (iterations <= 0 || runs < 1 || keys < _maxBatch || keys < _scanKeys) {
+    _usage();
+  }
+
+  final d = _Ditto(DynamicLibrary.open(libPath));
+  final b = _Bench(d, keys)..init(iterations);
+  _listener = NativeCallable<_OnChangeC>.listener(_onNotify);
+  if (d.subscribe(b.asyncDb, _listener.nativeFunction, nullptr, b.idCell) != 0) {
+    throw StateError('ditto_subscribe failed');
+  }
+
+  final results = <Map<String, Object>>[];
+  for (final c in _cases) {
+    results.add(await _runCase(b, iterations, runs, c));
+  }
+  final report = {
+    'harness': 'dart',
+    'library_version': d.version().toDartString(),
+    'platform': {
+      'os': Platform.operatingSystem,
+      'arch': Abi.current().toString().split('_').last,
+      'runtime': 'dart ${Platform.version.split(' ').first}',
+    },
+    'config': {'iterations': iterations, 'runs': runs, 'keys': keys},
+    'results': results,
+  };
+
+  b.release();
+  _listener.close();
+  _noop.close();
+
+  final json = const JsonEncoder.withIndent('  ').convert(report);
+  if (outPath != null) {
+    File(outPath).writeAsStringSync('$json\n');
+  } else {
+    stdout.writeln(json);
+  }
+}